@@ -0,0 +1,788 @@
+/************************************************************************//**
+ * \brief LSD throughput microbenchmarks. Runs the mw library against the
+ *        simulated 16C550 UART and reports, for each payload length, the
+ *        achieved throughput and the number of LSR polls per payload byte.
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include "uart-sim.h"
+#include "lsd.h"
+#include "megawifi.h"
+#include "util.h"
+#include "crc16.h"
+#include "prof.h"
+#include "mw-bench.h"
+
+/// Default payload chunk length used for split frame benchmarks.
+#define BENCH_SPLIT_CHUNK_DEF	64
+
+/// Default minimum number of payload bytes moved per measurement.
+#define BENCH_MIN_BYTES_DEF		16384
+
+/// Default time spent by the application between LsdPoll() calls (ns).
+#define BENCH_GAME_NS_DEF		500000
+
+/// Default scanline budget for MwService() calls.
+#define BENCH_SVC_LINES_DEF		8
+
+/// Channel used for benchmarks.
+#define BENCH_CH				1
+
+/// Disabled channel, used to check frames for it are dropped.
+#define BENCH_DIS_CH			2
+
+/// Benchmark configuration.
+typedef struct {
+	uint32_t clk;		///< UART clock
+	uint32_t accessNs;	///< Virtual time per register access
+	uint32_t baud;		///< Line rate override (0 for programmed divisor)
+	uint32_t rate;		///< Baud rate set with UartBaudSet() (0 for default)
+	uint32_t minBytes;	///< Minimum payload bytes per measurement
+	uint32_t gameNs;	///< Time spent between LsdPoll() calls
+	uint16_t chunk;		///< Chunk length for split frames
+	uint16_t step;		///< Payload length step (0 for powers of 2)
+	uint16_t len;		///< Single payload length to test (0 for all)
+	uint8_t flowTrig;	///< Auto flow control RX trigger (0 to disable)
+	uint8_t svcLines;	///< Scanline budget for MwService() calls
+} BenchCfg;
+
+/// Benchmark measurement.
+typedef struct {
+	uint64_t ns;		///< Elapsed virtual time
+	uint32_t bytes;		///< Payload bytes moved
+	uint32_t polls;		///< LSR reads
+	int err;			///< Nonzero if an error occurred
+} BenchResult;
+
+typedef void (*BenchFunc)(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res);
+
+static uint8_t payload[LSD_MAX_LEN];
+static uint8_t frame[3 * (LSD_MAX_LEN + LSD_OVERHEAD)];
+static uint8_t rxBuf[LSD_MAX_LEN + LSD_OVERHEAD];
+
+// Builds in dst the LSD frame for the payload
+static uint16_t FrameBuildCh(uint8_t *dst, const uint8_t *buf, uint16_t len,
+		uint8_t ch) {
+	uint16_t crc;
+
+	dst[0] = LSD_STX_ETX;
+	dst[1] = (ch<<4) | (len>>8);
+	dst[2] = len & 0xFF;
+	memcpy(dst + 3, buf, len);
+	crc = Crc16(dst + 1, len + 2, CRC16_INIT);
+	if (LSD_CRC_LEN) {
+		dst[3 + len] = crc>>8;
+		dst[4 + len] = crc & 0xFF;
+	}
+	dst[3 + len + LSD_CRC_LEN] = LSD_STX_ETX;
+
+	return len + LSD_OVERHEAD;
+}
+
+// Builds in frame[] the LSD frame for the payload
+static uint16_t FrameBuild(const uint8_t *buf, uint16_t len) {
+	return FrameBuildCh(frame, buf, len, BENCH_CH);
+}
+
+// Checks a received frame and returns it to the pool
+static int RxCheck(MwMsgBuf *rx, const uint8_t *buf, uint16_t len,
+		uint8_t ch) {
+	int err;
+
+	if (!rx) return 1;
+	err = (ch != rx->ch) || (rx->len != len) || memcmp(rx->data, buf, len);
+	LsdRxFree(rx);
+
+	return err;
+}
+
+// Waits until the line is idle, and discards data received by the peer
+static void PeerFlush(void) {
+	UartSimIdle(UINT32_MAX);
+	UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+}
+
+// Checks the peer received the frame previously built with FrameBuild()
+static int FrameCheck(uint16_t frameLen) {
+	uint16_t rx;
+
+	UartSimIdle(UINT32_MAX);
+	rx = UartSimPeerRecv(rxBuf, sizeof(rxBuf));
+	return rx != frameLen || memcmp(rxBuf, frame, frameLen);
+}
+
+static uint8_t FlowTrigFcr(uint8_t trig) {
+	if (trig >= 14) return UART_FCR__TRIG_14;
+	if (trig >= 8) return UART_FCR__TRIG_8;
+	if (trig >= 4) return UART_FCR__TRIG_4;
+	return UART_FCR__TRIG_1;
+}
+
+static void BenchInit(const BenchCfg *cfg) {
+	UartSimReset(cfg->clk, cfg->accessNs);
+	MwInit();
+	if (cfg->rate) UartBaudSet(cfg->rate);
+	UartSimBaudSet(cfg->baud);
+	if (cfg->flowTrig) {
+		UartAutoFlowEnable(FlowTrigFcr(cfg->flowTrig));
+		UartSimPeerFlowSet(1);
+	}
+	LsdChEnable(BENCH_CH);
+#ifdef LSD_RX_RING
+	UartSimIntSet(LsdRxIsr, LSD_RX_RING_LINES);
+#endif
+}
+
+static uint32_t BenchReps(uint16_t len, const BenchCfg *cfg) {
+	return MAX(1, (cfg->minBytes + len - 1) / len);
+}
+
+static void BenchStart(BenchResult *res) {
+	memset(res, 0, sizeof(BenchResult));
+	res->ns = UartSimNow();
+	res->polls = UartSimStatsGet()->lsrRd;
+}
+
+static void BenchEnd(BenchResult *res) {
+	res->ns = UartSimNow() - res->ns;
+	res->polls = UartSimStatsGet()->lsrRd - res->polls;
+}
+
+static void BenchSend(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuild(buf, len);
+
+	BenchStart(res);
+	while (reps--) {
+		if (LsdSend(buf, len, BENCH_CH) != len) res->err = 1;
+		res->bytes += len;
+		UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+	}
+	BenchEnd(res);
+	PeerFlush();
+	if (LsdSend(buf, len, BENCH_CH) != len || FrameCheck(frameLen)) {
+		res->err = 1;
+	}
+}
+
+static int SplitSend(uint8_t *buf, uint16_t len, const BenchCfg *cfg) {
+	uint16_t pos, n;
+	int err = 0;
+
+	n = MIN(cfg->chunk, len);
+	if (LsdSplitStart(buf, n, len, BENCH_CH) != n) err = 1;
+	for (pos = n; (len - pos) > cfg->chunk; pos += n) {
+		n = cfg->chunk;
+		if (LsdSplitNext(buf + pos, n) != n) err = 1;
+	}
+	n = len - pos;
+	if (LsdSplitEnd(buf + pos, n) != n) err = 1;
+
+	return err;
+}
+
+static void BenchSplit(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuild(buf, len);
+
+	BenchStart(res);
+	while (reps--) {
+		if (SplitSend(buf, len, cfg)) res->err = 1;
+		res->bytes += len;
+		UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+	}
+	BenchEnd(res);
+	PeerFlush();
+	if (SplitSend(buf, len, cfg) || FrameCheck(frameLen)) res->err = 1;
+}
+
+// Sends frames with LsdTxStart(), serviced once per game frame
+static void BenchSvc(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuild(buf, len);
+
+	BenchStart(res);
+	while (reps--) {
+		if (LsdTxStart(buf, len, BENCH_CH)) res->err = 1;
+		while (LSD_IN_PROGRESS == LsdTxPoll()) {
+			UartSimIdle(cfg->gameNs);
+			if (MwService(cfg->svcLines)) res->err = 1;
+		}
+		res->bytes += len;
+		UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+	}
+	BenchEnd(res);
+	PeerFlush();
+	if (LsdTxStart(buf, len, BENCH_CH)) res->err = 1;
+	while (LSD_IN_PROGRESS == LsdTxPoll()) MwService(cfg->svcLines);
+	if (FrameCheck(frameLen)) res->err = 1;
+}
+
+// Checks the peer received the payload in one or more frames
+static int StreamCheck(const uint8_t *buf, uint16_t len) {
+	uint16_t rx, pos = 0, flen;
+	uint16_t i = 0;
+
+	UartSimIdle(UINT32_MAX);
+	rx = UartSimPeerRecv(frame, sizeof(frame));
+	while (i + LSD_OVERHEAD <= rx) {
+		flen = ((frame[i + 1] & 0x0F)<<8) | frame[i + 2];
+		if (frame[i] != LSD_STX_ETX || (frame[i + 1]>>4) != BENCH_CH ||
+				i + flen + LSD_OVERHEAD > rx ||
+				frame[i + LSD_OVERHEAD - 1 + flen] != LSD_STX_ETX ||
+				pos + flen > len || memcmp(frame + i + 3, buf + pos, flen)) {
+			return 1;
+		}
+		pos += flen;
+		i += flen + LSD_OVERHEAD;
+	}
+
+	return i != rx || pos != len;
+}
+
+// Writes the payload to a socket in chunks, and flushes it
+static int SockSend(const uint8_t *buf, uint16_t len, const BenchCfg *cfg) {
+	uint16_t pos, n;
+
+	for (pos = 0; pos < len; pos += n) {
+		n = MIN(cfg->chunk, len - pos);
+		if (MwSockSend(BENCH_CH, buf + pos, n) != n) return 1;
+	}
+
+	return MwSockFlush(BENCH_CH);
+}
+
+// Sends the payload in chunks through a socket, coalesced in frames
+static void BenchSock(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	// OK reply to the connection request
+	static const uint8_t ok[4] = {0};
+	uint8_t okFrame[LSD_OVERHEAD + sizeof(ok)];
+
+	UartSimPeerSend(okFrame, FrameBuildCh(okFrame, ok, sizeof(ok),
+				MW_CTRL_CH));
+	if (MwTcpConnect(BENCH_CH, "127.0.0.1", "1234", "")) res->err = 1;
+	PeerFlush();
+
+	BenchStart(res);
+	while (reps--) {
+		if (SockSend(buf, len, cfg)) res->err = 1;
+		res->bytes += len;
+		UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+	}
+	BenchEnd(res);
+	PeerFlush();
+	if (SockSend(buf, len, cfg) || StreamCheck(buf, len)) res->err = 1;
+}
+
+#ifdef LSD_CRC
+// Completes commands until the peer receives the NAK frame. No command must
+// complete meanwhile.
+static int PeerNakWait(const uint8_t *nak, uint16_t nakLen, uint32_t polls,
+		const BenchCfg *cfg) {
+	static uint8_t cap[UART_SIM_PEER_BUFLEN];
+	uint16_t capLen = 0;
+	uint8_t tag;
+	MwCmd *rep;
+
+	while (polls--) {
+		if (MW_CMD_PENDING != MwCmdComplete(&tag, &rep)) return 1;
+		capLen += UartSimPeerRecv(cap + capLen, sizeof(cap) - capLen);
+		// NAK is the last frame sent
+		if (capLen >= nakLen && !memcmp(cap + capLen - nakLen, nak, nakLen)) {
+			return 0;
+		}
+		UartSimIdle(cfg->gameNs);
+	}
+
+	return 1;
+}
+
+// Command reply received corrupted, and recovered requesting it again
+static void BenchCrc(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuildCh(frame, buf, len, MW_CTRL_CH);
+	uint8_t nakCh = MW_CTRL_CH;
+	uint8_t nak[LSD_OVERHEAD + 1];
+	uint16_t nakLen = FrameBuildCh(nak, &nakCh, 1, LSD_NAK_CH);
+	uint32_t polls;
+	uint8_t tag;
+	MwCmd *rep;
+	int ret;
+
+	BenchStart(res);
+	while (reps--) {
+		if (MwCmdSubmitV(MW_CMD_VERSION, NULL, 0) < 0) res->err = 1;
+		// Send the reply with a corrupted payload byte
+		polls = 2 * frameLen + 16;
+		frame[3] ^= 0x01;
+		UartSimPeerSend(frame, frameLen);
+		frame[3] ^= 0x01;
+		if (PeerNakWait(nak, nakLen, polls, cfg)) res->err = 1;
+		UartSimPeerSend(frame, frameLen);
+		while ((MW_CMD_PENDING == (ret = MwCmdComplete(&tag, &rep))) &&
+				polls--) {
+			UartSimIdle(cfg->gameNs);
+		}
+		if (ret) {
+			MwCmdCancel();
+			res->err = 1;
+		} else if (RxCheck((MwMsgBuf*)rep, buf, len, MW_CTRL_CH)) {
+			res->err = 1;
+		}
+		res->bytes += len;
+	}
+	BenchEnd(res);
+}
+#endif
+
+// Command left unanswered until it times out, followed by commands that
+// must complete: the reply to the first one must not be waited for anymore
+static void BenchTout(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	// OK reply, with no data
+	static const uint8_t ok[4] = {0};
+	uint16_t frameLen = FrameBuildCh(frame, ok, sizeof(ok), MW_CTRL_CH);
+	MwCmd *rep;
+	uint8_t tag, i;
+
+	BenchStart(res);
+	if (MwCmdSendV(MW_CMD_VERSION, NULL, 0) || MwCmdReplyGet()) res->err = 1;
+	for (i = 0; i < 3; i++) {
+		if (MwCmdSendV(MW_CMD_VERSION, NULL, 0)) res->err = 1;
+		UartSimPeerSend(frame, frameLen);
+		if (!(rep = MwCmdReplyGet())) res->err = 1;
+		else if (RxCheck((MwMsgBuf*)rep, ok, sizeof(ok), MW_CTRL_CH)) {
+			res->err = 1;
+		}
+		res->bytes += sizeof(ok);
+	}
+	// No submission slot must be taken by the unanswered command
+	for (i = 0; i < MW_CMD_MAX_PEND; i++) {
+		if (MwCmdSubmitV(MW_CMD_VERSION, NULL, 0) < 0) res->err = 1;
+	}
+	MwCmdReset();
+	// Same for unanswered bulk requests, and submitted commands
+	if (!MwFlashRead(0, buf, len) || !MwCfgCacheLoad()) res->err = 1;
+	if (MwCmdSubmitV(MW_CMD_VERSION, NULL, 0) < 0) res->err = 1;
+	UartSimPeerSend(frame, frameLen);
+	if (MwCmdWait(&tag, &rep)) res->err = 1;
+	else if (RxCheck((MwMsgBuf*)rep, ok, sizeof(ok), MW_CTRL_CH)) {
+		res->err = 1;
+	}
+	res->bytes += sizeof(ok);
+	BenchEnd(res);
+}
+
+// Command data segments whose lengths wrap the 16-bit total to len: the
+// command must be rejected without sending anything
+static void BenchWrap(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	// Segments of up to LSD_MAX_LEN bytes, all taken from buf
+	LsdVec vec[UINT16_MAX / LSD_MAX_LEN + 2];
+	uint32_t left = UINT16_MAX + 1UL + len;
+	uint8_t cap[1];
+	uint8_t n;
+
+	(void)cfg;
+	for (n = 0; left; n++) {
+		vec[n].data = buf;
+		vec[n].len = MIN(left, LSD_MAX_LEN);
+		left -= vec[n].len;
+	}
+	PeerFlush();
+	BenchStart(res);
+	if (!MwCmdSendV(MW_CMD_ECHO, vec, n)) res->err = 1;
+	UartSimIdle(UINT32_MAX);
+	if (UartSimPeerRecv(cap, sizeof(cap))) res->err = 1;
+	BenchEnd(res);
+}
+
+// More socket frames than buffers can hold: the socket must return the
+// data received before the dropped frame, and then fail instead of
+// returning a stream with a gap
+static void BenchLost(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	// OK reply to the connection request
+	static const uint8_t ok[4] = {0};
+	uint8_t okFrame[LSD_OVERHEAD + sizeof(ok)];
+	uint16_t frameLen = 0;
+	uint32_t polls;
+	uint8_t i;
+
+	UartSimPeerSend(okFrame, FrameBuildCh(okFrame, ok, sizeof(ok),
+				MW_CTRL_CH));
+	if (MwTcpConnect(BENCH_CH, "127.0.0.1", "1234", "")) res->err = 1;
+	PeerFlush();
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		frameLen += FrameBuildCh(frame + frameLen, buf, len, BENCH_CH);
+	}
+
+	BenchStart(res);
+	UartSimPeerSend(frame, frameLen);
+	for (polls = 2 * frameLen + 16; polls; polls--) {
+		// Keep polling without delay after a frame is completed
+		if (LSD_IN_PROGRESS == LsdPoll()) UartSimIdle(cfg->gameNs);
+	}
+	if (MwSockRecv(BENCH_CH, rxBuf, sizeof(rxBuf)) !=
+			(LSD_BUF_FRAMES - 1) * len ||
+			MwSockRecv(BENCH_CH, rxBuf, sizeof(rxBuf)) >= 0) {
+		res->err = 1;
+	}
+	res->bytes = len * LSD_BUF_FRAMES;
+	BenchEnd(res);
+}
+
+// All the buffers taken by the application with a frame left to receive:
+// LsdRecv() must fail instead of waiting for a buffer, and receive the
+// frame once the buffers are freed
+static void BenchHold(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	MwMsgBuf *held[LSD_BUF_FRAMES];
+	uint16_t frameLen = 0;
+	uint16_t maxLen;
+	uint32_t polls;
+	uint8_t i;
+
+	for (i = 0; i <= LSD_BUF_FRAMES; i++) {
+		frameLen += FrameBuildCh(frame + frameLen, buf, len, LSD_RSV_CH);
+	}
+
+	BenchStart(res);
+	UartSimPeerSend(frame, frameLen);
+	for (polls = 2 * frameLen + 16; polls; polls--) {
+		if (LSD_IN_PROGRESS == LsdPoll()) UartSimIdle(cfg->gameNs);
+	}
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		if (!(held[i] = LsdRxGet(LSD_RSV_CH))) res->err = 1;
+	}
+	maxLen = LSD_MAX_LEN;
+	if (!res->err && LSD_ERROR != LsdRecv(rxBuf, &maxLen, UINT32_MAX)) {
+		res->err = 1;
+	}
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		if (RxCheck(held[i], buf, len, LSD_RSV_CH)) res->err = 1;
+	}
+	maxLen = LSD_MAX_LEN;
+	if (LSD_RSV_CH != LsdRecv(rxBuf, &maxLen, UINT32_MAX) ||
+			maxLen != len || memcmp(rxBuf, buf, len)) {
+		res->err = 1;
+	}
+	res->bytes = len * (LSD_BUF_FRAMES + 1);
+	BenchEnd(res);
+}
+
+static void BenchRecv(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuild(buf, len);
+	uint16_t maxLen;
+
+	BenchStart(res);
+	while (reps--) {
+		UartSimPeerSend(frame, frameLen);
+		maxLen = LSD_MAX_LEN;
+		if ((BENCH_CH != LsdRecv(rxBuf, &maxLen, UINT32_MAX)) ||
+				(maxLen != len) || memcmp(rxBuf, buf, len)) {
+			res->err = 1;
+		}
+		res->bytes += len;
+	}
+	BenchEnd(res);
+}
+
+static void BenchPoll(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen = FrameBuild(buf, len);
+	uint32_t polls;
+
+	BenchStart(res);
+	while (reps--) {
+		UartSimPeerSend(frame, frameLen);
+		// Bound the number of polls, in case the frame is lost
+		polls = 2 * frameLen + 16;
+		while ((LSD_IN_PROGRESS == LsdPoll()) && polls--) {
+			UartSimIdle(cfg->gameNs);
+		}
+		if (RxCheck(LsdRxGet(BENCH_CH), buf, len, BENCH_CH)) res->err = 1;
+		res->bytes += len;
+	}
+	BenchEnd(res);
+}
+
+// Frame with lost bytes followed by a good frame, that must be received
+static void BenchResync(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(len, cfg);
+	uint16_t frameLen;
+	uint32_t polls;
+	int errors;
+	int ret;
+
+	// Drop two bytes after the header of the first frame
+	frameLen = FrameBuild(buf, len);
+	memmove(frame + 3, frame + 5, frameLen - 5);
+	frameLen -= 2;
+	frameLen += FrameBuildCh(frame + frameLen, buf, len, BENCH_CH);
+
+	BenchStart(res);
+	while (reps--) {
+		UartSimPeerSend(frame, frameLen);
+		polls = 2 * frameLen + 16;
+		errors = 0;
+		while ((BENCH_CH != (ret = LsdPoll())) && polls--) {
+			if (LSD_IN_PROGRESS == ret) UartSimIdle(cfg->gameNs);
+			else errors++;
+		}
+		if (!errors) res->err = 1;
+		if (RxCheck(LsdRxGet(BENCH_CH), buf, len, BENCH_CH)) res->err = 1;
+		res->bytes += len;
+	}
+	BenchEnd(res);
+}
+
+// Data frame, frame for a disabled channel and control frame, interleaved
+static void BenchDemux(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	uint32_t reps = BenchReps(2 * len, cfg);
+	uint16_t frameLen;
+	uint32_t polls;
+	int ret;
+
+	frameLen = FrameBuildCh(frame, buf, len, BENCH_CH);
+	frameLen += FrameBuildCh(frame + frameLen, buf, len, BENCH_DIS_CH);
+	frameLen += FrameBuildCh(frame + frameLen, buf, len, 0);
+	LsdChEnable(0);
+
+	BenchStart(res);
+	while (reps--) {
+		UartSimPeerSend(frame, frameLen);
+		polls = 2 * frameLen + 16;
+		while ((0 != (ret = LsdPoll())) && polls--) {
+			// Keep polling without delay after a frame is completed
+			if (LSD_IN_PROGRESS == ret) UartSimIdle(cfg->gameNs);
+		}
+		// Control frame is read first, data frame must be still queued
+		if (RxCheck(LsdRxGet(0), buf, len, 0)) res->err = 1;
+		if (RxCheck(LsdRxGet(BENCH_CH), buf, len, BENCH_CH)) res->err = 1;
+		if (LsdRxGet(BENCH_DIS_CH)) res->err = 1;
+		res->bytes += 2 * len;
+	}
+	BenchEnd(res);
+}
+
+// UART internal loopback, measuring the driver without the LSD layer
+static void BenchLoop(uint8_t *buf, uint16_t len, const BenchCfg *cfg,
+		BenchResult *res) {
+	UartLoopStats st;
+
+#ifdef LSD_RING
+	// The reception ring (or the Z80 driver) would take the looped back data
+	UartSimIntSet(NULL, 0);
+	UartSimCopSet(NULL, 0, 0);
+#endif
+	BenchStart(res);
+	res->err = UartLoopbackBench(BenchReps(len, cfg) * len, &st) != 0;
+	res->bytes = st.bytes;
+	BenchEnd(res);
+}
+
+#ifdef LSD_STATS
+// Prints the link statistics of the last measurement, all channels added
+static void StatsPrint(void) {
+	LsdStats st;
+	uint32_t tx[2] = {0}, rx[2] = {0}, err = 0;
+	uint8_t ch;
+
+	LsdStatsGet(&st);
+	for (ch = 0; ch < LSD_MAX_CH; ch++) {
+		tx[0] += st.txFrames[ch];
+		tx[1] += st.txBytes[ch];
+		rx[0] += st.rxFrames[ch];
+		rx[1] += st.rxBytes[ch];
+		err += st.rxErr[ch];
+	}
+	printf("#  tx=%u/%u rx=%u/%u rx_err=%u tx_wait=%u rx_empty=%u oe=%u "
+			"ch=%u len=%u etx=%u crc=%u drop=%u no_buf=%u\n", tx[0], tx[1],
+			rx[0], rx[1], err, st.txWait, st.rxEmpty, st.overrun, st.chErr,
+			st.lenErr, st.etxErr, st.crcErr, st.dropped, st.noBuf);
+}
+#endif
+
+#ifdef MW_PROF
+// Prints the results of the probes with calls in the last measurement
+static void ProfPrint(void) {
+	static const char *const probeName[PROF_MAX] = {
+		"lsd_send", "lsd_poll", "mw_cmd_send", "mw_reply_get"
+	};
+	ProfProbe p;
+	uint8_t i, j;
+
+	for (i = 0; i < PROF_MAX; i++) {
+		ProfGet(i, &p);
+		if (!p.count) continue;
+		printf("#  %-12s n=%u cycles min=%u avg=%.1f max=%u hist=", probeName[i],
+				p.count, p.min, (double)p.sum / p.count, p.max);
+		for (j = 0; j < PROF_HIST_LEN; j++) {
+			printf("%u%c", p.hist[j], j < (PROF_HIST_LEN - 1) ? ',' : '\n');
+		}
+	}
+}
+#endif
+
+static void BenchRun(const char *name, BenchFunc f, uint16_t len,
+		const BenchCfg *cfg) {
+	BenchResult res;
+
+	BenchInit(cfg);
+	f(payload, len, cfg, &res);
+	printf("%-6s %5u %10.0f %10.3f%s\n", name, len,
+			res.ns ? res.bytes * 1e9 / res.ns : 0.0,
+			res.bytes ? (double)res.polls / res.bytes : 0.0, res.err ? " ERROR" : "");
+#ifdef LSD_STATS
+	StatsPrint();
+#endif
+#ifdef MW_PROF
+	ProfPrint();
+#endif
+}
+
+static uint16_t NextLen(uint16_t len, const BenchCfg *cfg) {
+	if (cfg->len) return 0;
+	if (len == LSD_MAX_LEN) return 0;
+	if (cfg->step) return MIN(LSD_MAX_LEN, len + cfg->step);
+	return MIN(LSD_MAX_LEN, len * 2);
+}
+
+// Opens the pseudo-terminal (or serial device) the firmware stand-in is
+// attached to, and connects it to the simulated UART
+static int PeerOpen(const char *path) {
+	struct termios tio;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_NOCTTY)) < 0) {
+		perror(path);
+		return -1;
+	}
+	if (!tcgetattr(fd, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	UartSimPeerFdSet(fd);
+
+	return 0;
+}
+
+// Prints an end to end suite result
+static void E2ePrint(const MwBenchResult *res) {
+	char csv[MW_BENCH_CSV_MAX];
+
+	MwBenchCsv(res, csv);
+	puts(csv);
+}
+
+static void Usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-h] [-c clk] [-a access_ns] [-b baud] "
+			"[-r rate] [-m min_bytes] [-k chunk] [-g game_ns] [-f rx_trigger] "
+			"[-s svc_lines] [-i step | -l len] [-p peer_tty]\n",
+			prog);
+	fprintf(stderr, "Send benchmarks sweep lengths up to %u bytes "
+			"(LSD_MAX_LEN). Reception benchmarks stop at %u bytes (LSD_RX_MAX_LEN), the "
+			"length of the LSD reception buffers.\n", LSD_MAX_LEN,
+			LSD_RX_MAX_LEN);
+}
+
+int main(int argc, char **argv) {
+	BenchCfg cfg = {
+		UART_SIM_CLK_DEF, UART_SIM_ACCESS_NS_DEF, 0, 0,
+		BENCH_MIN_BYTES_DEF, BENCH_GAME_NS_DEF, BENCH_SPLIT_CHUNK_DEF, 0, 0, 0,
+		BENCH_SVC_LINES_DEF
+	};
+	const char *peer = NULL;
+	uint16_t len;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hc:a:b:r:m:k:g:f:s:i:l:p:")) != -1) {
+		switch (opt) {
+			case 'c': cfg.clk = strtoul(optarg, NULL, 0); break;
+			case 'a': cfg.accessNs = strtoul(optarg, NULL, 0); break;
+			case 'b': cfg.baud = strtoul(optarg, NULL, 0); break;
+			case 'r': cfg.rate = strtoul(optarg, NULL, 0); break;
+			case 'm': cfg.minBytes = strtoul(optarg, NULL, 0); break;
+			case 'f': cfg.flowTrig = strtoul(optarg, NULL, 0); break;
+			case 's': cfg.svcLines = strtoul(optarg, NULL, 0); break;
+			case 'g': cfg.gameNs = strtoul(optarg, NULL, 0); break;
+			case 'k': cfg.chunk = strtoul(optarg, NULL, 0); break;
+			case 'i': cfg.step = strtoul(optarg, NULL, 0); break;
+			case 'l': cfg.len = strtoul(optarg, NULL, 0); break;
+			case 'p': peer = optarg; break;
+			case 'h': Usage(argv[0]); return 0;
+			default: Usage(argv[0]); return 1;
+		}
+	}
+	if (!cfg.chunk || cfg.len > LSD_MAX_LEN) {
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// Check the requested rate can be generated from the UART clock
+	UartSimReset(cfg.clk, cfg.accessNs);
+	UartInit();
+	if (cfg.rate && UartBaudSet(cfg.rate)) {
+		fprintf(stderr, "Unsupported baud rate %u\n", cfg.rate);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(payload); i++) payload[i] = i * 7;
+
+	printf("# clk=%u access_ns=%u baud=%u rate=%u chunk=%u game_ns=%u "
+			"flow_trig=%u svc_lines=%u\n", cfg.clk, cfg.accessNs, cfg.baud,
+			UartBaudGet(), cfg.chunk, cfg.gameNs, cfg.flowTrig, cfg.svcLines);
+	if (peer) {
+		// End to end suite, shared with the cart build
+		if (PeerOpen(peer)) return 1;
+		BenchInit(&cfg);
+		puts(MW_BENCH_CSV_HDR);
+		return MwBenchSuite(E2ePrint);
+	}
+	printf("# recv, poll, demux, resync and crc stop at rx_max=%u "
+			"(LSD_RX_MAX_LEN)\n", LSD_RX_MAX_LEN);
+	printf("# op     len    bytes/s polls/byte\n");
+	BenchRun("loop", BenchLoop, UART_TX_FIFO_LEN, &cfg);
+	BenchRun("tout", BenchTout, MW_CMD_MAX_BUFLEN, &cfg);
+	BenchRun("wrap", BenchWrap, 2, &cfg);
+	BenchRun("lost", BenchLost, 16, &cfg);
+	// The frame waiting for a buffer must fit in the UART RX FIFO, as long
+	// as the TX FIFO
+	BenchRun("hold", BenchHold, UART_TX_FIFO_LEN - LSD_OVERHEAD, &cfg);
+	for (len = cfg.len ? cfg.len : 1; len; len = NextLen(len, &cfg)) {
+		BenchRun("send", BenchSend, len, &cfg);
+		BenchRun("split", BenchSplit, len, &cfg);
+		BenchRun("svc", BenchSvc, len, &cfg);
+		BenchRun("sock", BenchSock, len, &cfg);
+		// Received frames must fit in the LSD reception buffers
+		if (len > LSD_RX_MAX_LEN) continue;
+		BenchRun("recv", BenchRecv, len, &cfg);
+		BenchRun("poll", BenchPoll, len, &cfg);
+		BenchRun("demux", BenchDemux, len, &cfg);
+		BenchRun("resync", BenchResync, len, &cfg);
+#ifdef LSD_CRC
+		BenchRun("crc", BenchCrc, len, &cfg);
+#endif
+	}
+
+	return 0;
+}
+
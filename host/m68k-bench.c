@@ -0,0 +1,252 @@
+/************************************************************************//**
+ * \brief Cycle counted benchmark harness. Runs the driver, built for the
+ *        68000 (host/m68k/bench.c), on the 68000 core (host/m68k-sim.c),
+ *        with the UART mapped to the simulated 16C550, and reports the CPU
+ *        cycles spent by LsdSend() and LsdRecv() for each payload length.
+ *
+ * The simulated line runs in step with the emulated CPU clock. By default
+ * the line rate is high enough for the CPU to be the bottleneck, so the
+ * cycles reported are the cost of the driver. Use -b to run at a real line
+ * rate instead.
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "m68k-sim.h"
+#include "uart-sim.h"
+#include "16c550.h"
+#include "lsd.h"
+#include "crc16.h"
+#include "m68k/bench-port.h"
+
+/// 68000 clock on PAL machines (Hz).
+#define M68K_CLK_PAL		7600489LU
+/// 68000 clock on NTSC machines (Hz).
+#define M68K_CLK_NTSC		7670453LU
+
+/// Default line rate: a character each 68000 cycle, so the CPU is the
+/// bottleneck.
+#define M68K_BENCH_BAUD_DEF	(10 * M68K_CLK_NTSC)
+
+/// Cycles emulated per timeslice.
+#define M68K_SLICE			10000
+
+/// Emulated seconds before the benchmark is considered hung.
+#define M68K_MAX_SECONDS	60
+
+/// Cartridge ROM length.
+#define M68K_ROM_LEN		0x400000
+/// Work RAM address.
+#define M68K_RAM_BASE		0xFF0000
+/// Work RAM length.
+#define M68K_RAM_LEN		0x10000
+/// Version register address.
+#define M68K_VERSION_REG	0xA10001
+/// VDP H/V counter address.
+#define M68K_HV_CNT			0xC00008
+
+/** \addtogroup m68k-bench M68kBenchData Local data required by the program.
+ *  \{ */
+typedef struct {
+	uint8_t rom[M68K_ROM_LEN];		///< Cartridge ROM
+	uint8_t ram[M68K_RAM_LEN];		///< Work RAM
+	uint64_t cycles;				///< Cycles run before current timeslice
+	uint64_t start;					///< Cycles when measurement started
+	uint32_t clk;					///< 68000 clock
+	uint32_t lsrRd;					///< LSR reads when measurement started
+	uint16_t len;					///< Payload length of the measurement
+	uint16_t op;					///< Operation measured (BenchPortCmd)
+	uint8_t exit;					///< The benchmark has ended
+	int err;						///< Any measurement failed
+} M68kBenchData;
+/** \} */
+
+// Program global data
+static M68kBenchData d;
+
+static uint8_t frame[LSD_MAX_LEN + LSD_OVERHEAD];
+
+// Cycles elapsed since reset
+static uint64_t CyclesGet(void) {
+	return d.cycles + M68kSimCyclesRun();
+}
+
+// Brings the simulated UART to the current emulated time
+static void UartSync(void) {
+	uint64_t ns = CyclesGet() * 1000000000LLU / d.clk;
+
+	if (ns > UartSimNow()) UartSimIdle(ns - UartSimNow());
+}
+
+// Queues for the peer to send a frame with a payload of len bytes
+static void FrameQueue(uint16_t len) {
+	uint16_t i, crc;
+
+	frame[0] = LSD_STX_ETX;
+	frame[1] = (BENCH_CH<<4) | (len>>8);
+	frame[2] = len & 0xFF;
+	for (i = 0; i < len; i++) frame[3 + i] = i * 7;
+	crc = Crc16(frame + 1, len + 2, CRC16_INIT);
+	if (LSD_CRC_LEN) {
+		frame[3 + len] = crc>>8;
+		frame[4 + len] = crc & 0xFF;
+	}
+	frame[3 + len + LSD_CRC_LEN] = LSD_STX_ETX;
+	UartSimPeerSend(frame, len + LSD_OVERHEAD);
+}
+
+// Reports a measurement
+static void Report(uint16_t len) {
+	uint64_t cycles = CyclesGet() - d.start;
+	uint32_t polls = UartSimStatsGet()->lsrRd - d.lsrRd;
+	int err = BENCH_CMD_RECV == d.op && len != d.len;
+
+	printf("%-6s %5u %10llu %10.2f %10.3f%s\n",
+			BENCH_CMD_SEND == d.op?"send":"recv", d.len,
+			(unsigned long long)cycles, (double)cycles / d.len,
+			(double)polls / d.len, err?" ERROR":"");
+	d.err |= err;
+}
+
+// Benchmark port writes
+static void PortWr(uint32_t addr, uint16_t val) {
+	static uint16_t len;
+
+	if (BENCH_PORT_LEN == addr) {
+		len = val;
+		return;
+	}
+	if (BENCH_PORT_CMD != addr) return;
+
+	switch (val) {
+		case BENCH_CMD_RECV:
+			UartSync();
+			FrameQueue(len);
+			// fallthrough
+		case BENCH_CMD_SEND:
+			d.op = val;
+			d.len = len;
+			d.start = CyclesGet();
+			d.lsrRd = UartSimStatsGet()->lsrRd;
+			break;
+
+		case BENCH_CMD_STOP:
+			Report(len);
+			break;
+
+		case BENCH_CMD_EXIT:
+			d.exit = 1;
+			M68kSimEnd();
+			break;
+	}
+}
+
+uint8_t M68kSimRd8(uint32_t addr) {
+	if (addr < M68K_ROM_LEN) return d.rom[addr];
+	if (addr >= M68K_RAM_BASE) return d.ram[addr - M68K_RAM_BASE];
+	if (addr >= UART_BASE && addr < UART_BASE + 16) {
+		UartSync();
+		return UartSimRd(addr - UART_BASE);
+	}
+	if (M68K_VERSION_REG == addr) return UartSimMdVersion();
+	return 0;
+}
+
+uint16_t M68kSimRd16(uint32_t addr) {
+	if (M68K_HV_CNT == addr) {
+		UartSync();
+		return UartSimHvCnt();
+	}
+	return (M68kSimRd8(addr)<<8) | M68kSimRd8(addr + 1);
+}
+
+void M68kSimWr8(uint32_t addr, uint8_t val) {
+	if (addr >= M68K_RAM_BASE) {
+		d.ram[addr - M68K_RAM_BASE] = val;
+	} else if (addr >= UART_BASE && addr < UART_BASE + 16) {
+		UartSync();
+		UartSimWr(addr - UART_BASE, val);
+	}
+}
+
+void M68kSimWr16(uint32_t addr, uint16_t val) {
+	if (addr >= BENCH_PORT_BASE && addr < BENCH_PORT_BASE + 4) {
+		PortWr(addr, val);
+		return;
+	}
+	M68kSimWr8(addr, val>>8);
+	M68kSimWr8(addr + 1, val & 0xFF);
+}
+
+static int RomLoad(const char *path) {
+	FILE *f;
+
+	if (!(f = fopen(path, "rb"))) {
+		perror(path);
+		return -1;
+	}
+	if (!fread(d.rom, 1, sizeof(d.rom), f)) {
+		fprintf(stderr, "%s: empty ROM\n", path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static void Usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-b baud] [-n] bench.bin\n", prog);
+	fprintf(stderr, "Runs the cycle counted benchmark built in "
+			"host/m68k/bench.bin. -n emulates a NTSC machine (PAL "
+			"otherwise).\n");
+}
+
+int main(int argc, char **argv) {
+	uint32_t baud = M68K_BENCH_BAUD_DEF;
+	uint64_t maxCycles;
+	int ntsc = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n")) != -1) {
+		switch (opt) {
+			case 'b': baud = strtoul(optarg, NULL, 0); break;
+			case 'n': ntsc = 1; break;
+			default: Usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		Usage(argv[0]);
+		return 1;
+	}
+	if (RomLoad(argv[optind])) return 1;
+
+	d.clk = ntsc?M68K_CLK_NTSC:M68K_CLK_PAL;
+	maxCycles = (uint64_t)M68K_MAX_SECONDS * d.clk;
+	// Register accesses take emulated cycles, not fixed virtual time
+	UartSimReset(ntsc?UART_CLK_NTSC:UART_CLK_PAL, 0);
+	UartSimBaudSet(baud);
+	UartSimPeerFlowSet(1);
+
+	M68kSimReset();
+
+	printf("# clk=%u baud=%u crc=%u\n", d.clk, baud, LSD_CRC_LEN);
+	printf("# op     len     cycles  cyc/byte polls/byte\n");
+	while (!d.exit && !M68kSimStopped() && d.cycles < maxCycles) {
+		d.cycles += M68kSimRun(M68K_SLICE);
+		// Discard data sent by the 68000
+		UartSimPeerRecv(NULL, UART_SIM_PEER_BUFLEN);
+	}
+	if (!d.exit && M68kSimStopped()) {
+		fprintf(stderr, "Benchmark halted, PC=0x%06X\n", M68kSimPcGet());
+		return 1;
+	}
+	if (!d.exit) {
+		fprintf(stderr, "Benchmark did not finish after %u s\n",
+				M68K_MAX_SECONDS);
+		return 1;
+	}
+
+	return d.err;
+}
+
@@ -0,0 +1,1347 @@
+/************************************************************************//**
+ * \brief 68000 CPU core for host builds. See m68k-sim.h for details.
+ ****************************************************************************/
+#include <setjmp.h>
+#include <string.h>
+#include "m68k-sim.h"
+
+/// \name Status register bits
+/// \{
+#define SR_C		0x0001
+#define SR_V		0x0002
+#define SR_Z		0x0004
+#define SR_N		0x0008
+#define SR_X		0x0010
+#define SR_CCR		0x001F
+#define SR_S		0x2000
+/// Implemented bits
+#define SR_MASK		0xA71F
+/// \}
+
+/// \name Exception vectors
+/// \{
+#define VEC_ADDR	3
+#define VEC_ILLEGAL	4
+#define VEC_DIV0	5
+#define VEC_CHK		6
+#define VEC_TRAPV	7
+#define VEC_PRIV	8
+#define VEC_LINEA	10
+#define VEC_LINEF	11
+#define VEC_TRAP	32
+/// \}
+
+/// \name Exception processing times
+/// \{
+#define EXC_CYCLES		34
+#define EXC_ADDR_CYCLES	50
+#define EXC_CHK_CYCLES	40
+#define EXC_DIV0_CYCLES	38
+/// \}
+
+/// Effective address kinds
+enum {
+	EA_DREG = 0,	///< Data register direct
+	EA_AREG,		///< Address register direct
+	EA_MEM,			///< Memory
+	EA_IMM			///< Immediate
+};
+
+/// Computed effective address
+typedef struct {
+	uint8_t kind;	///< One of EA_DREG, EA_AREG, EA_MEM or EA_IMM
+	uint8_t reg;	///< Register for EA_DREG and EA_AREG
+	uint32_t addr;	///< Address for EA_MEM, data for EA_IMM
+} Ea;
+
+/** \addtogroup m68k-sim M68kSimData Local data required by the module.
+ *  \{ */
+typedef struct {
+	uint32_t dr[8];		///< Data registers
+	uint32_t ar[8];		///< Address registers, ar[7] is the active SP
+	uint32_t osp;		///< Inactive stack pointer
+	uint32_t pc;		///< Program counter
+	uint32_t ipc;		///< Address of the instruction being executed
+	uint32_t cycles;	///< Clock periods run in current M68kSimRun()
+	uint32_t faultAddr;	///< Address causing the address error
+	uint16_t sr;		///< Status register
+	uint16_t ir;		///< Instruction register
+	uint8_t faultRd;	///< The address error was on a read
+	uint8_t inExc;		///< Processing an address error exception
+	uint8_t stopped;	///< CPU stopped
+	uint8_t end;		///< End current M68kSimRun()
+	jmp_buf fault;		///< Aborts the instruction on address errors
+} M68kSimData;
+/** \} */
+
+/// Module global data
+static M68kSimData d;
+
+/// Operand size masks, indexed by size in bytes
+static const uint32_t mask[5] = {0, 0xFF, 0xFFFF, 0, 0xFFFFFFFF};
+/// Operand sign bits, indexed by size in bytes
+static const uint32_t msb[5] = {0, 0x80, 0x8000, 0, 0x80000000};
+
+/// Times of the control addressing modes, for JMP, JSR, LEA and PEA:
+/// (An), d16(An), d8(An,Xn), abs.W, abs.L, d16(PC), d8(PC,Xn)
+static const uint8_t jmpTime[7] = { 8, 10, 14, 10, 12, 10, 14};
+static const uint8_t jsrTime[7] = {16, 18, 22, 18, 20, 18, 22};
+static const uint8_t leaTime[7] = { 4,  8, 12,  8, 12,  8, 12};
+static const uint8_t peaTime[7] = {12, 16, 20, 16, 20, 16, 20};
+/// MOVEM base times (plus 4 per word, 8 per long word transferred)
+static const uint8_t movemRdTime[7] = {12, 16, 18, 16, 20, 16, 18};
+static const uint8_t movemWrTime[7] = { 8, 12, 14, 12, 16,  0,  0};
+
+// Index in the control mode time tables, -1 for non control modes
+static int CtrlIdx(unsigned mode, unsigned reg) {
+	switch (mode) {
+		case 2: return 0;
+		case 5: return 1;
+		case 6: return 2;
+		case 7: return reg < 4?3 + (int)reg:-1;
+		default: return -1;
+	}
+}
+
+static int32_t Sext(uint32_t val, int size) {
+	switch (size) {
+		case 1: return (int8_t)val;
+		case 2: return (int16_t)val;
+		default: return (int32_t)val;
+	}
+}
+
+static int BitsSet(uint32_t val) {
+	int n;
+
+	for (n = 0; val; val &= val - 1) n++;
+
+	return n;
+}
+
+// Raises an address error, aborting the instruction
+static void AddrErr(uint32_t addr, int rd) {
+	d.faultAddr = addr;
+	d.faultRd = rd;
+	longjmp(d.fault, 1);
+}
+
+static uint32_t MemRd(uint32_t addr, int size) {
+	addr &= 0xFFFFFF;
+	if (1 == size) return M68kSimRd8(addr);
+	if (addr & 1) AddrErr(addr, 1);
+	if (2 == size) return M68kSimRd16(addr);
+	return ((uint32_t)M68kSimRd16(addr)<<16) |
+		M68kSimRd16((addr + 2) & 0xFFFFFF);
+}
+
+static void MemWr(uint32_t addr, int size, uint32_t val) {
+	addr &= 0xFFFFFF;
+	if (1 == size) {
+		M68kSimWr8(addr, val);
+		return;
+	}
+	if (addr & 1) AddrErr(addr, 0);
+	if (2 == size) {
+		M68kSimWr16(addr, val);
+	} else {
+		M68kSimWr16(addr, val>>16);
+		M68kSimWr16((addr + 2) & 0xFFFFFF, val);
+	}
+}
+
+static uint16_t Fetch16(void) {
+	uint16_t val = MemRd(d.pc, 2);
+
+	d.pc += 2;
+	return val;
+}
+
+static uint32_t Fetch32(void) {
+	uint32_t val = MemRd(d.pc, 4);
+
+	d.pc += 4;
+	return val;
+}
+
+static void Push16(uint16_t val) {
+	d.ar[7] -= 2;
+	MemWr(d.ar[7], 2, val);
+}
+
+static void Push32(uint32_t val) {
+	d.ar[7] -= 4;
+	MemWr(d.ar[7], 4, val);
+}
+
+static uint32_t Pop16(void) {
+	uint32_t val = MemRd(d.ar[7], 2);
+
+	d.ar[7] += 2;
+	return val;
+}
+
+static uint32_t Pop32(void) {
+	uint32_t val = MemRd(d.ar[7], 4);
+
+	d.ar[7] += 4;
+	return val;
+}
+
+// Sets the status register, swapping stack pointers on mode changes
+static void SrSet(uint16_t sr) {
+	sr &= SR_MASK;
+	if ((sr ^ d.sr) & SR_S) {
+		uint32_t sp = d.ar[7];
+
+		d.ar[7] = d.osp;
+		d.osp = sp;
+	}
+	d.sr = sr;
+}
+
+static void FlagSet(uint16_t flag, int cond) {
+	if (cond) d.sr |= flag;
+	else d.sr &= ~flag;
+}
+
+// Sets N and Z from the result, clears V and C
+static void FlagsLogic(uint32_t res, int size) {
+	d.sr &= ~(SR_N | SR_Z | SR_V | SR_C);
+	if (!(res & mask[size])) d.sr |= SR_Z;
+	if (res & msb[size]) d.sr |= SR_N;
+}
+
+static void Exception(int vec, uint32_t cycles) {
+	uint16_t sr = d.sr;
+
+	SrSet((d.sr | SR_S) & ~0x8000);
+	Push32(d.pc);
+	Push16(sr);
+	d.pc = MemRd(vec * 4, 4);
+	d.cycles += cycles;
+}
+
+// Exceptions taken with the PC pointing to the offending instruction
+static void ExceptionIpc(int vec) {
+	d.pc = d.ipc;
+	Exception(vec, EXC_CYCLES);
+}
+
+static int Privileged(void) {
+	if (d.sr & SR_S) return 1;
+	ExceptionIpc(VEC_PRIV);
+	return 0;
+}
+
+static int Cond(unsigned cc) {
+	int c = !!(d.sr & SR_C), v = !!(d.sr & SR_V);
+	int z = !!(d.sr & SR_Z), n = !!(d.sr & SR_N);
+
+	switch (cc) {
+		case 0x0: return 1;
+		case 0x1: return 0;
+		case 0x2: return !c && !z;
+		case 0x3: return c || z;
+		case 0x4: return !c;
+		case 0x5: return c;
+		case 0x6: return !z;
+		case 0x7: return z;
+		case 0x8: return !v;
+		case 0x9: return v;
+		case 0xA: return !n;
+		case 0xB: return n;
+		case 0xC: return n == v;
+		case 0xD: return n != v;
+		case 0xE: return !z && n == v;
+		default:  return z || n != v;
+	}
+}
+
+// Brief extension word indexed address
+static uint32_t Index(uint32_t base) {
+	uint16_t ext = Fetch16();
+	uint32_t idx = ext & 0x8000?d.ar[(ext>>12) & 7]:d.dr[(ext>>12) & 7];
+
+	if (!(ext & 0x0800)) idx = (int16_t)idx;
+	return base + idx + (int8_t)ext;
+}
+
+// Computes an effective address, adding its calculation time if timed.
+// Returns nonzero for invalid modes.
+static int EaGet(Ea *ea, unsigned mode, unsigned reg, int size, int timed) {
+	uint32_t t;
+	// Byte accesses through the stack pointer keep it word aligned
+	int step = 1 == size && 7 == reg?2:size;
+
+	ea->kind = EA_MEM;
+	switch (mode) {
+		case 0: ea->kind = EA_DREG; ea->reg = reg; return 0;
+		case 1: ea->kind = EA_AREG; ea->reg = reg; return 0;
+		case 2: ea->addr = d.ar[reg]; t = 4; break;
+		case 3: ea->addr = d.ar[reg]; d.ar[reg] += step; t = 4; break;
+		case 4: d.ar[reg] -= step; ea->addr = d.ar[reg]; t = 6; break;
+		case 5: ea->addr = d.ar[reg] + (int16_t)Fetch16(); t = 8; break;
+		case 6: ea->addr = Index(d.ar[reg]); t = 10; break;
+		default:
+			switch (reg) {
+				case 0: ea->addr = (int16_t)Fetch16(); t = 8; break;
+				case 1: ea->addr = Fetch32(); t = 12; break;
+				case 2: ea->addr = d.pc + (int16_t)Fetch16(); t = 8; break;
+				case 3: ea->addr = Index(d.pc); t = 10; break;
+				case 4:
+					ea->kind = EA_IMM;
+					if (4 == size) ea->addr = Fetch32();
+					else ea->addr = Fetch16() & mask[size];
+					t = 4;
+					break;
+				default: return 1;
+			}
+	}
+	if (timed) d.cycles += t + (4 == size?4:0);
+
+	return 0;
+}
+
+static uint32_t EaRd(const Ea *ea, int size) {
+	switch (ea->kind) {
+		case EA_DREG: return d.dr[ea->reg] & mask[size];
+		case EA_AREG: return d.ar[ea->reg] & mask[size];
+		case EA_MEM: return MemRd(ea->addr, size);
+		default: return ea->addr;
+	}
+}
+
+static void EaWr(const Ea *ea, int size, uint32_t val) {
+	switch (ea->kind) {
+		case EA_DREG:
+			d.dr[ea->reg] = (d.dr[ea->reg] & ~mask[size]) | (val & mask[size]);
+			break;
+		case EA_AREG: d.ar[ea->reg] = val; break;
+		case EA_MEM: MemWr(ea->addr, size, val); break;
+	}
+}
+
+static int Alterable(unsigned mode, unsigned reg) {
+	return mode < 7 || reg < 2;
+}
+
+static uint32_t Add(uint32_t src, uint32_t dst, int size, int x) {
+	uint32_t res = (dst + src + x) & mask[size];
+	uint32_t m = msb[size];
+
+	FlagSet(SR_C | SR_X, ((src & dst) | (~res & (src | dst))) & m);
+	FlagSet(SR_V, (src ^ res) & (dst ^ res) & m);
+	FlagSet(SR_N, res & m);
+	return res;
+}
+
+static uint32_t Sub(uint32_t src, uint32_t dst, int size, int x) {
+	uint32_t res = (dst - src - x) & mask[size];
+	uint32_t m = msb[size];
+
+	FlagSet(SR_C | SR_X, ((src & ~dst) | (res & ~dst) | (src & res)) & m);
+	FlagSet(SR_V, (src ^ dst) & (res ^ dst) & m);
+	FlagSet(SR_N, res & m);
+	return res;
+}
+
+// Operations with Z set from the result (ADD, SUB, NEG)
+static uint32_t AddZ(uint32_t src, uint32_t dst, int size) {
+	uint32_t res = Add(src, dst, size, 0);
+
+	FlagSet(SR_Z, !res);
+	return res;
+}
+
+static uint32_t SubZ(uint32_t src, uint32_t dst, int size) {
+	uint32_t res = Sub(src, dst, size, 0);
+
+	FlagSet(SR_Z, !res);
+	return res;
+}
+
+// Like SubZ, but leaves X untouched
+static void Cmp(uint32_t src, uint32_t dst, int size) {
+	uint16_t x = d.sr & SR_X;
+
+	SubZ(src, dst, size);
+	d.sr = (d.sr & ~SR_X) | x;
+}
+
+// Operations with Z only cleared by nonzero results (ADDX, SUBX, NEGX)
+static uint32_t AddX(uint32_t src, uint32_t dst, int size) {
+	uint32_t res = Add(src, dst, size, !!(d.sr & SR_X));
+
+	if (res) d.sr &= ~SR_Z;
+	return res;
+}
+
+static uint32_t SubX(uint32_t src, uint32_t dst, int size) {
+	uint32_t res = Sub(src, dst, size, !!(d.sr & SR_X));
+
+	if (res) d.sr &= ~SR_Z;
+	return res;
+}
+
+static uint32_t Abcd(uint32_t src, uint32_t dst) {
+	uint32_t res = (src & 0x0F) + (dst & 0x0F) + !!(d.sr & SR_X);
+
+	if (res > 9) res += 6;
+	res += (src & 0xF0) + (dst & 0xF0);
+	FlagSet(SR_C | SR_X, res > 0x99);
+	if (res > 0x99) res -= 0xA0;
+	res &= 0xFF;
+	FlagSet(SR_N, res & 0x80);
+	if (res) d.sr &= ~SR_Z;
+	return res;
+}
+
+static uint32_t Sbcd(uint32_t src, uint32_t dst) {
+	uint32_t res = (dst & 0x0F) - (src & 0x0F) - !!(d.sr & SR_X);
+
+	if (res > 9) res -= 6;
+	res += (dst & 0xF0) - (src & 0xF0);
+	FlagSet(SR_C | SR_X, res > 0x99);
+	if (res > 0x99) res += 0xA0;
+	res &= 0xFF;
+	FlagSet(SR_N, res & 0x80);
+	if (res) d.sr &= ~SR_Z;
+	return res;
+}
+
+// Shifts and rotates. type: 0 AS, 1 LS, 2 ROX, 3 RO
+static uint32_t Shift(unsigned type, int left, uint32_t val, unsigned cnt,
+		int size) {
+	uint32_t m = msb[size];
+	int c = 0, v = 0, x = !!(d.sr & SR_X);
+	unsigned i;
+
+	val &= mask[size];
+	for (i = 0; i < cnt; i++) {
+		uint32_t prev = val;
+
+		if (left) {
+			c = !!(val & m);
+			val = (val<<1) & mask[size];
+			if (2 == type) val |= x;
+			else if (3 == type) val |= c;
+			if ((prev ^ val) & m) v = 1;
+		} else {
+			c = val & 1;
+			val >>= 1;
+			if (0 == type) val |= prev & m;
+			else if (2 == type) val |= x?m:0;
+			else if (3 == type) val |= c?m:0;
+		}
+		if (3 != type) x = c;
+	}
+	if (2 == type && !cnt) c = x;
+	FlagsLogic(val, size);
+	FlagSet(SR_C, c);
+	FlagSet(SR_V, 0 == type && left && v);
+	if (cnt && 3 != type) FlagSet(SR_X, x);
+
+	return val;
+}
+
+// DIVU time (Jorge Cwik, "68000 division timing")
+static uint32_t DivuTime(uint32_t dividend, uint16_t divisor) {
+	uint32_t hdivisor = (uint32_t)divisor<<16;
+	uint32_t mcycles = 38;
+	int i;
+
+	if ((dividend>>16) >= divisor) return 10;
+	for (i = 0; i < 15; i++) {
+		uint32_t temp = dividend;
+
+		dividend <<= 1;
+		if ((int32_t)temp < 0) {
+			dividend -= hdivisor;
+		} else {
+			mcycles += 2;
+			if (dividend >= hdivisor) {
+				dividend -= hdivisor;
+				mcycles--;
+			}
+		}
+	}
+	return mcycles * 2;
+}
+
+// DIVS time (Jorge Cwik, "68000 division timing")
+static uint32_t DivsTime(int32_t dividend, int16_t divisor) {
+	uint32_t adividend = dividend < 0?0U - (uint32_t)dividend:(uint32_t)dividend;
+	uint32_t adivisor = divisor < 0?-divisor:divisor;
+	uint32_t mcycles = 6;
+	uint32_t aquot;
+	int i;
+
+	if (dividend < 0) mcycles++;
+	// Absolute overflow
+	if ((adividend>>16) >= adivisor) return (mcycles + 2) * 2;
+	aquot = adividend / adivisor;
+	mcycles += 55;
+	if (divisor >= 0) {
+		if (dividend >= 0) mcycles--;
+		else mcycles++;
+	}
+	// Count 15 MSBs of the absolute quotient that are zero
+	for (i = 0; i < 15; i++) {
+		if ((int16_t)aquot >= 0) mcycles++;
+		aquot <<= 1;
+	}
+	return mcycles * 2;
+}
+
+// ORI, ANDI and EORI to CCR and SR
+static void OpImmSr(uint16_t op) {
+	uint16_t src = Fetch16();
+	uint16_t sr = d.sr;
+
+	if (op & 0x40) {
+		if (!Privileged()) return;
+	} else {
+		src &= SR_CCR;
+		sr &= SR_CCR;
+	}
+	switch (op & 0x0F00) {
+		case 0x0000: sr |= src; break;
+		case 0x0200: sr &= src; break;
+		default: sr ^= src; break;
+	}
+	if (op & 0x40) SrSet(sr);
+	else d.sr = (d.sr & ~SR_CCR) | sr;
+	d.cycles += 20;
+}
+
+// Group 0: bit operations, MOVEP and immediate operations
+static void Op0(uint16_t op) {
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	int size = 1<<((op>>6) & 3);
+	uint32_t src, dst, res;
+	Ea ea;
+
+	if ((op & 0x0100) && 1 == mode) {
+		// MOVEP
+		uint32_t addr = d.ar[reg] + (int16_t)Fetch16();
+		uint32_t *dn = &d.dr[(op>>9) & 7];
+		int n = op & 0x40?4:2, i;
+
+		if (op & 0x80) {
+			for (i = n - 1; i >= 0; i--, addr += 2) {
+				MemWr(addr, 1, *dn>>(8 * i));
+			}
+		} else {
+			for (res = 0, i = 0; i < n; i++, addr += 2) {
+				res = (res<<8) | MemRd(addr, 1);
+			}
+			*dn = 4 == n?res:(*dn & 0xFFFF0000) | res;
+		}
+		d.cycles += 4 == n?24:16;
+		return;
+	}
+	if ((op & 0x0100) || 0x0800 == (op & 0x0F00)) {
+		// BTST, BCHG, BCLR, BSET
+		unsigned type = (op>>6) & 3;
+		int stat = !(op & 0x0100);
+		uint32_t bit;
+
+		bit = stat?Fetch16() & 0xFF:d.dr[(op>>9) & 7];
+		if (EaGet(&ea, mode, reg, 1, 1) || 1 == mode ||
+				(type && !Alterable(mode, reg))) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		if (EA_DREG == ea.kind) {
+			bit &= 31;
+			dst = d.dr[reg];
+			if (0 == type) d.cycles += 6;
+			else d.cycles += (2 == type?8:6) + (bit >= 16?2:0);
+			if (stat) d.cycles += 4;
+		} else {
+			bit &= 7;
+			dst = EaRd(&ea, 1);
+			d.cycles += (0 == type?4:8) + (stat?4:0);
+		}
+		FlagSet(SR_Z, !(dst & (1U<<bit)));
+		switch (type) {
+			case 1: dst ^= 1U<<bit; break;
+			case 2: dst &= ~(1U<<bit); break;
+			case 3: dst |= 1U<<bit; break;
+			default: return;
+		}
+		if (EA_DREG == ea.kind) d.dr[reg] = dst;
+		else EaWr(&ea, 1, dst);
+		return;
+	}
+	switch (op) {
+		case 0x003C: case 0x007C:	// ORI to CCR, SR
+		case 0x023C: case 0x027C:	// ANDI to CCR, SR
+		case 0x0A3C: case 0x0A7C:	// EORI to CCR, SR
+			OpImmSr(op);
+			return;
+	}
+	if (8 == size || 1 == mode || 0x0E00 == (op & 0x0E00) ||
+			!Alterable(mode, reg)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	src = 4 == size?Fetch32():Fetch16() & mask[size];
+	EaGet(&ea, mode, reg, size, 1);
+	dst = EaRd(&ea, size);
+	if (0x0C00 == (op & 0x0F00)) {
+		// CMPI
+		Cmp(src, dst, size);
+		if (EA_DREG == ea.kind) d.cycles += 4 == size?14:8;
+		else d.cycles += 4 == size?12:8;
+		return;
+	}
+	switch (op & 0x0F00) {
+		case 0x0000: res = src | dst; FlagsLogic(res, size); break;
+		case 0x0200: res = src & dst; FlagsLogic(res, size); break;
+		case 0x0400: res = SubZ(src, dst, size); break;
+		case 0x0600: res = AddZ(src, dst, size); break;
+		default:     res = src ^ dst; FlagsLogic(res, size); break;
+	}
+	EaWr(&ea, size, res);
+	if (EA_DREG == ea.kind) {
+		d.cycles += 4 != size?8:(0x0200 == (op & 0x0F00)?14:16);
+	} else {
+		d.cycles += 4 == size?20:12;
+	}
+}
+
+// Groups 1 to 3: MOVE and MOVEA
+static void OpMove(uint16_t op) {
+	static const int sizes[4] = {0, 1, 4, 2};
+	int size = sizes[(op>>12) & 3];
+	unsigned dmode = (op>>6) & 7, dreg = (op>>9) & 7;
+	uint32_t val;
+	Ea src, dst;
+
+	if (EaGet(&src, (op>>3) & 7, op & 7, size, 1) ||
+			(1 == size && EA_AREG == src.kind)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	val = EaRd(&src, size);
+	if (1 == dmode) {
+		if (1 == size) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		d.ar[dreg] = Sext(val, size);
+		d.cycles += 4;
+		return;
+	}
+	if (!Alterable(dmode, dreg) || EaGet(&dst, dmode, dreg, size, 1)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	FlagsLogic(val, size);
+	EaWr(&dst, size, val);
+	// -(An) destinations do not take the predecrement time
+	d.cycles += 4 == dmode?2:4;
+}
+
+// MOVEM
+static void OpMovem(uint16_t op) {
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	int size = op & 0x40?4:2;
+	uint16_t list = Fetch16();
+	int idx = CtrlIdx(mode, reg);
+	uint32_t addr;
+	int i, n = 0;
+	Ea ea;
+
+	if (op & 0x0400) {
+		// Memory to registers
+		if (3 == mode) idx = 0;
+		if (idx < 0) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		if (3 == mode) addr = d.ar[reg];
+		else {
+			EaGet(&ea, mode, reg, size, 0);
+			addr = ea.addr;
+		}
+		for (i = 0; i < 16; i++) {
+			if (!(list & (1<<i))) continue;
+			if (i < 8) d.dr[i] = Sext(MemRd(addr, size), size);
+			else d.ar[i - 8] = Sext(MemRd(addr, size), size);
+			addr += size;
+			n++;
+		}
+		if (3 == mode) d.ar[reg] = addr;
+		d.cycles += movemRdTime[idx];
+	} else {
+		// Registers to memory
+		if (4 == mode) {
+			// Registers are stored before updating An
+			addr = d.ar[reg];
+			for (i = 0; i < 16; i++) {
+				if (!(list & (1<<i))) continue;
+				addr -= size;
+				MemWr(addr, size, i < 8?d.ar[7 - i]:d.dr[15 - i]);
+				n++;
+			}
+			d.ar[reg] = addr;
+			idx = 0;
+		} else {
+			if (idx < 0 || idx > 4) {
+				ExceptionIpc(VEC_ILLEGAL);
+				return;
+			}
+			EaGet(&ea, mode, reg, size, 0);
+			addr = ea.addr;
+			for (i = 0; i < 16; i++) {
+				if (!(list & (1<<i))) continue;
+				MemWr(addr, size, i < 8?d.dr[i]:d.ar[i - 8]);
+				addr += size;
+				n++;
+			}
+		}
+		d.cycles += movemWrTime[idx];
+	}
+	d.cycles += n * (4 == size?8:4);
+}
+
+// Group 4: miscellaneous
+static void Op4(uint16_t op) {
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	unsigned sbits = (op>>6) & 3;
+	int size = 1<<sbits;
+	int idx = CtrlIdx(mode, reg);
+	unsigned sub;
+	uint32_t val;
+	Ea ea;
+
+	if (0x4AFC == op) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	if (0x41C0 == (op & 0xF1C0)) {
+		// LEA
+		if (idx < 0) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		EaGet(&ea, mode, reg, 4, 0);
+		d.ar[(op>>9) & 7] = ea.addr;
+		d.cycles += leaTime[idx];
+		return;
+	}
+	if (0x4180 == (op & 0xF1C0)) {
+		// CHK
+		int16_t bound, dn = d.dr[(op>>9) & 7];
+
+		if (EaGet(&ea, mode, reg, 2, 1) || EA_AREG == ea.kind) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		bound = EaRd(&ea, 2);
+		if (dn < 0 || dn > bound) {
+			FlagSet(SR_N, dn < 0);
+			Exception(VEC_CHK, EXC_CHK_CYCLES);
+		} else {
+			d.cycles += 10;
+		}
+		return;
+	}
+	if (0x4E40 == (op & 0xFFF0)) {
+		Exception(VEC_TRAP + (op & 15), EXC_CYCLES);
+		return;
+	}
+	if (0x4E50 == (op & 0xFFF8)) {
+		// LINK
+		int16_t disp = Fetch16();
+
+		Push32(d.ar[reg]);
+		d.ar[reg] = d.ar[7];
+		d.ar[7] += disp;
+		d.cycles += 16;
+		return;
+	}
+	if (0x4E58 == (op & 0xFFF8)) {
+		// UNLK
+		d.ar[7] = d.ar[reg];
+		d.ar[reg] = Pop32();
+		d.cycles += 12;
+		return;
+	}
+	if (0x4E60 == (op & 0xFFF0)) {
+		// MOVE USP
+		if (!Privileged()) return;
+		if (op & 8) d.ar[reg] = d.osp;
+		else d.osp = d.ar[reg];
+		d.cycles += 4;
+		return;
+	}
+	switch (op) {
+		case 0x4E70:	// RESET
+			if (Privileged()) d.cycles += 132;
+			return;
+
+		case 0x4E71:	// NOP
+			d.cycles += 4;
+			return;
+
+		case 0x4E72:	// STOP
+			val = Fetch16();
+			if (!Privileged()) return;
+			SrSet(val);
+			d.stopped = 1;
+			d.cycles += 4;
+			return;
+
+		case 0x4E73:	// RTE
+			if (!Privileged()) return;
+			val = Pop16();
+			d.pc = Pop32();
+			SrSet(val);
+			d.cycles += 20;
+			return;
+
+		case 0x4E75:	// RTS
+			d.pc = Pop32();
+			d.cycles += 16;
+			return;
+
+		case 0x4E76:	// TRAPV
+			if (d.sr & SR_V) Exception(VEC_TRAPV, EXC_CYCLES);
+			else d.cycles += 4;
+			return;
+
+		case 0x4E77:	// RTR
+			d.sr = (d.sr & ~SR_CCR) | (Pop16() & SR_CCR);
+			d.pc = Pop32();
+			d.cycles += 20;
+			return;
+	}
+	if (0x4E80 == (op & 0xFF80)) {
+		// JSR, JMP
+		if (idx < 0) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		EaGet(&ea, mode, reg, 4, 0);
+		if (!(op & 0x40)) {
+			Push32(d.pc);
+			d.cycles += jsrTime[idx];
+		} else {
+			d.cycles += jmpTime[idx];
+		}
+		d.pc = ea.addr;
+		return;
+	}
+	if (0x4880 == (op & 0xFFB8)) {
+		// EXT
+		if (op & 0x40) {
+			d.dr[reg] = (int16_t)d.dr[reg];
+			FlagsLogic(d.dr[reg], 4);
+		} else {
+			d.dr[reg] = (d.dr[reg] & 0xFFFF0000) |
+				((int8_t)d.dr[reg] & 0xFFFF);
+			FlagsLogic(d.dr[reg], 2);
+		}
+		d.cycles += 4;
+		return;
+	}
+	if (0x4880 == (op & 0xFB80)) {
+		OpMovem(op);
+		return;
+	}
+	if (0x4840 == (op & 0xFFC0)) {
+		// SWAP, PEA
+		if (0 == mode) {
+			d.dr[reg] = (d.dr[reg]>>16) | (d.dr[reg]<<16);
+			FlagsLogic(d.dr[reg], 4);
+			d.cycles += 4;
+		} else if (idx < 0) {
+			ExceptionIpc(VEC_ILLEGAL);
+		} else {
+			EaGet(&ea, mode, reg, 4, 0);
+			Push32(ea.addr);
+			d.cycles += peaTime[idx];
+		}
+		return;
+	}
+	// Single operand instructions: bits 11-9 select the operation
+	sub = (op>>9) & 7;
+	if ((op & 0x0100) || sub > 5 || 1 == mode || (1 == sub && 3 == sbits) ||
+			(4 == sub && sbits)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	if (3 == sbits && 2 == (sub & 6)) {
+		// MOVE to CCR, MOVE to SR
+		if (3 == sub && !Privileged()) return;
+		if (EaGet(&ea, mode, reg, 2, 1)) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		val = EaRd(&ea, 2);
+		if (3 == sub) SrSet(val);
+		else d.sr = (d.sr & ~SR_CCR) | (val & SR_CCR);
+		d.cycles += 12;
+		return;
+	}
+	if (!Alterable(mode, reg)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	if (3 == sbits || 4 == sub) {
+		EaGet(&ea, mode, reg, 3 == sbits && !sub?2:1, 1);
+		switch (sub) {
+			case 0:	// MOVE from SR
+				EaWr(&ea, 2, d.sr);
+				d.cycles += EA_DREG == ea.kind?6:8;
+				break;
+
+			case 4:	// NBCD
+				EaWr(&ea, 1, Sbcd(EaRd(&ea, 1), 0));
+				d.cycles += EA_DREG == ea.kind?6:8;
+				break;
+
+			default:	// TAS
+				val = EaRd(&ea, 1);
+				FlagsLogic(val, 1);
+				EaWr(&ea, 1, val | 0x80);
+				d.cycles += EA_DREG == ea.kind?4:10;
+				break;
+		}
+		return;
+	}
+	// NEGX, CLR, NEG, NOT, TST
+	EaGet(&ea, mode, reg, size, 1);
+	val = EaRd(&ea, size);
+	switch (sub) {
+		case 0: val = SubX(val, 0, size); break;
+		case 1: val = 0; FlagsLogic(0, size); break;
+		case 2: val = SubZ(val, 0, size); break;
+		case 3: val = ~val; FlagsLogic(val, size); break;
+		default:
+			FlagsLogic(val, size);
+			d.cycles += 4;
+			return;
+	}
+	EaWr(&ea, size, val);
+	if (EA_DREG == ea.kind) d.cycles += 4 == size?6:4;
+	else d.cycles += 4 == size?12:8;
+}
+
+// Group 5: ADDQ, SUBQ, Scc, DBcc
+static void Op5(uint16_t op) {
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	unsigned sbits = (op>>6) & 3;
+	int size = 1<<sbits;
+	uint32_t val;
+	Ea ea;
+
+	if (3 == sbits) {
+		int cc = Cond((op>>8) & 15);
+
+		if (1 == mode) {
+			// DBcc
+			int16_t disp = Fetch16();
+
+			if (cc) {
+				d.cycles += 12;
+			} else {
+				uint16_t cnt = d.dr[reg] - 1;
+
+				d.dr[reg] = (d.dr[reg] & 0xFFFF0000) | cnt;
+				if (0xFFFF == cnt) {
+					d.cycles += 14;
+				} else {
+					d.pc = d.ipc + 2 + disp;
+					d.cycles += 10;
+				}
+			}
+			return;
+		}
+		// Scc
+		if (!Alterable(mode, reg)) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		EaGet(&ea, mode, reg, 1, 1);
+		EaWr(&ea, 1, cc?0xFF:0);
+		if (EA_DREG == ea.kind) d.cycles += cc?6:4;
+		else d.cycles += 8;
+		return;
+	}
+	// ADDQ, SUBQ
+	val = (op>>9) & 7;
+	if (!val) val = 8;
+	if (!Alterable(mode, reg) || (1 == mode && 1 == size)) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	if (1 == mode) {
+		d.ar[reg] += op & 0x0100?-val:val;
+		d.cycles += 8;
+		return;
+	}
+	EaGet(&ea, mode, reg, size, 1);
+	if (op & 0x0100) EaWr(&ea, size, SubZ(val, EaRd(&ea, size), size));
+	else EaWr(&ea, size, AddZ(val, EaRd(&ea, size), size));
+	if (EA_DREG == ea.kind) d.cycles += 4 == size?8:4;
+	else d.cycles += 4 == size?12:8;
+}
+
+// Group 6: Bcc, BRA, BSR
+static void Op6(uint16_t op) {
+	unsigned cc = (op>>8) & 15;
+	int32_t disp = (int8_t)op;
+	int word = !disp;
+
+	if (word) disp = (int16_t)Fetch16();
+	if (1 == cc) {
+		Push32(d.pc);
+		d.pc = d.ipc + 2 + disp;
+		d.cycles += 18;
+	} else if (Cond(cc)) {
+		d.pc = d.ipc + 2 + disp;
+		d.cycles += 10;
+	} else {
+		d.cycles += word?12:8;
+	}
+}
+
+// ADDX, SUBX, ABCD, SBCD
+static void OpX(uint16_t op, int size) {
+	unsigned rx = (op>>9) & 7, ry = op & 7;
+	uint32_t src, dst, res;
+	unsigned grp = op>>12;
+
+	if (op & 8) {
+		Ea es, ed;
+
+		EaGet(&es, 4, ry, size, 0);
+		src = MemRd(es.addr, size);
+		EaGet(&ed, 4, rx, size, 0);
+		dst = MemRd(ed.addr, size);
+		switch (grp) {
+			case 0x8: res = Sbcd(src, dst); break;
+			case 0x9: res = SubX(src, dst, size); break;
+			case 0xC: res = Abcd(src, dst); break;
+			default: res = AddX(src, dst, size); break;
+		}
+		MemWr(ed.addr, size, res);
+		d.cycles += 4 == size?30:18;
+	} else {
+		src = d.dr[ry] & mask[size];
+		dst = d.dr[rx] & mask[size];
+		switch (grp) {
+			case 0x8: res = Sbcd(src, dst); break;
+			case 0x9: res = SubX(src, dst, size); break;
+			case 0xC: res = Abcd(src, dst); break;
+			default: res = AddX(src, dst, size); break;
+		}
+		d.dr[rx] = (d.dr[rx] & ~mask[size]) | res;
+		d.cycles += 0x8 == grp || 0xC == grp?6:(4 == size?8:4);
+	}
+}
+
+// Groups 8, 9, B, C, D: OR, SUB, CMP, EOR, AND, ADD and related
+static void OpArith(uint16_t op) {
+	unsigned grp = op>>12;
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	unsigned dn = (op>>9) & 7;
+	unsigned opmode = (op>>6) & 7;
+	int size = 1<<(opmode & 3);
+	uint32_t src, dst, res;
+	Ea ea;
+
+	if (3 == (opmode & 3)) {
+		if (0x8 == grp || 0xC == grp) {
+			// DIVU, DIVS, MULU, MULS
+			if (EaGet(&ea, mode, reg, 2, 1) || EA_AREG == ea.kind) {
+				ExceptionIpc(VEC_ILLEGAL);
+				return;
+			}
+			src = EaRd(&ea, 2);
+			dst = d.dr[dn];
+			if (0xC == grp) {
+				if (opmode & 4) {
+					res = (int16_t)src * (int16_t)dst;
+					d.cycles += 38 + 2 * BitsSet((src ^ (src<<1)) & 0xFFFF);
+				} else {
+					res = (src & 0xFFFF) * (dst & 0xFFFF);
+					d.cycles += 38 + 2 * BitsSet(src);
+				}
+				d.dr[dn] = res;
+				FlagsLogic(res, 4);
+				return;
+			}
+			if (!src) {
+				Exception(VEC_DIV0, EXC_DIV0_CYCLES);
+				return;
+			}
+			if (opmode & 4) {
+				int64_t quot = (int64_t)(int32_t)dst / (int16_t)src;
+				int64_t rem = (int64_t)(int32_t)dst % (int16_t)src;
+
+				d.cycles += DivsTime(dst, src);
+				if (quot < -32768 || quot > 32767) {
+					d.sr |= SR_V | SR_N;
+					d.sr &= ~SR_C;
+					return;
+				}
+				d.dr[dn] = ((uint32_t)rem<<16) | (quot & 0xFFFF);
+			} else {
+				uint32_t quot = dst / src;
+
+				d.cycles += DivuTime(dst, src);
+				if (quot > 0xFFFF) {
+					d.sr |= SR_V | SR_N;
+					d.sr &= ~SR_C;
+					return;
+				}
+				d.dr[dn] = ((dst % src)<<16) | quot;
+			}
+			FlagsLogic(d.dr[dn], 2);
+			return;
+		}
+		// SUBA, CMPA, ADDA
+		size = opmode & 4?4:2;
+		if (EaGet(&ea, mode, reg, size, 1)) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		src = Sext(EaRd(&ea, size), size);
+		if (0xB == grp) {
+			Cmp(src, d.ar[dn], 4);
+			d.cycles += 6;
+			return;
+		}
+		if (0x9 == grp) d.ar[dn] -= src;
+		else d.ar[dn] += src;
+		if (4 == size && ea.kind != EA_MEM) d.cycles += 8;
+		else d.cycles += 4 == size?6:8;
+		return;
+	}
+	if (opmode & 4) {
+		// Dn,<ea> forms and the register/predecrement instructions
+		if (mode < 2) {
+			if (0xB == grp) {
+				if (1 == mode) {
+					// CMPM
+					Ea es, ed;
+
+					EaGet(&es, 3, reg, size, 0);
+					src = MemRd(es.addr, size);
+					EaGet(&ed, 3, dn, size, 0);
+					Cmp(src, MemRd(ed.addr, size), size);
+					d.cycles += 4 == size?20:12;
+					return;
+				}
+			} else if (0xC == grp && size > 1) {
+				// EXG
+				uint32_t *rx, *ry, tmp;
+
+				if (2 == size && 0 == mode) {
+					rx = &d.dr[dn]; ry = &d.dr[reg];
+				} else if (2 == size) {
+					rx = &d.ar[dn]; ry = &d.ar[reg];
+				} else if (1 == mode) {
+					rx = &d.dr[dn]; ry = &d.ar[reg];
+				} else {
+					ExceptionIpc(VEC_ILLEGAL);
+					return;
+				}
+				tmp = *rx;
+				*rx = *ry;
+				*ry = tmp;
+				d.cycles += 6;
+				return;
+			} else if ((0x8 != grp && 0xC != grp) || 1 == size) {
+				OpX(op, size);
+				return;
+			} else {
+				ExceptionIpc(VEC_ILLEGAL);
+				return;
+			}
+		}
+		if (!Alterable(mode, reg) || EaGet(&ea, mode, reg, size, 1)) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		src = d.dr[dn] & mask[size];
+		dst = EaRd(&ea, size);
+		switch (grp) {
+			case 0x8: res = src | dst; FlagsLogic(res, size); break;
+			case 0x9: res = SubZ(src, dst, size); break;
+			case 0xB: res = src ^ dst; FlagsLogic(res, size); break;
+			case 0xC: res = src & dst; FlagsLogic(res, size); break;
+			default: res = AddZ(src, dst, size); break;
+		}
+		EaWr(&ea, size, res);
+		if (EA_DREG == ea.kind) d.cycles += 4 == size?8:4;
+		else d.cycles += 4 == size?12:8;
+		return;
+	}
+	// <ea>,Dn forms
+	if (EaGet(&ea, mode, reg, size, 1) || (EA_AREG == ea.kind &&
+				(1 == size || 0x8 == grp || 0xC == grp))) {
+		ExceptionIpc(VEC_ILLEGAL);
+		return;
+	}
+	src = EaRd(&ea, size);
+	dst = d.dr[dn] & mask[size];
+	switch (grp) {
+		case 0x8: res = src | dst; FlagsLogic(res, size); break;
+		case 0x9: res = SubZ(src, dst, size); break;
+		case 0xB: Cmp(src, dst, size); res = dst; break;
+		case 0xC: res = src & dst; FlagsLogic(res, size); break;
+		default: res = AddZ(src, dst, size); break;
+	}
+	d.dr[dn] = (d.dr[dn] & ~mask[size]) | res;
+	if (4 != size) d.cycles += 4;
+	else if (0xB == grp) d.cycles += 6;
+	else d.cycles += EA_MEM == ea.kind?6:8;
+}
+
+// Group E: shifts and rotates
+static void OpE(uint16_t op) {
+	unsigned mode = (op>>3) & 7, reg = op & 7;
+	int left = !!(op & 0x0100);
+	uint32_t cnt;
+	int size;
+	Ea ea;
+
+	if (0x00C0 == (op & 0x00C0)) {
+		// Memory, one bit
+		if (mode < 2 || !Alterable(mode, reg) || (op & 0x0800)) {
+			ExceptionIpc(VEC_ILLEGAL);
+			return;
+		}
+		EaGet(&ea, mode, reg, 2, 1);
+		EaWr(&ea, 2, Shift((op>>9) & 3, left, EaRd(&ea, 2), 1, 2));
+		d.cycles += 8;
+		return;
+	}
+	size = 1<<((op>>6) & 3);
+	cnt = (op>>9) & 7;
+	if (op & 0x20) cnt = d.dr[cnt] & 63;
+	else if (!cnt) cnt = 8;
+	d.dr[reg] = (d.dr[reg] & ~mask[size]) |
+		Shift((op>>3) & 3, left, d.dr[reg], cnt, size);
+	d.cycles += (4 == size?8:6) + 2 * cnt;
+}
+
+static void Step(void) {
+	uint16_t op;
+
+	d.ipc = d.pc;
+	op = d.ir = Fetch16();
+	switch (op>>12) {
+		case 0x0: Op0(op); break;
+		case 0x1:
+		case 0x2:
+		case 0x3: OpMove(op); break;
+		case 0x4: Op4(op); break;
+		case 0x5: Op5(op); break;
+		case 0x6: Op6(op); break;
+		case 0x7:
+			if (op & 0x0100) {
+				ExceptionIpc(VEC_ILLEGAL);
+				break;
+			}
+			d.dr[(op>>9) & 7] = (int8_t)op;
+			FlagsLogic((int8_t)op, 4);
+			d.cycles += 4;
+			break;
+		case 0xA: ExceptionIpc(VEC_LINEA); break;
+		case 0xE: OpE(op); break;
+		case 0xF: ExceptionIpc(VEC_LINEF); break;
+		default: OpArith(op); break;
+	}
+}
+
+// Address error exception processing, with the group 0 stack frame
+static void AddrErrTake(void) {
+	uint16_t sr = d.sr;
+
+	if (d.inExc) {
+		// Double fault: the CPU halts
+		d.stopped = 1;
+		d.end = 1;
+		return;
+	}
+	d.inExc = 1;
+	SrSet((d.sr | SR_S) & ~0x8000);
+	Push32(d.pc);
+	Push16(sr);
+	Push16(d.ir);
+	Push32(d.faultAddr);
+	Push16((d.faultRd?0x10:0) | (d.sr & SR_S?5:1));
+	d.pc = MemRd(VEC_ADDR * 4, 4);
+	d.cycles += EXC_ADDR_CYCLES;
+	d.inExc = 0;
+}
+
+void M68kSimReset(void) {
+	memset(d.dr, 0, sizeof(d.dr));
+	memset(d.ar, 0, sizeof(d.ar));
+	d.osp = 0;
+	d.sr = 0x2700;
+	d.stopped = 0;
+	d.inExc = 0;
+	d.cycles = 0;
+	d.ar[7] = MemRd(0, 4);
+	d.pc = MemRd(4, 4);
+}
+
+uint32_t M68kSimRun(uint32_t cycles) {
+	d.cycles = 0;
+	d.end = 0;
+	if (setjmp(d.fault)) AddrErrTake();
+	while (!d.end && !d.stopped && d.cycles < cycles) Step();
+	// A stopped CPU idles until the end of the run
+	if (d.stopped && d.cycles < cycles) d.cycles = cycles;
+
+	return d.cycles;
+}
+
+uint32_t M68kSimCyclesRun(void) {
+	return d.cycles;
+}
+
+void M68kSimEnd(void) {
+	d.end = 1;
+}
+
+int M68kSimStopped(void) {
+	return d.stopped;
+}
+
+uint32_t M68kSimPcGet(void) {
+	return d.pc;
+}
+
+uint32_t M68kSimRegGet(uint8_t reg) {
+	return reg < 8?d.dr[reg]:d.ar[reg & 7];
+}
+
+void M68kSimRegSet(uint8_t reg, uint32_t val) {
+	if (reg < 8) d.dr[reg] = val;
+	else d.ar[reg & 7] = val;
+}
+
+void M68kSimPcSet(uint32_t pc) {
+	d.pc = pc;
+	d.stopped = 0;
+}
+
+uint16_t M68kSimSrGet(void) {
+	return d.sr;
+}
+
+void M68kSimSrSet(uint16_t sr) {
+	SrSet(sr);
+}
+
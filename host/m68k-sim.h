@@ -0,0 +1,156 @@
+/************************************************************************//**
+ * \brief 68000 CPU core for host builds, used by the cycle counted benchmark
+ *        (host/m68k-bench). Interprets the whole 68000 instruction set,
+ *        accounting the clock periods of each instruction as listed in the
+ *        instruction execution times section of the M68000 user's manual,
+ *        including the data dependent times of MULU, MULS, DIVU and DIVS.
+ *
+ * All accesses go through the memory callbacks below, that the program
+ * using the core must define. Word and long word accesses are split in 16
+ * bit accesses, as done by the 68000 bus. Instruction prefetch is not
+ * modelled: the manual times already include it.
+ *
+ * Exceptions are processed through the vector table (address errors,
+ * illegal and unimplemented instructions, privilege violations, TRAP,
+ * TRAPV, CHK and division by zero). Interrupts, tracing and bus errors are
+ * not emulated.
+ *
+ * \defgroup m68k-sim 68000 CPU core
+ * \{
+ ****************************************************************************/
+
+#ifndef _M68K_SIM_H_
+#define _M68K_SIM_H_
+
+#include <stdint.h>
+
+/// Clock periods taken by the reset sequence.
+#define M68K_SIM_RESET_CYCLES	40
+
+/************************************************************************//**
+ * \brief Reads a byte. Defined by the program using the core.
+ *
+ * \param[in] addr Address (24 bits).
+ *
+ * \return Byte read.
+ ****************************************************************************/
+uint8_t M68kSimRd8(uint32_t addr);
+
+/************************************************************************//**
+ * \brief Reads a word. Defined by the program using the core.
+ *
+ * \param[in] addr Address (24 bits, even).
+ *
+ * \return Word read.
+ ****************************************************************************/
+uint16_t M68kSimRd16(uint32_t addr);
+
+/************************************************************************//**
+ * \brief Writes a byte. Defined by the program using the core.
+ *
+ * \param[in] addr Address (24 bits).
+ * \param[in] val  Byte to write.
+ ****************************************************************************/
+void M68kSimWr8(uint32_t addr, uint8_t val);
+
+/************************************************************************//**
+ * \brief Writes a word. Defined by the program using the core.
+ *
+ * \param[in] addr Address (24 bits, even).
+ * \param[in] val  Word to write.
+ ****************************************************************************/
+void M68kSimWr16(uint32_t addr, uint16_t val);
+
+/************************************************************************//**
+ * \brief Resets the CPU: enters supervisor mode with interrupts masked, and
+ *        loads the stack pointer and program counter from the first two
+ *        vectors.
+ ****************************************************************************/
+void M68kSimReset(void);
+
+/************************************************************************//**
+ * \brief Runs instructions until the requested clock periods have elapsed,
+ *        M68kSimEnd() is called, or the CPU executes STOP (that ends the
+ *        run as there are no interrupts to resume it).
+ *
+ * \param[in] cycles Clock periods to run.
+ *
+ * \return Clock periods run. The last instruction might end past the
+ *         requested periods.
+ ****************************************************************************/
+uint32_t M68kSimRun(uint32_t cycles);
+
+/************************************************************************//**
+ * \brief Returns the clock periods elapsed in the current M68kSimRun()
+ *        call. Accurate to the instruction accessing memory when called
+ *        from the memory callbacks.
+ *
+ * \return Clock periods elapsed.
+ ****************************************************************************/
+uint32_t M68kSimCyclesRun(void);
+
+/************************************************************************//**
+ * \brief Ends the current M68kSimRun() call after the instruction being
+ *        executed. Use it from the memory callbacks.
+ ****************************************************************************/
+void M68kSimEnd(void);
+
+/************************************************************************//**
+ * \brief Checks if the CPU has stopped: it executed STOP, or it halted on
+ *        an address error while processing another one.
+ *
+ * \return Nonzero if the CPU has stopped.
+ ****************************************************************************/
+int M68kSimStopped(void);
+
+/************************************************************************//**
+ * \brief Obtains the program counter.
+ *
+ * \return Address of the next instruction to execute.
+ ****************************************************************************/
+uint32_t M68kSimPcGet(void);
+
+/************************************************************************//**
+ * \brief Obtains a data or address register.
+ *
+ * \param[in] reg Register number: 0 to 7 for D0 to D7, 8 to 15 for A0 to
+ *            A7 (the active stack pointer).
+ *
+ * \return Register value.
+ ****************************************************************************/
+uint32_t M68kSimRegGet(uint8_t reg);
+
+/************************************************************************//**
+ * \brief Sets a data or address register.
+ *
+ * \param[in] reg Register number, as in M68kSimRegGet().
+ * \param[in] val Value to set.
+ ****************************************************************************/
+void M68kSimRegSet(uint8_t reg, uint32_t val);
+
+/************************************************************************//**
+ * \brief Sets the program counter, resuming the CPU if it was stopped.
+ *
+ * \param[in] pc Address of the next instruction to execute.
+ ****************************************************************************/
+void M68kSimPcSet(uint32_t pc);
+
+/************************************************************************//**
+ * \brief Obtains the status register.
+ *
+ * \return Status register value.
+ ****************************************************************************/
+uint16_t M68kSimSrGet(void);
+
+/************************************************************************//**
+ * \brief Sets the status register. Changing the S bit swaps the active
+ *        stack pointer, as done by the CPU.
+ *
+ * \param[in] sr Value to set. Unimplemented bits are ignored.
+ ****************************************************************************/
+void M68kSimSrSet(uint16_t sr);
+
+#endif /*_M68K_SIM_H_*/
+
+/** \} */
+
@@ -0,0 +1,595 @@
+/************************************************************************//**
+ * \brief Instruction tests for the 68000 core (host/m68k-sim.c). Runs each
+ *        test code on the core, and checks the clock periods taken by its
+ *        first instruction against the instruction execution times section
+ *        of the M68000 user's manual, and the results against the
+ *        instruction descriptions of the M68000 programmer's reference
+ *        manual.
+ *
+ * Test code is loaded at M68K_TEST_CODE and runs until its end, or until
+ * the CPU stops. All the exception vectors point to a handler that sets D6
+ * to -1 and stops. Memory at M68K_TEST_DATA holds the m68kTestData bytes,
+ * A7 starts at M68K_TEST_STACK and the other registers at zero, unless set
+ * by the test.
+ *
+ * DIVU and DIVS times are the ones given by Jorge Cwik's "68000 division
+ * timing", as the manual only lists the worst case.
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "m68k-sim.h"
+
+/// Memory length, covering the vectors, code, data and stack.
+#define M68K_TEST_MEM_LEN	0x8000
+/// Exception handler address.
+#define M68K_TEST_EXC		0x300
+/// Test code address.
+#define M68K_TEST_CODE		0x400
+/// Test data address.
+#define M68K_TEST_DATA		0x2000
+/// Initial stack pointer.
+#define M68K_TEST_STACK		0x8000
+/// Instructions run by a test before it is considered hung.
+#define M68K_TEST_STEPS		16
+
+/// Condition code bits
+enum {
+	C = 0x01, V = 0x02, Z = 0x04, N = 0x08, X = 0x10
+};
+
+/** \addtogroup m68k-test M68kTestLoc Locations set and checked by tests.
+ *  \{ */
+typedef enum {
+	NONE = 0,		///< Unused entry
+	D0, D1, D2, D3, D4, D5, D6, D7,
+	A0, A1, A2, A3, A4, A5, A6, A7,
+	CCR,			///< Condition codes
+	M0,				///< Long word at M68K_TEST_DATA
+	M4				///< Long word at M68K_TEST_DATA + 4
+} M68kTestLoc;
+/** \} */
+
+/// Value of a location
+typedef struct {
+	uint8_t loc;		///< Location (M68kTestLoc)
+	uint32_t val;		///< Value
+} M68kTestVal;
+
+/// Instruction test
+typedef struct {
+	const char *src;		///< Test code, the first instruction is timed
+	uint8_t words;			///< Machine code length in words
+	uint16_t code[6];		///< Machine code
+	uint16_t cycles;		///< Clock periods of the first instruction, 0
+							///< to skip the check
+	M68kTestVal set[4];		///< Initial values
+	M68kTestVal chk[4];		///< Expected results
+} M68kTest;
+
+/// Data at M68K_TEST_DATA when each test starts
+static const uint8_t m68kTestData[] = {
+	0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08
+};
+
+/// Exception handler: moveq #-1,%d6; stop #0x2700
+static const uint16_t m68kTestExc[] = {0x7CFF, 0x4E72, 0x2700};
+
+static const M68kTest m68kTest[] = {
+	{"moveq #5,%d0", 1, {0x7005}, 4,
+		{},
+		{{D0, 5}, {CCR, 0}}},
+	{"moveq #-1,%d0", 1, {0x70FF}, 4,
+		{},
+		{{D0, 0xFFFFFFFF}, {CCR, N}}},
+	{"move.l %d0,%d1", 1, {0x2200}, 4,
+		{{D0, 3}},
+		{{D1, 3}}},
+	{"move.w (%a0),%d0", 1, {0x3010}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{D0, 0x1234}}},
+	{"move.l (%a0),%d0", 1, {0x2010}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{D0, 0x12345678}}},
+	{"move.l %d0,(%a0)", 1, {0x2080}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{M0, 0x00000001}}},
+	{"move.l %d0,-(%a1)", 1, {0x2300}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{A1, 0x2004}, {M0, 0x12345678}, {M4, 0x00000001}}},
+	{"move.w %d0,-(%a1)", 1, {0x3300}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{A1, 0x2006}}},
+	{"move.b (%a0)+,(%a1)", 1, {0x1298}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A0, 0x2001}, {M0, 0x12345678}}},
+	{"move.l 4(%a0),8(%a1)", 3, {0x2368, 0x0004, 0x0008}, 28,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{}},
+	{"move.l 0x2000,%d0", 2, {0x2038, 0x2000}, 16,
+		{},
+		{{D0, 0x12345678}}},
+	{"move.l 0x2000.l,%d0", 3, {0x2039, 0x0000, 0x2000}, 20,
+		{},
+		{{D0, 0x12345678}}},
+	{"move.w #1,%d0", 2, {0x303C, 0x0001}, 8,
+		{},
+		{{D0, 1}}},
+	{"move.l #0x80000000,%d0", 3, {0x203C, 0x8000, 0x0000}, 12,
+		{},
+		{{CCR, N}}},
+	{"move.l (0,%a0,%d1.w),%d0", 2, {0x2030, 0x1000}, 18,
+		{{A0, 0x2000}, {A1, 0x2008}, {D1, 2}},
+		{{D0, 0x56789ABC}}},
+	{"move.b (5,%a0,%d1.l),%d0", 2, {0x1030, 0x1805}, 14,
+		{{A0, 0x2000}, {A1, 0x2008}, {D1, 0xFFFFFFFE}, {CCR, N}},
+		{{D0, 0x78}}},
+	{"movea.w (%a0),%a2", 1, {0x3450}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A2, 0x1234}}},
+	{"movea.w 4(%a0),%a2", 2, {0x3468, 0x0004}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A2, 0xFFFF9ABC}}},
+	{"move.b (%a0),%d0", 1, {0x1010}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{D0, 0x12}}},
+	{"move.b (%a0),%d0", 1, {0x1010}, 8,
+		{{D0, 0xFFFFFFFF}, {A0, 0x2000}, {A1, 0x2008}, {CCR, N}},
+		{{D0, 0xFFFFFF12}}},
+	{"add.l %d0,%d1", 1, {0xD280}, 8,
+		{{D0, 1}, {D1, 2}},
+		{{D1, 3}}},
+	{"add.w %d0,%d1", 1, {0xD240}, 4,
+		{{D0, 1}, {D1, 2}},
+		{{D1, 3}}},
+	{"add.l (%a0),%d1", 1, {0xD290}, 14,
+		{{A0, 0x2000}, {A1, 0x2008}, {D1, 2}},
+		{{D1, 0x1234567A}}},
+	{"add.l #1,%d1", 3, {0x0681, 0x0000, 0x0001}, 16,
+		{{D1, 2}},
+		{{D1, 3}}},
+	{"addq.l #1,%d1", 1, {0x5281}, 8,
+		{{D1, 2}},
+		{{D1, 3}}},
+	{"addq.w #1,%a0", 1, {0x5248}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A0, 0x2001}}},
+	{"addq.w #1,(%a0)", 1, {0x5250}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{M0, 0x12355678}}},
+	{"adda.l %d0,%a0", 1, {0xD1C0}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 4}},
+		{{A0, 0x2004}}},
+	{"adda.w %d0,%a0", 1, {0xD0C0}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 0xFFFFFFFC}, {CCR, N}},
+		{{A0, 0x1FFC}}},
+	{"adda.l (%a0),%a1", 1, {0xD3D0}, 14,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A1, 0x12347680}}},
+	{"sub.l %d0,(%a0)", 1, {0x9190}, 20,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{M0, 0x12345677}}},
+	{"cmp.l %d0,%d1", 1, {0xB280}, 6,
+		{{D0, 1}, {D1, 1}},
+		{{CCR, Z}}},
+	{"cmp.w %d0,%d1", 1, {0xB240}, 4,
+		{{D0, 2}, {D1, 1}},
+		{{CCR, N|C}}},
+	{"cmpa.l %a0,%a1", 1, {0xB3C8}, 6,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{CCR, 0}}},
+	{"cmpi.l #1,%d0", 3, {0x0C80, 0x0000, 0x0001}, 14,
+		{{D0, 1}},
+		{{CCR, Z}}},
+	{"cmpi.w #0x1234,(%a0)", 2, {0x0C50, 0x1234}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{CCR, Z}}},
+	{"andi.l #1,%d0", 3, {0x0280, 0x0000, 0x0001}, 14,
+		{{D0, 3}},
+		{{D0, 1}}},
+	{"ori.l #1,%d0", 3, {0x0080, 0x0000, 0x0001}, 16,
+		{{D0, 2}},
+		{{D0, 3}}},
+	{"eori.w #3,%d0", 2, {0x0A40, 0x0003}, 8,
+		{{D0, 2}},
+		{{D0, 1}}},
+	{"andi.b #0xF0,(%a0)", 2, {0x0210, 0x00F0}, 16,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{M0, 0x10345678}}},
+	{"addq.l #1,%d0", 1, {0x5280}, 8,
+		{{D0, 0x7FFFFFFF}},
+		{{D0, 0x80000000}, {CCR, N|V}}},
+	{"subq.l #1,%d0", 1, {0x5380}, 8,
+		{{D0, 0}, {CCR, Z}},
+		{{D0, 0xFFFFFFFF}, {CCR, X|N|C}}},
+	{"addq.w #1,%d0", 1, {0x5240}, 4,
+		{{D0, 0xFFFF}, {CCR, N}},
+		{{D0, 0}, {CCR, X|Z|C}}},
+	{"neg.l %d0", 1, {0x4480}, 6,
+		{{D0, 0}, {CCR, Z}},
+		{{CCR, Z}}},
+	{"neg.l %d0", 1, {0x4480}, 6,
+		{{D0, 1}},
+		{{D0, 0xFFFFFFFF}, {CCR, X|N|C}}},
+	{"negx.l %d0", 1, {0x4080}, 6,
+		{{D0, 0}, {D1, 0xFFFFFFFF}, {CCR, X|N|C}},
+		{{D0, 0xFFFFFFFF}, {CCR, X|N|C}}},
+	{"not.b %d0", 1, {0x4600}, 4,
+		{{D0, 5}},
+		{{D0, 0xFA}, {CCR, N}}},
+	{"clr.l %d0", 1, {0x4280}, 6,
+		{{D0, 5}},
+		{{D0, 0}, {CCR, Z}}},
+	{"clr.w (%a0)", 1, {0x4250}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{M0, 0x00005678}}},
+	{"tst.l (%a0)", 1, {0x4A90}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{CCR, 0}}},
+	{"ext.w %d0", 1, {0x4880}, 4,
+		{{D0, 0x1234FF80}},
+		{{D0, 0x1234FF80}, {CCR, N}}},
+	{"ext.w %d0", 1, {0x4880}, 4,
+		{{D0, 0x12340080}},
+		{{D0, 0x1234FF80}, {CCR, N}}},
+	{"ext.l %d0", 1, {0x48C0}, 4,
+		{{D0, 0x12348000}},
+		{{D0, 0xFFFF8000}, {CCR, N}}},
+	{"swap %d0", 1, {0x4840}, 4,
+		{{D0, 0x12345678}},
+		{{D0, 0x56781234}}},
+	{"exg %d0,%d1", 1, {0xC141}, 6,
+		{{D0, 1}, {D1, 2}},
+		{{D0, 2}, {D1, 1}}},
+	{"exg %a0,%a1", 1, {0xC149}, 6,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A0, 0x2008}, {A1, 0x2000}}},
+	{"exg %d0,%a1", 1, {0xC189}, 6,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{D0, 0x2008}, {A1, 1}}},
+	{"addx.l %d0,%d1", 1, {0xD380}, 8,
+		{{D0, 1}, {D1, 2}, {CCR, X}},
+		{{D1, 4}}},
+	{"addx.l -(%a0),-(%a1)", 1, {0xD388}, 30,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A0, 0x1FFC}, {A1, 0x2004}}},
+	{"cmpm.b (%a0)+,(%a1)+", 1, {0xB308}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A0, 0x2001}, {A1, 0x2009}, {CCR, N|C}}},
+	{"abcd %d0,%d1", 1, {0xC300}, 6,
+		{{D0, 0x19}, {D1, 0x28}},
+		{{D1, 0x47}}},
+	{"abcd %d0,%d1", 1, {0xC300}, 6,
+		{{D0, 0x99}, {D1, 1}, {CCR, Z}},
+		{{D1, 0}, {CCR, X|Z|C}}},
+	{"sbcd %d0,%d1", 1, {0x8300}, 6,
+		{{D0, 0x19}, {D1, 0x28}},
+		{{D1, 9}}},
+	{"sbcd %d0,%d1", 1, {0x8300}, 6,
+		{{D0, 0x28}, {D1, 0x19}, {CCR, Z}},
+		{{D1, 0x91}, {CCR, X|N|C}}},
+	{"lea 8(%a0),%a1", 2, {0x43E8, 0x0008}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A1, 0x2008}}},
+	{"lea 0x12345,%a1", 3, {0x43F9, 0x0001, 0x2345}, 12,
+		{},
+		{{A1, 0x12345}}},
+	{"lea (2,%a0,%a0.w),%a1", 2, {0x43F0, 0x8002}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A1, 0x4002}}},
+	{"pea (%a0)", 1, {0x4850}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{A7, 0x7FFC}}},
+	{"jmp (%a0); moveq #1,%d0; 1:", 2, {0x4ED0, 0x7001}, 8,
+		{{A0, 0x404}},
+		{{D0, 0}}},
+	{"bra.s 1f; moveq #1,%d0; 1:", 2, {0x6002, 0x7001}, 10,
+		{},
+		{{D0, 0}}},
+	{"beq.s 1f; moveq #1,%d0; 1:", 2, {0x6702, 0x7001}, 10,
+		{{D0, 0}, {CCR, Z}},
+		{{D0, 0}}},
+	{"beq.s 1f; moveq #2,%d0; 1:", 2, {0x6702, 0x7002}, 8,
+		{{D0, 1}},
+		{{D0, 2}}},
+	{"beq.w 1f; moveq #2,%d0; 1:", 3, {0x6700, 0x0004, 0x7002}, 12,
+		{{D0, 1}},
+		{{D0, 2}}},
+	{"bsr.s 1f; moveq #1,%d0; 1:", 2, {0x6102, 0x7001}, 18,
+		{},
+		{{A7, 0x7FFC}}},
+	{"bsr.s 1f; bra.s 2f; 1: rts; 2:", 3, {0x6102, 0x6002, 0x4E75}, 18,
+		{},
+		{{A7, 0x8000}}},
+	{"1: dbra %d1,1b", 2, {0x51C9, 0xFFFE}, 10,
+		{{D1, 3}},
+		{{D1, 0xFFFF}}},
+	{"dbra %d1,1f; 1:", 2, {0x51C9, 0x0002}, 14,
+		{{D1, 0}, {CCR, Z}},
+		{{D1, 0xFFFF}}},
+	{"dbeq %d1,1f; 1:", 2, {0x57C9, 0x0002}, 12,
+		{{D1, 5}, {D0, 0}, {CCR, Z}},
+		{{D1, 5}}},
+	{"seq %d0", 1, {0x57C0}, 6,
+		{{D0, 0}, {CCR, Z}},
+		{{D0, 0xFF}}},
+	{"seq %d0", 1, {0x57C0}, 4,
+		{{D0, 1}},
+		{{D0, 0}}},
+	{"st (%a0)", 1, {0x50D0}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 0}, {CCR, Z}},
+		{{M0, 0xFF345678}}},
+	{"btst %d0,%d1", 1, {0x0101}, 6,
+		{{D0, 3}, {D1, 8}},
+		{{CCR, 0}}},
+	{"btst #2,%d1", 2, {0x0801, 0x0002}, 10,
+		{{D1, 8}},
+		{{CCR, Z}}},
+	{"btst %d0,(%a0)", 1, {0x0110}, 8,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 4}},
+		{{CCR, 0}}},
+	{"btst #2,10(%a0)", 3, {0x0828, 0x0002, 0x000A}, 16,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{CCR, Z}}},
+	{"bset %d0,%d1", 1, {0x01C1}, 6,
+		{{D0, 3}, {D1, 0}, {CCR, Z}},
+		{{D1, 8}, {CCR, Z}}},
+	{"bset %d0,%d1", 1, {0x01C1}, 8,
+		{{D0, 0x14}, {D1, 0}, {CCR, Z}},
+		{{D1, 0x100000}}},
+	{"bclr #20,%d1", 2, {0x0881, 0x0014}, 14,
+		{{D1, 0x100000}},
+		{{D1, 0}}},
+	{"bclr #0,%d1", 2, {0x0881, 0x0000}, 12,
+		{{D1, 1}},
+		{{D1, 0}}},
+	{"bchg #1,%d1", 2, {0x0841, 0x0001}, 10,
+		{{D1, 1}},
+		{{D1, 3}}},
+	{"bset #0,(%a0)", 2, {0x08D0, 0x0000}, 16,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{M0, 0x13345678}}},
+	{"bclr %d0,(%a0)", 1, {0x0190}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}, {D0, 1}},
+		{{M0, 0x10345678}}},
+	{"lsl.l #3,%d0", 1, {0xE788}, 14,
+		{{D0, 1}},
+		{{D0, 8}}},
+	{"lsl.w #1,%d0", 1, {0xE348}, 8,
+		{{D0, 1}},
+		{{D0, 2}}},
+	{"lsr.l %d1,%d0", 1, {0xE2A8}, 28,
+		{{D0, 0x80000000}, {D1, 0xA}},
+		{{D0, 0x200000}}},
+	{"lsr.l %d1,%d0", 1, {0xE2A8}, 8,
+		{{D1, 0}, {D0, 5}},
+		{{D0, 5}, {CCR, 0}}},
+	{"asr.w (%a0)", 1, {0xE0D0}, 12,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{M0, 0x091A5678}}},
+	{"asl.w #1,%d0", 1, {0xE340}, 8,
+		{{D0, 0x4000}},
+		{{D0, 0x8000}, {CCR, N|V}}},
+	{"asr.w #1,%d0", 1, {0xE240}, 8,
+		{{D0, 0x8001}, {CCR, N}},
+		{{D0, 0xC000}, {CCR, X|N|C}}},
+	{"ror.w #1,%d0", 1, {0xE258}, 8,
+		{{D0, 0x8001}, {CCR, N}},
+		{{D0, 0xC000}, {CCR, N|C}}},
+	{"roxl.w #1,%d0", 1, {0xE350}, 8,
+		{{D0, 0x8000}},
+		{{D0, 0}, {CCR, X|Z|C}}},
+	{"roxr.b #1,%d0", 1, {0xE210}, 8,
+		{{D0, 0}, {CCR, X}},
+		{{D0, 0x80}, {CCR, N}}},
+	{"rol.b #1,%d0", 1, {0xE318}, 8,
+		{{D0, 0x81}},
+		{{D0, 3}, {CCR, C}}},
+	{"lsl.l %d1,%d0", 1, {0xE3A8}, 88,
+		{{D1, 0x28}, {D0, 1}},
+		{{D0, 0}, {CCR, Z}}},
+	{"mulu %d1,%d0", 1, {0xC0C1}, 38,
+		{{D1, 0}, {D0, 7}},
+		{{D0, 0}}},
+	{"mulu %d1,%d0", 1, {0xC0C1}, 70,
+		{{D1, 0xFFFF}, {D0, 0xFFFF}},
+		{{D0, 0xFFFE0001}}},
+	{"muls %d1,%d0", 1, {0xC1C1}, 70,
+		{{D1, 0x5555}, {D0, 2}},
+		{{D0, 0xAAAA}}},
+	{"muls %d1,%d0", 1, {0xC1C1}, 44,
+		{{D1, 0xFFFFFFFD}, {D0, 5}},
+		{{D0, 0xFFFFFFF1}}},
+	{"divu %d1,%d0", 1, {0x80C1}, 130,
+		{{D0, 0x64}, {D1, 7}},
+		{{D0, 0x2000E}}},
+	{"divu %d1,%d0", 1, {0x80C1}, 10,
+		{{D0, 0xFFFFF}, {D1, 1}},
+		{{D0, 0xFFFFF}, {CCR, N|V}}},
+	{"divs %d1,%d0", 1, {0x81C1}, 150,
+		{{D0, 0xFFFFFF9C}, {D1, 7}},
+		{{D0, 0xFFFEFFF2}}},
+	{"divu %d1,%d0", 1, {0x80C1}, 38,
+		{{D0, 1}, {D1, 0}, {D6, 0}, {CCR, Z}},
+		{{D6, 0xFFFFFFFF}}},
+	{"movem.l %d0-%d3,-(%sp)", 2, {0x48E7, 0xF000}, 40,
+		{},
+		{{A7, 0x7FF0}}},
+	{"movem.l (%sp)+,%d4-%d7", 2, {0x4CDF, 0x00F0}, 44,
+		{{A7, 0x7FEC}},
+		{}},
+	{"movem.w (%a0),%d0-%d1", 2, {0x4C90, 0x0003}, 20,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{D0, 0x1234}, {D1, 0x5678}}},
+	{"movem.w 4(%a0),%d0/%a2", 3, {0x4CA8, 0x0401, 0x0004}, 24,
+		{{A0, 0x2000}, {A1, 0x2008}},
+		{{D0, 0xFFFF9ABC}, {A2, 0xFFFFDEF0}}},
+	{"movem.l %d0-%d1,(%a0)", 2, {0x48D0, 0x0003}, 24,
+		{{D0, 1}, {D1, 2}, {A0, 0x2000}},
+		{{M0, 0x00000001}, {M4, 0x00000002}}},
+	{"link %a6,#-8", 2, {0x4E56, 0xFFF8}, 16,
+		{},
+		{{A6, 0x7FFC}, {A7, 0x7FF4}}},
+	{"unlk %a6", 1, {0x4E5E}, 12,
+		{{A6, 0x7FFC}, {A7, 0x7FF4}},
+		{{A7, 0x8000}}},
+	{"move.w #0x2700,%sr", 2, {0x46FC, 0x2700}, 16,
+		{},
+		{}},
+	{"move.w %sr,%d0", 1, {0x40C0}, 6,
+		{},
+		{{D0, 0x2700}}},
+	{"trap #0", 1, {0x4E40}, 34,
+		{{D6, 0}, {CCR, Z}},
+		{{D6, 0xFFFFFFFF}, {A7, 0x7FFA}}},
+	{"move.w (%a0),%d0", 1, {0x3010}, 54,
+		{{D6, 0}, {A0, 0x2001}, {CCR, Z}},
+		{{D6, 0xFFFFFFFF}, {A7, 0x7FF2}}},
+	{"ori #0x1F,%ccr", 2, {0x003C, 0x001F}, 20,
+		{},
+		{{CCR, X|N|Z|V|C}}},
+	{"andi #0x04,%ccr", 2, {0x023C, 0x0004}, 20,
+		{{CCR, X|N|Z|V|C}},
+		{{CCR, Z}}},
+	{"nop", 1, {0x4E71}, 4,
+		{},
+		{}},
+	{"chk %d1,%d0", 1, {0x4181}, 40,
+		{{D0, 5}, {D1, 3}, {D6, 0}, {CCR, Z}},
+		{{D6, 0xFFFFFFFF}}},
+	{"chk %d1,%d0", 1, {0x4181}, 10,
+		{{D0, 2}, {D1, 3}, {D6, 0}, {CCR, Z}},
+		{{D6, 0}}},
+	{"chk %d1,%d0", 1, {0x4181}, 40,
+		{{D0, 0xFFFFFFFF}, {D1, 3}, {D6, 0}, {CCR, Z}},
+		{{D6, 0xFFFFFFFF}}},
+	{"move.b %d1,%d0", 1, {0x1001}, 4,
+		{{D1, 0x80}, {CCR, X|N|Z|V|C}},
+		{{D0, 0x80}, {CCR, X|N}}},
+	{"move.l %d1,%d0", 1, {0x2001}, 4,
+		{{D0, 5}, {CCR, N|V|C}},
+		{{D0, 0}, {CCR, Z}}},
+	{"movea.l %d0,%a2", 1, {0x2440}, 4,
+		{{D0, 0}, {CCR, X|N|Z|V|C}},
+		{{A2, 0}, {CCR, X|N|Z|V|C}}},
+	{"sub.b #31,%d0; move.b %d5,%d0; bhi.s 1f; moveq #1,%d1; 1:", 5, {0x0400, 0x001F, 0x1005, 0x6202, 0x7201}, 8,
+		{{D0, 0x40}, {D5, 0}, {CCR, Z}},
+		{{D0, 0}, {D1, 1}}},
+	{"sub.b #31,%d0; move.b %d5,%d0; bhi.s 1f; moveq #1,%d1; 1:", 5, {0x0400, 0x001F, 0x1005, 0x6202, 0x7201}, 8,
+		{{D0, 0x40}, {D5, 1}},
+		{{D0, 1}, {D1, 0}}},
+};
+
+static uint8_t mem[M68K_TEST_MEM_LEN];
+
+uint8_t M68kSimRd8(uint32_t addr) {
+	return addr < M68K_TEST_MEM_LEN?mem[addr]:0;
+}
+
+uint16_t M68kSimRd16(uint32_t addr) {
+	return (M68kSimRd8(addr)<<8) | M68kSimRd8(addr + 1);
+}
+
+void M68kSimWr8(uint32_t addr, uint8_t val) {
+	if (addr < M68K_TEST_MEM_LEN) mem[addr] = val;
+}
+
+void M68kSimWr16(uint32_t addr, uint16_t val) {
+	M68kSimWr8(addr, val>>8);
+	M68kSimWr8(addr + 1, val & 0xFF);
+}
+
+static void Wr32(uint32_t addr, uint32_t val) {
+	M68kSimWr16(addr, val>>16);
+	M68kSimWr16(addr + 2, val & 0xFFFF);
+}
+
+static uint32_t Rd32(uint32_t addr) {
+	return (M68kSimRd16(addr)<<16) | M68kSimRd16(addr + 2);
+}
+
+// Loads the memory and registers for a test, leaving the PC at its code
+static void Load(const M68kTest *t) {
+	const M68kTestVal *v;
+	int i;
+
+	memset(mem, 0, sizeof(mem));
+	Wr32(0, M68K_TEST_STACK);
+	Wr32(4, M68K_TEST_CODE);
+	for (i = 2; i < 64; i++) Wr32(4 * i, M68K_TEST_EXC);
+	for (i = 0; i < (int)(sizeof(m68kTestExc) / 2); i++) {
+		M68kSimWr16(M68K_TEST_EXC + 2 * i, m68kTestExc[i]);
+	}
+	for (i = 0; i < t->words; i++) {
+		M68kSimWr16(M68K_TEST_CODE + 2 * i, t->code[i]);
+	}
+	memcpy(mem + M68K_TEST_DATA, m68kTestData, sizeof(m68kTestData));
+
+	M68kSimReset();
+	for (v = t->set; v < t->set + 4 && v->loc; v++) {
+		if (CCR == v->loc) {
+			M68kSimSrSet((M68kSimSrGet() & 0xFF00) | v->val);
+		} else {
+			M68kSimRegSet(v->loc - D0, v->val);
+		}
+	}
+}
+
+static uint32_t Get(M68kTestLoc loc) {
+	switch (loc) {
+		case CCR: return M68kSimSrGet() & 0x1F;
+		case M0: return Rd32(M68K_TEST_DATA);
+		case M4: return Rd32(M68K_TEST_DATA + 4);
+		default: return M68kSimRegGet(loc - D0);
+	}
+}
+
+static const char *LocName(M68kTestLoc loc) {
+	static const char *const name[] = {
+		"", "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+		"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "ccr", "m0", "m4"
+	};
+
+	return name[loc];
+}
+
+// Runs a test, returns the number of mismatches
+static int Run(const M68kTest *t) {
+	const M68kTestVal *v;
+	uint32_t end = M68K_TEST_CODE + 2 * t->words;
+	uint32_t cycles;
+	int steps = 0;
+	int err = 0;
+
+	Load(t);
+	cycles = M68kSimRun(1);
+	while (M68kSimPcGet() != end && !M68kSimStopped() &&
+			++steps < M68K_TEST_STEPS) M68kSimRun(1);
+
+	if (t->cycles && cycles != t->cycles) {
+		printf("%s: %u cycles, expected %u\n", t->src, cycles, t->cycles);
+		err++;
+	}
+	for (v = t->chk; v < t->chk + 4 && v->loc; v++) {
+		uint32_t val = Get(v->loc);
+
+		if (val != v->val) {
+			printf("%s: %s = 0x%X, expected 0x%X\n", t->src,
+					LocName(v->loc), val, v->val);
+			err++;
+		}
+	}
+
+	return err;
+}
+
+int main(void) {
+	const int tests = sizeof(m68kTest) / sizeof(M68kTest);
+	int fails = 0;
+	int i;
+
+	for (i = 0; i < tests; i++) fails += Run(&m68kTest[i]) != 0;
+	printf("m68k-test: %d tests, %d failed\n", tests, fails);
+
+	return fails != 0;
+}
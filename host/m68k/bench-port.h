@@ -0,0 +1,44 @@
+/************************************************************************//**
+ * \brief Benchmark port, used by the 68000 side of the cycle counted
+ *        benchmark to signal the harness (host/m68k-bench) when each
+ *        measurement starts and stops. The port is mapped by the harness
+ *        at an address not used by the console.
+ *
+ * \defgroup bench-port Cycle counted benchmark port
+ * \{
+ ****************************************************************************/
+
+#ifndef _BENCH_PORT_H_
+#define _BENCH_PORT_H_
+
+/// LSD channel used by the benchmark
+#define BENCH_CH			1
+
+/// Benchmark port base address
+#define BENCH_PORT_BASE		0xA1F000
+
+/// Payload length register (16 bits). Written before each command. When
+/// stopping a reception measurement, holds the length received (0 if
+/// reception failed).
+#define BENCH_PORT_LEN		(BENCH_PORT_BASE + 0)
+/// Command register (16 bits), see BenchPortCmd.
+#define BENCH_PORT_CMD		(BENCH_PORT_BASE + 2)
+
+/** \addtogroup bench-port BenchPortCmd Benchmark port commands.
+ *  \{ */
+typedef enum {
+	BENCH_CMD_SEND = 1,		///< Starts measuring a frame send
+	BENCH_CMD_RECV,			///< Queues a frame and starts measuring its reception
+	BENCH_CMD_STOP,			///< Stops the measurement and reports it
+	BENCH_CMD_EXIT			///< Ends the benchmark
+} BenchPortCmd;
+/** \} */
+
+/// Writes a benchmark port register (LEN or CMD), 68000 side.
+#define BenchPortWr(reg, val)	\
+	do{*((volatile uint16_t*)BENCH_PORT_##reg) = (val);}while(0)
+
+#endif /*_BENCH_PORT_H_*/
+
+/** \} */
+
@@ -0,0 +1,51 @@
+/************************************************************************//**
+ * \brief Cycle counted benchmark, 68000 side. Sends and receives a frame of
+ *        each payload length, signalling the harness (host/m68k-bench)
+ *        through the benchmark port when each measurement starts and stops.
+ *        Built with the console toolchain, and run on the emulated 68000.
+ ****************************************************************************/
+#include "mw/lsd.h"
+#include "mw/16c550.h"
+#include "mw/util.h"
+#include "bench-port.h"
+
+/// Loops LsdRecv() waits for data before failing
+#define BENCH_RECV_LOOPS	100000
+
+static uint8_t buf[LSD_MAX_LEN];
+
+// Writes a command to the benchmark port
+static void BenchCmd(BenchPortCmd cmd, uint16_t len) {
+	BenchPortWr(LEN, len);
+	BenchPortWr(CMD, cmd);
+}
+
+int main(void) {
+	uint16_t len, max;
+	uint16_t i;
+	int ch;
+
+	for (i = 0; i < sizeof(buf); i++) buf[i] = i * 7;
+	LsdInit();
+	// The harness queues whole frames: let auto-RTS pace them, so received
+	// data is never lost whatever the line rate
+	UartAutoFlowEnable(UART_FCR__TRIG_14);
+	LsdChEnable(BENCH_CH);
+
+	for (len = 1; len; len = (LSD_MAX_LEN == len)?0:MIN(LSD_MAX_LEN, 2 * len)) {
+		BenchCmd(BENCH_CMD_SEND, len);
+		LsdSend(buf, len, BENCH_CH);
+		BenchCmd(BENCH_CMD_STOP, len);
+
+		// Received frames must fit in the LSD reception buffers
+		if (len > LSD_RX_MAX_LEN) continue;
+		BenchCmd(BENCH_CMD_RECV, len);
+		max = sizeof(buf);
+		ch = LsdRecv(buf, &max, BENCH_RECV_LOOPS);
+		BenchCmd(BENCH_CMD_STOP, BENCH_CH == ch?max:0);
+	}
+	BenchCmd(BENCH_CMD_EXIT, 0);
+
+	return 0;
+}
+
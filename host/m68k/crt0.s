@@ -0,0 +1,34 @@
+/* Cycle counted benchmark startup code: vector table, .data and .bss
+ * initialization, and call to main(). Unhandled exceptions and returning
+ * from main() halt the CPU. */
+
+	.section .vectors, "a"
+	.long	_stack_top
+	.long	_start
+	.rept	62
+	.long	_halt
+	.endr
+
+	.text
+	.globl	_start
+_start:
+	move.w	#0x2700, sr
+	/* Copy .data from ROM to RAM */
+	lea		_data_load, a0
+	lea		_data_start, a1
+	lea		_data_end, a2
+1:	cmp.l	a2, a1
+	bcc.s	2f
+	move.b	(a0)+, (a1)+
+	bra.s	1b
+	/* Clear .bss */
+2:	lea		_bss_start, a1
+	lea		_bss_end, a2
+3:	cmp.l	a2, a1
+	bcc.s	4f
+	clr.b	(a1)+
+	bra.s	3b
+4:	jsr		main
+_halt:
+	stop	#0x2700
+	bra.s	_halt
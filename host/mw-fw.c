@@ -0,0 +1,617 @@
+/************************************************************************//**
+ * \brief MegaWiFi firmware stand-in. Speaks LSD through a pseudo-terminal
+ *        (or a serial device) and answers the MegaWiFi commands, so the
+ *        tests and benchmarks can run without the WiFi module. Flash
+ *        commands are served from a file backed flash image, and TCP
+ *        sockets are bridged to localhost. Connections to the echo port
+ *        are served by the stand-in itself.
+ *
+ * Build it with the same OPTION as the library (e.g. -DLSD_CRC), so both
+ * ends use the same frame format.
+ ****************************************************************************/
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "lsd.h"
+#include "megawifi.h"
+#include "crc16.h"
+#include "util.h"
+
+/// Default flash image file.
+#define FW_FLASH_FILE_DEF	"mw-flash.bin"
+
+/// Default flash image length.
+#define FW_FLASH_LEN_DEF	(1024 * 1024)
+
+/// TCP port of the built-in echo service (RFC 862).
+#define FW_ECHO_PORT		7
+
+/// Firmware version reported.
+#define FW_VER_MAJOR		1
+#define FW_VER_MINOR		0
+/// Firmware variant reported.
+#define FW_VARIANT			"host"
+
+/// Flash manufacturer and device identifiers reported.
+static const uint8_t fwFlashId[] = {0xEF, 0x40, 0x16};
+
+/// Access points reported on scans: auth, channel, strength, SSID length
+/// and SSID.
+static const uint8_t fwApScan[] = {
+	3, 1, 0xC0, 8, 'h', 'o', 's', 't', '-', 'a', 'p', '1',
+	0, 6, 0xA8, 8, 'h', 'o', 's', 't', '-', 'a', 'p', '2'
+};
+
+/** \addtogroup mw-fw FwRxState Frame reception states.
+ *  \{ */
+typedef enum {
+	FW_RX_STX = 0,			///< Waiting for STX
+	FW_RX_CH_LENH,			///< Receiving channel and length high bits
+	FW_RX_LENL,				///< Receiving length low bits
+	FW_RX_DATA,				///< Receiving payload
+	FW_RX_CRC,				///< Receiving CRC
+	FW_RX_ETX				///< Receiving ETX
+} FwRxState;
+/** \} */
+
+/// Stand-in configuration.
+typedef struct {
+	const char *flash;	///< Flash image file
+	const char *dev;	///< Device to use instead of a pseudo-terminal
+	uint32_t flashLen;	///< Flash image length
+	uint32_t latUs;		///< Latency added before each command reply (us)
+	uint32_t baud;		///< Emulated line rate (0 for no limit)
+	uint8_t be;			///< Multi-byte fields are big endian (as the MD)
+	uint8_t verbose;	///< Log commands
+} FwCfg;
+
+/** \addtogroup mw-fw FwData Local data required by the program.
+ *  \{ */
+typedef struct {
+	FwCfg cfg;						///< Configuration
+	int fd;							///< Link file descriptor
+	int flash;						///< Flash image file descriptor
+	uint32_t baud;					///< Current emulated line rate
+	int sock[MW_MAX_SOCK + 1];		///< Socket of each channel
+	uint8_t echo[MW_MAX_SOCK + 1];	///< Channel connected to the echo port
+	FwRxState rxs;					///< Reception state
+	uint8_t ch;						///< Channel of the frame being received
+	uint16_t len;					///< Length of the frame being received
+	uint16_t pos;					///< Position in the frame being received
+	uint16_t crc;					///< CRC of the frame being received
+	uint8_t rx[LSD_MAX_LEN + LSD_CRC_LEN];	///< Frame being received
+	uint8_t last[LSD_MAX_LEN + LSD_OVERHEAD];	///< Last control frame
+	uint16_t lastLen;				///< Length of the last control frame
+	uint8_t ap[MW_NUM_AP_CFGS][sizeof(MwMsgApCfg)];	///< AP configurations
+	uint8_t ip[MW_NUM_AP_CFGS][sizeof(MwMsgIpCfg)];	///< IP configurations
+} FwData;
+/** \} */
+
+// Program global data
+static FwData d;
+
+static uint16_t Rd16(const uint8_t *p) {
+	uint16_t val;
+
+	if (d.cfg.be) return (p[0]<<8) | p[1];
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static uint32_t Rd32(const uint8_t *p) {
+	uint32_t val;
+
+	if (d.cfg.be) return (p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static void Wr16(uint8_t *p, uint16_t val) {
+	if (d.cfg.be) {
+		p[0] = val>>8;
+		p[1] = val;
+	} else {
+		memcpy(p, &val, sizeof(val));
+	}
+}
+
+static void Wr32(uint8_t *p, uint32_t val) {
+	if (d.cfg.be) {
+		p[0] = val>>24;
+		p[1] = val>>16;
+		p[2] = val>>8;
+		p[3] = val;
+	} else {
+		memcpy(p, &val, sizeof(val));
+	}
+}
+
+// Writes data to the link, taking the time it needs at the emulated rate
+static void LinkWrite(const uint8_t *data, uint16_t len) {
+	uint16_t sent = 0;
+	ssize_t n;
+	struct pollfd pfd = {d.fd, POLLOUT, 0};
+
+	while (sent < len) {
+		if ((n = write(d.fd, data + sent, len - sent)) > 0) sent += n;
+		else poll(&pfd, 1, 100);
+	}
+	// 10 bits per character (8N1)
+	if (d.baud) usleep(len * 10000000LLU / d.baud);
+}
+
+// Sends a frame through the link
+static void FrameSend(uint8_t ch, const uint8_t *data, uint16_t len) {
+	static uint8_t frame[LSD_MAX_LEN + LSD_OVERHEAD];
+	uint16_t crc;
+
+	frame[0] = LSD_STX_ETX;
+	frame[1] = (ch<<4) | (len>>8);
+	frame[2] = len & 0xFF;
+	memcpy(frame + 3, data, len);
+	crc = Crc16(frame + 1, len + 2, CRC16_INIT);
+	if (LSD_CRC_LEN) {
+		frame[3 + len] = crc>>8;
+		frame[4 + len] = crc & 0xFF;
+	}
+	frame[3 + len + LSD_CRC_LEN] = LSD_STX_ETX;
+	len += LSD_OVERHEAD;
+	// Keep control frames, to send them again if requested
+	if (MW_CTRL_CH == ch) {
+		memcpy(d.last, frame, len);
+		d.lastLen = len;
+	}
+	LinkWrite(frame, len);
+}
+
+// Sends a command reply
+static void ReplySend(uint16_t cmd, const uint8_t *data, uint16_t len) {
+	static uint8_t rep[MW_MSG_MAX_BUFLEN];
+
+	if (len > MW_CMD_MAX_BUFLEN) len = MW_CMD_MAX_BUFLEN;
+	Wr16(rep, cmd);
+	Wr16(rep + 2, len);
+	memcpy(rep + 4, data, len);
+	if (d.cfg.latUs) usleep(d.cfg.latUs);
+	FrameSend(MW_CTRL_CH, rep, len + 4);
+}
+
+#define ReplyOk()		ReplySend(MW_CMD_OK, NULL, 0)
+#define ReplyErr()		ReplySend(MW_CMD_ERROR, NULL, 0)
+
+static void FwDatetime(void) {
+	uint8_t rep[2 * sizeof(uint32_t) + 32];
+	time_t t = time(NULL);
+	uint64_t bin = t;
+
+	Wr32(rep, bin>>32);
+	Wr32(rep + 4, bin);
+	strftime((char*)rep + 8, sizeof(rep) - 8, "%a %b %d %H:%M:%S %Y",
+			localtime(&t));
+	ReplySend(MW_CMD_OK, rep, 8 + strlen((char*)rep + 8) + 1);
+}
+
+static void FwHrng(const uint8_t *data) {
+	uint8_t rep[MW_CMD_MAX_BUFLEN];
+	uint16_t len = Rd16(data);
+	uint16_t i;
+
+	if (len > sizeof(rep)) len = sizeof(rep);
+	for (i = 0; i < len; i++) rep[i] = rand();
+	ReplySend(MW_CMD_OK, rep, len);
+}
+
+static void FwFlashRead(const uint8_t *data) {
+	uint8_t rep[MW_CMD_MAX_BUFLEN];
+	uint32_t addr = Rd32(data);
+	uint16_t len = Rd16(data + sizeof(uint32_t));
+
+	if (len > sizeof(rep) || addr + len > d.cfg.flashLen ||
+			pread(d.flash, rep, len, addr) != len) {
+		ReplyErr();
+		return;
+	}
+	ReplySend(MW_CMD_OK, rep, len);
+}
+
+static void FwFlashWrite(const uint8_t *data, uint16_t datalen) {
+	uint8_t buf[MW_CMD_MAX_BUFLEN];
+	uint32_t addr = Rd32(data);
+	uint16_t len = datalen - sizeof(uint32_t);
+	uint16_t i;
+
+	if (datalen < sizeof(uint32_t) || addr + len > d.cfg.flashLen ||
+			pread(d.flash, buf, len, addr) != len) {
+		ReplyErr();
+		return;
+	}
+	// Programming can only clear bits
+	for (i = 0; i < len; i++) buf[i] &= data[sizeof(uint32_t) + i];
+	if (pwrite(d.flash, buf, len, addr) != len) ReplyErr();
+	else ReplyOk();
+}
+
+static void FwFlashErase(const uint8_t *data) {
+	uint8_t buf[MW_FLASH_SECT_LEN];
+	uint32_t addr = Rd16(data) * MW_FLASH_SECT_LEN;
+
+	memset(buf, 0xFF, sizeof(buf));
+	if (addr + MW_FLASH_SECT_LEN > d.cfg.flashLen ||
+			pwrite(d.flash, buf, sizeof(buf), addr) != sizeof(buf)) {
+		ReplyErr();
+	} else {
+		ReplyOk();
+	}
+}
+
+// Connects a channel to a localhost TCP port. The requested address is
+// ignored.
+static void FwTcpCon(const uint8_t *data, uint16_t datalen) {
+	const MwMsgInAddr *in = (const MwMsgInAddr*)data;
+	struct sockaddr_in addr;
+	uint8_t ch = in->channel;
+	int one = 1;
+	int s;
+
+	if (datalen < sizeof(in->dst_port) + sizeof(in->src_port) + 1 || !ch || ch > MW_MAX_SOCK ||
+			d.sock[ch] >= 0 || d.echo[ch]) {
+		ReplyErr();
+		return;
+	}
+	if (FW_ECHO_PORT == atoi(in->dst_port)) {
+		d.echo[ch] = 1;
+		ReplyOk();
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(atoi(in->dst_port));
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		ReplyErr();
+		return;
+	}
+	if (connect(s, (struct sockaddr*)&addr, sizeof(addr))) {
+		close(s);
+		ReplyErr();
+		return;
+	}
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	d.sock[ch] = s;
+	ReplyOk();
+}
+
+static void FwTcpDisc(const uint8_t *data) {
+	uint8_t ch = data[0];
+
+	if (!ch || ch > MW_MAX_SOCK || (d.sock[ch] < 0 && !d.echo[ch])) {
+		ReplyErr();
+		return;
+	}
+	if (d.echo[ch]) {
+		d.echo[ch] = 0;
+		ReplyOk();
+		return;
+	}
+	close(d.sock[ch]);
+	d.sock[ch] = -1;
+	ReplyOk();
+}
+
+static void FwCmd(const uint8_t *buf, uint16_t len) {
+	uint16_t cmd = Rd16(buf);
+	uint16_t datalen = Rd16(buf + 2);
+	const uint8_t *data = buf + 4;
+	uint8_t rep[MW_CMD_MAX_BUFLEN];
+	uint8_t num = data[0];
+
+	if (len < 4 || datalen > len - 4) {
+		ReplyErr();
+		return;
+	}
+	if (d.cfg.verbose) printf("cmd %u, %u bytes\n", cmd, datalen);
+	switch (cmd) {
+		case MW_CMD_VERSION:
+			rep[0] = FW_VER_MAJOR;
+			rep[1] = FW_VER_MINOR;
+			memcpy(rep + 2, FW_VARIANT, sizeof(FW_VARIANT) - 1);
+			ReplySend(MW_CMD_OK, rep, 2 + sizeof(FW_VARIANT) - 1);
+			break;
+
+		case MW_CMD_ECHO:
+			ReplySend(MW_CMD_OK, data, datalen);
+			break;
+
+		case MW_CMD_AP_SCAN:
+			ReplySend(MW_CMD_OK, fwApScan, sizeof(fwApScan));
+			break;
+
+		case MW_CMD_AP_CFG:
+		case MW_CMD_IP_CFG:
+			if (num >= MW_NUM_AP_CFGS) {
+				ReplyErr();
+				break;
+			}
+			if (MW_CMD_AP_CFG == cmd) {
+				memcpy(d.ap[num], data, MIN(datalen, sizeof(d.ap[num])));
+			} else {
+				memcpy(d.ip[num], data, MIN(datalen, sizeof(d.ip[num])));
+			}
+			ReplyOk();
+			break;
+
+		case MW_CMD_AP_CFG_GET:
+		case MW_CMD_IP_CFG_GET:
+			if (num >= MW_NUM_AP_CFGS) {
+				ReplyErr();
+			} else if (MW_CMD_AP_CFG_GET == cmd) {
+				d.ap[num][0] = num;
+				ReplySend(MW_CMD_OK, d.ap[num], sizeof(d.ap[num]));
+			} else {
+				d.ip[num][0] = num;
+				ReplySend(MW_CMD_OK, d.ip[num], sizeof(d.ip[num]));
+			}
+			break;
+
+		case MW_CMD_DATETIME:
+			FwDatetime();
+			break;
+
+		case MW_CMD_HRNG_GET:
+			FwHrng(data);
+			break;
+
+		case MW_CMD_FLASH_READ:
+			FwFlashRead(data);
+			break;
+
+		case MW_CMD_FLASH_WRITE:
+			FwFlashWrite(data, datalen);
+			break;
+
+		case MW_CMD_FLASH_ERASE:
+			FwFlashErase(data);
+			break;
+
+		case MW_CMD_FLASH_ID:
+			ReplySend(MW_CMD_OK, fwFlashId, sizeof(fwFlashId));
+			break;
+
+		case MW_CMD_TCP_CON:
+			FwTcpCon(data, datalen);
+			break;
+
+		case MW_CMD_TCP_DISC:
+			FwTcpDisc(data);
+			break;
+
+		case MW_CMD_UART_CFG:
+			// Reply at the old rate, then switch
+			ReplyOk();
+			if (d.cfg.baud) d.baud = Rd32(data);
+			break;
+
+		case MW_CMD_DEF_CFG_SET:
+			// Factory settings have no AP nor IP configurations
+			memset(d.ap, 0, sizeof(d.ap));
+			memset(d.ip, 0, sizeof(d.ip));
+			ReplyOk();
+			break;
+
+		case MW_CMD_AP_JOIN:
+		case MW_CMD_AP_LEAVE:
+		case MW_CMD_SNTP_CFG:
+		case MW_CMD_DT_SET:
+		case MW_CMD_PING:
+			ReplyOk();
+			break;
+
+		default:
+			ReplyErr();
+	}
+}
+
+// Processes a received frame
+static void FrameProcess(void) {
+	uint16_t pos, n;
+
+	if (MW_CTRL_CH == d.ch) {
+		FwCmd(d.rx, d.len);
+	} else if (LSD_CRC_LEN && LSD_NAK_CH == d.ch) {
+		// Send again the last control frame
+		if (1 == d.len && LSD_RETX_CH == d.rx[0] && d.lastLen) {
+			LinkWrite(d.last, d.lastLen);
+		}
+	} else if (d.ch <= MW_MAX_SOCK && d.echo[d.ch]) {
+		// Frames must fit in the console reception buffers
+		for (pos = 0; pos < d.len; pos += n) {
+			n = MIN(d.len - pos, MW_MSG_MAX_BUFLEN);
+			FrameSend(d.ch, d.rx + pos, n);
+		}
+	} else if (d.ch <= MW_MAX_SOCK && d.sock[d.ch] >= 0) {
+		if (send(d.sock[d.ch], d.rx, d.len, 0) != d.len) {
+			fprintf(stderr, "ch %u: send failed\n", d.ch);
+		}
+	} else if (d.cfg.verbose) {
+		printf("ch %u: frame dropped\n", d.ch);
+	}
+}
+
+// Receives a byte from the link
+static void FwRx(uint8_t c) {
+	switch (d.rxs) {
+		case FW_RX_STX:
+			if (LSD_STX_ETX == c) d.rxs = FW_RX_CH_LENH;
+			break;
+
+		case FW_RX_CH_LENH:
+			// Another STX: previous one was the ETX of previous frame
+			if (LSD_STX_ETX == c) break;
+			d.ch = c>>4;
+			d.len = (c & 0x0F)<<8;
+			d.crc = Crc16Upd(CRC16_INIT, c);
+			d.rxs = FW_RX_LENL;
+			break;
+
+		case FW_RX_LENL:
+			d.len |= c;
+			d.crc = Crc16Upd(d.crc, c);
+			d.pos = 0;
+			d.rxs = d.len?FW_RX_DATA:(LSD_CRC_LEN?FW_RX_CRC:FW_RX_ETX);
+			break;
+
+		case FW_RX_DATA:
+		case FW_RX_CRC:
+			d.rx[d.pos++] = c;
+			d.crc = Crc16Upd(d.crc, c);
+			if (d.pos >= d.len + LSD_CRC_LEN) d.rxs = FW_RX_ETX;
+			break;
+
+		case FW_RX_ETX:
+			d.rxs = FW_RX_STX;
+			if (LSD_STX_ETX != c) {
+				fprintf(stderr, "ch %u: ETX not found\n", d.ch);
+			} else if (LSD_CRC_LEN && d.crc) {
+				fprintf(stderr, "ch %u: wrong CRC\n", d.ch);
+				c = LSD_RETX_CH;
+				FrameSend(LSD_NAK_CH, &c, 1);
+			} else {
+				FrameProcess();
+			}
+			break;
+	}
+}
+
+// Sends data received from a socket through its channel
+static void SockRx(uint8_t ch) {
+	uint8_t buf[MW_MSG_MAX_BUFLEN];
+	ssize_t n;
+
+	if ((n = recv(d.sock[ch], buf, sizeof(buf), 0)) > 0) {
+		FrameSend(ch, buf, n);
+	} else {
+		if (d.cfg.verbose) printf("ch %u: closed by peer\n", ch);
+		close(d.sock[ch]);
+		d.sock[ch] = -1;
+	}
+}
+
+// Opens the flash image, creating it erased if needed
+static int FlashOpen(void) {
+	uint8_t buf[MW_FLASH_SECT_LEN];
+	off_t len;
+	uint32_t addr;
+
+	if ((d.flash = open(d.cfg.flash, O_RDWR | O_CREAT, 0644)) < 0) {
+		perror(d.cfg.flash);
+		return -1;
+	}
+	len = lseek(d.flash, 0, SEEK_END);
+	memset(buf, 0xFF, sizeof(buf));
+	for (addr = len; addr < d.cfg.flashLen; addr += sizeof(buf)) {
+		if (pwrite(d.flash, buf, sizeof(buf), addr) != sizeof(buf)) {
+			perror(d.cfg.flash);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void RawSet(int fd) {
+	struct termios tio;
+
+	if (!tcgetattr(fd, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+}
+
+// Opens the link: the specified device, or a new pseudo-terminal
+static int LinkOpen(void) {
+	const char *slave;
+
+	if (d.cfg.dev) {
+		if ((d.fd = open(d.cfg.dev, O_RDWR | O_NOCTTY)) < 0) {
+			perror(d.cfg.dev);
+			return -1;
+		}
+		RawSet(d.fd);
+		return 0;
+	}
+	if ((d.fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(d.fd) ||
+			unlockpt(d.fd) || !(slave = ptsname(d.fd))) {
+		perror("pty");
+		return -1;
+	}
+	// Keep the slave open, so the master does not get hangups
+	RawSet(open(slave, O_RDWR | O_NOCTTY));
+	printf("%s\n", slave);
+	fflush(stdout);
+
+	return 0;
+}
+
+static void Usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-f flash_file] [-s flash_len] [-l latency_us]"
+			" [-r baud] [-b] [-d device] [-v]\n", prog);
+	fprintf(stderr, "Prints the pseudo-terminal to connect to, unless a "
+			"device is specified.\n");
+	fprintf(stderr, "-b: multi-byte fields are big endian (real console)\n");
+}
+
+int main(int argc, char **argv) {
+	struct pollfd pfd[MW_MAX_SOCK + 1];
+	uint8_t buf[256];
+	ssize_t n;
+	int opt, i;
+
+	d.cfg.flash = FW_FLASH_FILE_DEF;
+	d.cfg.flashLen = FW_FLASH_LEN_DEF;
+	while ((opt = getopt(argc, argv, "f:s:l:r:bd:v")) != -1) {
+		switch (opt) {
+			case 'f': d.cfg.flash = optarg; break;
+			case 's': d.cfg.flashLen = strtoul(optarg, NULL, 0); break;
+			case 'l': d.cfg.latUs = strtoul(optarg, NULL, 0); break;
+			case 'r': d.cfg.baud = strtoul(optarg, NULL, 0); break;
+			case 'b': d.cfg.be = 1; break;
+			case 'd': d.cfg.dev = optarg; break;
+			case 'v': d.cfg.verbose = 1; break;
+			default: Usage(argv[0]); return 1;
+		}
+	}
+	d.baud = d.cfg.baud;
+	for (i = 0; i <= MW_MAX_SOCK; i++) d.sock[i] = -1;
+	if (FlashOpen() || LinkOpen()) return 1;
+
+	while (1) {
+		// Link on slot 0, sockets on their channel slot
+		pfd[0].fd = d.fd;
+		for (i = 1; i <= MW_MAX_SOCK; i++) pfd[i].fd = d.sock[i];
+		for (i = 0; i <= MW_MAX_SOCK; i++) pfd[i].events = POLLIN;
+		if (poll(pfd, MW_MAX_SOCK + 1, -1) < 0) break;
+		if (pfd[0].revents & POLLIN) {
+			if ((n = read(d.fd, buf, sizeof(buf))) < 0) break;
+			for (i = 0; i < n; i++) FwRx(buf[i]);
+		}
+		for (i = 1; i <= MW_MAX_SOCK; i++) {
+			if (d.sock[i] >= 0 && (pfd[i].revents & (POLLIN | POLLHUP))) {
+				SockRx(i);
+			}
+		}
+	}
+
+	return 0;
+}
+
@@ -0,0 +1,580 @@
+/************************************************************************//**
+ * \brief Simulated 16C550 UART, used to build and benchmark the mw library
+ *        on a host machine.
+ ****************************************************************************/
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include "uart-sim.h"
+#include "16c550.h"
+#include "hvcnt.h"
+#include "util.h"
+
+/// Number of bits per character on the line (start + 8N1).
+#define UART_SIM_CHAR_BITS		10
+
+/// Scanline triggering the vertical interrupt.
+#define UART_SIM_VINT_LINE		224
+
+/// Byte ring buffer.
+typedef struct {
+	uint8_t *buf;		///< Buffer data
+	uint16_t size;		///< Buffer size
+	uint16_t head;		///< Next position to write
+	uint16_t count;		///< Number of bytes in the buffer
+} UartSimRing;
+
+/** \addtogroup uart-sim UartSimData Local data required by the module.
+ *  \{ */
+typedef struct {
+	uint64_t now;				///< Virtual time (ns)
+	uint64_t txDone;			///< Time TX shift register gets empty
+	uint64_t rxDone;			///< Time next peer byte is received
+	uint32_t clk;				///< Chip clock (Hz)
+	uint32_t accessNs;			///< Time consumed per register access
+	uint32_t baud;				///< Line rate override (0 if unused)
+	uint8_t txShift;			///< Byte in the TX shift register
+	uint8_t txBusy;				///< TX shift register holds a byte
+	uint8_t rxBusy;				///< Peer is sending a byte
+	uint8_t lsrErr;				///< Latched LSR error bits
+	uint8_t rtsAuto;			///< RTS state driven by auto-RTS
+	uint8_t peerFlow;			///< Peer honours RTS before sending
+	uint8_t reg[16];			///< Plain registers
+	uint8_t dll;				///< Divisor latch LSB
+	uint8_t dlm;				///< Divisor latch MSB
+	uint8_t txFifoBuf[UART_SIM_FIFO_LEN];
+	uint8_t rxFifoBuf[UART_SIM_FIFO_LEN];
+	uint8_t peerTxBuf[UART_SIM_PEER_BUFLEN];
+	uint8_t peerRxBuf[UART_SIM_PEER_BUFLEN];
+	UartSimRing txFifo;			///< TX FIFO
+	UartSimRing rxFifo;			///< RX FIFO
+	UartSimRing peerTx;			///< Bytes the peer has to send
+	UartSimRing peerRx;			///< Bytes captured by the peer
+	UartSimStats st;			///< Simulation counters
+	void (*intHandler)(void);	///< Emulated interrupt handler
+	uint64_t intNext;			///< Time of the next emulated interrupt
+	uint16_t intLines;			///< Scanlines between horizontal interrupts
+	uint8_t inInt;				///< Interrupt handler is running
+	void (*copHandler)(void);	///< Emulated coprocessor polling round
+	uint64_t copNext;			///< Time of the next coprocessor round
+	uint32_t copNs;				///< Time between coprocessor rounds
+	uint32_t copAccessNs;		///< Time consumed per coprocessor access
+	uint8_t inCop;				///< Coprocessor round is running
+} UartSimData;
+/** \} */
+
+// Module global data
+static UartSimData d;
+
+// Peer file descriptor, -1 if none. Kept across simulation resets.
+static int peerFd = -1;
+// Wall time (ns) matching virtual time 0 while the peer is attached
+static uint64_t peerT0;
+
+static void RingInit(UartSimRing *r, uint8_t *buf, uint16_t size) {
+	r->buf = buf;
+	r->size = size;
+	r->head = r->count = 0;
+}
+
+static int RingPut(UartSimRing *r, uint8_t c) {
+	if (r->count >= r->size) return -1;
+	r->buf[r->head] = c;
+	r->head = (r->head + 1) % r->size;
+	r->count++;
+	return 0;
+}
+
+static uint8_t RingGet(UartSimRing *r) {
+	uint8_t c;
+
+	if (!r->count) return 0;
+	c = r->buf[(r->head + r->size - r->count) % r->size];
+	r->count--;
+	return c;
+}
+
+// Time needed to send a character through the line, in ns
+static uint64_t CharNs(void) {
+	uint32_t div;
+
+	if (d.baud) return UART_SIM_CHAR_BITS * 1000000000LLU / d.baud;
+	div = (d.dlm<<8) | d.dll;
+	if (!div) div = 1;
+	return UART_SIM_CHAR_BITS * 16LLU * div * 1000000000LLU / d.clk;
+}
+
+static int Loopback(void) {
+	return d.reg[UART_REG_MCR] & UART_MCR__LOOP;
+}
+
+// RX FIFO trigger level, in bytes
+static uint8_t RxTrigger(void) {
+	static const uint8_t trig[4] = {1, 4, 8, 14};
+
+	return trig[d.reg[UART_REG_FCR]>>6];
+}
+
+// RTS output state, as seen by the peer
+static int RtsActive(void) {
+	uint8_t mcr = d.reg[UART_REG_MCR];
+
+	if (!(mcr & UART_MCR__RTS)) return 0;
+	if (!(mcr & UART_MCR__AFE)) return 1;
+	return d.rtsAuto;
+}
+
+static void RxPut(uint8_t c) {
+	if (RingPut(&d.rxFifo, c)) {
+		d.lsrErr |= UART_LSR__OE;
+		d.st.rxOvr++;
+	}
+	// Auto-RTS: deassert when reaching trigger level
+	if (d.rxFifo.count >= RxTrigger()) d.rtsAuto = 0;
+}
+
+static void TxLoad(uint64_t start) {
+	if (d.txFifo.count) {
+		d.txShift = RingGet(&d.txFifo);
+		d.txBusy = 1;
+		d.txDone = start + CharNs();
+	} else {
+		d.txBusy = 0;
+	}
+}
+
+static void RxStart(uint64_t start) {
+	if (d.peerTx.count && !Loopback() && (!d.peerFlow || RtsActive())) {
+		d.rxBusy = 1;
+		d.rxDone = start + CharNs();
+	} else {
+		d.rxBusy = 0;
+	}
+}
+
+// Processes line events (in time order) up to current virtual time
+static void Advance(void) {
+	uint64_t t;
+
+	while (1) {
+		if (d.txBusy && (!d.rxBusy || d.txDone <= d.rxDone)) {
+			if ((t = d.txDone) > d.now) break;
+			if (Loopback()) {
+				RxPut(d.txShift);
+			} else if (RingPut(&d.peerRx, d.txShift)) {
+				d.st.peerOvf++;
+			}
+			TxLoad(t);
+		} else if (d.rxBusy) {
+			if ((t = d.rxDone) > d.now) break;
+			RxPut(RingGet(&d.peerTx));
+			RxStart(t);
+		} else {
+			break;
+		}
+	}
+}
+
+static int Pal(void) {
+	return UartSimMdVersion() & UART_MD_VERSION__PAL;
+}
+
+static uint32_t LineNs(void) {
+	return Pal()?UART_SIM_LINE_NS_PAL:UART_SIM_LINE_NS_NTSC;
+}
+
+static uint16_t FrameLines(void) {
+	return Pal()?UART_SIM_LINES_PAL:UART_SIM_LINES_NTSC;
+}
+
+// Time of the first emulated interrupt after t: every intLines scanlines of
+// the active display (horizontal interrupts), and on UART_SIM_VINT_LINE
+// (vertical interrupt)
+static uint64_t IntNext(uint64_t t) {
+	uint64_t line = t / LineNs() + 1;
+	uint16_t v = line % FrameLines();
+	uint64_t frame = line - v;
+
+	if (v > UART_SIM_VINT_LINE) {
+		frame += FrameLines();
+		v = 0;
+	}
+	v = (v + d.intLines - 1) / d.intLines * d.intLines;
+	if (!v) v = d.intLines;
+	if (v > UART_SIM_VINT_LINE) v = UART_SIM_VINT_LINE;
+
+	return (frame + v) * LineNs();
+}
+
+// Runs an emulated interrupt handler or coprocessor round due at time at.
+// Returns the time it took.
+static uint64_t HandlerRun(void (*handler)(void), uint64_t at) {
+	uint64_t start = MAX(d.now, at);
+
+	d.now = start;
+	Advance();
+	d.inInt = 1;
+	handler();
+	d.inInt = 0;
+
+	return d.now - start;
+}
+
+// Advances virtual time to t, running the interrupts and coprocessor rounds
+// due. Time spent in them delays the interrupted code.
+static void TimeTo(uint64_t t) {
+	while (!d.inInt) {
+		if (d.intHandler && d.intNext <= t &&
+				(!d.copHandler || d.intNext <= d.copNext)) {
+			t += HandlerRun(d.intHandler, d.intNext);
+			d.intNext = IntNext(d.now);
+		} else if (d.copHandler && d.copNext <= t) {
+			d.inCop = 1;
+			t += HandlerRun(d.copHandler, d.copNext);
+			d.inCop = 0;
+			d.copNext = d.now + d.copNs;
+		} else {
+			break;
+		}
+	}
+	d.now = MAX(d.now, t);
+	Advance();
+}
+
+// Wall clock time, in ns
+static uint64_t WallNs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+}
+
+// Writes to the peer file descriptor the data sent by the UART, and queues
+// for the peer to send the data read from it. The peer runs in real time,
+// so virtual time is not allowed to fall behind wall time.
+static void PeerPump(void) {
+	uint8_t buf[UART_SIM_PEER_BUFLEN];
+	struct pollfd pfd = {peerFd, POLLOUT, 0};
+	uint64_t t;
+	uint16_t len, i;
+	ssize_t n;
+
+	if (peerFd < 0) return;
+	if ((t = WallNs() - peerT0) > d.now) TimeTo(t);
+	for (len = 0; d.peerRx.count; len++) buf[len] = RingGet(&d.peerRx);
+	for (i = 0; i < len; i += n) {
+		if ((n = write(peerFd, buf + i, len - i)) <= 0) {
+			n = 0;
+			poll(&pfd, 1, 100);
+		}
+	}
+	len = d.peerTx.size - d.peerTx.count;
+	if (len && (n = read(peerFd, buf, len)) > 0) {
+		for (i = 0; i < n; i++) RingPut(&d.peerTx, buf[i]);
+		if (!d.rxBusy) RxStart(d.now);
+	}
+}
+
+static void Tick(void) {
+	TimeTo(d.now + (d.inCop?d.copAccessNs:d.accessNs));
+}
+
+/************************************************************************//**
+ * \brief Resets the simulation. Must be called before UartInit().
+ *
+ * \param[in] clk      Clock applied to the simulated chip (Hz).
+ * \param[in] accessNs Virtual time consumed by each register access (ns).
+ ****************************************************************************/
+void UartSimReset(uint32_t clk, uint32_t accessNs) {
+	memset(&d, 0, sizeof(d));
+	d.clk = clk;
+	d.accessNs = accessNs;
+	d.dll = 1;
+	d.rtsAuto = 1;
+	RingInit(&d.txFifo, d.txFifoBuf, UART_SIM_FIFO_LEN);
+	RingInit(&d.rxFifo, d.rxFifoBuf, UART_SIM_FIFO_LEN);
+	RingInit(&d.peerTx, d.peerTxBuf, UART_SIM_PEER_BUFLEN);
+	RingInit(&d.peerRx, d.peerRxBuf, UART_SIM_PEER_BUFLEN);
+}
+
+/************************************************************************//**
+ * \brief Overrides the line rate derived from the programmed divisor.
+ *
+ * \param[in] baud Line rate in bits per second. 0 to use the programmed
+ *            divisor.
+ ****************************************************************************/
+void UartSimBaudSet(uint32_t baud) {
+	d.baud = baud;
+}
+
+/************************************************************************//**
+ * \brief Sets whether the peer honours the UART RTS output (i.e. the peer
+ *        has CTS flow control enabled) before sending each byte.
+ *
+ * \param[in] enable Nonzero to enable peer flow control.
+ ****************************************************************************/
+void UartSimPeerFlowSet(uint8_t enable) {
+	d.peerFlow = enable;
+	if (!d.rxBusy) RxStart(d.now);
+}
+
+/************************************************************************//**
+ * \brief Reads the Megadrive version register. The PAL bit is derived from
+ *        the clock set with UartSimReset().
+ *
+ * \return Version register value.
+ ****************************************************************************/
+uint8_t UartSimMdVersion(void) {
+	// Overseas model, PAL if clock is nearer the PAL one
+	return 0x80 | (d.clk < (UART_CLK_PAL + UART_CLK_NTSC) / 2?
+			UART_MD_VERSION__PAL:0);
+}
+
+/************************************************************************//**
+ * \brief Reads the VDP H/V counter, derived from the virtual time. The V
+ *        counter jumps back during the vertical blanking as in the real
+ *        hardware.
+ *
+ * \return H/V counter value (V counter on the high byte).
+ ****************************************************************************/
+uint16_t UartSimHvCnt(void) {
+	uint32_t lineNs = LineNs();
+	uint16_t lines = FrameLines();
+	// Last V counter value before jumping back
+	uint16_t jump = Pal()?0x102:0xEA;
+	uint64_t total = d.now / lineNs;
+	uint16_t v = total % lines;
+	// Scanlines start when the V counter is incremented, at HV_H_VINC
+	uint16_t h = (d.now % lineNs) * HV_H_STEPS / lineNs + HV_H_VINC;
+
+	Tick();
+	if (h >= HV_H_STEPS) h -= HV_H_STEPS;
+	if (h > HV_H_JUMP) h += HV_H_SKIP;
+	if (v > jump) v -= lines - 256;
+	return ((v & 0xFF)<<8) | h;
+}
+
+/************************************************************************//**
+ * \brief Returns the number of vertical interrupts (triggered on line 224)
+ *        elapsed, derived from the virtual time.
+ *
+ * \return Frame counter value.
+ ****************************************************************************/
+uint16_t UartSimFrameCnt(void) {
+	uint16_t lines = FrameLines();
+
+	return (d.now / LineNs() + lines - UART_SIM_VINT_LINE) / lines;
+}
+
+/************************************************************************//**
+ * \brief Reads a simulated register.
+ *
+ * \param[in] off Register offset from UART_BASE.
+ * \return Register value.
+ ****************************************************************************/
+uint8_t UartSimRd(uint8_t off) {
+	uint8_t val;
+	int dlab = d.reg[UART_REG_LCR] & 0x80;
+
+	Tick();
+	switch (off) {
+		case UART_REG_RHR:
+			if (dlab) return d.dll;
+			d.st.rhrRd++;
+			val = RingGet(&d.rxFifo);
+			// Auto-RTS: assert again when FIFO is emptied
+			if (!d.rxFifo.count && !d.rtsAuto) {
+				d.rtsAuto = 1;
+				if (!d.rxBusy) RxStart(d.now);
+			}
+			return val;
+
+		case UART_REG_IER:
+			if (dlab) return d.dlm;
+			return d.reg[off];
+
+		case UART_REG_ISR:
+			// FIFOs enabled, no interrupt pending
+			return 0xC1;
+
+		case UART_REG_LSR:
+			PeerPump();
+			d.st.lsrRd++;
+			val = d.lsrErr;
+			d.lsrErr = 0;
+			if (d.rxFifo.count) val |= UART_LSR__DR;
+			if (!d.txFifo.count) val |= UART_LSR__THRE;
+			if (!d.txFifo.count && !d.txBusy) val |= UART_LSR__TEMT;
+			return val;
+
+		case UART_REG_MSR:
+			return 0;
+
+		default:
+			return d.reg[off & 0x0F];
+	}
+}
+
+/************************************************************************//**
+ * \brief Writes a simulated register.
+ *
+ * \param[in] off Register offset from UART_BASE.
+ * \param[in] val Value to write.
+ ****************************************************************************/
+void UartSimWr(uint8_t off, uint8_t val) {
+	int dlab = d.reg[UART_REG_LCR] & 0x80;
+
+	Tick();
+	switch (off) {
+		case UART_REG_THR:
+			if (dlab) {
+				d.dll = val;
+				break;
+			}
+			d.st.thrWr++;
+			if (RingPut(&d.txFifo, val)) d.st.txOvf++;
+			if (!d.txBusy) TxLoad(d.now);
+			break;
+
+		case UART_REG_IER:
+			if (dlab) d.dlm = val;
+			else d.reg[off] = val;
+			break;
+
+		case UART_REG_FCR:
+			if (val & UART_FCR__RX_RST) d.rxFifo.count = 0;
+			if (val & UART_FCR__TX_RST) d.txFifo.count = 0;
+			d.reg[off] = val & ~(UART_FCR__RX_RST | UART_FCR__TX_RST);
+			break;
+
+		case UART_REG_MCR:
+			d.reg[off] = val;
+			if (!d.rxBusy) RxStart(d.now);
+			break;
+
+		default:
+			d.reg[off & 0x0F] = val;
+	}
+}
+
+/************************************************************************//**
+ * \brief Returns the current virtual time.
+ *
+ * \return Virtual time in nanoseconds since last UartSimReset().
+ ****************************************************************************/
+uint64_t UartSimNow(void) {
+	return d.now;
+}
+
+/************************************************************************//**
+ * \brief Advances virtual time without accessing any register.
+ *
+ * \param[in] ns Nanoseconds to advance.
+ ****************************************************************************/
+void UartSimIdle(uint64_t ns) {
+	TimeTo(d.now + ns);
+	PeerPump();
+}
+
+/************************************************************************//**
+ * \brief Emulates the VDP interrupts: calls a handler every few scanlines of
+ *        the active display (horizontal interrupt) and on the line the
+ *        vertical interrupt is triggered. The handler runs in virtual time,
+ *        delaying the interrupted code, and is not interrupted again.
+ *
+ * \param[in] handler Interrupt handler, or NULL to disable interrupts.
+ * \param[in] lines   Scanlines between horizontal interrupts.
+ ****************************************************************************/
+void UartSimIntSet(void (*handler)(void), uint16_t lines) {
+	d.intHandler = handler;
+	d.intLines = lines?lines:1;
+	d.intNext = IntNext(d.now);
+}
+
+/************************************************************************//**
+ * \brief Emulates a coprocessor (e.g. the Z80) polling the UART: calls a
+ *        handler every period of virtual time. Each register access from
+ *        the handler takes accessNs, delaying the interrupted code as the
+ *        coprocessor takes its bus.
+ *
+ * \param[in] handler  Coprocessor polling round, or NULL to disable it.
+ * \param[in] periodNs Virtual time between rounds (ns).
+ * \param[in] accessNs Virtual time consumed by each register access (ns).
+ ****************************************************************************/
+void UartSimCopSet(void (*handler)(void), uint32_t periodNs,
+		uint32_t accessNs) {
+	d.copHandler = handler;
+	d.copNs = periodNs;
+	d.copAccessNs = accessNs;
+	d.copNext = d.now + periodNs;
+}
+
+/************************************************************************//**
+ * \brief Queues data for the peer to send to the simulated UART. Data is
+ *        sent back to back at the configured line rate.
+ *
+ * \param[in] data Data to send.
+ * \param[in] len  Length of the data to send.
+ *
+ * \return Number of bytes queued (less than len if the queue is full).
+ ****************************************************************************/
+uint16_t UartSimPeerSend(const uint8_t *data, uint16_t len) {
+	uint16_t i;
+
+	for (i = 0; i < len; i++) {
+		if (RingPut(&d.peerTx, data[i])) break;
+	}
+	if (!d.rxBusy) RxStart(d.now);
+
+	return i;
+}
+
+/************************************************************************//**
+ * \brief Obtains data sent by the simulated UART to the peer.
+ *
+ * \param[out] buf Buffer to store received data. If NULL, data is
+ *             discarded.
+ * \param[in]  max Maximum number of bytes to obtain.
+ *
+ * \return Number of bytes obtained.
+ ****************************************************************************/
+uint16_t UartSimPeerRecv(uint8_t *buf, uint16_t max) {
+	uint16_t i;
+
+	for (i = 0; i < max && d.peerRx.count; i++) {
+		if (buf) buf[i] = RingGet(&d.peerRx);
+		else RingGet(&d.peerRx);
+	}
+
+	return i;
+}
+
+/************************************************************************//**
+ * \brief Connects the peer to a file descriptor (e.g. a pseudo-terminal with
+ *        a MegaWiFi firmware stand-in on the other end). Data sent by the
+ *        UART is written to it, and data read from it is sent to the UART
+ *        at the configured line rate. Data is exchanged each time the LSR
+ *        is read or virtual time advances without accessing registers.
+ *        While attached, virtual time advances at least as fast as wall
+ *        time.
+ *
+ * \param[in] fd File descriptor, or -1 to disconnect it. It is set to
+ *            non-blocking mode.
+ ****************************************************************************/
+void UartSimPeerFdSet(int fd) {
+	if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	peerFd = fd;
+	peerT0 = WallNs() - d.now;
+}
+
+/************************************************************************//**
+ * \brief Gets the simulation counters.
+ *
+ * \return Pointer to the simulation counters.
+ ****************************************************************************/
+const UartSimStats *UartSimStatsGet(void) {
+	return &d.st;
+}
+
@@ -0,0 +1,205 @@
+/************************************************************************//**
+ * \brief Simulated 16C550 UART, used to build and benchmark the mw library
+ *        on a host machine.
+ *
+ * The simulation models the THR/RHR registers, the 16-byte TX and RX FIFOs
+ * and their trigger levels, the LSR DR, OE, THRE and TEMT bits, the MCR
+ * loopback mode, auto-RTS flow control and the line rate derived from the
+ * programmed divisor. Time is virtual: each register access advances the
+ * simulation clock by a configurable amount, that approximates the cost of
+ * the 68000 bus cycles and surrounding code.
+ *
+ * The other end of the serial line is a peer that can queue bytes to be
+ * received by the UART, and that captures the bytes the UART transmits.
+ *
+ * \defgroup uart-sim Simulated 16C550 UART
+ * \{
+ ****************************************************************************/
+
+#ifndef _UART_SIM_H_
+#define _UART_SIM_H_
+
+#include <stdint.h>
+
+/// Default clock applied to the simulated chip (PAL console).
+#define UART_SIM_CLK_DEF		7610000LU
+
+/// Default virtual time consumed by each register access, in nanoseconds.
+#define UART_SIM_ACCESS_NS_DEF	3000
+
+/// Length of the simulated RX and TX FIFOs.
+#define UART_SIM_FIFO_LEN		16
+
+/// Scanline duration on NTSC machines, in nanoseconds.
+#define UART_SIM_LINE_NS_NTSC	63556
+/// Scanline duration on PAL machines, in nanoseconds.
+#define UART_SIM_LINE_NS_PAL	64000
+/// Scanlines per frame on NTSC machines.
+#define UART_SIM_LINES_NTSC		262
+/// Scanlines per frame on PAL machines.
+#define UART_SIM_LINES_PAL		313
+
+/// Length of the peer transmit and capture buffers.
+#define UART_SIM_PEER_BUFLEN	8192
+
+/// Counters updated by the simulation.
+typedef struct {
+	uint32_t lsrRd;		///< LSR register reads
+	uint32_t rhrRd;		///< RHR register reads
+	uint32_t thrWr;		///< THR register writes
+	uint32_t txOvf;		///< Bytes written to THR with a full TX FIFO
+	uint32_t rxOvr;		///< Bytes lost because of RX FIFO overruns
+	uint32_t peerOvf;	///< Bytes lost because peer capture buffer was full
+} UartSimStats;
+
+/************************************************************************//**
+ * \brief Resets the simulation. Must be called before UartInit().
+ *
+ * \param[in] clk      Clock applied to the simulated chip (Hz).
+ * \param[in] accessNs Virtual time consumed by each register access (ns).
+ ****************************************************************************/
+void UartSimReset(uint32_t clk, uint32_t accessNs);
+
+/************************************************************************//**
+ * \brief Overrides the line rate derived from the programmed divisor.
+ *
+ * \param[in] baud Line rate in bits per second. 0 to use the programmed
+ *            divisor.
+ ****************************************************************************/
+void UartSimBaudSet(uint32_t baud);
+
+/************************************************************************//**
+ * \brief Sets whether the peer honours the UART RTS output (i.e. the peer
+ *        has CTS flow control enabled) before sending each byte.
+ *
+ * \param[in] enable Nonzero to enable peer flow control.
+ ****************************************************************************/
+void UartSimPeerFlowSet(uint8_t enable);
+
+/************************************************************************//**
+ * \brief Reads the Megadrive version register. The PAL bit is derived from
+ *        the clock set with UartSimReset().
+ *
+ * \return Version register value.
+ ****************************************************************************/
+uint8_t UartSimMdVersion(void);
+
+/************************************************************************//**
+ * \brief Reads the VDP H/V counter, derived from the virtual time. The V
+ *        counter jumps back during the vertical blanking, and the H counter
+ *        jumps ahead and increments the V counter at HV_H_VINC, as in the
+ *        real hardware.
+ *
+ * \return H/V counter value (V counter on the high byte).
+ ****************************************************************************/
+uint16_t UartSimHvCnt(void);
+
+/************************************************************************//**
+ * \brief Returns the number of vertical interrupts (triggered on line 224)
+ *        elapsed, derived from the virtual time.
+ *
+ * \return Frame counter value.
+ ****************************************************************************/
+uint16_t UartSimFrameCnt(void);
+
+/************************************************************************//**
+ * \brief Reads a simulated register.
+ *
+ * \param[in] off Register offset from UART_BASE.
+ * \return Register value.
+ ****************************************************************************/
+uint8_t UartSimRd(uint8_t off);
+
+/************************************************************************//**
+ * \brief Writes a simulated register.
+ *
+ * \param[in] off Register offset from UART_BASE.
+ * \param[in] val Value to write.
+ ****************************************************************************/
+void UartSimWr(uint8_t off, uint8_t val);
+
+/************************************************************************//**
+ * \brief Returns the current virtual time.
+ *
+ * \return Virtual time in nanoseconds since last UartSimReset().
+ ****************************************************************************/
+uint64_t UartSimNow(void);
+
+/************************************************************************//**
+ * \brief Advances virtual time without accessing any register.
+ *
+ * \param[in] ns Nanoseconds to advance.
+ ****************************************************************************/
+void UartSimIdle(uint64_t ns);
+
+/************************************************************************//**
+ * \brief Emulates the VDP interrupts: calls a handler every few scanlines of
+ *        the active display (horizontal interrupt) and on the line the
+ *        vertical interrupt is triggered. The handler runs in virtual time,
+ *        delaying the interrupted code, and is not interrupted again.
+ *
+ * \param[in] handler Interrupt handler, or NULL to disable interrupts.
+ * \param[in] lines   Scanlines between horizontal interrupts.
+ ****************************************************************************/
+void UartSimIntSet(void (*handler)(void), uint16_t lines);
+
+/************************************************************************//**
+ * \brief Emulates a coprocessor (e.g. the Z80) polling the UART: calls a
+ *        handler every period of virtual time. Each register access from
+ *        the handler takes accessNs, delaying the interrupted code as the
+ *        coprocessor takes its bus.
+ *
+ * \param[in] handler  Coprocessor polling round, or NULL to disable it.
+ * \param[in] periodNs Virtual time between rounds (ns).
+ * \param[in] accessNs Virtual time consumed by each register access (ns).
+ ****************************************************************************/
+void UartSimCopSet(void (*handler)(void), uint32_t periodNs,
+		uint32_t accessNs);
+
+/************************************************************************//**
+ * \brief Queues data for the peer to send to the simulated UART. Data is
+ *        sent back to back at the configured line rate.
+ *
+ * \param[in] data Data to send.
+ * \param[in] len  Length of the data to send.
+ *
+ * \return Number of bytes queued (less than len if the queue is full).
+ ****************************************************************************/
+uint16_t UartSimPeerSend(const uint8_t *data, uint16_t len);
+
+/************************************************************************//**
+ * \brief Obtains data sent by the simulated UART to the peer.
+ *
+ * \param[out] buf Buffer to store received data. If NULL, data is
+ *             discarded.
+ * \param[in]  max Maximum number of bytes to obtain.
+ *
+ * \return Number of bytes obtained.
+ ****************************************************************************/
+uint16_t UartSimPeerRecv(uint8_t *buf, uint16_t max);
+
+/************************************************************************//**
+ * \brief Connects the peer to a file descriptor (e.g. a pseudo-terminal with
+ *        a MegaWiFi firmware stand-in on the other end). Data sent by the
+ *        UART is written to it, and data read from it is sent to the UART
+ *        at the configured line rate. Data is exchanged each time the LSR
+ *        is read or virtual time advances without accessing registers.
+ *        While attached, virtual time advances at least as fast as wall
+ *        time.
+ *
+ * \param[in] fd File descriptor, or -1 to disconnect it. It is set to
+ *            non-blocking mode.
+ ****************************************************************************/
+void UartSimPeerFdSet(int fd);
+
+/************************************************************************//**
+ * \brief Gets the simulation counters.
+ *
+ * \return Pointer to the simulation counters.
+ ****************************************************************************/
+const UartSimStats *UartSimStatsGet(void);
+
+#endif /*_UART_SIM_H_*/
+
+/** \} */
+
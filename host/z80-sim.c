@@ -0,0 +1,962 @@
+/************************************************************************//**
+ * \brief Z80 for host builds. See z80-sim.h for details.
+ ****************************************************************************/
+#include <string.h>
+#include "z80-sim.h"
+#include "uart-sim.h"
+#include "16c550.h"
+#include "z80.h"
+
+/// \name Flag bits
+/// \{
+#define F_C		0x01
+#define F_N		0x02
+#define F_PV	0x04
+#define F_X		0x08
+#define F_H		0x10
+#define F_Y		0x20
+#define F_Z		0x40
+#define F_S		0x80
+/// Undocumented bits, copied from results
+#define F_XY	(F_X | F_Y)
+/// \}
+
+/// \name Z80 memory map
+/// \{
+#define Z80_SIM_YM_ADDR		0x4000
+#define Z80_SIM_BANK_ADDR	0x6000
+#define Z80_SIM_BANK_END	0x6100
+#define Z80_SIM_WIN_ADDR	0x8000
+/// Bank register bits
+#define Z80_SIM_BANK_MASK	0x1FF
+/// \}
+
+/// High byte of a register pair
+#define HI(rr)		((uint8_t)((rr)>>8))
+/// Low byte of a register pair
+#define LO(rr)		((uint8_t)(rr))
+
+/** \addtogroup z80-sim Z80SimData Local data required by the module.
+ *  \{ */
+typedef struct {
+	uint8_t ram[Z80_RAM_LEN];	///< Z80 RAM
+	uint16_t af, bc, de, hl;	///< Main registers
+	uint16_t af2, bc2, de2, hl2;///< Alternate registers
+	uint16_t ix, iy, sp, pc;	///< Index registers, SP and PC
+	uint16_t *xy;				///< HL, IX or IY, as selected by the prefix
+	uint8_t i, r;				///< Interrupt vector and refresh registers
+	uint8_t iff1, iff2;			///< Interrupt flip-flops
+	uint8_t im;					///< Interrupt mode
+	uint16_t bank;				///< 68000 bank window (address bits 23-15)
+	uint32_t clk;				///< Z80 clock
+	uint64_t base;				///< Virtual time cycles are counted from
+	uint64_t cycles;			///< T-states run since base
+	uint8_t busReq;				///< The 68000 holds the Z80 bus
+	uint8_t reset;				///< Z80 reset asserted
+} Z80SimData;
+/** \} */
+
+// Module global data
+static Z80SimData d = {.reset = 1};
+
+// Even parity
+static int Parity(uint8_t val) {
+	val ^= val>>4;
+	return !((0x6996>>(val & 0xF)) & 1);
+}
+
+// Sign, zero, parity and undocumented flags of a result
+static uint8_t FlagsSzp(uint8_t val) {
+	return (val & (F_S | F_XY)) | (val?0:F_Z) | (Parity(val)?F_PV:0);
+}
+
+static uint8_t MemRd(uint16_t addr) {
+	uint32_t m68kAddr;
+
+	if (addr < Z80_SIM_YM_ADDR) return d.ram[addr & (Z80_RAM_LEN - 1)];
+	if (addr < Z80_SIM_WIN_ADDR) return 0xFF;
+	m68kAddr = ((uint32_t)d.bank<<15) | (addr & 0x7FFF);
+	if (m68kAddr >= UART_BASE && m68kAddr < UART_BASE + 16) {
+		return UartSimRd(m68kAddr - UART_BASE);
+	}
+	return 0xFF;
+}
+
+static void MemWr(uint16_t addr, uint8_t val) {
+	uint32_t m68kAddr;
+
+	if (addr < Z80_SIM_YM_ADDR) {
+		d.ram[addr & (Z80_RAM_LEN - 1)] = val;
+	} else if (addr >= Z80_SIM_BANK_ADDR && addr < Z80_SIM_BANK_END) {
+		// Bank bits are written one by one, LSB first
+		d.bank = ((d.bank>>1) | ((val & 1)<<8)) & Z80_SIM_BANK_MASK;
+	} else if (addr >= Z80_SIM_WIN_ADDR) {
+		m68kAddr = ((uint32_t)d.bank<<15) | (addr & 0x7FFF);
+		if (m68kAddr >= UART_BASE && m68kAddr < UART_BASE + 16) {
+			UartSimWr(m68kAddr - UART_BASE, val);
+		}
+	}
+}
+
+static uint16_t MemRd16(uint16_t addr) {
+	return MemRd(addr) | (MemRd(addr + 1)<<8);
+}
+
+static void MemWr16(uint16_t addr, uint16_t val) {
+	MemWr(addr, LO(val));
+	MemWr(addr + 1, HI(val));
+}
+
+// Opcode fetch (M1 cycle)
+static uint8_t FetchOp(void) {
+	d.r = (d.r & 0x80) | ((d.r + 1) & 0x7F);
+	return MemRd(d.pc++);
+}
+
+static uint8_t Fetch(void) {
+	return MemRd(d.pc++);
+}
+
+static uint16_t Fetch16(void) {
+	uint16_t val = MemRd16(d.pc);
+
+	d.pc += 2;
+	return val;
+}
+
+static void Push(uint16_t val) {
+	d.sp -= 2;
+	MemWr16(d.sp, val);
+}
+
+static uint16_t Pop(void) {
+	uint16_t val = MemRd16(d.sp);
+
+	d.sp += 2;
+	return val;
+}
+
+static uint8_t A(void) {
+	return HI(d.af);
+}
+
+static uint8_t F(void) {
+	return LO(d.af);
+}
+
+static void ASet(uint8_t val) {
+	d.af = (val<<8) | F();
+}
+
+static void FSet(uint8_t val) {
+	d.af = (d.af & 0xFF00) | val;
+}
+
+// Evaluates condition code cc
+static int Cond(unsigned cc) {
+	static const uint8_t flag[4] = {F_Z, F_C, F_PV, F_S};
+	int set = (F() & flag[cc>>1]) != 0;
+
+	return (cc & 1)?set:!set;
+}
+
+// Register pair p (BC, DE, HL/IX/IY, SP)
+static uint16_t *Rp(unsigned p) {
+	uint16_t *rp[4] = {&d.bc, &d.de, d.xy, &d.sp};
+
+	return rp[p];
+}
+
+// Register pair p for PUSH and POP (BC, DE, HL/IX/IY, AF)
+static uint16_t *Rp2(unsigned p) {
+	uint16_t *rp[4] = {&d.bc, &d.de, d.xy, &d.af};
+
+	return rp[p];
+}
+
+// 8 bit register r (B, C, D, E, H, L, -, A). When idx is set, H and L are
+// the high and low halves of the prefixed index register.
+static uint8_t RegRd(unsigned r, int idx) {
+	uint16_t hl = idx?*d.xy:d.hl;
+
+	switch (r) {
+		case 0: return HI(d.bc);
+		case 1: return LO(d.bc);
+		case 2: return HI(d.de);
+		case 3: return LO(d.de);
+		case 4: return HI(hl);
+		case 5: return LO(hl);
+		default: return A();
+	}
+}
+
+static void RegWr(unsigned r, int idx, uint8_t val) {
+	uint16_t *hl = idx?d.xy:&d.hl;
+
+	switch (r) {
+		case 0: d.bc = (val<<8) | LO(d.bc); break;
+		case 1: d.bc = (d.bc & 0xFF00) | val; break;
+		case 2: d.de = (val<<8) | LO(d.de); break;
+		case 3: d.de = (d.de & 0xFF00) | val; break;
+		case 4: *hl = (val<<8) | LO(*hl); break;
+		case 5: *hl = (*hl & 0xFF00) | val; break;
+		default: ASet(val); break;
+	}
+}
+
+// Address of the (HL) operand. With a prefix, it is (IX+d) or (IY+d): the
+// displacement is fetched and the extra time accounted.
+static uint16_t HlAddr(void) {
+	if (d.xy == &d.hl) return d.hl;
+	d.cycles += 8;
+	return *d.xy + (int8_t)Fetch();
+}
+
+// 8 bit arithmetic and logic operation op (ADD, ADC, SUB, SBC, AND, XOR,
+// OR, CP) of A with val
+static void Alu(unsigned op, uint8_t val) {
+	uint8_t a = A();
+	uint8_t c = (op == 1 || op == 3)?(F() & F_C):0;
+	unsigned res;
+	uint8_t f;
+
+	switch (op) {
+		case 0:
+		case 1:
+			res = a + val + c;
+			f = ((a ^ val ^ res) & F_H) | ((res>>8) & F_C) |
+				((~(a ^ val) & (a ^ res) & 0x80)?F_PV:0);
+			break;
+
+		case 2:
+		case 3:
+		case 7:
+			res = a - val - c;
+			f = ((a ^ val ^ res) & F_H) | ((res>>8) & F_C) | F_N |
+				(((a ^ val) & (a ^ res) & 0x80)?F_PV:0);
+			break;
+
+		case 4:
+			res = a & val;
+			FSet(FlagsSzp(res) | F_H);
+			ASet(res);
+			return;
+
+		case 5:
+			res = a ^ val;
+			FSet(FlagsSzp(res));
+			ASet(res);
+			return;
+
+		default:
+			res = a | val;
+			FSet(FlagsSzp(res));
+			ASet(res);
+			return;
+	}
+	f |= (res & F_S) | ((uint8_t)res?0:F_Z);
+	if (7 == op) {
+		// CP takes the undocumented flags from the operand
+		FSet(f | (val & F_XY));
+	} else {
+		FSet(f | (res & F_XY));
+		ASet(res);
+	}
+}
+
+static uint8_t Inc(uint8_t val) {
+	uint8_t res = val + 1;
+
+	FSet((F() & F_C) | (res & (F_S | F_XY)) | (res?0:F_Z) |
+			((res & 0xF)?0:F_H) | ((0x80 == res)?F_PV:0));
+	return res;
+}
+
+static uint8_t Dec(uint8_t val) {
+	uint8_t res = val - 1;
+
+	FSet((F() & F_C) | (res & (F_S | F_XY)) | (res?0:F_Z) | F_N |
+			((0xF == (res & 0xF))?F_H:0) | ((0x7F == res)?F_PV:0));
+	return res;
+}
+
+static uint16_t Add16(uint16_t dst, uint16_t src) {
+	uint32_t res = dst + src;
+
+	FSet((F() & (F_S | F_Z | F_PV)) | ((res>>8) & F_XY) |
+			(((dst ^ src ^ res)>>8) & F_H) | ((res>>16) & F_C));
+	return res;
+}
+
+// ADC HL,rr (sub = 0) and SBC HL,rr (sub = 1)
+static void AdcSbc16(uint16_t src, int sub) {
+	uint16_t hl = d.hl;
+	uint32_t c = F() & F_C;
+	uint32_t res = sub?(uint32_t)hl - src - c:(uint32_t)hl + src + c;
+	uint16_t ov = sub?(hl ^ src) & (hl ^ res):~(hl ^ src) & (hl ^ res);
+
+	d.hl = res;
+	FSet(((res>>8) & (F_S | F_XY)) | ((uint16_t)res?0:F_Z) |
+			(((hl ^ src ^ res)>>8) & F_H) | ((ov & 0x8000)?F_PV:0) |
+			((res>>16) & F_C) | (sub?F_N:0));
+}
+
+// Rotate and shift operation op (RLC, RRC, RL, RR, SLA, SRA, SLL, SRL)
+static uint8_t Rot(unsigned op, uint8_t val) {
+	uint8_t c = F() & F_C;
+	uint8_t res, out;
+
+	switch (op) {
+		case 0: out = val>>7; res = (val<<1) | out; break;
+		case 1: out = val & 1; res = (val>>1) | (out<<7); break;
+		case 2: out = val>>7; res = (val<<1) | c; break;
+		case 3: out = val & 1; res = (val>>1) | (c<<7); break;
+		case 4: out = val>>7; res = val<<1; break;
+		case 5: out = val & 1; res = (val>>1) | (val & 0x80); break;
+		case 6: out = val>>7; res = (val<<1) | 1; break;
+		default: out = val & 1; res = val>>1; break;
+	}
+	FSet(FlagsSzp(res) | out);
+	return res;
+}
+
+static void Daa(void) {
+	uint8_t a = A();
+	uint8_t f = F();
+	uint8_t adj = 0;
+	uint8_t c = f & F_C;
+	uint8_t res;
+
+	if ((f & F_H) || (a & 0xF) > 9) adj = 0x06;
+	if (c || a > 0x99) {
+		adj |= 0x60;
+		c = F_C;
+	}
+	res = (f & F_N)?a - adj:a + adj;
+	FSet(FlagsSzp(res) | (f & F_N) | c | ((a ^ res) & F_H));
+	ASet(res);
+}
+
+// LDI, LDD, CPI, CPD and their repeating forms
+static void Block(unsigned y, unsigned z) {
+	int dir = (y & 1)?-1:1;
+	uint8_t val, res;
+	uint8_t f = F() & (F_S | F_Z | F_C);
+
+	d.cycles += 16;
+	switch (z) {
+		case 0:
+			val = MemRd(d.hl);
+			MemWr(d.de, val);
+			d.de += dir;
+			break;
+
+		case 1:
+			val = MemRd(d.hl);
+			res = A() - val;
+			f = (F() & F_C) | F_N | (res & F_S) | (res?0:F_Z) |
+				((A() ^ val ^ res) & F_H);
+			break;
+
+		case 2:
+			// INI, IND: ports read 0xFF
+			MemWr(d.hl, 0xFF);
+			d.bc -= 0x100;
+			d.hl += dir;
+			FSet(F_N | (HI(d.bc)?0:F_Z));
+			if (y >= 6 && HI(d.bc)) {
+				d.pc -= 2;
+				d.cycles += 5;
+			}
+			return;
+
+		default:
+			// OUTI, OUTD
+			MemRd(d.hl);
+			d.bc -= 0x100;
+			d.hl += dir;
+			FSet(F_N | (HI(d.bc)?0:F_Z));
+			if (y >= 6 && HI(d.bc)) {
+				d.pc -= 2;
+				d.cycles += 5;
+			}
+			return;
+	}
+	d.hl += dir;
+	d.bc--;
+	if (d.bc) f |= F_PV;
+	FSet(f);
+	// Repeat while BC is not zero (and, for CPIR/CPDR, no match)
+	if (y >= 6 && d.bc && !(1 == z && (f & F_Z))) {
+		d.pc -= 2;
+		d.cycles += 5;
+	}
+}
+
+// CB prefixed instructions. With an index prefix, the displacement comes
+// before the opcode, and the operand is always (IX+d) or (IY+d).
+static void OpCb(void) {
+	uint16_t addr = 0;
+	uint8_t op, val, res;
+	unsigned x, y, z;
+	int mem;
+
+	if (d.xy != &d.hl) {
+		addr = *d.xy + (int8_t)Fetch();
+		op = Fetch();
+	} else {
+		op = FetchOp();
+		addr = d.hl;
+	}
+	x = op>>6;
+	y = (op>>3) & 7;
+	z = op & 7;
+	mem = (6 == z) || (d.xy != &d.hl);
+	val = mem?MemRd(addr):RegRd(z, 0);
+
+	if (1 == x) {
+		// BIT
+		res = val & (1<<y);
+		FSet((F() & F_C) | F_H | (res & F_S) | (res?0:F_Z | F_PV) |
+				(val & F_XY));
+		d.cycles += (d.xy != &d.hl)?16:mem?12:8;
+		return;
+	}
+	switch (x) {
+		case 0: res = Rot(y, val); break;
+		case 2: res = val & ~(1<<y); break;
+		default: res = val | (1<<y); break;
+	}
+	if (mem) MemWr(addr, res);
+	// Indexed forms also copy the result to the register (undocumented)
+	if (6 != z) RegWr(z, 0, res);
+	d.cycles += (d.xy != &d.hl)?19:mem?15:8;
+}
+
+// ED prefixed instructions
+static void OpEd(void) {
+	uint8_t op = FetchOp();
+	unsigned x = op>>6;
+	unsigned y = (op>>3) & 7;
+	unsigned z = op & 7;
+	unsigned p = y>>1;
+	unsigned q = y & 1;
+	uint16_t *rp[4] = {&d.bc, &d.de, &d.hl, &d.sp};
+	uint8_t val;
+
+	if (2 == x && z <= 3 && y >= 4) {
+		Block(y, z);
+		return;
+	}
+	if (1 != x) {
+		// Invalid, executes as two NOPs
+		d.cycles += 8;
+		return;
+	}
+	switch (z) {
+		case 0:
+			// IN r,(C): ports read 0xFF
+			val = 0xFF;
+			FSet((F() & F_C) | FlagsSzp(val));
+			if (6 != y) RegWr(y, 0, val);
+			d.cycles += 12;
+			break;
+
+		case 1:
+			// OUT (C),r: no ports
+			d.cycles += 12;
+			break;
+
+		case 2:
+			AdcSbc16(*rp[p], !q);
+			d.cycles += 15;
+			break;
+
+		case 3:
+			if (q) *rp[p] = MemRd16(Fetch16());
+			else MemWr16(Fetch16(), *rp[p]);
+			d.cycles += 20;
+			break;
+
+		case 4:
+			val = A();
+			ASet(0);
+			Alu(2, val);
+			d.cycles += 8;
+			break;
+
+		case 5:
+			// RETN, RETI
+			d.iff1 = d.iff2;
+			d.pc = Pop();
+			d.cycles += 14;
+			break;
+
+		case 6:
+			d.im = (y & 3)?(y & 3) - 1:0;
+			d.cycles += 8;
+			break;
+
+		default:
+			d.cycles += 9;
+			switch (y) {
+				case 0: d.i = A(); break;
+				case 1: d.r = A(); break;
+				case 2:
+				case 3:
+					val = (2 == y)?d.i:d.r;
+					ASet(val);
+					FSet((F() & F_C) | (val & (F_S | F_XY)) | (val?0:F_Z) |
+							(d.iff2?F_PV:0));
+					break;
+
+				case 4:
+				case 5:
+					// RRD, RLD
+					val = MemRd(d.hl);
+					if (4 == y) {
+						MemWr(d.hl, (A()<<4) | (val>>4));
+						ASet((A() & 0xF0) | (val & 0xF));
+					} else {
+						MemWr(d.hl, (val<<4) | (A() & 0xF));
+						ASet((A() & 0xF0) | (val>>4));
+					}
+					FSet((F() & F_C) | FlagsSzp(A()));
+					d.cycles += 9;
+					break;
+
+				default:
+					d.cycles -= 1;
+					break;
+			}
+			break;
+	}
+}
+
+// Unprefixed instructions, and those using IX or IY when prefixed
+static void OpMain(uint8_t op) {
+	unsigned x = op>>6;
+	unsigned y = (op>>3) & 7;
+	unsigned z = op & 7;
+	unsigned p = y>>1;
+	unsigned q = y & 1;
+	int idx = d.xy != &d.hl;
+	uint16_t addr, tmp;
+	uint8_t val;
+
+	switch (x) {
+		case 0:
+			switch (z) {
+				case 0:
+					if (0 == y) {
+						d.cycles += 4;
+					} else if (1 == y) {
+						tmp = d.af;
+						d.af = d.af2;
+						d.af2 = tmp;
+						d.cycles += 4;
+					} else {
+						val = Fetch();
+						if (2 == y) {
+							d.bc -= 0x100;
+							if (!HI(d.bc)) {
+								d.cycles += 8;
+								break;
+							}
+							d.cycles += 1;
+						} else if (y >= 4 && !Cond(y - 4)) {
+							d.cycles += 7;
+							break;
+						}
+						d.pc += (int8_t)val;
+						d.cycles += 12;
+					}
+					break;
+
+				case 1:
+					if (q) {
+						*d.xy = Add16(*d.xy, *Rp(p));
+						d.cycles += 11;
+					} else {
+						*Rp(p) = Fetch16();
+						d.cycles += 10;
+					}
+					break;
+
+				case 2:
+					switch (p) {
+						case 0:
+						case 1:
+							addr = p?d.de:d.bc;
+							if (q) ASet(MemRd(addr));
+							else MemWr(addr, A());
+							d.cycles += 7;
+							break;
+
+						case 2:
+							addr = Fetch16();
+							if (q) *d.xy = MemRd16(addr);
+							else MemWr16(addr, *d.xy);
+							d.cycles += 16;
+							break;
+
+						default:
+							addr = Fetch16();
+							if (q) ASet(MemRd(addr));
+							else MemWr(addr, A());
+							d.cycles += 13;
+							break;
+					}
+					break;
+
+				case 3:
+					*Rp(p) += q?-1:1;
+					d.cycles += 6;
+					break;
+
+				case 4:
+				case 5:
+					if (6 == y) {
+						addr = HlAddr();
+						val = MemRd(addr);
+						MemWr(addr, (4 == z)?Inc(val):Dec(val));
+						d.cycles += 11;
+					} else {
+						val = RegRd(y, idx);
+						RegWr(y, idx, (4 == z)?Inc(val):Dec(val));
+						d.cycles += 4;
+					}
+					break;
+
+				case 6:
+					if (6 == y) {
+						if (idx) {
+							addr = *d.xy + (int8_t)Fetch();
+							d.cycles += 5;
+						} else {
+							addr = d.hl;
+						}
+						MemWr(addr, Fetch());
+						d.cycles += 10;
+					} else {
+						RegWr(y, idx, Fetch());
+						d.cycles += 7;
+					}
+					break;
+
+				default:
+					d.cycles += 4;
+					val = A();
+					switch (y) {
+						case 0:
+						case 1:
+						case 2:
+						case 3:
+							// RLCA, RRCA, RLA, RRA: as CB rotates, but
+							// S, Z and P/V are kept
+							tmp = F();
+							val = Rot(y, val);
+							FSet((tmp & (F_S | F_Z | F_PV)) | (val & F_XY) |
+									(F() & F_C));
+							ASet(val);
+							break;
+
+						case 4:
+							Daa();
+							break;
+
+						case 5:
+							val = ~val;
+							ASet(val);
+							FSet((F() & (F_S | F_Z | F_PV | F_C)) | F_H | F_N |
+									(val & F_XY));
+							break;
+
+						case 6:
+							FSet((F() & (F_S | F_Z | F_PV)) | (val & F_XY) |
+									F_C);
+							break;
+
+						default:
+							FSet(((F() & (F_S | F_Z | F_PV | F_C)) |
+									(val & F_XY) | ((F() & F_C)?F_H:0)) ^
+									F_C);
+							break;
+					}
+					break;
+			}
+			break;
+
+		case 1:
+			if (6 == y && 6 == z) {
+				// HALT runs again until an interrupt, that is never taken
+				d.pc--;
+				d.cycles += 4;
+			} else if (6 == z) {
+				RegWr(y, 0, MemRd(HlAddr()));
+				d.cycles += 7;
+			} else if (6 == y) {
+				addr = HlAddr();
+				MemWr(addr, RegRd(z, 0));
+				d.cycles += 7;
+			} else {
+				RegWr(y, idx, RegRd(z, idx));
+				d.cycles += 4;
+			}
+			break;
+
+		case 2:
+			if (6 == z) {
+				Alu(y, MemRd(HlAddr()));
+				d.cycles += 7;
+			} else {
+				Alu(y, RegRd(z, idx));
+				d.cycles += 4;
+			}
+			break;
+
+		default:
+			switch (z) {
+				case 0:
+					if (Cond(y)) {
+						d.pc = Pop();
+						d.cycles += 11;
+					} else {
+						d.cycles += 5;
+					}
+					break;
+
+				case 1:
+					if (!q) {
+						*Rp2(p) = Pop();
+						d.cycles += 10;
+					} else if (0 == p) {
+						d.pc = Pop();
+						d.cycles += 10;
+					} else if (1 == p) {
+						tmp = d.bc; d.bc = d.bc2; d.bc2 = tmp;
+						tmp = d.de; d.de = d.de2; d.de2 = tmp;
+						tmp = d.hl; d.hl = d.hl2; d.hl2 = tmp;
+						d.cycles += 4;
+					} else if (2 == p) {
+						d.pc = *d.xy;
+						d.cycles += 4;
+					} else {
+						d.sp = *d.xy;
+						d.cycles += 6;
+					}
+					break;
+
+				case 2:
+					addr = Fetch16();
+					if (Cond(y)) d.pc = addr;
+					d.cycles += 10;
+					break;
+
+				case 3:
+					switch (y) {
+						case 0:
+							d.pc = Fetch16();
+							d.cycles += 10;
+							break;
+
+						case 1:
+							OpCb();
+							break;
+
+						case 2:
+						case 3:
+							// OUT (n),A and IN A,(n): no ports
+							Fetch();
+							if (3 == y) ASet(0xFF);
+							d.cycles += 11;
+							break;
+
+						case 4:
+							tmp = MemRd16(d.sp);
+							MemWr16(d.sp, *d.xy);
+							*d.xy = tmp;
+							d.cycles += 19;
+							break;
+
+						case 5:
+							tmp = d.de;
+							d.de = d.hl;
+							d.hl = tmp;
+							d.cycles += 4;
+							break;
+
+						default:
+							d.iff1 = d.iff2 = (7 == y);
+							d.cycles += 4;
+							break;
+					}
+					break;
+
+				case 4:
+					addr = Fetch16();
+					if (Cond(y)) {
+						Push(d.pc);
+						d.pc = addr;
+						d.cycles += 17;
+					} else {
+						d.cycles += 10;
+					}
+					break;
+
+				case 5:
+					if (!q) {
+						Push(*Rp2(p));
+						d.cycles += 11;
+					} else if (0 == p) {
+						addr = Fetch16();
+						Push(d.pc);
+						d.pc = addr;
+						d.cycles += 17;
+					} else if (2 == p) {
+						OpEd();
+					}
+					// DD and FD are taken by Step()
+					break;
+
+				case 6:
+					Alu(y, Fetch());
+					d.cycles += 7;
+					break;
+
+				default:
+					Push(d.pc);
+					d.pc = y * 8;
+					d.cycles += 11;
+					break;
+			}
+			break;
+	}
+}
+
+// Runs an instruction
+static void Step(void) {
+	uint8_t op;
+
+	d.xy = &d.hl;
+	op = FetchOp();
+	// Each prefix takes 4 T-states, the last one selects the register
+	while (0xDD == op || 0xFD == op) {
+		d.xy = (0xDD == op)?&d.ix:&d.iy;
+		d.cycles += 4;
+		op = FetchOp();
+	}
+	// ED ignores the index prefix
+	if (0xED == op) d.xy = &d.hl;
+	OpMain(op);
+}
+
+// Register pair storage, indexed by Z80SimReg
+static uint16_t *RegPair(Z80SimReg reg) {
+	uint16_t *const pair[Z80_SIM_REG_MAX] = {
+		&d.af, &d.bc, &d.de, &d.hl, &d.af2, &d.bc2, &d.de2, &d.hl2,
+		&d.ix, &d.iy, &d.sp, &d.pc
+	};
+
+	return pair[reg];
+}
+
+// Virtual time of the Z80, in ns
+static uint64_t Now(void) {
+	return d.base + d.cycles * 1000000000LLU / d.clk;
+}
+
+// Restarts counting Z80 time from the current virtual time, as the Z80 has
+// been stopped until now
+static void TimeSync(void) {
+	d.base = UartSimNow();
+	d.cycles = 0;
+}
+
+// Runs the Z80 until it reaches the 68000 virtual time. Accesses to the
+// 68000 bus advance it, so this also keeps running as they are done.
+static void Z80SimRun(void) {
+	if (d.busReq) {
+		TimeSync();
+		return;
+	}
+	while (Now() < UartSimNow()) Step();
+}
+
+/************************************************************************//**
+ * \brief Returns the simulated Z80 RAM.
+ *
+ * \return Z80 RAM, Z80_RAM_LEN bytes long.
+ ****************************************************************************/
+uint8_t *Z80SimRam(void) {
+	return d.ram;
+}
+
+/************************************************************************//**
+ * \brief Takes or releases the Z80 bus. The Z80 does not run while the bus
+ *        is taken. Taking it advances virtual time Z80_SIM_BUSREQ_NS.
+ *
+ * \param[in] req Nonzero to take the bus, zero to release it.
+ ****************************************************************************/
+void Z80SimBusReq(uint8_t req) {
+	// The Z80 keeps running until the bus is granted
+	if (req) UartSimIdle(Z80_SIM_BUSREQ_NS);
+	else if (d.busReq) TimeSync();
+	d.busReq = req;
+}
+
+/************************************************************************//**
+ * \brief Asserts or releases the Z80 reset line. The Z80 starts running
+ *        from address 0 when reset is released.
+ *
+ * \param[in] reset Nonzero to assert reset, zero to release it.
+ ****************************************************************************/
+void Z80SimResetSet(uint8_t reset) {
+	if (reset) {
+		UartSimCopSet(NULL, 0, 0);
+	} else if (d.reset) {
+		d.pc = d.i = d.r = d.im = 0;
+		d.iff1 = d.iff2 = 0;
+		d.af = d.sp = 0xFFFF;
+		d.bank = 0;
+		d.clk = (UartSimMdVersion() & UART_MD_VERSION__PAL)?
+			Z80_SIM_CLK_PAL:Z80_SIM_CLK_NTSC;
+		TimeSync();
+		UartSimCopSet(Z80SimRun, Z80_SIM_SLICE_NS, Z80_SIM_ACCESS_NS);
+	}
+	d.reset = reset;
+}
+
+/************************************************************************//**
+ * \brief Runs a single instruction, outside the UART virtual time. Meant
+ *        for testing the core, with the Z80 held in reset.
+ *
+ * \return T-states taken by the instruction.
+ ****************************************************************************/
+uint32_t Z80SimStep(void) {
+	uint64_t start = d.cycles;
+
+	Step();
+	return d.cycles - start;
+}
+
+/************************************************************************//**
+ * \brief Obtains a register pair.
+ *
+ * \param[in] reg Register pair.
+ *
+ * \return Register pair value.
+ ****************************************************************************/
+uint16_t Z80SimRegGet(Z80SimReg reg) {
+	return *RegPair(reg);
+}
+
+/************************************************************************//**
+ * \brief Sets a register pair.
+ *
+ * \param[in] reg Register pair.
+ * \param[in] val Value to set.
+ ****************************************************************************/
+void Z80SimRegSet(Z80SimReg reg, uint16_t val) {
+	*RegPair(reg) = val;
+}
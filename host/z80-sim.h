@@ -0,0 +1,112 @@
+/************************************************************************//**
+ * \brief Z80 for host builds. Runs the code loaded to the simulated Z80 RAM
+ *        (the LSD Z80 reception driver, mw/lsdz80.s80) on a Z80 core,
+ *        counting the T-states of each instruction.
+ *
+ * The Z80 runs in the simulated UART virtual time: every Z80_SIM_SLICE_NS,
+ * it runs the instructions due since the previous slice. Accesses to the
+ * 68000 bus (through the bank window at 0x8000) stop the 68000 for
+ * Z80_SIM_ACCESS_NS each, and the UART registers are reachable this way.
+ * The Z80 does not run while the 68000 holds its bus or its reset line.
+ *
+ * The whole documented instruction set is interpreted, including the IX/IY
+ * forms. Interrupts are not emulated, and I/O ports read 0xFF.
+ *
+ * \defgroup z80-sim Z80 for host builds
+ * \{
+ ****************************************************************************/
+
+#ifndef _Z80_SIM_H_
+#define _Z80_SIM_H_
+
+#include <stdint.h>
+
+/// Z80 clock on PAL machines (Hz).
+#define Z80_SIM_CLK_PAL		3546894LU
+/// Z80 clock on NTSC machines (Hz).
+#define Z80_SIM_CLK_NTSC	3579545LU
+
+/// Virtual time between runs of the Z80, in nanoseconds. The Z80 lags the
+/// 68000 at most this time.
+#define Z80_SIM_SLICE_NS	2000
+
+/// Virtual time the 68000 is stopped by each Z80 access to its bus, in
+/// nanoseconds.
+#define Z80_SIM_ACCESS_NS	1000
+
+/// Virtual time the 68000 waits for the Z80 bus to be granted, in
+/// nanoseconds.
+#define Z80_SIM_BUSREQ_NS	2000
+
+/** \addtogroup z80-sim Z80SimReg Register pairs, for Z80SimRegGet() and
+ *  Z80SimRegSet().
+ *  \{ */
+typedef enum {
+	Z80_SIM_AF = 0,		///< AF
+	Z80_SIM_BC,			///< BC
+	Z80_SIM_DE,			///< DE
+	Z80_SIM_HL,			///< HL
+	Z80_SIM_AF2,		///< AF'
+	Z80_SIM_BC2,		///< BC'
+	Z80_SIM_DE2,		///< DE'
+	Z80_SIM_HL2,		///< HL'
+	Z80_SIM_IX,			///< IX
+	Z80_SIM_IY,			///< IY
+	Z80_SIM_SP,			///< SP
+	Z80_SIM_PC,			///< PC
+	Z80_SIM_REG_MAX		///< Number of register pairs
+} Z80SimReg;
+/** \} */
+
+/************************************************************************//**
+ * \brief Returns the simulated Z80 RAM.
+ *
+ * \return Z80 RAM, Z80_RAM_LEN bytes long.
+ ****************************************************************************/
+uint8_t *Z80SimRam(void);
+
+/************************************************************************//**
+ * \brief Takes or releases the Z80 bus. The Z80 does not run while the bus
+ *        is taken. Taking it advances virtual time Z80_SIM_BUSREQ_NS.
+ *
+ * \param[in] req Nonzero to take the bus, zero to release it.
+ ****************************************************************************/
+void Z80SimBusReq(uint8_t req);
+
+/************************************************************************//**
+ * \brief Asserts or releases the Z80 reset line. The Z80 starts running
+ *        from address 0 when reset is released.
+ *
+ * \param[in] reset Nonzero to assert reset, zero to release it.
+ ****************************************************************************/
+void Z80SimResetSet(uint8_t reset);
+
+/************************************************************************//**
+ * \brief Runs a single instruction, outside the UART virtual time. Meant
+ *        for testing the core, with the Z80 held in reset.
+ *
+ * \return T-states taken by the instruction.
+ ****************************************************************************/
+uint32_t Z80SimStep(void);
+
+/************************************************************************//**
+ * \brief Obtains a register pair.
+ *
+ * \param[in] reg Register pair.
+ *
+ * \return Register pair value.
+ ****************************************************************************/
+uint16_t Z80SimRegGet(Z80SimReg reg);
+
+/************************************************************************//**
+ * \brief Sets a register pair.
+ *
+ * \param[in] reg Register pair.
+ * \param[in] val Value to set.
+ ****************************************************************************/
+void Z80SimRegSet(Z80SimReg reg, uint16_t val);
+
+#endif /*_Z80_SIM_H_*/
+
+/** \} */
+
@@ -0,0 +1,521 @@
+/************************************************************************//**
+ * \brief Instruction tests for the Z80 core (host/z80-sim.c). Runs each
+ *        test code on the core, and checks the T-states taken by its first
+ *        instruction and the results against the Z80 CPU user manual.
+ *
+ * Test code is loaded at Z80_TEST_CODE and runs until its end. Memory at
+ * Z80_TEST_DATA holds the z80TestData bytes, SP starts at Z80_TEST_STACK
+ * and the other registers at zero, unless set by the test. Only the
+ * documented flags are checked, except for BIT, where S and P/V follow
+ * the result as on the real CPU.
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "z80-sim.h"
+#include "z80.h"
+
+/// Test code address.
+#define Z80_TEST_CODE		0x0100
+/// Test data address.
+#define Z80_TEST_DATA		0x1000
+/// Initial stack pointer.
+#define Z80_TEST_STACK		0x1F00
+/// Instructions run by a test before it is considered hung.
+#define Z80_TEST_STEPS		16
+
+/// Flag bits
+enum {
+	FC = 0x01, FN = 0x02, FPV = 0x04, FH = 0x10, FZ = 0x40, FS = 0x80
+};
+
+/// Documented flags, the ones checked
+#define Z80_TEST_FLAGS	(FS | FZ | FH | FPV | FN | FC)
+
+/** \addtogroup z80-test Z80TestLoc Locations set and checked by tests.
+ *  \{ */
+typedef enum {
+	NONE = 0,		///< Unused entry
+	AF, BC, DE, HL, AF2, BC2, DE2, HL2, IX, IY, SP, PC,
+	A,				///< Accumulator
+	F,				///< Documented flags
+	M0,				///< Word at Z80_TEST_DATA
+	M4				///< Word at Z80_TEST_DATA + 4
+} Z80TestLoc;
+/** \} */
+
+/// Value of a location
+typedef struct {
+	uint8_t loc;		///< Location (Z80TestLoc)
+	uint16_t val;		///< Value
+} Z80TestVal;
+
+/// Instruction test
+typedef struct {
+	const char *src;		///< Test code, the first instruction is timed
+	uint8_t len;			///< Machine code length
+	uint8_t code[6];		///< Machine code
+	uint8_t tstates;		///< T-states of the first instruction
+	Z80TestVal set[5];		///< Initial values
+	Z80TestVal chk[5];		///< Expected results
+} Z80Test;
+
+/// Data at Z80_TEST_DATA when each test starts
+static const uint8_t z80TestData[] = {
+	0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08
+};
+
+static const Z80Test z80Test[] = {
+	// 8 and 16 bit loads
+	{"ld a,0x12", 2, {0x3E, 0x12}, 7,
+		{},
+		{{A, 0x12}}},
+	{"ld b,a", 1, {0x47}, 4,
+		{{A, 0x55}},
+		{{BC, 0x5500}}},
+	{"ld hl,0x1234", 3, {0x21, 0x34, 0x12}, 10,
+		{},
+		{{HL, 0x1234}}},
+	{"ld a,(hl)", 1, {0x7E}, 7,
+		{{HL, 0x1000}},
+		{{A, 0x12}}},
+	{"ld (hl),0x99", 2, {0x36, 0x99}, 10,
+		{{HL, 0x1000}},
+		{{M0, 0x3499}}},
+	{"ld a,(bc)", 1, {0x0A}, 7,
+		{{BC, 0x1001}},
+		{{A, 0x34}}},
+	{"ld (de),a", 1, {0x12}, 7,
+		{{DE, 0x1000}, {A, 0x66}},
+		{{M0, 0x3466}}},
+	{"ld a,(0x1001)", 3, {0x3A, 0x01, 0x10}, 13,
+		{},
+		{{A, 0x34}}},
+	{"ld (0x1000),a", 3, {0x32, 0x00, 0x10}, 13,
+		{{A, 0x77}},
+		{{M0, 0x3477}}},
+	{"ld hl,(0x1000)", 3, {0x2A, 0x00, 0x10}, 16,
+		{},
+		{{HL, 0x3412}}},
+	{"ld (0x1000),hl", 3, {0x22, 0x00, 0x10}, 16,
+		{{HL, 0xBEEF}},
+		{{M0, 0xBEEF}}},
+	{"ld bc,(0x1000)", 4, {0xED, 0x4B, 0x00, 0x10}, 20,
+		{},
+		{{BC, 0x3412}}},
+	{"ld (0x1000),de", 4, {0xED, 0x53, 0x00, 0x10}, 20,
+		{{DE, 0xCAFE}},
+		{{M0, 0xCAFE}}},
+	{"ld (0x1000),sp", 4, {0xED, 0x73, 0x00, 0x10}, 20,
+		{},
+		{{M0, Z80_TEST_STACK}}},
+	{"ld sp,hl", 1, {0xF9}, 6,
+		{{HL, 0x1234}},
+		{{SP, 0x1234}}},
+	{"ld ix,0x1000", 4, {0xDD, 0x21, 0x00, 0x10}, 14,
+		{},
+		{{IX, 0x1000}}},
+	{"ld ix,(0x1000)", 4, {0xDD, 0x2A, 0x00, 0x10}, 20,
+		{},
+		{{IX, 0x3412}}},
+	{"ld sp,ix", 2, {0xDD, 0xF9}, 10,
+		{{IX, 0x1234}},
+		{{SP, 0x1234}}},
+	{"ld a,(ix+1)", 3, {0xDD, 0x7E, 0x01}, 19,
+		{{IX, 0x1000}},
+		{{A, 0x34}}},
+	{"ld h,(ix+1)", 3, {0xDD, 0x66, 0x01}, 19,
+		{{IX, 0x1000}},
+		{{HL, 0x3400}, {IX, 0x1000}}},
+	{"ld (ix+0),h", 3, {0xDD, 0x74, 0x00}, 19,
+		{{IX, 0x1000}, {HL, 0xAB00}},
+		{{M0, 0x34AB}}},
+	{"ld (iy-1),b", 3, {0xFD, 0x70, 0xFF}, 19,
+		{{IY, 0x1001}, {BC, 0x5500}},
+		{{M0, 0x3455}}},
+	{"ld (ix+0),0x42", 4, {0xDD, 0x36, 0x00, 0x42}, 19,
+		{{IX, 0x1000}},
+		{{M0, 0x3442}}},
+	{"ld a,i", 2, {0xED, 0x57}, 9,
+		{{A, 0x55}},
+		{{A, 0}, {F, FZ}}},
+
+	// Stack and exchanges
+	{"push bc", 1, {0xC5}, 11,
+		{{BC, 0xABCD}, {SP, 0x1002}},
+		{{SP, 0x1000}, {M0, 0xABCD}}},
+	{"pop de", 1, {0xD1}, 10,
+		{{SP, 0x1000}},
+		{{DE, 0x3412}, {SP, 0x1002}}},
+	{"push ix", 2, {0xDD, 0xE5}, 15,
+		{{IX, 0x1234}, {SP, 0x1002}},
+		{{SP, 0x1000}, {M0, 0x1234}}},
+	{"pop iy", 2, {0xFD, 0xE1}, 14,
+		{{SP, 0x1000}},
+		{{IY, 0x3412}, {SP, 0x1002}}},
+	{"push af", 1, {0xF5}, 11,
+		{{AF, 0x12D7}, {SP, 0x1002}},
+		{{M0, 0x12D7}}},
+	{"ex (sp),hl", 1, {0xE3}, 19,
+		{{SP, 0x1000}, {HL, 0xAAAA}},
+		{{HL, 0x3412}, {M0, 0xAAAA}}},
+	{"ex (sp),ix", 2, {0xDD, 0xE3}, 23,
+		{{SP, 0x1000}, {IX, 0x5555}},
+		{{IX, 0x3412}, {M0, 0x5555}}},
+	{"ex de,hl", 1, {0xEB}, 4,
+		{{DE, 1}, {HL, 2}},
+		{{DE, 2}, {HL, 1}}},
+	{"ex af,af'", 1, {0x08}, 4,
+		{{AF, 0x1234}, {AF2, 0x5678}},
+		{{AF, 0x5678}, {AF2, 0x1234}}},
+	{"exx", 1, {0xD9}, 4,
+		{{BC, 1}, {BC2, 2}, {HL, 3}, {HL2, 4}},
+		{{BC, 2}, {BC2, 1}, {HL, 4}, {HL2, 3}}},
+
+	// Block transfers and searches
+	{"ldi", 2, {0xED, 0xA0}, 16,
+		{{HL, 0x1000}, {DE, 0x1001}, {BC, 2}},
+		{{M0, 0x1212}, {HL, 0x1001}, {DE, 0x1002}, {BC, 1}, {F, FPV}}},
+	{"ldd", 2, {0xED, 0xA8}, 16,
+		{{HL, 0x1001}, {DE, 0x1005}, {BC, 1}},
+		{{M4, 0x349A}, {HL, 0x1000}, {DE, 0x1004}, {BC, 0}, {F, 0}}},
+	{"ldir", 2, {0xED, 0xB0}, 21,
+		{{HL, 0x1000}, {DE, 0x1004}, {BC, 2}},
+		{{M4, 0x3412}, {HL, 0x1002}, {DE, 0x1006}, {BC, 0}, {F, 0}}},
+	{"ldir", 2, {0xED, 0xB0}, 16,
+		{{HL, 0x1000}, {DE, 0x1004}, {BC, 1}},
+		{{M4, 0xBC12}, {BC, 0}}},
+	{"cpi", 2, {0xED, 0xA1}, 16,
+		{{A, 0x12}, {HL, 0x1000}, {BC, 1}},
+		{{HL, 0x1001}, {BC, 0}, {F, FZ | FN}}},
+	{"cpir", 2, {0xED, 0xB1}, 21,
+		{{A, 0x56}, {HL, 0x1000}, {BC, 8}},
+		{{HL, 0x1003}, {BC, 5}, {F, FZ | FPV | FN}}},
+	{"cpir", 2, {0xED, 0xB1}, 16,
+		{{A, 0x12}, {HL, 0x1000}, {BC, 8}},
+		{{HL, 0x1001}, {BC, 7}, {F, FZ | FPV | FN}}},
+
+	// 8 bit arithmetic and logic
+	{"add a,b", 1, {0x80}, 4,
+		{{A, 0x7F}, {BC, 0x0100}},
+		{{A, 0x80}, {F, FS | FH | FPV}}},
+	{"add a,a", 1, {0x87}, 4,
+		{{A, 0x88}},
+		{{A, 0x10}, {F, FH | FPV | FC}}},
+	{"add a,0xff", 2, {0xC6, 0xFF}, 7,
+		{{A, 1}},
+		{{A, 0}, {F, FZ | FH | FC}}},
+	{"adc a,(hl)", 1, {0x8E}, 7,
+		{{A, 0x10}, {F, FC}, {HL, 0x1000}},
+		{{A, 0x23}, {F, 0}}},
+	{"sub c", 1, {0x91}, 4,
+		{{A, 0x10}, {BC, 0x0001}},
+		{{A, 0x0F}, {F, FH | FN}}},
+	{"sub (hl)", 1, {0x96}, 7,
+		{{A, 0x12}, {HL, 0x1000}},
+		{{A, 0}, {F, FZ | FN}}},
+	{"sbc a,0x01", 2, {0xDE, 0x01}, 7,
+		{{A, 0}, {F, FC}},
+		{{A, 0xFE}, {F, FS | FH | FN | FC}}},
+	{"sub 0x01", 2, {0xD6, 0x01}, 7,
+		{{A, 0x80}},
+		{{A, 0x7F}, {F, FH | FPV | FN}}},
+	{"cp 0x12", 2, {0xFE, 0x12}, 7,
+		{{A, 0x12}},
+		{{A, 0x12}, {F, FZ | FN}}},
+	{"cp (ix+2)", 3, {0xDD, 0xBE, 0x02}, 19,
+		{{A, 0x50}, {IX, 0x1000}},
+		{{A, 0x50}, {F, FS | FH | FN | FC}}},
+	{"and 0x0f", 2, {0xE6, 0x0F}, 7,
+		{{A, 0x3C}, {F, FC}},
+		{{A, 0x0C}, {F, FH | FPV}}},
+	{"or b", 1, {0xB0}, 4,
+		{{A, 0x80}, {BC, 0x0100}},
+		{{A, 0x81}, {F, FS | FPV}}},
+	{"xor a", 1, {0xAF}, 4,
+		{{A, 0x55}, {F, FC}},
+		{{A, 0}, {F, FZ | FPV}}},
+	{"inc a", 1, {0x3C}, 4,
+		{{A, 0x7F}},
+		{{A, 0x80}, {F, FS | FH | FPV}}},
+	{"dec b", 1, {0x05}, 4,
+		{{BC, 0x1000}, {F, FC}},
+		{{BC, 0x0F00}, {F, FH | FN | FC}}},
+	{"inc (hl)", 1, {0x34}, 11,
+		{{HL, 0x1000}},
+		{{M0, 0x3413}, {F, 0}}},
+	{"inc (iy+1)", 3, {0xFD, 0x34, 0x01}, 23,
+		{{IY, 0x1000}},
+		{{M0, 0x3512}, {F, 0}}},
+	{"dec (ix+0)", 3, {0xDD, 0x35, 0x00}, 23,
+		{{IX, 0x1000}},
+		{{M0, 0x3411}, {F, FN}}},
+	{"neg", 2, {0xED, 0x44}, 8,
+		{{A, 1}},
+		{{A, 0xFF}, {F, FS | FH | FN | FC}}},
+	{"cpl", 1, {0x2F}, 4,
+		{{A, 0x0F}},
+		{{A, 0xF0}, {F, FH | FN}}},
+	{"daa", 1, {0x27}, 4,
+		{{A, 0x3C}},
+		{{A, 0x42}, {F, FH | FPV}}},
+	{"daa", 1, {0x27}, 4,
+		{{A, 0x0F}, {F, FN}},
+		{{A, 0x09}, {F, FPV | FN}}},
+	{"scf", 1, {0x37}, 4,
+		{},
+		{{F, FC}}},
+	{"ccf", 1, {0x3F}, 4,
+		{{F, FC}},
+		{{F, FH}}},
+
+	// Rotates, shifts and bit operations
+	{"rlca", 1, {0x07}, 4,
+		{{A, 0x81}},
+		{{A, 0x03}, {F, FC}}},
+	{"rra", 1, {0x1F}, 4,
+		{{A, 0x01}},
+		{{A, 0}, {F, FC}}},
+	{"rlc b", 2, {0xCB, 0x00}, 8,
+		{{BC, 0x8000}},
+		{{BC, 0x0100}, {F, FC}}},
+	{"rrc (hl)", 2, {0xCB, 0x0E}, 15,
+		{{HL, 0x1000}},
+		{{M0, 0x3409}, {F, FPV}}},
+	{"sla (hl)", 2, {0xCB, 0x26}, 15,
+		{{HL, 0x1000}},
+		{{M0, 0x3424}, {F, FPV}}},
+	{"sra a", 2, {0xCB, 0x2F}, 8,
+		{{A, 0x81}},
+		{{A, 0xC0}, {F, FS | FPV | FC}}},
+	{"srl c", 2, {0xCB, 0x39}, 8,
+		{{BC, 0x0001}},
+		{{BC, 0}, {F, FZ | FPV | FC}}},
+	{"rl (ix+1)", 4, {0xDD, 0xCB, 0x01, 0x16}, 23,
+		{{IX, 0x1000}, {F, FC}},
+		{{M0, 0x6912}, {F, FPV}}},
+	{"bit 0,a", 2, {0xCB, 0x47}, 8,
+		{{A, 0x02}, {F, FC}},
+		{{F, FZ | FH | FPV | FC}}},
+	{"bit 7,a", 2, {0xCB, 0x7F}, 8,
+		{{A, 0x80}},
+		{{F, FS | FH}}},
+	{"bit 2,(hl)", 2, {0xCB, 0x56}, 12,
+		{{HL, 0x1000}},
+		{{F, FZ | FH | FPV}}},
+	{"bit 1,(ix+0)", 4, {0xDD, 0xCB, 0x00, 0x4E}, 20,
+		{{IX, 0x1000}},
+		{{F, FH}}},
+	{"set 0,b", 2, {0xCB, 0xC0}, 8,
+		{},
+		{{BC, 0x0100}}},
+	{"set 7,(hl)", 2, {0xCB, 0xFE}, 15,
+		{{HL, 0x1000}},
+		{{M0, 0x3492}}},
+	{"res 1,(iy+0)", 4, {0xFD, 0xCB, 0x00, 0x8E}, 23,
+		{{IY, 0x1000}},
+		{{M0, 0x3410}}},
+	{"rld", 2, {0xED, 0x6F}, 18,
+		{{A, 0x7A}, {HL, 0x1000}},
+		{{A, 0x71}, {M0, 0x342A}, {F, FPV}}},
+	{"rrd", 2, {0xED, 0x67}, 18,
+		{{A, 0x84}, {HL, 0x1000}},
+		{{A, 0x82}, {M0, 0x3441}, {F, FS | FPV}}},
+
+	// 16 bit arithmetic
+	{"add hl,de", 1, {0x19}, 11,
+		{{HL, 0x0FFF}, {DE, 1}},
+		{{HL, 0x1000}, {F, FH}}},
+	{"adc hl,bc", 2, {0xED, 0x4A}, 15,
+		{{HL, 0x7FFF}, {F, FC}},
+		{{HL, 0x8000}, {F, FS | FH | FPV}}},
+	{"sbc hl,de", 2, {0xED, 0x52}, 15,
+		{{DE, 1}},
+		{{HL, 0xFFFF}, {F, FS | FH | FN | FC}}},
+	{"sbc hl,de", 2, {0xED, 0x52}, 15,
+		{{HL, 0x1234}, {DE, 0x1234}},
+		{{HL, 0}, {F, FZ | FN}}},
+	{"add ix,sp", 2, {0xDD, 0x39}, 15,
+		{{IX, 0x8000}, {SP, 0x8000}, {F, FZ}},
+		{{IX, 0}, {F, FZ | FC}}},
+	{"inc de", 1, {0x13}, 6,
+		{{DE, 0xFFFF}},
+		{{DE, 0}, {F, 0}}},
+	{"dec ix", 2, {0xDD, 0x2B}, 10,
+		{},
+		{{IX, 0xFFFF}}},
+
+	// Jumps, calls and returns
+	{"jp 1f; inc a; 1:", 4, {0xC3, 0x04, 0x01, 0x3C}, 10,
+		{},
+		{{A, 0}}},
+	{"jp nz,1f; inc a; 1:", 4, {0xC2, 0x04, 0x01, 0x3C}, 10,
+		{{F, FZ}},
+		{{A, 1}}},
+	{"jp nz,1f; inc a; 1:", 4, {0xC2, 0x04, 0x01, 0x3C}, 10,
+		{},
+		{{A, 0}}},
+	{"jp (hl); inc a", 2, {0xE9, 0x3C}, 4,
+		{{HL, 0x0102}},
+		{{A, 0}}},
+	{"jp (ix); inc a", 3, {0xDD, 0xE9, 0x3C}, 8,
+		{{IX, 0x0103}},
+		{{A, 0}}},
+	{"jr 1f; inc a; 1:", 3, {0x18, 0x01, 0x3C}, 12,
+		{},
+		{{A, 0}}},
+	{"jr z,1f; inc a; 1:", 3, {0x28, 0x01, 0x3C}, 7,
+		{},
+		{{A, 1}}},
+	{"jr c,1f; inc a; 1:", 3, {0x38, 0x01, 0x3C}, 12,
+		{{F, FC}},
+		{{A, 0}}},
+	{"djnz 1f; inc a; 1:", 3, {0x10, 0x01, 0x3C}, 13,
+		{{BC, 0x0200}},
+		{{A, 0}, {BC, 0x0100}}},
+	{"djnz 1f; inc a; 1:", 3, {0x10, 0x01, 0x3C}, 8,
+		{{BC, 0x0100}},
+		{{A, 1}, {BC, 0}}},
+	{"call 1f; inc a; 1:", 4, {0xCD, 0x04, 0x01, 0x3C}, 17,
+		{{SP, 0x1002}},
+		{{A, 0}, {SP, 0x1000}, {M0, 0x0103}}},
+	{"call nz,1f; inc a; 1:", 4, {0xC4, 0x04, 0x01, 0x3C}, 10,
+		{{SP, 0x1002}, {F, FZ}},
+		{{A, 1}, {SP, 0x1002}}},
+	{"call 1f; jr 2f; 1: ret; 2:", 6, {0xCD, 0x05, 0x01, 0x18, 0x01, 0xC9}, 17,
+		{},
+		{{SP, Z80_TEST_STACK}}},
+	{"ret", 1, {0xC9}, 10,
+		{{SP, 0x1000}, {M0, 0x0101}},
+		{{SP, 0x1002}}},
+	{"ret z", 1, {0xC8}, 11,
+		{{SP, 0x1000}, {M0, 0x0101}, {F, FZ}},
+		{{SP, 0x1002}}},
+	{"ret nz", 1, {0xC0}, 5,
+		{{SP, 0x1000}, {F, FZ}},
+		{{SP, 0x1000}}},
+	{"rst 0x38", 1, {0xFF}, 11,
+		{{SP, 0x1002}},
+		{{SP, 0x1000}, {M0, 0x0101}}},
+
+	// Control and I/O
+	{"nop", 1, {0x00}, 4,
+		{},
+		{}},
+	{"di", 1, {0xF3}, 4,
+		{},
+		{}},
+	{"ei", 1, {0xFB}, 4,
+		{},
+		{}},
+	{"im 1", 2, {0xED, 0x56}, 8,
+		{},
+		{}},
+	{"in a,(0x10)", 2, {0xDB, 0x10}, 11,
+		{},
+		{{A, 0xFF}}},
+	{"out (0x10),a", 2, {0xD3, 0x10}, 11,
+		{},
+		{}},
+	{"inir", 2, {0xED, 0xB2}, 21,
+		{{HL, 0x1000}, {BC, 0x0210}},
+		{{M0, 0xFFFF}, {HL, 0x1002}, {BC, 0x0010}}},
+	{"otir", 2, {0xED, 0xB3}, 16,
+		{{HL, 0x1000}, {BC, 0x0110}},
+		{{HL, 0x1001}, {BC, 0x0010}}},
+};
+
+// Loads the memory and registers for a test, leaving the PC at its code
+static void Load(const Z80Test *t) {
+	uint8_t *ram = Z80SimRam();
+	const Z80TestVal *v;
+	int i;
+
+	memset(ram, 0, Z80_RAM_LEN);
+	memcpy(ram + Z80_TEST_CODE, t->code, t->len);
+	memcpy(ram + Z80_TEST_DATA, z80TestData, sizeof(z80TestData));
+	for (i = 0; i < Z80_SIM_REG_MAX; i++) Z80SimRegSet(i, 0);
+	Z80SimRegSet(Z80_SIM_SP, Z80_TEST_STACK);
+	Z80SimRegSet(Z80_SIM_PC, Z80_TEST_CODE);
+
+	for (v = t->set; v < t->set + 5 && v->loc; v++) {
+		uint16_t af = Z80SimRegGet(Z80_SIM_AF);
+
+		switch (v->loc) {
+			case A: Z80SimRegSet(Z80_SIM_AF, (af & 0xFF) | (v->val<<8)); break;
+			case F: Z80SimRegSet(Z80_SIM_AF, (af & 0xFF00) | v->val); break;
+			case M0:
+			case M4:
+				ram[Z80_TEST_DATA + 4 * (v->loc - M0)] = v->val & 0xFF;
+				ram[Z80_TEST_DATA + 4 * (v->loc - M0) + 1] = v->val>>8;
+				break;
+			default: Z80SimRegSet(v->loc - AF, v->val); break;
+		}
+	}
+}
+
+static uint16_t Get(Z80TestLoc loc) {
+	const uint8_t *ram = Z80SimRam();
+
+	switch (loc) {
+		case A: return Z80SimRegGet(Z80_SIM_AF)>>8;
+		case F: return Z80SimRegGet(Z80_SIM_AF) & Z80_TEST_FLAGS;
+		case M0:
+		case M4:
+			return ram[Z80_TEST_DATA + 4 * (loc - M0)] |
+				(ram[Z80_TEST_DATA + 4 * (loc - M0) + 1]<<8);
+		default: return Z80SimRegGet(loc - AF);
+	}
+}
+
+static const char *LocName(Z80TestLoc loc) {
+	static const char *const name[] = {
+		"", "af", "bc", "de", "hl", "af'", "bc'", "de'", "hl'", "ix", "iy",
+		"sp", "pc", "a", "f", "m0", "m4"
+	};
+
+	return name[loc];
+}
+
+// Runs a test, returns the number of mismatches
+static int Run(const Z80Test *t) {
+	const Z80TestVal *v;
+	uint16_t end = Z80_TEST_CODE + t->len;
+	uint32_t tstates;
+	int steps = 0;
+	int err = 0;
+
+	Load(t);
+	tstates = Z80SimStep();
+	while (Z80SimRegGet(Z80_SIM_PC) != end && ++steps < Z80_TEST_STEPS) {
+		Z80SimStep();
+	}
+
+	if (tstates != t->tstates) {
+		printf("%s: %u T-states, expected %u\n", t->src, tstates,
+				t->tstates);
+		err++;
+	}
+	for (v = t->chk; v < t->chk + 5 && v->loc; v++) {
+		uint16_t val = Get(v->loc);
+
+		if (val != v->val) {
+			printf("%s: %s = 0x%X, expected 0x%X\n", t->src,
+					LocName(v->loc), val, v->val);
+			err++;
+		}
+	}
+
+	return err;
+}
+
+int main(void) {
+	const int tests = sizeof(z80Test) / sizeof(Z80Test);
+	int fails = 0;
+	int i;
+
+	for (i = 0; i < tests; i++) fails += Run(&z80Test[i]) != 0;
+	printf("z80-test: %d tests, %d failed\n", tests, fails);
+
+	return fails != 0;
+}
@@ -11,31 +11,33 @@
 #include "mw/16c550.h"
 #include "mw/lsd.h"
 #include "mw/util.h"
+#include "mw/prof.h"
+#include "mw/mw-bench.h"
 #include "ssid_config.h"
 // SGDK includes must be after mw ones, or they will conflict with stdint.h
 #include <genesis.h>
 
-#define TCP_TEST_CH		1
-
 #define dtext(str, col)	do{VDP_drawText(str, col, line++);\
                            if ((line) > 28)line = 0;}while(0)
 
 #define IPV4_BUILD(a, b, c, d)	(((a)<<24) | ((b)<<16) | ((c)<<8) | (d))
 
+/// First screen line used by the link statistics overlay
+#define STATS_LINE		24
+
+/// First screen line used by the profiler overlay
+#define PROF_LINE		20
+
 static inline void DelayFrames(unsigned int fr) {
 	while (fr--) VDP_waitVSync();
 }
 
-static const char echoTestStr[] = "OLAKASE, ECO O KASE!";
-
 static const char spinner[] = "|/-\\";
 static const char hexTable[] = "0123456789ABCDEF";
 static unsigned char line;
 
 // Command to send
 static MwCmd cmd;
-// Command reply
-static MwCmd rep;
 
 static inline void ByteToHexStr(uint8_t byte, char hexStr[]){
 	hexStr[0] = hexTable[byte>>4];
@@ -43,6 +45,11 @@ static inline void ByteToHexStr(uint8_t byte, char hexStr[]){
 	hexStr[2] = '\0';
 }
 
+static inline void WordToHexStr(uint16_t word, char hexStr[]) {
+	ByteToHexStr(word>>8, hexStr);
+	ByteToHexStr(word, hexStr + 2);
+}
+
 static inline void DWordToHexStr(uint32_t dword, char hexStr[]) {
 	ByteToHexStr(dword>>24, hexStr);
 	ByteToHexStr(dword>>16, hexStr + 2);
@@ -110,32 +117,25 @@ void UartTxLoop(void) {
 	}
 }
 
-// Uses loopback to echo characters
-void UartLoopbackLoop(void) {
-	uint8_t sent;
-	volatile uint32_t i;
+#ifdef MW_BENCH
+// Draws a benchmark suite result as a CSV line
+void BenchDraw(const MwBenchResult *res) {
+	char csv[MW_BENCH_CSV_MAX];
 
-	for (i = 0; i < 100000; i++);
-	MwModuleStart();
-	for (i = 0; i < 100000; i++);
+	MwBenchCsv(res, csv);
+	dtext(csv, 1);
+}
 
-	CheckUartIsr(0xC1);
+// Measures the UART driver through the internal loopback, 16 KiB in full
+// TX FIFO bursts
+void BenchUartRun(void) {
+	MwBenchResult res;
 
-	UartResetFifos();
-	dtext("LOOPBACK TEST START!", 1);
-	sent = '0';
-	UartPutc(sent);	// Tx first byte, that will be continuously echoed
-	while (1) {
-		if (UartRxReady()) {
-			if (UartGetc() != sent) break;
-			sent = '~' == sent?'0':sent + 1;
-			UartPutc(sent);
-			SpinTick();
-		}
-	}
-	// Exit with error!
-	dtext("LOOPBACK TEST ERROR!", 1);
+	dtext(MW_BENCH_CSV_HDR, 1);
+	MwBenchRun(MW_BENCH_UART, UART_TX_FIFO_LEN, 1024, &res);
+	BenchDraw(&res);
 }
+#endif
 
 // Echoes characters received
 void UartEchoLoop(void) {
@@ -162,83 +162,6 @@ void MwModuleRun() {
 	MwModuleStart();
 }
 
-void MwEchoTest(void) {
-	int i;
-
-	// Try sending and receiving echo
-	cmd.cmd = MW_CMD_ECHO;
-	cmd.datalen = sizeof(echoTestStr) - 1;
-	strcpy((char*)cmd.data, echoTestStr);
-	dtext("Sending echo string...\n", 1);
-	UartResetFifos();
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
-		dtext("Echo recv failed!\n", 1);
-		return;
-	}
-	dtext("Got response!\n", 1);
-	for (i = 0; i < cmd.datalen; i++) {
-		if (cmd.data[i] != rep.data[i]) break;
-	}
-	if (i != cmd.datalen) {
-		dtext("Echo reply differs!", 1);
-	}
-	else {
-		dtext("Echo test OK", 1);
-	}
-}
-
-void MwTcpHelloTest(void) {
-	MwMsgInAddr* addr = (MwMsgInAddr*)cmd.data;
-	const char dstport[] = "1234";
-	const char dstaddr[] = "192.168.1.10";
-	const char helloStr[] = "Hello world, this is a MEGADRIVE!\n";
-	char echoBuff[80];
-	uint16_t len = 80 - 1;
-
-	// Configure TCP socket
-	cmd.cmd = MW_CMD_TCP_CON;
-	// Length is the length of both ports, the channel and the address.
-	cmd.datalen = 6 + 6 + 1 + sizeof(dstaddr);
-	memset(addr->dst_port, 0, cmd.datalen);
-	strcpy(addr->dst_port, dstport);
-	strcpy(addr->data, dstaddr);
-	addr->channel = TCP_TEST_CH;
-
-	// Try to establish connection
-	dtext("Connecting to host...", 1);
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
-		dtext("Connection failed!", 1);
-		return;
-	}
-	// TODO check returned code
-	dtext("Connecton established", 1);
-
-	// Enable channel 1
-	LsdChEnable(TCP_TEST_CH);
-	// Send hello string on channel 1
-	LsdSend((uint8_t*)helloStr, sizeof(helloStr) - 1, TCP_TEST_CH);
-	// Try receiving the echoed string
-	if (TCP_TEST_CH == LsdRecv((uint8_t*)echoBuff, &len, UINT32_MAX)) {
-		echoBuff[len] = '\0';
-		VDP_drawText("Rx:", 1, line);
-		dtext(echoBuff, 5);
-	} else {
-		dtext("Error waiting for data", 1);
-	}
-	// Disconnect from host
-	cmd.cmd = MW_CMD_TCP_DISC;
-	cmd.datalen = 1;
-	cmd.data[0] = TCP_TEST_CH;
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
-		dtext("Disconnect failed!", 1);
-	} else {
-		dtext("Disconnected from host.", 1);
-	}
-}
-
 #define AUTH_MAX 5
 void MwApScanPrint(MwCmd *rep) {
 	// Character strings related to supported authentication modes
@@ -282,64 +205,78 @@ void MwApScanPrint(MwCmd *rep) {
 }
 
 void MwApConfig(void) {
-	cmd.cmd = MW_CMD_AP_CFG;
-	cmd.datalen = sizeof(MwMsgApCfg);
-	cmd.apCfg.cfgNum = 0;
-	strcpy(cmd.apCfg.ssid, WIFI_SSID);
-	strcpy(cmd.apCfg.pass, WIFI_PASS);
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	MwCmd *rep;
+	// SSID and password fields are padded with '\0' up to their length
+	static const uint8_t cfgNum = 0;
+	static const char ssid[MW_SSID_MAXLEN] = WIFI_SSID;
+	static const char pass[MW_PASS_MAXLEN] = WIFI_PASS;
+	static const LsdVec apCfg[] = {
+		{&cfgNum, sizeof(cfgNum)}, {ssid, sizeof(ssid)}, {pass, sizeof(pass)}
+	};
+
+	MwCmdSendV(MW_CMD_AP_CFG, apCfg, 3);
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("AP configuration failed!", 1);
 		return;
 	}
+	MwCmdReplyFree(rep);
 	dtext("AP configuration OK!", 1);
 }
 
-void MwConfigGet(uint8_t num) {
-	char hex[9];
+void MwApCfgPrint(uint8_t num, const MwMsgApCfg *cfg) {
+	char hex[3];
 
-	cmd.cmd = MW_CMD_AP_CFG_GET;
-	cmd.datalen = 1;
-	cmd.data[0] = num;
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
-		dtext("AP CFG GET failed!", 1);
-		return;
-	}
 	VDP_drawText("CFG ", 1, line);
 	ByteToHexStr(num, hex);
 	dtext(hex, 5);
 	VDP_drawText("SSID: ", 1, line);
-	dtext(rep.apCfg.ssid, 7);
+	dtext(cfg->ssid, 7);
 	VDP_drawText("PASS: ", 1, line);
-	dtext(rep.apCfg.pass, 7);
-	
-	cmd.cmd = MW_CMD_IP_CFG_GET;
-	cmd.datalen = 1;
-	cmd.data[0] = num;
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
-		dtext("IP CFG GET failed!", 1);
-		return;
-	}
+	dtext(cfg->pass, 7);
+}
+
+void MwIpCfgPrint(const MwMsgIpCfg *cfg) {
+	char hex[9];
+
 	VDP_drawText("IP:   ", 1, line);
-	DWordToHexStr(rep.ipCfg.ip_addr, hex);
+	DWordToHexStr(cfg->ip_addr, hex);
 	dtext(hex, 7);
 	VDP_drawText("MASK: ", 1, line);
-	DWordToHexStr(rep.ipCfg.mask, hex);
+	DWordToHexStr(cfg->mask, hex);
 	dtext(hex, 7);
 	VDP_drawText("GW:   ", 1, line);
-	DWordToHexStr(rep.ipCfg.gateway, hex);
+	DWordToHexStr(cfg->gateway, hex);
 	dtext(hex, 7);
 	VDP_drawText("DNS1: ", 1, line);
-	DWordToHexStr(rep.ipCfg.dns1, hex);
+	DWordToHexStr(cfg->dns1, hex);
 	dtext(hex, 7);
 	VDP_drawText("DNS2: ", 1, line);
-	DWordToHexStr(rep.ipCfg.dns2, hex);
+	DWordToHexStr(cfg->dns2, hex);
 	dtext(hex, 7);
 }
 
+// Get AP and IP configurations for all the slots. Configurations not cached
+// are requested pipelined, later calls print them without link traffic.
+void MwConfigGetAll(void) {
+	const MwMsgApCfg *ap;
+	const MwMsgIpCfg *ip;
+	uint8_t i;
+
+	if (MwCfgCacheLoad()) {
+		dtext("CFG GET failed!", 1);
+		return;
+	}
+	for (i = 0; i < MW_NUM_AP_CFGS; i++) {
+		MwApCfgGet(i, &ap);
+		MwIpCfgGet(i, &ip);
+		MwApCfgPrint(i, ap);
+		MwIpCfgPrint(ip);
+	}
+}
+
 void MwIpConfig(void) {
+	MwCmd *rep;
+
 	cmd.cmd = MW_CMD_IP_CFG;
 	cmd.datalen = sizeof(MwMsgIpCfg);
 	cmd.ipCfg.cfgNum = 0;
@@ -352,153 +289,160 @@ void MwIpConfig(void) {
 	cmd.ipCfg.dns1 = IPV4_BUILD(87, 216, 1, 65);
 	cmd.ipCfg.dns2 = IPV4_BUILD(87, 216, 1, 66);
 	MwCmdSend(&cmd);
-	if ((MwCmdReplyGet(&rep) < 0) || (MW_CMD_OK != rep.cmd)) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("IP configuration failed!", 1);
 		return;
 	}
+	if (MW_CMD_OK != rep->cmd) {
+		MwCmdReplyFree(rep);
+		dtext("IP configuration failed!", 1);
+		return;
+	}
+	MwCmdReplyFree(rep);
 	dtext("Configured static IP", 1);
 }
 
 void MwScanTest(void) {
+	MwCmd *rep;
+
 	// Leave current AP
 	dtext("Leaving AP...", 1);
 	cmd.cmd = MW_CMD_AP_LEAVE;
 	cmd.datalen = 0;
 	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("AP leave failed!", 1);
 		return;
 	}
+	MwCmdReplyFree(rep);
 	// Start scan and get scan result
 	dtext("AP left, starting scan", 1);
 	cmd.cmd = MW_CMD_AP_SCAN;
 	cmd.datalen = 0;
 	MwCmdSend(&cmd);
-	if ((MwCmdReplyGet(&rep) < 0) || (MW_CMD_OK != rep.cmd)) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("AP Scan failed!", 1);
 		return;
 	}
-	MwApScanPrint(&rep);
+	if (MW_CMD_OK == rep->cmd) {
+		MwApScanPrint(rep);
+	} else {
+		dtext("AP Scan failed!", 1);
+	}
+	MwCmdReplyFree(rep);
 }
 
 void MwSntpCfgSet(void) {
-	uint8_t offset;
-	const char *servers[3] = {"0.es.pool.ntp.org", "1.europe.pool.ntp.org",
-	"3.europe.pool.ntp.org"};
-
-	cmd.cmd = MW_CMD_SNTP_CFG;
-	cmd.sntpCfg.upDelay = 60;
-	cmd.sntpCfg.tz = 1;
-	cmd.sntpCfg.dst = 1;
-	strcpy(cmd.sntpCfg.servers, servers[0]);
-	// Offset: server length + 1 ('\0')
-	offset  = strlen(servers[0]) + 1;
-	strcpy(cmd.sntpCfg.servers + offset, servers[1]);
-	offset += strlen(servers[1]) + 1;
-	strcpy(cmd.sntpCfg.servers + offset, servers[2]);
-	offset += strlen(servers[2]) + 1;
-	// Mark the end of the list with two adjacent '\0'
-	cmd.sntpCfg.servers[offset] = '\0';
-	cmd.datalen = offset + 1;
-	MwCmdSend(&cmd);
-	if ((MwCmdReplyGet(&rep) < 0) || (MW_CMD_OK != rep.cmd)) {
+	MwCmd *rep;
+	// Fixed fields of MwMsgSntpCfg: update delay, timezone and DST
+	static const struct {
+		uint16_t upDelay;
+		int8_t tz;
+		uint8_t dst;
+	} sntp = {60, 1, 1};
+	// Server list, the end is marked with two adjacent '\0' (the last one
+	// is the string terminator)
+	static const char servers[] = "0.es.pool.ntp.org\0"
+		"1.europe.pool.ntp.org\0" "3.europe.pool.ntp.org\0";
+	static const LsdVec sntpCfg[] = {
+		{&sntp, sizeof(sntp)}, {servers, sizeof(servers)}
+	};
+
+	MwCmdSendV(MW_CMD_SNTP_CFG, sntpCfg, 2);
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("SNTP configuration failed!", 1);
 		return;
 	}
+	if (MW_CMD_OK != rep->cmd) {
+		MwCmdReplyFree(rep);
+		dtext("SNTP configuration failed!", 1);
+		return;
+	}
+	MwCmdReplyFree(rep);
 	dtext("SNTP configuration set!", 1);
 }
 
 // Get date and time
-void MwDatetimeGet(void) {
+void MwDatetimePrint(MwCmd *rep) {
 	char datetime[80]; 
+
+	memcpy(datetime, rep->datetime.dtStr, rep->datalen - 2*sizeof(uint32_t));
+	datetime[rep->datalen - 2*sizeof(uint32_t)] = '\0';
+	dtext(datetime, 1);
+}
+
+void MwDatetimeGet(void) {
+	MwCmd *rep;
+
 	cmd.cmd = MW_CMD_DATETIME;
 	cmd.datalen = 0;
 	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("Date and time query failed!", 1);
 		return;
 	}
-	memcpy(datetime, rep.datetime.dtStr, rep.datalen - 2*sizeof(uint32_t));
-	datetime[rep.datalen - 2*sizeof(uint32_t)] = '\0';
-	dtext(datetime, 1);
+	MwDatetimePrint(rep);
+	MwCmdReplyFree(rep);
 }
 
 // Query and print MegaWiFi version
 void MwVersionGet(void) {
+	uint8_t major, minor;
+	const char *variant;
 	char hex[3];
-	char variant[80];
 
-	cmd.cmd = MW_CMD_VERSION;
-	cmd.datalen = 0;
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (MwFwVersionGet(&major, &minor, &variant)) {
 		dtext("Version query failed!", 1);
 		return;
 	}
 	VDP_drawText("MegaWiFi cart version ", 1, line);
-	ByteToHexStr(rep.data[0], hex);
+	ByteToHexStr(major, hex);
 	VDP_drawText(hex, 23, line);
 	VDP_drawText(".", 25, line);
-	ByteToHexStr(rep.data[1], hex);
+	ByteToHexStr(minor, hex);
 	VDP_drawText(hex, 26, line);
 	VDP_drawText("-", 28, line);
-	memcpy(variant, rep.data + 2, rep.datalen - 2);
-	variant[rep.datalen - 2] = '\0';
 	VDP_drawText(variant, 29, line);
-	VDP_drawText(" detected!", 29 + rep.datalen - 2, line++);
+	VDP_drawText(" detected!", 29 + strlen(variant), line++);
 }
 
 void MwFlashTest(void) {
+	const uint8_t *ids;
 	char hex[3];
-	const char str[] = "MegaWiFi flash API test string!";
+	char buf[81];
+	static const char str[] = "MegaWiFi flash API test string!";
 
 	// Obtain and print Flash manufacturer and device IDs
-	cmd.cmd = MW_CMD_FLASH_ID;
-	cmd.datalen = 0;
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (MwFlashIdGet(&ids)) {
 		dtext("FlashID query failed!", 1);
 		return;
 	}
 	VDP_drawText("FlashIDs: ", 1, line);
-	ByteToHexStr(rep.data[0], hex);
+	ByteToHexStr(ids[0], hex);
 	VDP_drawText(hex, 11, line);
-	ByteToHexStr(rep.data[1], hex);
+	ByteToHexStr(ids[1], hex);
 	VDP_drawText(hex, 14, line);
-	ByteToHexStr(rep.data[2], hex);
+	ByteToHexStr(ids[2], hex);
 	VDP_drawText(hex, 17, line++);
 
-	// Try reading some data
-	cmd.cmd = MW_CMD_FLASH_READ;
-	cmd.flRange.addr = 0;	// Corresponds to 0x80000
-	cmd.flRange.len = 80;
-	cmd.datalen = sizeof(MwMsgFlashRange);
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	// Try reading some data. Address 0 corresponds to 0x80000
+	if (MwFlashRead(0, (uint8_t*)buf, sizeof(buf) - 1)) {
 		dtext("Flash read failed!\n", 1);
 		return;
 	}
+	buf[sizeof(buf) - 1] = '\0';
 	dtext("Flash read OK:", 1);
-	dtext((const char*)rep.data, 1);
+	dtext(buf, 1);
 
-	// Erase sector
-	cmd.cmd = MW_CMD_FLASH_ERASE;
-	cmd.datalen = sizeof(uint16_t);
-	cmd.flSect = 0;	// Corresponds to sector 0x80
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	// Erase the sector holding the string. Sector 0 corresponds to 0x80
+	if (MwFlashErase(0, sizeof(str))) {
 		dtext("Sector erase failed!", 1);
 		return;
 	}
 	dtext("Sector erase OK!", 1);
 
 	// Write some data
-	cmd.cmd = MW_CMD_FLASH_WRITE;
-	cmd.datalen = sizeof(str) + sizeof(uint32_t);
-	cmd.flData.addr = 0;
-	strcpy((char*)cmd.flData.data, str);
-	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (MwFlashWrite(0, (const uint8_t*)str, sizeof(str))) {
 		dtext("Flash write failed!", 1);
 		return;
 	}
@@ -506,66 +450,223 @@ void MwFlashTest(void) {
 }
 
 void MwApJoin(uint8_t num) {
+	MwCmd *rep;
+
 	cmd.cmd = MW_CMD_AP_JOIN;
 	cmd.datalen = 1;
 	cmd.data[0] = num;
 	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("AP join failed!", 1);
 		return;
 	}
+	MwCmdReplyFree(rep);
 	dtext("Joining AP...", 1);
 }
 
 // Get a bunch of numbers from the hardware random number generator
-void MwHrngGet(void) {
+void MwHrngPrint(MwCmd *rep) {
 	char hex[9];
 	uint8_t i;
 
+	dtext("Dice roll:", 1);
+	for (i = 0; i < 16; i++) {
+		DWordToHexStr(rep->dwData[4 * i], hex);
+		VDP_drawText(hex, 1, line);
+		DWordToHexStr(rep->dwData[4 * i + 1], hex);
+		VDP_drawText(hex, 10, line);
+		DWordToHexStr(rep->dwData[4 * i + 2], hex);
+		VDP_drawText(hex, 19, line);
+		DWordToHexStr(rep->dwData[4 * i + 3], hex);
+		dtext(hex, 28);
+	}
+}
+
+void MwHrngGet(void) {
+	MwCmd *rep;
+
 	cmd.cmd = MW_CMD_HRNG_GET;
 	cmd.datalen = 2;
 	cmd.rndLen = 4 * 4 * 16;
 	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("HRNG get failed!", 1);
 		return;
 	}
-	dtext("Dice roll:", 1);
-	for (i = 0; i < 16; i++) {
-		DWordToHexStr(rep.dwData[4 * i], hex);
-		VDP_drawText(hex, 1, line);
-		DWordToHexStr(rep.dwData[4 * i + 1], hex);
-		VDP_drawText(hex, 10, line);
-		DWordToHexStr(rep.dwData[4 * i + 2], hex);
-		VDP_drawText(hex, 19, line);
-		DWordToHexStr(rep.dwData[4 * i + 3], hex);
-		dtext(hex, 28);
+	MwHrngPrint(rep);
+	MwCmdReplyFree(rep);
+}
+
+// Get date and time and random numbers, with both requests in flight
+void MwStatusGet(void) {
+	MwCmd *rep;
+	int dtTag, rndTag;
+	uint8_t tag;
+
+	cmd.cmd = MW_CMD_DATETIME;
+	cmd.datalen = 0;
+	dtTag = MwCmdSubmit(&cmd);
+	cmd.cmd = MW_CMD_HRNG_GET;
+	cmd.datalen = 2;
+	cmd.rndLen = 4 * 4 * 16;
+	rndTag = MwCmdSubmit(&cmd);
+	if (dtTag < 0 || rndTag < 0) {
+		MwCmdCancel();
+		dtext("Status query failed!", 1);
+		return;
+	}
+
+	while (MwCmdPendGet()) {
+		// Gives up if a reply does not arrive within MW_CMD_TOUT_LINES
+		if (MwCmdWait(&tag, &rep)) {
+			MwCmdCancel();
+			dtext("Status query failed!", 1);
+			return;
+		}
+		if (tag == dtTag) MwDatetimePrint(rep);
+		else MwHrngPrint(rep);
+		MwCmdReplyFree(rep);
 	}
 }
 
 void MwCfgDefaultSet(void) {
+	MwCmd *rep;
+
 	cmd.cmd = MW_CMD_DEF_CFG_SET;
 	cmd.datalen = 4;
 	cmd.dwData[0] = 0xFEAA5501;
 	MwCmdSend(&cmd);
-	if (MwCmdReplyGet(&rep) < 0) {
+	if (!(rep = MwCmdReplyGet())) {
 		dtext("Factory reset failed!", 1);
 		return;
 	}
+	MwCmdReplyFree(rep);
 	dtext("Configuration reset to default.", 1);
 }
 
+#ifdef LSD_STATS
+// Draws a label followed by a 16-bit counter
+static void StatDraw16(const char *label, uint16_t val, uint8_t x, uint8_t y) {
+	char hex[5];
+
+	VDP_drawText(label, x, y);
+	WordToHexStr(val, hex);
+	VDP_drawText(hex, x + 3, y);
+}
+
+// Draws a label followed by two 32-bit counters
+static void StatDraw32(const char *label, uint32_t val1, uint32_t val2,
+		uint8_t y) {
+	char hex[9];
+
+	VDP_drawText(label, 1, y);
+	DWordToHexStr(val1, hex);
+	VDP_drawText(hex, 4, y);
+	VDP_drawText("/", 12, y);
+	DWordToHexStr(val2, hex);
+	VDP_drawText(hex, 13, y);
+}
+
+// Draws the link statistics (all channels added) on the bottom lines
+void LsdStatsDraw(void) {
+	LsdStats st;
+	uint32_t txFr = 0, txB = 0, rxFr = 0, rxB = 0;
+	char hex[9];
+	uint8_t ch;
+
+	LsdStatsGet(&st);
+	for (ch = 0; ch < LSD_MAX_CH; ch++) {
+		txFr += st.txFrames[ch];
+		txB += st.txBytes[ch];
+		rxFr += st.rxFrames[ch];
+		rxB += st.rxBytes[ch];
+	}
+	StatDraw32("TX:", txFr, txB, STATS_LINE);
+	VDP_drawText("WT:", 22, STATS_LINE);
+	DWordToHexStr(st.txWait, hex);
+	VDP_drawText(hex, 25, STATS_LINE);
+	StatDraw32("RX:", rxFr, rxB, STATS_LINE + 1);
+	VDP_drawText("EM:", 22, STATS_LINE + 1);
+	DWordToHexStr(st.rxEmpty, hex);
+	VDP_drawText(hex, 25, STATS_LINE + 1);
+	StatDraw16("OE:", st.overrun, 1, STATS_LINE + 2);
+	StatDraw16("PE:", st.parity, 9, STATS_LINE + 2);
+	StatDraw16("FE:", st.framing, 17, STATS_LINE + 2);
+	StatDraw16("BI:", st.brk, 25, STATS_LINE + 2);
+	StatDraw16("NB:", st.noBuf, 33, STATS_LINE + 2);
+	StatDraw16("CH:", st.chErr, 1, STATS_LINE + 3);
+	StatDraw16("LN:", st.lenErr, 9, STATS_LINE + 3);
+	StatDraw16("EX:", st.etxErr, 17, STATS_LINE + 3);
+	StatDraw16("CR:", st.crcErr, 25, STATS_LINE + 3);
+	StatDraw16("DR:", st.dropped, 33, STATS_LINE + 3);
+}
+#endif
+
+#ifdef MW_PROF
+// Draws the calls, average and maximum cycles of each probe
+void ProfDraw(void) {
+	static const char *const probeName[PROF_MAX] = {
+		"SND", "POL", "CMD", "REP"
+	};
+	ProfProbe p;
+	char hex[9];
+	uint8_t i;
+
+	for (i = 0; i < PROF_MAX; i++) {
+		ProfGet(i, &p);
+		VDP_drawText(probeName[i], 1, PROF_LINE + i);
+		DWordToHexStr(p.count, hex);
+		VDP_drawText(hex, 5, PROF_LINE + i);
+		VDP_drawText("AV:", 14, PROF_LINE + i);
+		DWordToHexStr(p.count?p.sum / p.count:0, hex);
+		VDP_drawText(hex, 17, PROF_LINE + i);
+		VDP_drawText("MX:", 26, PROF_LINE + i);
+		DWordToHexStr(p.max, hex);
+		VDP_drawText(hex, 29, PROF_LINE + i);
+	}
+}
+#endif
+
+#if defined(MW_PROF) || defined(MW_BENCH) || defined(LSD_RX_RING)
+// Updates the frame counters of the profiler and the benchmark suite, and
+// drains the UART during the vertical blanking
+void VIntHandler(void) {
+#ifdef MW_PROF
+	ProfVInt();
+#endif
+#ifdef MW_BENCH
+	MwBenchVInt();
+#endif
+#ifdef LSD_RX_RING
+	LsdRxIsr();
+#endif
+}
+#endif
+
 int main(void) {
 	line = 0;
 	dtext("MeGaWiFi TEST PROGRAM", 1);
 
 	// MegaWifi module initialization
 	MwInit();
+#if defined(MW_PROF) || defined(MW_BENCH) || defined(LSD_RX_RING)
+	SYS_setVIntCallback(VIntHandler);
+#endif
+#ifdef LSD_RX_RING
+	// Drain the UART into the reception ring every few scanlines
+	SYS_setHIntCallback(LsdRxIsr);
+	VDP_setHIntCounter(LSD_RX_RING_LINES - 1);
+	VDP_setHInterrupt(TRUE);
+#endif
 
 	//UartTxLoop();
 	//UartEchoLoop();
-	//UartSetBits(MCR, 0x10);	// Loopback enable
-	//UartLoopbackLoop();
+#if defined(MW_BENCH) && !defined(LSD_RING)
+	// UART loopback must run before the module is started. Not available
+	// with the reception ring or the Z80 driver, that would take the looped
+	// back data.
+	BenchUartRun();
+#endif
 
 	MwModuleRun();
 	// Wait 3 seconds for the module to start
@@ -574,22 +675,35 @@ int main(void) {
 	// Wait 6 additional seconds for the module to get ready
 	dtext("Connecting to router...", 1);
 	DelayFrames(6 * 60);
-//	MwEchoTest();
-//	MwTcpHelloTest();
-	MwDatetimeGet();
-	MwHrngGet();
+#ifdef MW_BENCH
+	// Run the benchmark suite instead of the API tests
+	MwBenchSuite(BenchDraw);
+#else
+	MwStatusGet();
 //	MwCfgDefaultSet();
-//	MwConfigGet(0);
-//	MwConfigGet(1);
-//	MwConfigGet(2);
+//	MwConfigGetAll();
 //	MwSntpCfgSet();
 //	MwScanTest();
 //	MwApJoin(1);
 //	MwApConfig();
 //	MwIpConfig();
 //	MwFlashTest();
+#endif
 
+#if defined(LSD_STATS) || defined(MW_PROF)
+	// Keep the link statistics and profiler overlays updated
+	while(1) {
+#ifdef LSD_STATS
+		LsdStatsDraw();
+#endif
+#ifdef MW_PROF
+		ProfDraw();
+#endif
+		VDP_waitVSync();
+	}
+#else
 	while(1);
+#endif
 
 	return 0;	
 }
@@ -2,32 +2,202 @@
 
 UartShadow sh;
 
+/// Clock applied to the UART chip
+static uint32_t uartClk;
+
+// Writes the divisor latch. LCR[7] must be set to access DLX registers.
+static void UartDivWrite(uint16_t div) {
+	UartRegWr(LCR, sh.LCR | 0x80);
+	UartRegWr(DLM, div>>8);
+	UartRegWr(DLL, div & 0xFF);
+	UartRegWr(LCR, sh.LCR);
+	sh.DIV = div;
+}
+
 /************************************************************************//**
- * \brief Initializes the driver. The baud rate is set to UART_BR, and the
- *        UART FIFOs are enabled. This function must be called before using
- *        any other API call.
+ * \brief Initializes the driver. The console clock (PAL/NTSC) is detected,
+ *        the divisor is set to UART_DIV_DEF, and the UART FIFOs are
+ *        enabled. This function must be called before using any other API
+ *        call.
  ****************************************************************************/
 void UartInit(void) {
-	// Set line to BR,8N1. LCR[7] must be set to access DLX registers
-	UART_LCR = 0x83;
-	UART_DLM = UART_DLM_VAL;
-	UART_DLL = UART_DLL_VAL;
-	UartSet(LCR, 0x03);
-
-	// Disable flow control
-	// TODO: Use auto flow control and auto #RTS/#CTS
-	
+	// Clock depends on the machine video mode
+	uartClk = (UART_MD_VERSION & UART_MD_VERSION__PAL)?
+		UART_CLK_PAL:UART_CLK_NTSC;
+
+	// Set line to BR,8N1.
+	sh.LCR = 0x03;
+	UartDivWrite(UART_DIV_DEF);
+
 	// Enable FIFOs
-	UART_FCR = 0x01;
+	UartRegWr(FCR, UART_FCR__FIFO_EN);
 	// Reset FIFOs
-	UartSet(FCR, 0x07);
+	UartSet(FCR, UART_FCR__FIFO_EN | UART_FCR__RX_RST | UART_FCR__TX_RST);
 
 	// Set IER and MCR to their default values, for the shadow registers
 	// to be initialized.
 	UartSet(MCR, 0x00);
 	UartSet(IER, 0x00);
+	sh.LSR = 0;
+
+#ifdef UART_AUTO_FLOW_TRIG
+	// Use auto flow control and auto #RTS/#CTS
+	UartAutoFlowEnable(UART_AUTO_FLOW_TRIG);
+#endif
 
 	// Ready to go! Interrupt and DMA modes were not configured since the
 	// Megadrive console lacks interrupt/DMA control pins on cart connector.
 }
 
+/************************************************************************//**
+ * \brief Enables automatic RTS/CTS flow control. The UART deasserts RTS
+ *        when the RX FIFO reaches the trigger level (and asserts it again
+ *        when the FIFO is emptied), and stops transmitting while CTS is not
+ *        asserted.
+ *
+ * \param[in] rxTrig RX FIFO trigger level (UART_FCR__TRIG_x).
+ ****************************************************************************/
+void UartAutoFlowEnable(uint8_t rxTrig) {
+	// Set trigger level without resetting the FIFOs
+	UartSet(FCR, UART_FCR__FIFO_EN | (rxTrig & UART_FCR__TRIG_MASK));
+	// With AFE and RTS set, both auto-RTS and auto-CTS are enabled
+	UartSetBits(MCR, UART_MCR__AFE | UART_MCR__RTS);
+}
+
+/************************************************************************//**
+ * \brief Disables automatic RTS/CTS flow control. RX FIFO must then be
+ *        read fast enough to avoid overruns, that can be detected with
+ *        UartLineErrGet().
+ ****************************************************************************/
+void UartAutoFlowDisable(void) {
+	UartClrBits(MCR, UART_MCR__AFE | UART_MCR__RTS);
+}
+
+/************************************************************************//**
+ * \brief Returns the clock applied to the UART chip, detected by
+ *        UartInit().
+ *
+ * \return UART clock in Hz (UART_CLK_PAL or UART_CLK_NTSC).
+ ****************************************************************************/
+uint32_t UartClkGet(void) {
+	return uartClk;
+}
+
+/************************************************************************//**
+ * \brief Computes the divisor for the requested baud rate.
+ *
+ * \param[in] baud Requested baud rate.
+ *
+ * \return The divisor, or 0 if the baud rate cannot be obtained with an
+ *         error lower than UART_BR_MAX_ERR_PCT.
+ ****************************************************************************/
+uint16_t UartBaudDiv(uint32_t baud) {
+	uint32_t div;
+	uint32_t actual;
+	uint32_t err;
+
+	if (!baud) return 0;
+	div = DivWithRounding(uartClk / 16, baud);
+	if (!div || div > 0xFFFF) return 0;
+	actual = uartClk / 16 / div;
+	err = actual > baud?actual - baud:baud - actual;
+	if (err > baud / 100 * UART_BR_MAX_ERR_PCT) return 0;
+
+	return div;
+}
+
+/************************************************************************//**
+ * \brief Sets the divisor latch. Waits until the transmitter is empty
+ *        before changing it, so data being sent is not corrupted.
+ *
+ * \param[in] div Divisor to set (baud rate is UartClkGet()/(16*div)).
+ ****************************************************************************/
+void UartDivSet(uint16_t div) {
+	while (!(UartLsrRd() & UART_LSR__TEMT));
+	UartDivWrite(div);
+}
+
+/************************************************************************//**
+ * \brief Sets the baud rate. Waits until the transmitter is empty before
+ *        changing it, so data being sent is not corrupted.
+ *
+ * \param[in] baud Requested baud rate.
+ *
+ * \return 0 on success, or -1 if the baud rate cannot be obtained with an
+ *         error lower than UART_BR_MAX_ERR_PCT.
+ ****************************************************************************/
+int UartBaudSet(uint32_t baud) {
+	uint16_t div = UartBaudDiv(baud);
+
+	if (!div) return -1;
+	UartDivSet(div);
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Returns the current baud rate.
+ *
+ * \return The baud rate obtained with the current divisor.
+ ****************************************************************************/
+uint32_t UartBaudGet(void) {
+	return uartClk / 16 / sh.DIV;
+}
+
+#ifdef MW_BENCH
+/************************************************************************//**
+ * \brief Loopback benchmark. Sends data through the UART internal loopback
+ *        at the configured divisor, keeping the TX FIFO topped up while
+ *        received data is drained, and checks it is received back. Measures
+ *        the cost of the driver alone, without the module and the network.
+ *
+ * \param[in]  bytes Number of bytes to send.
+ * \param[out] st    Results.
+ *
+ * \return 0 if all data was received back without errors, -1 otherwise.
+ *
+ * \warning Loopback mode drives the MCR outputs (the WiFi module control
+ *          lines) inactive, so the module must not be running.
+ ****************************************************************************/
+int UartLoopbackBench(uint32_t bytes, UartLoopStats *st) {
+	uint32_t sent = 0;
+	uint16_t idle = 0;
+	uint8_t tx = 0, rx = 0;
+	uint8_t n;
+
+	st->bytes = st->polls = st->errors = 0;
+	UartSetBits(MCR, UART_MCR__LOOP);
+	UartRegWr(FCR, sh.FCR | UART_FCR__RX_RST | UART_FCR__TX_RST);
+	UartLineErrGet();
+
+	// The TX FIFO is refilled each time it empties, keeping up to
+	// UART_TX_FIFO_LEN bytes in flight, so the RX FIFO cannot overrun and
+	// the line does not go idle while they are received
+	while (st->bytes < bytes && idle < UART_LOOP_TOUT_POLLS) {
+		n = sent - st->bytes;
+		if (sent < bytes && n < UART_TX_FIFO_LEN) {
+			st->polls++;
+			if (UartTxReady()) {
+				n = UART_TX_FIFO_LEN - n;
+				if (bytes - sent < n) n = bytes - sent;
+				sent += n;
+				while (n--) UartPutc(tx++);
+			}
+		}
+		st->polls++;
+		if (UartRxReady()) {
+			if (UartGetc() != rx++) st->errors++;
+			st->bytes++;
+			idle = 0;
+		} else {
+			idle++;
+		}
+	}
+	st->lsr = UartLineErrGet();
+
+	UartClrBits(MCR, UART_MCR__LOOP);
+	UartRegWr(FCR, sh.FCR | UART_FCR__RX_RST | UART_FCR__TX_RST);
+
+	return st->bytes < bytes || st->errors || st->lsr?-1:0;
+}
+#endif
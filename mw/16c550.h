@@ -16,28 +16,63 @@
 /// 16C550 UART base address
 #define UART_BASE		0xA130C1
 
-/// Clock applied to 17C550 chip
-/// \todo We should detect the machine (PAL/NTSC) and set the clock
-/// accordingly
-#define UART_CLK		7610000LU
-// For NTSC MACHINES
-//#define UART_CLK		7670500LU
+/// Clock applied to 16C550 chip on PAL machines
+#define UART_CLK_PAL	7610000LU
+/// Clock applied to 16C550 chip on NTSC machines
+#define UART_CLK_NTSC	7670500LU
 
-/// Desired baud rate
-//#define UART_BR			115200LU
-#define UART_BR			(UART_CLK/32)
+/// Divisor for the default baud rate set by UartInit() (clock/32)
+#define UART_DIV_DEF	2
+
+/// Maximum error allowed when setting a baud rate, in percent
+#define UART_BR_MAX_ERR_PCT	4
 
 /// Length of the TX FIFO in bytes
 #define UART_TX_FIFO_LEN		16
 
 /// Division with one bit rounding, useful for divisor calculations.
 #define DivWithRounding(dividend, divisor)	((((dividend)*2/(divisor))+1)/2)
-/// Value to load on the UART divisor, high byte
-#define UART_DLM_VAL	(DivWithRounding(UART_CLK, 16 * UART_BR)>>8)
-//#define UART_DLM_VAL	((UART_CLK/16/UART_BR)>>8)
-/// Value to load on the UART divisor, low byte
-#define UART_DLL_VAL	(DivWithRounding(UART_CLK, 16 * UART_BR) & 0xFF)
-//#define UART_DLL_VAL	((UART_CLK/16/UART_BR)&0xFF)
+
+#ifdef UART_SIM
+/// Megadrive version register, used to detect PAL/NTSC machines.
+#define UART_MD_VERSION	UartSimMdVersion()
+#else
+/// Megadrive version register, used to detect PAL/NTSC machines.
+#define UART_MD_VERSION	(*((volatile uint8_t*)0xA10001))
+#endif
+/// Version register bit set on PAL machines.
+#define UART_MD_VERSION__PAL	0x40
+
+/** \addtogroup 16c550 uartRegOffs 16C550 UART register offsets from
+ *  UART_BASE.
+ *  \{
+ */
+#define UART_REG_RHR	 0	///< Receiver holding register
+#define UART_REG_THR	 0	///< Transmit holding register
+#define UART_REG_IER	 2	///< Interrupt enable register
+#define UART_REG_FCR	 4	///< FIFO control register
+#define UART_REG_ISR	 4	///< Interrupt status register
+#define UART_REG_LCR	 6	///< Line control register
+#define UART_REG_MCR	 8	///< Modem control register
+#define UART_REG_LSR	10	///< Line status register
+#define UART_REG_MSR	12	///< Modem status register
+#define UART_REG_SPR	14	///< Scratchpad register
+#define UART_REG_DLL	 0	///< Divisor latch LSB
+#define UART_REG_DLM	 2	///< Divisor latch MSB
+/** \} */
+
+#ifdef UART_SIM
+// Host build: register accesses are routed to a simulated 16C550 chip.
+// Registers can only be accessed through UartRegRd() and UartRegWr().
+#include "uart-sim.h"
+
+/// Reads a UART register (RHR, ISR, LSR, MSR or SPR).
+#define UartRegRd(reg)			UartSimRd(UART_REG_##reg)
+/// Writes a UART register (THR, IER, FCR, LCR, MCR, SPR, DLL or DLM).
+#define UartRegWr(reg, val)		UartSimWr(UART_REG_##reg, (val))
+#else
+/// Access to the UART register at the specified offset.
+#define UART_REG(off)	(*((volatile uint8_t*)(UART_BASE + (off))))
 
 /** \addtogroup 16c550 uartRegs 16C550 UART registers
  *  \note Do NOT access IER, FCR, LCR and MCR directly, use Set/Get functions.
@@ -46,36 +81,44 @@
  *  \{
  */
 /// Receiver holding register. Read only.
-#define UART_RHR	(*((volatile uint8_t*)(UART_BASE +  0)))
+#define UART_RHR	UART_REG(UART_REG_RHR)
 /// Transmit holding register. Write only.
-#define UART_THR	(*((volatile uint8_t*)(UART_BASE +  0)))
+#define UART_THR	UART_REG(UART_REG_THR)
 /// Interrupt enable register. Write only.
-#define UART_IER	(*((volatile uint8_t*)(UART_BASE +  2)))
+#define UART_IER	UART_REG(UART_REG_IER)
 /// FIFO control register. Write only.
-#define UART_FCR	(*((volatile uint8_t*)(UART_BASE +  4)))
+#define UART_FCR	UART_REG(UART_REG_FCR)
 /// Interrupt status register. Read only.
-#define UART_ISR	(*((volatile uint8_t*)(UART_BASE +  4)))
+#define UART_ISR	UART_REG(UART_REG_ISR)
 /// Line control register. Write only.
-#define UART_LCR	(*((volatile uint8_t*)(UART_BASE +  6)))
+#define UART_LCR	UART_REG(UART_REG_LCR)
 /// Modem control register. Write only.
-#define UART_MCR	(*((volatile uint8_t*)(UART_BASE +  8)))
+#define UART_MCR	UART_REG(UART_REG_MCR)
 /// Line status register. Read only.
-#define UART_LSR	(*((volatile uint8_t*)(UART_BASE + 10)))
+#define UART_LSR	UART_REG(UART_REG_LSR)
 /// Modem status register. Read only.
-#define UART_MSR	(*((volatile uint8_t*)(UART_BASE + 12)))
+#define UART_MSR	UART_REG(UART_REG_MSR)
 /// Scratchpad register.
-#define UART_SPR	(*((volatile uint8_t*)(UART_BASE + 14)))
+#define UART_SPR	UART_REG(UART_REG_SPR)
 /// Divisor latch LSB. Acessed only when LCR[7] = 1.
-#define UART_DLL	(*((volatile uint8_t*)(UART_BASE +  0)))
+#define UART_DLL	UART_REG(UART_REG_DLL)
 /// Divisor latch MSB. Acessed only when LCR[7] = 1.
-#define UART_DLM	(*((volatile uint8_t*)(UART_BASE +  2)))
+#define UART_DLM	UART_REG(UART_REG_DLM)
 /** \} */
 
+/// Reads a UART register (RHR, ISR, LSR, MSR or SPR).
+#define UartRegRd(reg)			(UART_##reg)
+/// Writes a UART register (THR, IER, FCR, LCR, MCR, SPR, DLL or DLM).
+#define UartRegWr(reg, val)		do{UART_##reg = (val);}while(0)
+#endif
+
 typedef struct {
 	uint8_t IER;
 	uint8_t FCR;
 	uint8_t LCR;
 	uint8_t MCR;
+	uint8_t LSR;	///< LSR bits accumulated since last UartLineErrGet()
+	uint16_t DIV;	///< Divisor latch
 } UartShadow;
 
 /// Uart shadow registers. Do NOT access directly!
@@ -88,6 +131,35 @@ extern UartShadow sh;
 #define UART_MCR__RTS		0x02	///< Request To Send.
 #define UART_MCR__OUT1		0x04	///< GPIO pin 1.
 #define UART_MCR__OUT2		0x08	///< GPIO pin 2.
+#define UART_MCR__LOOP		0x10	///< Loopback mode.
+#define UART_MCR__AFE		0x20	///< Auto flow control enable.
+/** \} */
+
+/** \addtogroup 16c550 uart_fcr FIFO control register bits.
+ *  \{ */
+#define UART_FCR__FIFO_EN	0x01	///< FIFO enable.
+#define UART_FCR__RX_RST	0x02	///< RX FIFO reset.
+#define UART_FCR__TX_RST	0x04	///< TX FIFO reset.
+#define UART_FCR__TRIG_1	0x00	///< RX trigger level: 1 byte.
+#define UART_FCR__TRIG_4	0x40	///< RX trigger level: 4 bytes.
+#define UART_FCR__TRIG_8	0x80	///< RX trigger level: 8 bytes.
+#define UART_FCR__TRIG_14	0xC0	///< RX trigger level: 14 bytes.
+#define UART_FCR__TRIG_MASK	0xC0	///< RX trigger level bits.
+/** \} */
+
+/** \addtogroup 16c550 uart_lsr Line status register bits.
+ *  \{ */
+#define UART_LSR__DR		0x01	///< Data ready.
+#define UART_LSR__OE		0x02	///< Overrun error.
+#define UART_LSR__PE		0x04	///< Parity error.
+#define UART_LSR__FE		0x08	///< Framing error.
+#define UART_LSR__BI		0x10	///< Break interrupt.
+#define UART_LSR__THRE		0x20	///< TX holding register (FIFO) empty.
+#define UART_LSR__TEMT		0x40	///< Transmitter empty.
+#define UART_LSR__RX_ERR	0x80	///< Error in RX FIFO.
+/// Line error bits.
+#define UART_LSR__ERR_MASK	(UART_LSR__OE | UART_LSR__PE | UART_LSR__FE | \
+							 UART_LSR__BI)
 /** \} */
 
 /** \addtogroup 16c550 uart_ins Input pins readed in the MSR UART register.
@@ -96,26 +168,143 @@ extern UartShadow sh;
 /** \} */
 
 /************************************************************************//**
- * \brief Initializes the driver. The baud rate is set to UART_BR, and the
- *        UART FIFOs are enabled. This function must be called before using
- *        any other API call.
+ * \brief Initializes the driver. The console clock (PAL/NTSC) is detected,
+ *        the divisor is set to UART_DIV_DEF, and the UART FIFOs are
+ *        enabled. This function must be called before using any other API
+ *        call.
  ****************************************************************************/
 void UartInit(void);
 
+/************************************************************************//**
+ * \brief Returns the clock applied to the UART chip, detected by
+ *        UartInit().
+ *
+ * \return UART clock in Hz (UART_CLK_PAL or UART_CLK_NTSC).
+ ****************************************************************************/
+uint32_t UartClkGet(void);
+
+/************************************************************************//**
+ * \brief Computes the divisor for the requested baud rate.
+ *
+ * \param[in] baud Requested baud rate.
+ *
+ * \return The divisor, or 0 if the baud rate cannot be obtained with an
+ *         error lower than UART_BR_MAX_ERR_PCT.
+ ****************************************************************************/
+uint16_t UartBaudDiv(uint32_t baud);
+
+/************************************************************************//**
+ * \brief Sets the divisor latch. Waits until the transmitter is empty
+ *        before changing it, so data being sent is not corrupted.
+ *
+ * \param[in] div Divisor to set (baud rate is UartClkGet()/(16*div)).
+ ****************************************************************************/
+void UartDivSet(uint16_t div);
+
+/************************************************************************//**
+ * \brief Sets the baud rate. Waits until the transmitter is empty before
+ *        changing it, so data being sent is not corrupted.
+ *
+ * \param[in] baud Requested baud rate.
+ *
+ * \return 0 on success, or -1 if the baud rate cannot be obtained with an
+ *         error lower than UART_BR_MAX_ERR_PCT.
+ ****************************************************************************/
+int UartBaudSet(uint32_t baud);
+
+/************************************************************************//**
+ * \brief Returns the current baud rate.
+ *
+ * \return The baud rate obtained with the current divisor.
+ ****************************************************************************/
+uint32_t UartBaudGet(void);
+
+/************************************************************************//**
+ * \brief Enables automatic RTS/CTS flow control. The UART deasserts RTS
+ *        when the RX FIFO reaches the trigger level (and asserts it again
+ *        when the FIFO is emptied), and stops transmitting while CTS is not
+ *        asserted.
+ *
+ * \param[in] rxTrig RX FIFO trigger level (UART_FCR__TRIG_x).
+ ****************************************************************************/
+void UartAutoFlowEnable(uint8_t rxTrig);
+
+/************************************************************************//**
+ * \brief Disables automatic RTS/CTS flow control. RX FIFO must then be
+ *        read fast enough to avoid overruns, that can be detected with
+ *        UartLineErrGet().
+ ****************************************************************************/
+void UartAutoFlowDisable(void);
+
+#ifdef MW_BENCH
+/// LSR reads without progress before the loopback benchmark gives up
+#define UART_LOOP_TOUT_POLLS	65535
+
+/// Loopback benchmark results.
+typedef struct {
+	uint32_t bytes;		///< Bytes sent and received back
+	uint32_t polls;		///< LSR reads
+	uint32_t errors;	///< Bytes received back with a wrong value
+	uint8_t lsr;		///< Line error bits (UART_LSR__ERR_MASK) detected
+} UartLoopStats;
+
+/************************************************************************//**
+ * \brief Loopback benchmark. Sends data through the UART internal loopback
+ *        at the configured divisor, keeping the TX FIFO topped up while
+ *        received data is drained, and checks it is received back. Measures
+ *        the cost of the driver alone, without the module and the network.
+ *
+ * \param[in]  bytes Number of bytes to send.
+ * \param[out] st    Results.
+ *
+ * \return 0 if all data was received back without errors, -1 otherwise.
+ *
+ * \warning Loopback mode drives the MCR outputs (the WiFi module control
+ *          lines) inactive, so the module must not be running.
+ ****************************************************************************/
+int UartLoopbackBench(uint32_t bytes, UartLoopStats *st);
+#endif
+
+/************************************************************************//**
+ * \brief Reads LSR register, keeping the line error bits for them to be
+ *        obtained later with UartLineErrGet().
+ *
+ * \return The LSR register value.
+ ****************************************************************************/
+static inline uint8_t UartLsrRd(void) {
+	uint8_t lsr = UartRegRd(LSR);
+
+	sh.LSR |= lsr;
+	return lsr;
+}
+
+/************************************************************************//**
+ * \brief Obtains line errors (overrun, parity, framing and break) detected
+ *        since last call to this function, and clears them.
+ *
+ * \return Line error bits of LSR (UART_LSR__ERR_MASK).
+ ****************************************************************************/
+static inline uint8_t UartLineErrGet(void) {
+	uint8_t err = (sh.LSR | UartRegRd(LSR)) & UART_LSR__ERR_MASK;
+
+	sh.LSR = 0;
+	return err;
+}
+
 /************************************************************************//**
  * \brief Checks if UART transmit register/FIFO is ready. In FIFO mode, up to
  *        16 characters can be loaded each time transmitter is ready.
  *
  * \return TRUE if transmitter is ready, FALSE otherwise.
  ****************************************************************************/
-#define UartTxReady()	(UART_LSR & 0x20)
+#define UartTxReady()	(UartLsrRd() & UART_LSR__THRE)
 
 /************************************************************************//**
  * \brief Checks if UART receive register/FIFO has data available.
  *
  * \return TRUE if at least 1 byte is available, FALSE otherwise.
  ****************************************************************************/
-#define UartRxReady()	(UART_LSR & 0x01)
+#define UartRxReady()	(UartLsrRd() & UART_LSR__DR)
 
 /************************************************************************//**
  * \brief Sends a character. Please make sure there is room in the transmit
@@ -123,7 +312,7 @@ void UartInit(void);
  *
  * \return Received character.
  ****************************************************************************/
-#define UartPutc(c)		do{UART_RHR = (c);}while(0);
+#define UartPutc(c)		UartRegWr(THR, c)
 
 /************************************************************************//**
  * \brief Returns a received character. Please make sure data is available by
@@ -131,7 +320,7 @@ void UartInit(void);
  *
  * \return Received character.
  ****************************************************************************/
-#define UartGetc()		(UART_RHR)
+#define UartGetc()		UartRegRd(RHR)
 
 /************************************************************************//**
  * \brief Sets a value in IER, FCR, LCR or MCR register.
@@ -139,7 +328,7 @@ void UartInit(void);
  * \param[in] reg Register to modify (IER, FCR, LCR or MCR).
  * \param[in] val Value to set in IER, FCR, LCR or MCR register.
  ****************************************************************************/
-#define UartSet(reg, val)	do{sh.reg = (val);UART_##reg = (val);}while(0)
+#define UartSet(reg, val)	do{sh.reg = (val);UartRegWr(reg, val);}while(0)
 
 /************************************************************************//**
  * \brief Gets value of IER, FCR, LCR or MCR register.
@@ -156,7 +345,7 @@ void UartInit(void);
  * \param[in] val Bits set in val, will be set in reg register.
  ****************************************************************************/
 #define UartSetBits(reg, val)	do{sh.reg |= (val);							\
-								UART_##reg = sh.reg;}while(0)
+								UartRegWr(reg, sh.reg);}while(0)
 
 /************************************************************************//**
  * \brief Clears bits in IER, FCR, LCR or MCR register.
@@ -165,7 +354,7 @@ void UartInit(void);
  * \param[in] val Bits set in val, will be cleared in reg register.
  ****************************************************************************/
 #define UartClrBits(reg, val)	do{sh.reg &= ~(val);						\
-								UART_##reg = sh.reg;}while(0)
+								UartRegWr(reg, sh.reg);}while(0)
 
 /************************************************************************//**
  * \brief Reset TX and RX FIFOs.
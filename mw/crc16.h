@@ -0,0 +1,46 @@
+/************************************************************************//**
+ * \brief CRC-16 (CCITT polynomial 0x1021, non reflected) computation. Used
+ *        to protect LSD frames. Computing the CRC of data followed by its
+ *        CRC (high byte first) results in 0.
+ *
+ * \defgroup crc16 CRC-16 computation
+ * \{
+ ****************************************************************************/
+
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stdint.h>
+
+/// Initial CRC value
+#define CRC16_INIT		0xFFFF
+
+/// CRC lookup table, one entry per byte value
+extern const uint16_t crc16Tab[256];
+
+/************************************************************************//**
+ * \brief Updates the CRC with a byte.
+ *
+ * \param[in] crc Current CRC value.
+ * \param[in] b   Byte to add to the CRC.
+ *
+ * \return Updated CRC value.
+ ****************************************************************************/
+#define Crc16Upd(crc, b)	((uint16_t)(((crc)<<8) ^ \
+			crc16Tab[(uint8_t)(((crc)>>8) ^ (b))]))
+
+/************************************************************************//**
+ * \brief Updates the CRC with a data buffer.
+ *
+ * \param[in] data Data to add to the CRC.
+ * \param[in] len  Length of the data.
+ * \param[in] crc  Current CRC value (CRC16_INIT for a new computation).
+ *
+ * \return Updated CRC value.
+ ****************************************************************************/
+uint16_t Crc16(const uint8_t *data, uint16_t len, uint16_t crc);
+
+#endif /*_CRC16_H_*/
+
+/** \} */
+
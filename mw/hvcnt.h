@@ -0,0 +1,126 @@
+/************************************************************************//**
+ * \brief VDP H/V counter access, used to measure elapsed time in scanlines
+ *        and within a scanline.
+ *
+ * \defgroup hvcnt VDP H/V counter
+ * \{
+ ****************************************************************************/
+
+#ifndef _HVCNT_H_
+#define _HVCNT_H_
+
+#include <stdint.h>
+
+#ifdef UART_SIM
+#include "uart-sim.h"
+/// H/V counter register (V counter on the high byte, H on the low byte).
+#define HV_CNT		UartSimHvCnt()
+#else
+/// H/V counter register (V counter on the high byte, H on the low byte).
+#define HV_CNT		(*((volatile uint16_t*)0xC00008))
+#endif
+
+/// V counter value when the vertical interrupt is triggered (V28 mode).
+#define HV_VINT_V	0xE0
+
+/// Scanlines per frame on NTSC machines.
+#define HV_LINES_NTSC	262
+/// Scanlines per frame on PAL machines.
+#define HV_LINES_PAL	313
+
+/// Last scanline before the V counter jumps back, on NTSC machines. Next
+/// scanlines are numbered (scanline - (HV_LINES_NTSC - 256)).
+#define HV_JUMP_NTSC	0xEA
+/// Last scanline before the V counter jumps back, on PAL machines. Next
+/// scanlines are numbered (scanline - (HV_LINES_PAL - 256)).
+#define HV_JUMP_PAL		0x102
+
+/// Values the V counter jumps back during the vertical blanking, on NTSC
+/// machines.
+#define HV_BACK_NTSC	(HV_LINES_NTSC - 256)
+/// Values the V counter jumps back during the vertical blanking, on PAL
+/// machines.
+#define HV_BACK_PAL		(HV_LINES_PAL - 256)
+
+#ifdef HV_H32
+/// Last H counter value before it jumps ahead (H32 mode).
+#define HV_H_JUMP		0x93
+/// H counter value after the jump (H32 mode).
+#define HV_H_JUMP_TO	0xE9
+/// H counter value when the V counter is incremented (H32 mode).
+#define HV_H_VINC		0x85
+#else
+/// Last H counter value before it jumps ahead (H40 mode, define HV_H32 for
+/// H32 mode).
+#define HV_H_JUMP		0xB6
+/// H counter value after the jump (H40 mode).
+#define HV_H_JUMP_TO	0xE4
+/// H counter value when the V counter is incremented (H40 mode).
+#define HV_H_VINC		0xA5
+#endif
+
+/// H counter values skipped by the jump.
+#define HV_H_SKIP		(HV_H_JUMP_TO - HV_H_JUMP - 1)
+/// H counter steps per scanline.
+#define HV_H_STEPS		(0x100 - HV_H_SKIP)
+
+/// Master clock cycles per scanline.
+#define HV_LINE_MCLK	3420
+/// Master clock cycles per 68000 cycle.
+#define HV_M68K_MCLK	7
+
+/************************************************************************//**
+ * \brief Reads the H/V counter.
+ *
+ * \return H/V counter value (V counter on the high byte, H on the low byte).
+ ****************************************************************************/
+#define HvCntGet()		((uint16_t)HV_CNT)
+
+/************************************************************************//**
+ * \brief Reads the V counter (current scanline, 8 bits).
+ *
+ * \return V counter value.
+ ****************************************************************************/
+#define HvVCntGet()		((uint8_t)(HV_CNT>>8))
+
+/************************************************************************//**
+ * \brief Returns the scanlines elapsed between two V counter reads, taken
+ *        less than a frame apart. If the counter went back less than it
+ *        jumps during the vertical blanking, the jump happened between both
+ *        reads. Otherwise the counter wrapped around. Times up to
+ *        (255 - back) scanlines are measured, but as values after the jump
+ *        were also reached before it, times including the vertical blanking
+ *        can be measured up to back scanlines shorter.
+ *
+ * \param[in] prev V counter previous value.
+ * \param[in] now  V counter current value.
+ * \param[in] back Values the counter jumps back (HV_BACK_NTSC or
+ *            HV_BACK_PAL).
+ *
+ * \return Scanlines elapsed.
+ ****************************************************************************/
+static inline uint8_t HvLinesElapsed(uint8_t prev, uint8_t now,
+		uint8_t back) {
+	uint8_t before = prev - now;
+
+	return (before && before < back)?back - before:now - prev;
+}
+
+/************************************************************************//**
+ * \brief Converts a H counter value to the steps elapsed since the V counter
+ *        was incremented, skipping the values the counter jumps over.
+ *
+ * \param[in] h H counter value.
+ *
+ * \return Steps since the start of the scanline (0 to HV_H_STEPS - 1).
+ ****************************************************************************/
+static inline uint8_t HvHStepsGet(uint8_t h) {
+	if (h > HV_H_JUMP) h -= HV_H_SKIP;
+
+	return (h >= HV_H_VINC)?h - HV_H_VINC:h + HV_H_STEPS - HV_H_VINC;
+}
+
+#endif /*_HVCNT_H_*/
+
+/** \} */
+
@@ -0,0 +1,102 @@
+*-------------------------------------------------------
+*
+*       LSD TX burst, RX payload copy and CRC kernels, used by
+*       lsd.c instead of the C loops when built with LSD_ASM
+*       defined.
+*       Calling convention is the gcc one: parameters on the
+*       stack (one long slot each), result in d0, and d0-d1/a0-a1
+*       free for use.
+*
+*-------------------------------------------------------
+
+* UART registers (must match UART_BASE and UART_REG_* in 16c550.h)
+        .equ    UART_THR,       0xA130C1
+        .equ    UART_RHR,       0xA130C1
+        .equ    UART_REG_LSR,   10
+* LSR data ready bit
+        .equ    UART_LSR_DR,    0
+* Offset of LSR in the UartShadow struct (sh)
+        .equ    SH_LSR,         4
+
+        .text
+
+*-------------------------------------------------------
+* void LsdKernTxBurst(const uint8_t *data, uint16_t n)
+*
+* Writes n bytes (1 to 16, the TX FIFO length) to THR. Jumps
+* into a fully unrolled burst, so only the last n moves run.
+*-------------------------------------------------------
+        .globl  LsdKernTxBurst
+LsdKernTxBurst:
+        move.l  4(%sp),%a0
+        lea     UART_THR,%a1
+        move.w  10(%sp),%d0
+        neg.w   %d0
+        add.w   %d0,%d0
+        jmp     1f(%pc,%d0.w)
+        .rept   16
+        move.b  (%a0)+,(%a1)
+        .endr
+1:      rts
+
+*-------------------------------------------------------
+* uint16_t LsdKernRxDrain(uint8_t *dst, uint16_t max)
+*
+* Copies bytes from RHR to dst while LSR reports data ready,
+* up to max bytes. Returns the number of bytes copied. As
+* reading LSR clears its error bits, they are accumulated in
+* sh.LSR, as UartLsrRd() does.
+*-------------------------------------------------------
+        .globl  LsdKernRxDrain
+LsdKernRxDrain:
+        move.l  4(%sp),%a0
+        lea     UART_RHR,%a1
+        move.w  10(%sp),%d1
+        beq.s   3f
+        move.l  %d2,-(%sp)
+        moveq   #0,%d2
+        subq.w  #1,%d1
+1:      move.b  UART_REG_LSR(%a1),%d0
+        or.b    %d0,%d2
+        btst    #UART_LSR_DR,%d0
+        beq.s   2f
+        move.b  (%a1),(%a0)+
+        dbra    %d1,1b
+2:      or.b    %d2,sh+SH_LSR
+        move.l  (%sp)+,%d2
+3:      move.l  %a0,%d0
+        sub.l   4(%sp),%d0
+        rts
+
+*-------------------------------------------------------
+* uint16_t LsdKernCrc16(const uint8_t *data, uint16_t len,
+*                       uint16_t crc)
+*
+* Same as Crc16() (crc16.c). Keeps the CRC high byte in d0
+* and the low one in d1, and reads each half of the table
+* entry as a byte, so no shifts are needed per byte.
+*-------------------------------------------------------
+        .globl  LsdKernCrc16
+LsdKernCrc16:
+        movem.l %d2-%d3,-(%sp)
+        move.l  12(%sp),%a0
+        lea     crc16Tab,%a1
+        move.w  22(%sp),%d1
+        moveq   #0,%d0
+        move.w  %d1,%d0
+        lsr.w   #8,%d0
+        move.w  18(%sp),%d2
+        beq.s   2f
+        subq.w  #1,%d2
+1:      moveq   #0,%d3
+        move.b  (%a0)+,%d3
+        eor.b   %d0,%d3
+        add.w   %d3,%d3
+        move.b  0(%a1,%d3.w),%d0
+        eor.b   %d1,%d0
+        move.b  1(%a1,%d3.w),%d1
+        dbra    %d2,1b
+2:      lsl.w   #8,%d0
+        move.b  %d1,%d0
+        movem.l (%sp)+,%d2-%d3
+        rts
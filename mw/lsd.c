@@ -5,33 +5,123 @@
  *
  * \author Jesus Alonso (doragasu)
  * \date   2016
- * \todo   Implement UART RTS/CTS handshaking.
  * \todo   Current implementation uses polling. Unfortunately as the Genesis/
  *         Megadrive does not have an interrupt pin on the cart, implementing
  *         more efficient data transmission techniques will be tricky.
  * \todo   Proper implementation of error handling.
  ****************************************************************************/
 #include "lsd.h"
+#include <string.h>
 #include "util.h" 
-/// Number of buffer frames available
-#define LSD_BUF_FRAMES			2
+#include "crc16.h"
+#include "prof.h"
+#include "z80.h"
 
 /// Start of data in the buffer (skips STX and LEN fields).
 #define LSD_BUF_DATA_START 		3
 
-static inline void LsdPollSend(uint8_t data[], uint16_t len) {
-	int16_t i;
-	uint8_t n;
+/// Marks the end of a channel queue
+#define LSD_BUF_NONE			0xFF
 
-	// Buffer is sent in chunks of up to UART_TX_FIFO_LEN bytes.
-	// Only the last chunck gets some advantage of the FIFOs :(
-	for (i = 0; i < len;) {
-		n = MIN(UART_TX_FIFO_LEN, len - i);
-		while (!UartTxReady());
-		while (n--) UartPutc(data[i++]);
-	}
+/// Length of the frame trailer (CRC and ETX)
+#define LSD_TRL_LEN				(LSD_CRC_LEN + 1)
+
+/// Marks the retransmission buffer as not holding a valid frame
+#define LSD_RETX_NONE			0xFFFF
+
+#ifdef LSD_CRC
+/// State after receiving the payload
+#define LSD_ST_TRL_RECV			LSD_ST_CRCH_RECV
+/// Updates the CRC of the frame being received
+#define LsdRxCrcUpd(b)			do{d.rxCrc = Crc16Upd(d.rxCrc, b);}while(0)
+/// Channel is valid for reception (NAK frames are received on LSD_NAK_CH)
+#define LsdRxChValid(ch)		((ch) < LSD_MAX_CH || LSD_NAK_CH == (ch))
+#else
+/// State after receiving the payload
+#define LSD_ST_TRL_RECV			LSD_ST_ETX_RECV
+/// Updates the CRC of the frame being received
+#define LsdRxCrcUpd(b)
+/// Channel is valid for reception
+#define LsdRxChValid(ch)		((ch) < LSD_MAX_CH)
+#endif
+
+/// Frames for this channel are received into the buffers
+#define LsdRxChEn(ch)			((ch) < LSD_MAX_CH && d.en[ch])
+
+#ifdef LSD_STATS
+/// Increments a statistics counter
+#define LsdStatInc(field)		do{d.st.field++;}while(0)
+/// Adds a value to a statistics counter
+#define LsdStatAdd(field, n)	do{d.st.field += (n);}while(0)
+#else
+/// Increments a statistics counter
+#define LsdStatInc(field)
+/// Adds a value to a statistics counter
+#define LsdStatAdd(field, n)
+#endif
+
+#ifdef LSD_ASM
+#ifdef UART_SIM
+#error "LSD_ASM kernels access the UART directly, use them in console builds"
+#endif
+// Assembly kernels (lsd-kern.s)
+void LsdKernTxBurst(const uint8_t *data, uint16_t n);
+uint16_t LsdKernRxDrain(uint8_t *dst, uint16_t max);
+uint16_t LsdKernCrc16(const uint8_t *data, uint16_t len, uint16_t crc);
+
+/// Writes n bytes (up to UART_TX_FIFO_LEN) to the TX FIFO
+#define LsdTxBurst(data, n)		LsdKernTxBurst(data, n)
+/// Copies received bytes while available, up to max. Returns the count.
+#define LsdRxDrain(dst, max)	LsdKernRxDrain(dst, max)
+/// Updates the CRC with a data buffer
+#define LsdCrc16(data, len, crc)	LsdKernCrc16(data, len, crc)
+#else
+/// Writes n bytes (up to UART_TX_FIFO_LEN) to the TX FIFO
+#define LsdTxBurst(data, n)		do {				\
+	const uint8_t *_d = (data); uint8_t _n = (n);	\
+	while (_n--) UartPutc(*_d++);					\
+} while(0)
+
+// Copies received bytes while available, up to max. Returns the count.
+static inline uint16_t LsdRxDrain(uint8_t *dst, uint16_t max) {
+	uint16_t n = 0;
+
+	while (n < max && UartRxReady()) dst[n++] = UartGetc();
+
+	return n;
 }
 
+/// Updates the CRC with a data buffer
+#define LsdCrc16(data, len, crc)	Crc16(data, len, crc)
+#endif
+
+#ifdef LSD_RING
+#if LSD_RX_RING_LEN & (LSD_RX_RING_LEN - 1)
+#error "LSD_RX_RING_LEN must be a power of 2"
+#endif
+/// Ring position mask
+#define LSD_RING_MASK			(LSD_RX_RING_LEN - 1)
+/// Z80 ring position mask
+#define LSD_Z80_RING_MASK		(LSD_Z80_RING_LEN - 1)
+/// Received data is available in the ring
+#define LsdRxReady()			LsdRingReady()
+/// Reads a received byte. Check LsdRxReady() before calling it.
+#define LsdRxGetc()				LsdRingGetc()
+/// Copies received bytes while available, up to max. Returns the count.
+#define LsdRxCopy(dst, max)		LsdRingRead(dst, max)
+#else
+/// Received data is available in the UART
+#define LsdRxReady()			UartRxReady()
+/// Reads a received byte. Check LsdRxReady() before calling it.
+#define LsdRxGetc()				UartGetc()
+/// Copies received bytes while available, up to max. Returns the count.
+#define LsdRxCopy(dst, max)		LsdRxDrain(dst, max)
+#endif
+
+/// There is received data to process (pending to be scanned again, in the
+/// ring or in the UART)
+#define LsdRxAvail()			(d.rqPos < d.rqLen || LsdRxReady())
+
 /** \addtogroup lsd LsdState Allowed states for reception state machine.
  *  \{ */
 typedef enum {
@@ -40,26 +130,514 @@ typedef enum {
 	LSD_ST_CH_LENH_RECV,	///< Receiving channel and length (high bits)
 	LSD_ST_LEN_RECV,		///< Receiving frame length
 	LSD_ST_DATA_RECV,		///< Receiving data length
+	LSD_ST_DATA_SKIP,		///< Skipping data of a disabled channel
+	LSD_ST_CRCH_RECV,		///< Receiving CRC high byte
+	LSD_ST_CRCL_RECV,		///< Receiving CRC low byte
 	LSD_ST_ETX_RECV,		///< Receiving ETX
 	LSD_ST_MAX				///< Number of states
 } LsdState;
 /** \} */
 
+/** \addtogroup lsd LsdTxState Allowed states for asynchronous send.
+ *  \{ */
+typedef enum {
+	LSD_TX_IDLE = 0,		///< No frame being sent
+	LSD_TX_HDR,				///< Sending STX, channel and length
+	LSD_TX_DATA,			///< Sending payload
+	LSD_TX_ETX				///< Sending CRC and ETX
+} LsdTxState;
+/** \} */
+
+/** \addtogroup lsd LsdBufState Allowed states for reception buffers.
+ *  \{ */
+typedef enum {
+	LSD_BUF_FREE = 0,		///< Available for reception
+	LSD_BUF_RECV,			///< Frame is being received into the buffer
+	LSD_BUF_READY,			///< Holds a frame not yet obtained by the app
+	LSD_BUF_USED			///< Obtained by the app, waiting to be freed
+} LsdBufState;
+/** \} */
+
 /** \addtogroup lsd LsdData Local data required by the module.
  *  \{ */
 typedef struct {
-	//MwMsgBuf rx[LSD_BUF_FRAMES];	///< Reception buffers
+	MwMsgBuf rx[LSD_BUF_FRAMES];	///< Reception buffers
+	uint8_t bufSt[LSD_BUF_FRAMES];	///< Reception buffers state
+	uint8_t next[LSD_BUF_FRAMES];	///< Next ready buffer in channel queue
+	uint8_t qHead[LSD_MAX_CH];		///< Oldest ready buffer per channel
+	uint8_t qTail[LSD_MAX_CH];		///< Newest ready buffer per channel
 	LsdState rxs;					///< Reception state
-	LsdState txs;					///< Send state
+	LsdTxState txs;					///< Asynchronous send state
 	uint8_t en[LSD_MAX_CH];			///< Channel enable
+	uint8_t lost[LSD_MAX_CH];		///< Frame dropped for lack of buffers
 	uint16_t pos;					///< Position in current buffer
 	uint8_t current;				///< Current buffer in use
+	uint16_t rxLen;					///< Length of the frame being received
+	uint8_t skip;					///< Frame being received is not stored
+	uint8_t txFree;					///< TX FIFO slots known to be free
+	const uint8_t *txData;			///< Next data to send asynchronously
+	uint16_t txLen;					///< Data remaining in current TX stage
+	const uint8_t *txPay;			///< Payload of asynchronous frame
+	uint16_t txPayLen;				///< Payload length of asynchronous frame
+	uint8_t txHdr[LSD_BUF_DATA_START];	///< Header of asynchronous frame
+	uint8_t txTrl[LSD_TRL_LEN];		///< Trailer of asynchronous frame
+	uint8_t hist[LSD_RESYNC_LEN];	///< Last bytes received after STX
+	uint8_t histPos;				///< Next write position in hist
+	uint8_t histCnt;				///< Number of bytes in hist
+	uint8_t rq[LSD_RESYNC_LEN];		///< Bytes to scan again after an error
+	uint8_t rqPos;					///< Next byte to read from rq
+	uint8_t rqLen;					///< Number of bytes in rq
+#ifdef LSD_RING
+	uint8_t ring[LSD_RX_RING_LEN];	///< Data drained from the UART
+	volatile uint16_t ringHead;		///< Next ring position to write
+	volatile uint16_t ringTail;		///< Next ring position to read
+	volatile uint8_t ringBusy;		///< Ring being filled outside LsdRxIsr()
+#endif
+#ifdef LSD_RX_Z80
+	uint8_t z80Err;					///< UART line errors seen by the Z80
+#endif
+#ifdef LSD_STATS
+	LsdStats st;					///< Link statistics
+#endif
+#ifdef LSD_CRC
+	uint16_t txCrc;					///< CRC of the frame being sent
+	uint16_t rxCrc;					///< CRC of the frame being received
+	uint8_t txCh;					///< Channel of the frame being sent
+	uint8_t split;					///< A split frame is being sent
+	uint8_t errCh;					///< Channel of last frame with CRC error
+	uint8_t nak;					///< Channel requested by a NAK frame
+	uint8_t retxPend;				///< Retransmission requested
+	uint16_t retxLen;				///< Length of the frame to retransmit
+	uint8_t retx[LSD_RX_MAX_LEN];	///< Last frame sent on LSD_RETX_CH
+#endif
 } LsdData;
 /** \} */
 
 // Module global data
 static LsdData d;
 
+static inline void LsdPollSend(const uint8_t data[], uint16_t len) {
+	uint8_t n;
+
+	// Data is sent in bursts filling the TX FIFO slots known to be free.
+	// THRE is only polled when the FIFO might be full, so the frame header,
+	// payload and ETX (even across split frame calls) share bursts.
+	while (len) {
+		if (!d.txFree) {
+			while (!UartTxReady()) LsdStatInc(txWait);
+			d.txFree = UART_TX_FIFO_LEN;
+		}
+		n = MIN(d.txFree, len);
+		len -= n;
+		d.txFree -= n;
+		LsdTxBurst(data, n);
+		data += n;
+	}
+}
+
+static inline void LsdHeaderBuild(uint8_t hdr[], uint16_t len, uint8_t ch) {
+	hdr[0] = LSD_STX_ETX;
+	hdr[1] = (ch<<4) | (len>>8);
+	hdr[2] = len & 0xFF;
+}
+
+#ifdef LSD_STATS
+// Accounts a frame sent
+static inline void LsdStatsTx(uint16_t len, uint8_t ch) {
+	if (ch >= LSD_MAX_CH) return;
+	d.st.txFrames[ch]++;
+	d.st.txBytes[ch] += len;
+}
+
+// Accounts a frame dropped because of reception errors
+static inline void LsdStatsRxErr(uint8_t ch) {
+	if (ch < LSD_MAX_CH) d.st.rxErr[ch]++;
+}
+#else
+#define LsdStatsTx(len, ch)
+#define LsdStatsRxErr(ch)
+#endif
+
+// Obtains the UART line errors, accounting them
+static inline uint8_t LsdLineErrGet(void) {
+	uint8_t err = UartLineErrGet();
+
+#ifdef LSD_RX_Z80
+	err |= d.z80Err;
+	d.z80Err = 0;
+#endif
+#ifdef LSD_STATS
+	if (err & UART_LSR__OE) d.st.overrun++;
+	if (err & UART_LSR__PE) d.st.parity++;
+	if (err & UART_LSR__FE) d.st.framing++;
+	if (err & UART_LSR__BI) d.st.brk++;
+#endif
+	return err;
+}
+
+static inline void LsdHeaderSend(uint16_t len, uint8_t ch) {
+	uint8_t hdr[LSD_BUF_DATA_START];
+
+	LsdStatsTx(len, ch);
+	LsdHeaderBuild(hdr, len, ch);
+#ifdef LSD_CRC
+	d.txCrc = LsdCrc16(hdr + 1, LSD_BUF_DATA_START - 1, CRC16_INIT);
+	d.txCh = ch;
+#endif
+	LsdPollSend(hdr, LSD_BUF_DATA_START);
+}
+
+// Builds the frame trailer (CRC and ETX)
+static inline void LsdTrailerBuild(uint8_t trl[], uint16_t crc) {
+#ifdef LSD_CRC
+	trl[0] = crc>>8;
+	trl[1] = crc & 0xFF;
+#else
+	UNUSED_PARAM(crc);
+#endif
+	trl[LSD_CRC_LEN] = LSD_STX_ETX;
+}
+
+static inline void LsdTrailerSend(void) {
+	uint8_t trl[LSD_TRL_LEN];
+
+#ifdef LSD_CRC
+	LsdTrailerBuild(trl, d.txCrc);
+#else
+	LsdTrailerBuild(trl, 0);
+#endif
+	LsdPollSend(trl, LSD_TRL_LEN);
+}
+
+#ifdef LSD_CRC
+// Copies payload of frames sent on LSD_RETX_CH, to be able to send it again.
+// This adds a memcpy() pass over every control channel payload, before it
+// is sent.
+static void LsdRetxCopy(const uint8_t data[], uint16_t len) {
+	if (LSD_RETX_CH != d.txCh || LSD_RETX_NONE == d.retxLen) return;
+	if ((d.retxLen + len) > LSD_RX_MAX_LEN) {
+		d.retxLen = LSD_RETX_NONE;
+		return;
+	}
+	memcpy(d.retx + d.retxLen, data, len);
+	d.retxLen += len;
+}
+
+// Starts a new frame to keep for retransmission
+static inline void LsdRetxStart(uint8_t ch) {
+	if (LSD_RETX_CH == ch) d.retxLen = 0;
+}
+#else
+#define LsdRetxStart(ch)
+#endif
+
+// Sends payload data, updating the CRC
+static inline void LsdPaySend(const uint8_t data[], uint16_t len) {
+#ifdef LSD_CRC
+	d.txCrc = LsdCrc16(data, len, d.txCrc);
+	LsdRetxCopy(data, len);
+#endif
+	LsdPollSend(data, len);
+}
+
+// Writes to the TX FIFO as much data as fits without waiting. Returns the
+// number of bytes written.
+static uint16_t LsdTxTry(const uint8_t data[], uint16_t len) {
+	uint8_t n;
+
+	if (!d.txFree) {
+		if (!UartTxReady()) {
+			LsdStatInc(txWait);
+			return 0;
+		}
+		d.txFree = UART_TX_FIFO_LEN;
+	}
+	n = MIN(d.txFree, len);
+	d.txFree -= n;
+	LsdTxBurst(data, n);
+
+	return n;
+}
+
+// Finishes sending the asynchronous frame, if any, so frames sent with the
+// blocking functions are not interleaved with it
+static void LsdTxFlush(void) {
+	while (LSD_IN_PROGRESS == LsdTxPoll());
+}
+
+#ifdef LSD_CRC
+// Sends again the last frame sent on LSD_RETX_CH if requested, and no
+// other frame is being sent
+static void LsdRetxService(void) {
+	if (!d.retxPend || d.split || LSD_TX_IDLE != d.txs) return;
+	d.retxPend = FALSE;
+	if (LSD_RETX_NONE == d.retxLen) return;
+
+	LsdHeaderSend(d.retxLen, LSD_RETX_CH);
+	d.txCrc = LsdCrc16(d.retx, d.retxLen, d.txCrc);
+	LsdPollSend(d.retx, d.retxLen);
+	LsdTrailerSend();
+}
+#else
+#define LsdRetxService()
+#endif
+
+// Starts receiving on a free buffer. If none is available, reception is
+// stopped (data is left in the UART) until a buffer is freed.
+static int LsdRxNext(void) {
+	uint8_t i;
+
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		if (LSD_BUF_FREE == d.bufSt[i]) {
+			d.bufSt[i] = LSD_BUF_RECV;
+			d.current = i;
+			d.pos = 0;
+			d.rxs = LSD_ST_STX_WAIT;
+			return LSD_OK;
+		}
+	}
+	d.rxs = LSD_ST_IDLE;
+
+	return LSD_ERROR;
+}
+
+// Returns TRUE if storing a frame received on ch would leave no free
+// buffer for LSD_RSV_CH
+static int LsdRxRsvHit(uint8_t ch) {
+	uint8_t i;
+
+	if (LSD_RSV_CH == ch) return FALSE;
+	// The current buffer is not free, so any other is left
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		if (LSD_BUF_FREE == d.bufSt[i]) return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Appends the buffer being received to the queue of its channel
+static void LsdRxQueue(uint8_t ch) {
+	uint8_t i = d.current;
+
+	d.bufSt[i] = LSD_BUF_READY;
+	d.next[i] = LSD_BUF_NONE;
+	if (LSD_BUF_NONE == d.qTail[ch]) d.qHead[ch] = i;
+	else d.next[d.qTail[ch]] = i;
+	d.qTail[ch] = i;
+}
+
+// Removes the oldest buffer from a channel queue
+static uint8_t LsdRxDequeue(uint8_t ch) {
+	uint8_t i = d.qHead[ch];
+
+	if (LSD_BUF_NONE != i) {
+		d.qHead[ch] = d.next[i];
+		if (LSD_BUF_NONE == d.qHead[ch]) d.qTail[ch] = LSD_BUF_NONE;
+	}
+
+	return i;
+}
+
+// Keeps a received byte, to be able to scan it again if the frame is wrong
+static inline void LsdHistPut(uint8_t b) {
+	d.hist[d.histPos] = b;
+	if (++d.histPos >= LSD_RESYNC_LEN) d.histPos = 0;
+	if (d.histCnt < LSD_RESYNC_LEN) d.histCnt++;
+}
+
+#ifdef LSD_RX_Z80
+// Z80 reception driver (lsdz80.s80), padded to LSD_Z80_CODE_LEN bytes
+extern const uint8_t lsdz80[];
+
+// Loads the reception driver to the Z80 and starts it
+static void LsdZ80Start(void) {
+	volatile uint8_t *z = Z80_RAM;
+	uint16_t i;
+
+	Z80BusReq();
+	for (i = 0; i < LSD_Z80_CODE_LEN; i++) z[i] = lsdz80[i];
+	for (i = LSD_Z80_HEAD; i <= LSD_Z80_ERR; i++) z[i] = 0;
+	Z80ResetSet(TRUE);
+	Z80BusRel();
+	Z80ResetSet(FALSE);
+	d.z80Err = 0;
+}
+
+// Copies the data received by the Z80 driver into the ring, while there is
+// space. The Z80 is stopped meanwhile, so up to LSD_Z80_COPY_MAX bytes are
+// copied each time.
+static void LsdRingFill(void) {
+	volatile uint8_t *z = Z80_RAM;
+	volatile uint8_t *src;
+	uint16_t head = d.ringHead;
+	uint16_t tail = d.ringTail;
+	uint16_t zHead, zTail, max, n, i;
+
+	Z80BusReq();
+	// While the Z80 updates the head it is not valid, try again next time
+	if (!z[LSD_Z80_BUSY]) {
+		zHead = z[LSD_Z80_HEAD] | (z[LSD_Z80_HEAD + 1]<<8);
+		zTail = z[LSD_Z80_TAIL] | (z[LSD_Z80_TAIL + 1]<<8);
+		d.z80Err |= z[LSD_Z80_ERR];
+		z[LSD_Z80_ERR] = 0;
+		for (max = LSD_Z80_COPY_MAX; max && zTail != zHead; max -= n) {
+			// Contiguous data in the Z80 ring, fitting contiguous free
+			// space in the ring (a slot is kept free)
+			n = (zHead - zTail) & LSD_Z80_RING_MASK;
+			n = MIN(n, LSD_Z80_RING_LEN - zTail);
+			n = MIN(n, (tail - head - 1) & LSD_RING_MASK);
+			n = MIN(n, LSD_RX_RING_LEN - head);
+			n = MIN(n, max);
+			if (!n) break;
+			src = z + LSD_Z80_RING + zTail;
+			zTail = (zTail + n) & LSD_Z80_RING_MASK;
+			for (i = n; i; i--) d.ring[head++] = *src++;
+			head &= LSD_RING_MASK;
+		}
+		z[LSD_Z80_TAIL] = zTail & 0xFF;
+		z[LSD_Z80_TAIL + 1] = zTail>>8;
+	}
+	Z80BusRel();
+	d.ringHead = head;
+}
+#endif
+
+#ifdef LSD_RX_RING
+// Drains the UART RX FIFO into the ring, while there is space
+static void LsdRingFill(void) {
+	uint16_t head = d.ringHead;
+	uint16_t tail = d.ringTail;
+	uint16_t max, n;
+
+	do {
+		// Contiguous free space. A slot is kept free to tell a full ring
+		// from an empty one.
+		max = (tail - head - 1) & LSD_RING_MASK;
+		max = MIN(max, LSD_RX_RING_LEN - head);
+		if (!max) break;
+		n = LsdRxDrain(d.ring + head, max);
+		head = (head + n) & LSD_RING_MASK;
+	} while (n == max);
+	d.ringHead = head;
+}
+#endif
+
+#ifdef LSD_RING
+// Checks if there is data in the ring. If empty, it is filled from here,
+// so data keeps flowing while polling, even when there are no interrupts
+// (e.g. during the vertical blanking).
+static inline int LsdRingReady(void) {
+	if (d.ringHead != d.ringTail) return TRUE;
+
+	// Keep the interrupt handler out while filling the ring
+	d.ringBusy = TRUE;
+	LsdRingFill();
+	d.ringBusy = FALSE;
+
+	return d.ringHead != d.ringTail;
+}
+
+// Reads a byte from the ring
+static inline uint8_t LsdRingGetc(void) {
+	uint8_t b = d.ring[d.ringTail];
+
+	d.ringTail = (d.ringTail + 1) & LSD_RING_MASK;
+	return b;
+}
+
+// Copies data from the ring, up to max bytes, draining the UART into it
+// when it gets empty. Returns the count.
+static uint16_t LsdRingRead(uint8_t *dst, uint16_t max) {
+	uint16_t total = 0;
+	uint16_t n;
+
+	while (total < max && LsdRingReady()) {
+		// Contiguous data
+		n = (d.ringHead - d.ringTail) & LSD_RING_MASK;
+		n = MIN(n, LSD_RX_RING_LEN - d.ringTail);
+		n = MIN(n, max - total);
+		memcpy(dst + total, d.ring + d.ringTail, n);
+		d.ringTail = (d.ringTail + n) & LSD_RING_MASK;
+		total += n;
+	}
+
+	return total;
+}
+#endif
+
+// No more received data to process for now
+static inline int LsdRxEmpty(void) {
+	LsdStatInc(rxEmpty);
+
+	return LSD_IN_PROGRESS;
+}
+
+// Copies the payload bytes available in the UART directly to the buffer,
+// instead of going through the state machine for each one. Returns TRUE if
+// the UART ran out of data before the end of the payload.
+static int LsdRxBulk(MwMsgBuf *buf) {
+	uint16_t n, i;
+
+	// Bytes pending to be scanned again go first
+	if (d.rqPos < d.rqLen) return FALSE;
+
+	n = LsdRxCopy(buf->data + d.pos, d.rxLen - d.pos);
+#ifdef LSD_CRC
+	d.rxCrc = LsdCrc16(buf->data + d.pos, n, d.rxCrc);
+#endif
+	// History only needs the last bytes
+	for (i = (n > LSD_RESYNC_LEN)?n - LSD_RESYNC_LEN:0; i < n; i++) {
+		LsdHistPut(buf->data[d.pos + i]);
+	}
+	d.pos += n;
+	if (d.pos < d.rxLen) return TRUE;
+
+	d.rxs = LSD_ST_TRL_RECV;
+	return FALSE;
+}
+
+// Drops the frame being received and prepares the bytes received after its
+// STX to be scanned again, so if the STX was not a real frame start (e.g.
+// a payload byte, or data was lost), the next frame is found among them
+// instead of being lost. Returns the error code to report.
+static int LsdResync(int err) {
+	uint8_t tmp[LSD_RESYNC_LEN];
+	uint8_t i, n;
+
+	// Oldest byte kept in the history
+	i = (d.histPos >= d.histCnt)?d.histPos - d.histCnt:
+		d.histPos + LSD_RESYNC_LEN - d.histCnt;
+	for (n = 0; n < d.histCnt; n++) {
+		tmp[n] = d.hist[i];
+		if (++i >= LSD_RESYNC_LEN) i = 0;
+	}
+	// Bytes pending to be scanned again were received after the history.
+	// As history only holds bytes taken from them when scanning again,
+	// both together always fit.
+	while (d.rqPos < d.rqLen && n < LSD_RESYNC_LEN) {
+		tmp[n++] = d.rq[d.rqPos++];
+	}
+	memcpy(d.rq, tmp, n);
+	d.rqPos = 0;
+	d.rqLen = n;
+	d.histPos = d.histCnt = 0;
+	d.pos = 0;
+	d.rxs = LSD_ST_STX_WAIT;
+
+	return err;
+}
+
+// Drops a frame that ended with ETX but was received with errors. As a byte
+// might have been lost, the ETX could also be the STX of the next frame, so
+// it is taken as such: if it was a real ETX, the next STX follows it.
+static int LsdEtxResync(int err) {
+	d.histPos = d.histCnt = 0;
+	d.pos = 0;
+	d.rxs = LSD_ST_CH_LENH_RECV;
+
+	return err;
+}
+
 /************************************************************************//**
  * Module initialization. Call this function before any other one in this
  * module.
@@ -67,12 +645,37 @@ static LsdData d;
 void LsdInit(void) {
 	uint8_t i;
 
-	d.rxs = d.txs = LSD_ST_IDLE;
-	d.pos = d.current = 0;
+	d.txs = LSD_TX_IDLE;
+	d.txFree = 0;
+	d.histPos = d.histCnt = 0;
+	d.rqPos = d.rqLen = 0;
+#ifdef LSD_RING
+	d.ringHead = d.ringTail = 0;
+	d.ringBusy = FALSE;
+#endif
+#ifdef LSD_STATS
+	LsdStatsReset();
+#endif
+#ifdef LSD_CRC
+	d.split = d.retxPend = FALSE;
+	d.errCh = LSD_CH_NONE;
+	d.retxLen = LSD_RETX_NONE;
+#endif
 	for (i = 0; i < LSD_MAX_CH; i++) {
 		d.en[i] = FALSE;
+		d.qHead[i] = d.qTail[i] = LSD_BUF_NONE;
+	}
+	for (i = 0; i < LSD_BUF_FRAMES; i++) {
+		d.bufSt[i] = LSD_BUF_FREE;
 	}
+	// Start receiving on the first buffer
+	d.rxs = LSD_ST_IDLE;
+	LsdRxNext();
 	UartInit();
+#ifdef LSD_RX_Z80
+	// The driver polls the UART, so it must be initialized first
+	LsdZ80Start();
+#endif
 }
 
 /************************************************************************//**
@@ -87,11 +690,13 @@ int LsdChEnable(uint8_t ch) {
 	if (ch >= LSD_MAX_CH) return LSD_ERROR;
 
 	d.en[ch] = TRUE;
+	d.lost[ch] = FALSE;
 	return LSD_OK;
 }
 
 /************************************************************************//**
- * Disables a channel to stop reception and prohibit sending data.
+ * Disables a channel to stop reception and prohibit sending data. Frames
+ * queued on the channel and not yet obtained are discarded.
  *
  * \param[in] ch Channel number.
  *
@@ -99,9 +704,14 @@ int LsdChEnable(uint8_t ch) {
  *         available.
  ****************************************************************************/
 int LsdChDisable(uint8_t ch) {
+	uint8_t i;
+
 	if (ch >= LSD_MAX_CH) return LSD_ERROR;
 
 	d.en[ch] = FALSE;
+	while (LSD_BUF_NONE != (i = LsdRxDequeue(ch))) {
+		LsdRxFree(&d.rx[i]);
+	}
 
 	return LSD_OK;
 }
@@ -117,7 +727,7 @@ int LsdChDisable(uint8_t ch) {
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSend(uint8_t *data, uint16_t len, uint8_t ch) {
+int LsdSend(const uint8_t *data, uint16_t len, uint8_t ch) {
 	if (ch >= LSD_MAX_CH) {
 		return -1;
 	}
@@ -128,23 +738,54 @@ int LsdSend(uint8_t *data, uint16_t len, uint8_t ch) {
 		return -1;
 	}
 
-	while (!UartTxReady());
-	// Send STX
-	UartPutc(LSD_STX_ETX);
-	// Send ch and high nibble of length
-	UartPutc((ch<<4) | (len>>8));
-	// Send low byte of length
-	UartPutc(len & 0xFF);
-	// Send data payload
-	LsdPollSend(data, len);
-	// Send ETX
-	// TODO: It's stupid using FIFOs to end up doing this:
-	while (!UartTxReady());
-	UartPutc(LSD_STX_ETX);
+	// Send STX, ch, length, payload, CRC and ETX
+	PROF_ENTER(PROF_LSD_SEND);
+	LsdTxFlush();
+	LsdRetxStart(ch);
+	LsdHeaderSend(len, ch);
+	LsdPaySend(data, len);
+	LsdTrailerSend();
+	LsdRetxService();
+	PROF_EXIT(PROF_LSD_SEND);
 	
 	return len;
 }
 
+/************************************************************************//**
+ * Sends a frame built from several data segments (scatter-gather) through a
+ * previously enabled channel. Segments are sent directly from their
+ * location (e.g. constants in ROM), without copying them to a buffer.
+ *
+ * \param[in] vec Segments to send, in order.
+ * \param[in] n   Number of segments.
+ * \param[in] ch  Channel number to use.
+ *
+ * \return -1 if there was an error, or the number of characters sent
+ * 		   otherwise.
+ ****************************************************************************/
+int LsdSendV(const LsdVec vec[], uint8_t n, uint8_t ch) {
+	uint16_t total = 0;
+	uint8_t i;
+
+	if (ch >= LSD_MAX_CH || !d.en[ch]) return -1;
+	for (i = 0; i < n; i++) {
+		total += vec[i].len;
+		if (total > LSD_MAX_LEN || total < vec[i].len) return -1;
+	}
+
+	// Send STX, ch, length, all the segments, CRC and ETX
+	PROF_ENTER(PROF_LSD_SEND);
+	LsdTxFlush();
+	LsdRetxStart(ch);
+	LsdHeaderSend(total, ch);
+	for (i = 0; i < n; i++) LsdPaySend(vec[i].data, vec[i].len);
+	LsdTrailerSend();
+	LsdRetxService();
+	PROF_EXIT(PROF_LSD_SEND);
+
+	return total;
+}
+
 /************************************************************************//**
  * Starts sending data through a previously enabled channel. Once started,
  * you can send more additional data inside of the frame by issuing as
@@ -159,21 +800,22 @@ int LsdSend(uint8_t *data, uint16_t len, uint8_t ch) {
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitStart(uint8_t *data, uint16_t len,
+int LsdSplitStart(const uint8_t *data, uint16_t len,
 	              uint16_t total, uint8_t ch) {
 	if (ch >= LSD_MAX_CH) return -1;
 	if (total > LSD_MAX_LEN) return -1;
 	if (!d.en[ch]) return -1;
 
-	while (!UartTxReady());
-	// Send STX
-	UartPutc(LSD_STX_ETX);
-	// Send ch and high nibble of length
-	UartPutc((ch<<4) | (len>>8));
-	// Send low byte of length
-	UartPutc(len & 0xFF);
-	// Send data payload
-	if (len) LsdPollSend(data, len);
+	// Send STX, ch, total length and first chunk of the payload. The frame
+	// is profiled until LsdSplitEnd().
+	PROF_ENTER(PROF_LSD_SEND);
+	LsdTxFlush();
+	LsdRetxStart(ch);
+	LsdHeaderSend(total, ch);
+	LsdPaySend(data, len);
+#ifdef LSD_CRC
+	d.split = TRUE;
+#endif
 	
 	return len;
 }
@@ -188,8 +830,8 @@ int LsdSplitStart(uint8_t *data, uint16_t len,
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitNext(uint8_t *data, uint16_t len) {
-	LsdPollSend(data, len);
+int LsdSplitNext(const uint8_t *data, uint16_t len) {
+	LsdPaySend(data, len);
 
 	return len;
 }
@@ -204,102 +846,485 @@ int LsdSplitNext(uint8_t *data, uint16_t len) {
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitEnd(uint8_t *data, uint16_t len) {
-	if (len) LsdPollSend(data, len);
-	// Send ETX
-	// TODO: It's stupid using FIFOs to end up doing this:
-	while (!UartTxReady());
-	UartPutc(LSD_STX_ETX);
+int LsdSplitEnd(const uint8_t *data, uint16_t len) {
+	LsdPaySend(data, len);
+	LsdTrailerSend();
+#ifdef LSD_CRC
+	d.split = FALSE;
+	LsdRetxService();
+#endif
+	PROF_EXIT(PROF_LSD_SEND);
 
 	return len;
 }
 
 
 /************************************************************************//**
- * Receives a frame using LSD protocol.
+ * Starts sending a frame through a previously enabled channel, without
+ * waiting for the UART. Data is written to the UART as FIFO space becomes
+ * available, each time LsdTxPoll() is called. Only one frame can be sent
+ * asynchronously at a time, and it must not be started while a split frame
+ * is being sent.
  *
- * \param[out]   buf Buffer that will hold the received data.
- * \param[inout] maxLen When calling the function, the variable pointed by
- *               maxLen, must hold the maximum number of bytes buf can
- *               store. On return, the variable is updated to the number
- *               of bytes received.
- * \param[in]    maxLoopCnt Maximum number of loops trying to read data.
+ * \param[in] data Buffer to send. Must be kept unmodified until LsdTxPoll()
+ *            returns LSD_OK.
+ * \param[in] len  Length of the buffer to send.
+ * \param[in] ch   Channel number to use.
  *
- * \return On success, the number of the channel in which data has been
- * 		   received. On failure, a negative number.
+ * \return LSD_OK if the frame was started, or LSD_ERROR if parameters are
+ *         not valid or another frame is being sent asynchronously.
  ****************************************************************************/
-// Returns the channel number
-//int LsdRecv(MwMsgBuf* buf, uint16_t maxLen, uint32_t maxLoopCnt) {
-int LsdRecv(uint8_t* buf, uint16_t* maxLen, uint32_t maxLoopCnt) {
-	LsdState rxs = LSD_ST_STX_WAIT;
-	uint32_t loops;
-	uint16_t pos = 0;
-	uint16_t len = 0;
-	uint8_t recv;
-	int8_t ch = -1;
+int LsdTxStart(const uint8_t *data, uint16_t len, uint8_t ch) {
+	if (ch >= LSD_MAX_CH || len > LSD_MAX_LEN || !d.en[ch]) {
+		return LSD_ERROR;
+	}
+	if (LSD_TX_IDLE != d.txs) return LSD_ERROR;
 
-	while (1) {
-		// Receive a character
-		loops = maxLoopCnt;
-		while (!UartRxReady()) {
-			loops--;
-			if (!loops) return -1;
+	LsdHeaderBuild(d.txHdr, len, ch);
+	LsdStatsTx(len, ch);
+#ifdef LSD_CRC
+	// Whole frame is available, compute the CRC in advance
+	d.txCrc = LsdCrc16(d.txHdr + 1, LSD_BUF_DATA_START - 1, CRC16_INIT);
+	d.txCrc = LsdCrc16(data, len, d.txCrc);
+	LsdTrailerBuild(d.txTrl, d.txCrc);
+	d.txCh = ch;
+	LsdRetxStart(ch);
+	LsdRetxCopy(data, len);
+#else
+	LsdTrailerBuild(d.txTrl, 0);
+#endif
+	d.txData = d.txHdr;
+	d.txLen = LSD_BUF_DATA_START;
+	d.txPay = data;
+	d.txPayLen = len;
+	d.txs = LSD_TX_HDR;
+	LsdTxPoll();
+
+	return LSD_OK;
+}
+
+/************************************************************************//**
+ * Writes to the UART as much data of the frame started with LsdTxStart() as
+ * fits in the TX FIFO. Does not wait for the UART.
+ *
+ * \return LSD_OK if no frame is being sent asynchronously (i.e. the frame
+ *         has been completely written to the UART), or LSD_IN_PROGRESS if
+ *         there is still data to send.
+ ****************************************************************************/
+int LsdTxPoll(void) {
+	uint16_t n;
+
+	while (LSD_TX_IDLE != d.txs) {
+		if (d.txLen) {
+			if (!(n = LsdTxTry(d.txData, d.txLen))) return LSD_IN_PROGRESS;
+			d.txData += n;
+			d.txLen -= n;
+			continue;
 		}
-		recv = UartGetc();
-		switch (rxs) {
-			case LSD_ST_IDLE:			// Do nothing!
-				return -1;
-	
+		// Current stage done, go for the next one
+		switch (d.txs) {
+			case LSD_TX_HDR:
+				d.txData = d.txPay;
+				d.txLen = d.txPayLen;
+				d.txs = LSD_TX_DATA;
+				break;
+
+			case LSD_TX_DATA:
+				d.txData = d.txTrl;
+				d.txLen = LSD_TRL_LEN;
+				d.txs = LSD_TX_ETX;
+				break;
+
+			default:
+				d.txs = LSD_TX_IDLE;
+				LsdRetxService();
+		}
+	}
+
+	return LSD_OK;
+}
+
+#ifdef LSD_CRC
+/************************************************************************//**
+ * Requests the other end to send again the last frame it sent on a channel.
+ * Call it when LsdPoll() returns LSD_CRC_ERROR.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return LSD_OK on success, or LSD_ERROR if a split frame is being sent.
+ ****************************************************************************/
+int LsdNakSend(uint8_t ch) {
+	if (d.split) return LSD_ERROR;
+
+	LsdTxFlush();
+	LsdHeaderSend(1, LSD_NAK_CH);
+	LsdPaySend(&ch, 1);
+	LsdTrailerSend();
+
+	return LSD_OK;
+}
+
+/************************************************************************//**
+ * Returns the channel of the last frame received with a wrong CRC. As the
+ * channel field might also be corrupted, use it only as a hint.
+ *
+ * \return Channel number, or LSD_CH_NONE if no CRC errors occurred.
+ ****************************************************************************/
+uint8_t LsdRxErrCh(void) {
+	return d.errCh;
+}
+#endif
+
+// Reception state machine, see LsdPoll()
+static int LsdRxRun(void) {
+	MwMsgBuf *buf;
+	uint8_t recv;
+	uint8_t ch;
+
+	// If all buffers are in use, leave data in the UART
+	if (LSD_ST_IDLE == d.rxs && LsdRxNext()) return LSD_IN_PROGRESS;
+	buf = &d.rx[d.current];
+
+	while (LsdRxAvail()) {
+		// Bytes to scan again after an error go before new ones
+		recv = (d.rqPos < d.rqLen)?d.rq[d.rqPos++]:LsdRxGetc();
+		LsdHistPut(recv);
+		switch (d.rxs) {
 			case LSD_ST_STX_WAIT:		// Wait for STX to arrive
-				if (LSD_STX_ETX == recv) rxs = LSD_ST_CH_LENH_RECV;
+				if (LSD_STX_ETX == recv) {
+					// Forget line errors previous to this frame
+					LsdLineErrGet();
+					d.histPos = d.histCnt = 0;
+					d.rxs = LSD_ST_CH_LENH_RECV;
+				}
 				break;
 	
 			case LSD_ST_CH_LENH_RECV:	// Receive CH and len high
 				// Check special case: if we receive STX and pos == 0,
 				// then this is the real STX (previous one was ETX from
 				// previous frame!).
-				if (!(LSD_STX_ETX == recv && 0 == pos)) {
-					ch = recv>>4;
-					len = (recv & 0x0F)<<8;
+				if (LSD_STX_ETX == recv && 0 == d.pos) {
+					d.histPos = d.histCnt = 0;
+				} else {
+					buf->ch = recv>>4;
+					d.rxLen = (recv & 0x0F)<<8;
+#ifdef LSD_CRC
+					d.rxCrc = Crc16Upd(CRC16_INIT, recv);
+#endif
 					// Sanity check (not exceding number of channels)
-					if (ch >= LSD_MAX_CH) {
-						return -1;
+					if (!LsdRxChValid(buf->ch)) {
+						LsdStatInc(chErr);
+						return LsdResync(LSD_ERROR);
 					}
-					else rxs = LSD_ST_LEN_RECV;
+					else d.rxs = LSD_ST_LEN_RECV;
 				}
 				break;
 	
 			case LSD_ST_LEN_RECV:		// Receive len low
-				len |= recv;
+				d.rxLen |= recv;
+				d.pos = 0;
+				LsdRxCrcUpd(recv);
+				// Frames for disabled channels are skipped, not stored, and
+				// so are frames that would take the buffer kept for
+				// LSD_RSV_CH, and frames following a frame lost that way
+				d.skip = !LsdRxChEn(buf->ch) || d.lost[buf->ch] ||
+					LsdRxRsvHit(buf->ch);
+				if (d.skip) {
+					d.rxs = d.rxLen?LSD_ST_DATA_SKIP:LSD_ST_TRL_RECV;
+					break;
+				}
 				// Sanity check (not exceeding maximum buffer length)
-				if (len > *maxLen) {
-					return -1;
+				if (d.rxLen > LSD_RX_MAX_LEN) {
+					LsdStatInc(lenErr);
+					return LsdResync(LSD_ERROR);
 				}
 				// If there's payload, receive it. Else wait for ETX
-				if (len) {
-					pos = 0;
-					rxs = LSD_ST_DATA_RECV;
+				if (d.rxLen) {
+					d.rxs = LSD_ST_DATA_RECV;
+					// Copy the payload in bulk while it keeps arriving
+					if (LsdRxBulk(buf)) return LsdRxEmpty();
 				} else {
-					rxs = LSD_ST_ETX_RECV;
+					d.rxs = LSD_ST_TRL_RECV;
 				}
 				break;
 	
 			case LSD_ST_DATA_RECV:		// Receive payload
-				buf[pos++] = recv;
-				if (pos >= len) rxs = LSD_ST_ETX_RECV;
+				buf->data[d.pos++] = recv;
+				LsdRxCrcUpd(recv);
+				if (d.pos >= d.rxLen) d.rxs = LSD_ST_TRL_RECV;
+				else if (LsdRxBulk(buf)) return LsdRxEmpty();
+				break;
+
+			case LSD_ST_DATA_SKIP:		// Skip payload
+#ifdef LSD_CRC
+				// Keep the channel requested by NAK frames
+				if (!d.pos) d.nak = recv;
+#endif
+				LsdRxCrcUpd(recv);
+				if (++d.pos >= d.rxLen) d.rxs = LSD_ST_TRL_RECV;
+				break;
+
+#ifdef LSD_CRC
+			case LSD_ST_CRCH_RECV:		// Receive CRC high byte
+				LsdRxCrcUpd(recv);
+				d.rxs = LSD_ST_CRCL_RECV;
+				break;
+
+			case LSD_ST_CRCL_RECV:		// Receive CRC low byte
+				LsdRxCrcUpd(recv);
+				d.rxs = LSD_ST_ETX_RECV;
 				break;
+#endif
 	
 			case LSD_ST_ETX_RECV:		// ETX should come here
-				if (LSD_STX_ETX == recv) {
-					*maxLen = pos;
-					return ch;
+				if (LSD_STX_ETX != recv) {
+					// Error, ETX not received.
+					LsdStatInc(etxErr);
+					LsdStatsRxErr(buf->ch);
+					return LsdResync(LSD_FRAMING_ERROR);
+				}
+				ch = buf->ch;
+				if (LsdLineErrGet() & UART_LSR__OE) {
+					// Data was lost during reception, drop frame
+					LsdStatsRxErr(ch);
+					return LsdEtxResync(LSD_FRAMING_ERROR);
+				}
+#ifdef LSD_CRC
+				// CRC of data followed by its CRC must be 0
+				if (d.rxCrc) {
+					d.errCh = ch;
+					LsdStatInc(crcErr);
+					LsdStatsRxErr(ch);
+					return LsdEtxResync(LSD_CRC_ERROR);
+				}
+				if (LSD_NAK_CH == ch) {
+					if (1 == d.rxLen && LSD_RETX_CH == d.nak) {
+						d.retxPend = TRUE;
+						LsdRetxService();
+					}
+					d.pos = 0;
+					d.rxs = LSD_ST_STX_WAIT;
+					break;
+				}
+#endif
+				if (d.skip) {
+					// Frame dropped, reuse the buffer for the next one. The
+					// reader of an enabled channel must know data is missing.
+					if (d.en[ch]) {
+						d.lost[ch] = TRUE;
+						LsdStatInc(noBuf);
+					} else {
+						LsdStatInc(dropped);
+					}
+					d.pos = 0;
+					d.rxs = LSD_ST_STX_WAIT;
+					break;
 				}
-				// Error, ETX not received.
-				return -1;
+				// Frame complete, queue it and go for the next one
+				buf->len = d.pos;
+				LsdStatInc(rxFrames[ch]);
+				LsdStatAdd(rxBytes[ch], d.pos);
+				LsdRxQueue(ch);
+				LsdRxNext();
+				return ch;
 	
 			default:
 				// Code should never reach here!
-				return -1;
+				d.pos = 0;
+				d.rxs = LSD_ST_STX_WAIT;
+				return LSD_ERROR;
 		} // switch(d.rxs)
-	} // while (1)
+	}
+
+	return LsdRxEmpty();
+}
+
+/************************************************************************//**
+ * Receives the data available in the UART into the reception buffer pool.
+ * Returns as soon as there is no more data available or a frame has been
+ * completely received. Received frames are then obtained with LsdRxGet().
+ *
+ * \return The channel number the frame was received on if a frame has
+ *         been completely received, LSD_IN_PROGRESS if frame reception is
+ *         not complete (or there are no free reception buffers),
+ *         LSD_FRAMING_ERROR if data was lost because of an UART overrun or
+ *         ETX was not found, LSD_CRC_ERROR if the frame CRC is wrong, or
+ *         LSD_ERROR if there was another error. On error, the frame being
+ *         received is discarded, and data received after its STX is scanned
+ *         again on next calls looking for the next frame.
+ ****************************************************************************/
+int LsdPoll(void) {
+	int ret;
+
+	PROF_ENTER(PROF_LSD_POLL);
+	ret = LsdRxRun();
+	PROF_EXIT(PROF_LSD_POLL);
+
+	return ret;
 }
+
+/************************************************************************//**
+ * Checks if there is received data not yet processed by LsdPoll().
+ *
+ * \return TRUE if there is data pending to be processed, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxPend(void) {
+	return LsdRxAvail()?TRUE:FALSE;
+}
+
+/************************************************************************//**
+ * Checks if reception is stopped because all the reception buffers hold
+ * frames not yet returned with LsdRxFree(). Until a buffer is freed,
+ * LsdPoll() leaves received data in the UART.
+ *
+ * \return TRUE if reception is stopped, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxStalled(void) {
+	return LSD_ST_IDLE == d.rxs?TRUE:FALSE;
+}
+
+/************************************************************************//**
+ * Checks if a frame received on a channel was dropped because the only
+ * free reception buffer was the one kept for LSD_RSV_CH. Later frames on
+ * the channel are also dropped until this function is called, so the
+ * frames queued are the ones received before the first frame lost. The
+ * condition is cleared by this call, and when the channel is enabled.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return TRUE if a frame was dropped since the last call, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxLost(uint8_t ch) {
+	int lost;
+
+	if (ch >= LSD_MAX_CH) return FALSE;
+	lost = d.lost[ch];
+	d.lost[ch] = FALSE;
+
+	return lost;
+}
+
+#ifdef LSD_RX_RING
+/************************************************************************//**
+ * Drains the UART RX FIFO into the reception ring. Call it from the
+ * horizontal interrupt handler every LSD_RX_RING_LINES scanlines, and from
+ * the vertical interrupt handler. If the ring is full, data is left in the
+ * UART.
+ ****************************************************************************/
+void LsdRxIsr(void) {
+	// If interrupting LsdPoll() filling the ring, let it finish
+	if (!d.ringBusy) LsdRingFill();
+}
+#endif
+
+#ifdef LSD_STATS
+/************************************************************************//**
+ * Obtains a snapshot of the link statistics.
+ *
+ * \param[out] st Statistics recorded since module initialization or since
+ *             the last LsdStatsReset() call.
+ ****************************************************************************/
+void LsdStatsGet(LsdStats *st) {
+	memcpy(st, &d.st, sizeof(LsdStats));
+}
+
+/************************************************************************//**
+ * Clears the link statistics.
+ ****************************************************************************/
+void LsdStatsReset(void) {
+	memset(&d.st, 0, sizeof(LsdStats));
+}
+#endif
+
+/************************************************************************//**
+ * Obtains the oldest frame received on a channel. The frame stays owned by
+ * the application until it is returned to the pool with LsdRxFree(). This
+ * function does not read data from the UART, call LsdPoll() for that.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return The received frame (payload, length and channel), or NULL if no
+ *         frame has been received on the channel.
+ ****************************************************************************/
+MwMsgBuf *LsdRxGet(uint8_t ch) {
+	uint8_t i;
+
+	if (ch >= LSD_MAX_CH) return NULL;
+	if (LSD_BUF_NONE == (i = LsdRxDequeue(ch))) return NULL;
+	d.bufSt[i] = LSD_BUF_USED;
+
+	return &d.rx[i];
+}
+
+// Obtains a received frame from any channel, lower channels first
+static MwMsgBuf *LsdRxGetAny(void) {
+	MwMsgBuf *rx = NULL;
+	uint8_t ch;
+
+	for (ch = 0; ch < LSD_MAX_CH && !rx; ch++) rx = LsdRxGet(ch);
+
+	return rx;
+}
+
+/************************************************************************//**
+ * Returns a frame previously obtained with LsdRxGet() to the reception
+ * buffer pool.
+ *
+ * \param[in] buf Frame to return to the pool.
+ ****************************************************************************/
+void LsdRxFree(MwMsgBuf *buf) {
+	d.bufSt[buf - d.rx] = LSD_BUF_FREE;
+	// Resume reception if it was stopped
+	if (LSD_ST_IDLE == d.rxs) LsdRxNext();
+}
+
+/************************************************************************//**
+ * Receives a frame using LSD protocol. Blocks until the frame is received,
+ * an error occurs or no data is received for maxLoopCnt loops. Received
+ * data is copied to the specified buffer, use LsdPoll() and LsdRxGet() to
+ * avoid the copy.
+ *
+ * \param[out]   buf Buffer that will hold the received data.
+ * \param[inout] maxLen When calling the function, the variable pointed by
+ *               maxLen, must hold the maximum number of bytes buf can
+ *               store. On return, the variable is updated to the number
+ *               of bytes received.
+ * \param[in]    maxLoopCnt Maximum number of loops trying to read data.
+ *
+ * \return On success, the number of the channel in which data has been
+ * 		   received. On failure, a negative number. LSD_ERROR is also
+ * 		   returned if no frame is queued and the application holds all the
+ * 		   reception buffers (see LsdRxStalled()).
+ * \note   Frames already queued are returned first, lower channels first.
+ ****************************************************************************/
+int LsdRecv(uint8_t* buf, uint16_t* maxLen, uint32_t maxLoopCnt) {
+	MwMsgBuf *rx;
+	uint32_t loops;
+	int ret;
+
+	while (!(rx = LsdRxGetAny())) {
+		// No frame can be received until the application frees a buffer
+		if (LsdRxStalled()) return LSD_ERROR;
+		// Wait for a character
+		loops = maxLoopCnt;
+		while (!LsdRxAvail()) {
+			LsdStatInc(rxEmpty);
+			loops--;
+			if (!loops) return LSD_ERROR;
+		}
+		ret = LsdPoll();
+		if (ret < 0 && LSD_IN_PROGRESS != ret) return ret;
+	}
+
+	if (rx->len > *maxLen) {
+		ret = LSD_ERROR;
+	} else {
+		memcpy(buf, rx->data, rx->len);
+		*maxLen = rx->len;
+		ret = rx->ch;
+	}
+	LsdRxFree(rx);
+
+	return ret;
+}
+
@@ -5,7 +5,6 @@
  *
  * \author Jesus Alonso (doragasu)
  * \date   2016
- * \todo   Implement UART RTS/CTS handshaking.
  * \todo   Current implementation uses polling. Unfortunately as the Genesis/
  *         Megadrive does not have an interrupt pin on the cart, implementing
  *         more efficient data transmission techniques will be tricky.
@@ -21,15 +20,72 @@
  *
  * To send data call LsdSend();
  *
+ * Frames are received into a small pool of buffers owned by this module.
+ * To receive data without blocking, call LsdPoll() periodically (e.g. once
+ * per frame). Received frames are queued per channel, obtained with
+ * LsdRxGet() and read in place, and must be returned to the pool with
+ * LsdRxFree() when done. Frames for disabled channels are dropped.
+ * The last free buffer is kept for LSD_RSV_CH, so frames left unread on
+ * other channels cannot stop the reception of LSD_RSV_CH frames: a frame
+ * on another channel that would take it is dropped, as are the next
+ * frames on its channel until LsdRxLost() reports it.
+ * While the application processes a frame, the next one is received into
+ * another buffer. LsdRecv() can be used instead to block until a frame is
+ * received and copy it to an application buffer.
+ *
  * Frame format is:
  *
- * STX : CH-LENH : LENL : DATA : ETX
+ * STX : CH-LENH : LENL : DATA : [CRC] : ETX
  *
  * - STX and ETX are the start/end of transmission characters (1 byte each).
  * - CH-LENH is the channel number (first 4 bits) and the 4 high bits of the
  *   data length.
  * - LENL is the low 8 bits of the data length.
  * - DATA is the payload, of the previously specified length.
+ * - CRC is only present when built with LSD_CRC defined. It is the CRC-16
+ *   (see crc16.h) of CH-LENH, LENL and DATA, high byte first.
+ *
+ * When built with LSD_CRC, frames received with a wrong CRC are dropped and
+ * LsdPoll() returns LSD_CRC_ERROR. The sender can be requested to send again
+ * its last frame on a channel by calling LsdNakSend(), that sends a frame
+ * on LSD_NAK_CH with the channel number as payload. When such a frame is
+ * received, the last frame sent on LSD_RETX_CH is sent again. To be able to
+ * do so, the payload of every frame sent on LSD_RETX_CH is also copied to a
+ * LSD_RX_MAX_LEN bytes buffer, costing an extra memcpy() per frame (longer
+ * frames are not kept, and cannot be sent again).
+ *
+ * As STX/ETX can also appear inside the payload, when a frame has a wrong
+ * channel or length, or ETX is not found where expected, the frame is
+ * dropped and the last LSD_RESYNC_LEN bytes received after its STX are
+ * scanned again. Candidate frames are validated by their channel, length,
+ * ETX position and CRC, so reception restarts on the next real frame
+ * instead of losing frames until the stream realigns. When the ETX is found
+ * but the frame has other errors (UART overrun or wrong CRC), the ETX is
+ * taken as a possible STX of the next frame.
+ *
+ * When built with LSD_STATS defined, link statistics (see LsdStats) are
+ * recorded, and can be read with LsdStatsGet() and cleared with
+ * LsdStatsReset().
+ *
+ * As the cartridge port has no UART interrupt line, received data only
+ * leaves the 16 byte RX FIFO when the application calls LsdPoll() or
+ * LsdRecv(), and a busy main loop can overrun it. When built with
+ * LSD_RX_RING defined, LsdRxIsr() must be called from the horizontal
+ * interrupt handler every LSD_RX_RING_LINES scanlines, and from the
+ * vertical interrupt handler. It drains the FIFO into a RAM ring, and the
+ * frames are parsed from the ring instead of the UART. LsdPoll() also
+ * drains the FIFO when the ring is empty. As there are no horizontal
+ * interrupts during the vertical blanking, keep auto flow control enabled
+ * for the module to pause sending during it, unless LsdPoll() is called
+ * then.
+ *
+ * When built with LSD_RX_Z80 defined instead, LsdInit() loads a driver to
+ * the Z80 (lsdz80.s80) that polls the UART through the bank window and
+ * moves received data to a ring in Z80 RAM. LsdPoll() takes the Z80 bus to
+ * copy it, so the 68000 does not poll the UART for received data, and no
+ * interrupt handler is needed. The Z80 cannot be used for anything else
+ * (e.g. a sound driver) then. The driver takes 71 Z80 cycles per received
+ * byte (about 50 KB/s), so faster lines need auto flow control enabled.
  */
 #ifndef _LSD_H_
 #define _LSD_H_
@@ -45,10 +101,34 @@
 #define LSD_ERROR			-1
 /// A framing error occurred. Possible data loss.
 #define LSD_FRAMING_ERROR	-2
+/// Frame reception has not been completed yet
+#define LSD_IN_PROGRESS		-3
+/// Frame received with wrong CRC, data was corrupted.
+#define LSD_CRC_ERROR		-4
 /** \} */
 
+#ifdef LSD_CRC
+/// Length of the CRC field
+#define LSD_CRC_LEN			2
+#else
+/// Length of the CRC field
+#define LSD_CRC_LEN			0
+#endif
+
 /// LSD frame overhead in bytes
-#define LSD_OVERHEAD		4
+#define LSD_OVERHEAD		(4 + LSD_CRC_LEN)
+
+/// Channel used to request retransmission of the last frame on a channel
+#define LSD_NAK_CH			0xF
+
+/// Channel whose last sent frame is kept, to be sent again if requested
+#define LSD_RETX_CH			0
+
+/// Channel the last free reception buffer is kept for
+#define LSD_RSV_CH			0
+
+/// No channel
+#define LSD_CH_NONE			0xFF
 
 /// Uart used for LSD
 #define LSD_UART			0
@@ -65,6 +145,107 @@
 /// Maximum data payload length
 #define LSD_MAX_LEN		 4095
 
+/// Number of reception buffers in the pool. Frames are queued per channel.
+/// Channels other than LSD_RSV_CH can hold up to LSD_BUF_FRAMES - 1 of them,
+/// as the last one is kept for LSD_RSV_CH. Must be at least 2.
+#ifndef LSD_BUF_FRAMES
+#define LSD_BUF_FRAMES		4
+#endif
+#if LSD_BUF_FRAMES < 2
+#error "LSD_BUF_FRAMES must be at least 2"
+#endif
+
+/// Maximum payload length of received frames (reception buffer length)
+#define LSD_RX_MAX_LEN		MW_MSG_MAX_BUFLEN
+
+/// Number of bytes scanned again looking for the next frame when a frame is
+/// received with errors (up to 255). The last bytes received after the STX
+/// of the wrong frame are kept, so the real start of the next frame is not
+/// lost if it arrived within them.
+#ifndef LSD_RESYNC_LEN
+#define LSD_RESYNC_LEN		32
+#endif
+
+#if defined(LSD_RX_RING) && defined(LSD_RX_Z80)
+#error "Define either LSD_RX_RING or LSD_RX_Z80, not both"
+#endif
+
+#if defined(LSD_RX_RING) || defined(LSD_RX_Z80)
+/// Received data is parsed from a ring in RAM, instead of from the UART
+#define LSD_RING
+
+/// Length of the ring filled by LsdRxIsr() or from the Z80 ring. Must be a
+/// power of 2.
+#ifndef LSD_RX_RING_LEN
+#define LSD_RX_RING_LEN		1024
+#endif
+#endif
+
+#ifdef LSD_RX_RING
+/// Scanlines between LsdRxIsr() calls. At the default line rate, the RX
+/// FIFO fills in about 10 scanlines.
+#ifndef LSD_RX_RING_LINES
+#define LSD_RX_RING_LINES	8
+#endif
+#endif
+
+/** \addtogroup lsd Z80Layout Z80 RAM layout of the reception driver used
+ *  with LSD_RX_Z80. Must match lsdz80.s80. Head and tail are ring offsets,
+ *  little endian.
+ *  \{ */
+/// Driver code length, loaded at the start of Z80 RAM
+#define LSD_Z80_CODE_LEN	0x0100
+/// Ring head (2 bytes), written by the Z80
+#define LSD_Z80_HEAD		0x0100
+/// Ring tail (2 bytes), written by the 68000
+#define LSD_Z80_TAIL		0x0102
+/// Nonzero while the Z80 writes the head or the line errors
+#define LSD_Z80_BUSY		0x0104
+/// UART line errors seen by the Z80, cleared by the 68000
+#define LSD_Z80_ERR			0x0105
+/// Reception ring, filled by the Z80
+#define LSD_Z80_RING		0x1000
+/// Reception ring length
+#define LSD_Z80_RING_LEN	0x1000
+/** \} */
+
+#ifdef LSD_RX_Z80
+/// Maximum bytes copied from the Z80 ring each time the Z80 bus is taken.
+/// The Z80 does not poll the UART while stopped.
+#ifndef LSD_Z80_COPY_MAX
+#define LSD_Z80_COPY_MAX	64
+#endif
+#endif
+
+/// Data segment, for scatter-gather sends.
+typedef struct {
+	const void *data;	///< Segment data
+	uint16_t len;		///< Segment length
+} LsdVec;
+
+#ifdef LSD_STATS
+/// Link statistics, recorded when built with LSD_STATS defined.
+typedef struct {
+	uint32_t txBytes[LSD_MAX_CH];	///< Payload bytes sent per channel
+	uint32_t txFrames[LSD_MAX_CH];	///< Frames sent per channel
+	uint32_t rxBytes[LSD_MAX_CH];	///< Payload bytes received per channel
+	uint32_t rxFrames[LSD_MAX_CH];	///< Frames received per channel
+	uint32_t rxErr[LSD_MAX_CH];		///< Frames dropped on errors per channel
+	uint32_t txWait;		///< LSR polls waiting for TX FIFO space (THRE)
+	uint32_t rxEmpty;		///< LSR polls finding no received data
+	uint16_t overrun;		///< UART overrun errors (LSR OE)
+	uint16_t parity;		///< UART parity errors (LSR PE)
+	uint16_t framing;		///< UART framing errors (LSR FE)
+	uint16_t brk;			///< UART break conditions (LSR BI)
+	uint16_t chErr;			///< Frames with invalid channel
+	uint16_t lenErr;		///< Frames exceeding the reception buffer length
+	uint16_t etxErr;		///< Frames with ETX not found where expected
+	uint16_t crcErr;		///< Frames with wrong CRC
+	uint16_t dropped;		///< Frames dropped because channel is disabled
+	uint16_t noBuf;			///< Frames dropped to keep a buffer for LSD_RSV_CH
+} LsdStats;
+#endif
+
 /************************************************************************//**
  * Module initialization. Call this function before any other one in this
  * module.
@@ -82,7 +263,8 @@ void LsdInit(void);
 int LsdChEnable(uint8_t ch);
 
 /************************************************************************//**
- * Disables a channel to stop reception and prohibit sending data.
+ * Disables a channel to stop reception and prohibit sending data. Frames
+ * queued on the channel and not yet obtained are discarded.
  *
  * \param[in] ch Channel number.
  *
@@ -102,7 +284,21 @@ int LsdChDisable(uint8_t ch);
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSend(uint8_t *data, uint16_t len, uint8_t ch);
+int LsdSend(const uint8_t *data, uint16_t len, uint8_t ch);
+
+/************************************************************************//**
+ * Sends a frame built from several data segments (scatter-gather) through a
+ * previously enabled channel. Segments are sent directly from their
+ * location (e.g. constants in ROM), without copying them to a buffer.
+ *
+ * \param[in] vec Segments to send, in order.
+ * \param[in] n   Number of segments.
+ * \param[in] ch  Channel number to use.
+ *
+ * \return -1 if there was an error, or the number of characters sent
+ * 		   otherwise.
+ ****************************************************************************/
+int LsdSendV(const LsdVec vec[], uint8_t n, uint8_t ch);
 
 /************************************************************************//**
  * Starts sending data through a previously enabled channel. Once started,
@@ -118,7 +314,7 @@ int LsdSend(uint8_t *data, uint16_t len, uint8_t ch);
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitStart(uint8_t *data, uint16_t len,
+int LsdSplitStart(const uint8_t *data, uint16_t len,
 		              uint16_t total, uint8_t ch);
 
 /************************************************************************//**
@@ -131,7 +327,7 @@ int LsdSplitStart(uint8_t *data, uint16_t len,
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitNext(uint8_t *data, uint16_t len);
+int LsdSplitNext(const uint8_t *data, uint16_t len);
 
 /************************************************************************//**
  * Appends (sends) additional data to a frame previously started by an
@@ -143,10 +339,165 @@ int LsdSplitNext(uint8_t *data, uint16_t len);
  * \return -1 if there was an error, or the number of characterse sent
  * 		   otherwise.
  ****************************************************************************/
-int LsdSplitEnd(uint8_t *data, uint16_t len);
+int LsdSplitEnd(const uint8_t *data, uint16_t len);
+
+/************************************************************************//**
+ * Starts sending a frame through a previously enabled channel, without
+ * waiting for the UART. Data is written to the UART as FIFO space becomes
+ * available, each time LsdTxPoll() is called. Only one frame can be sent
+ * asynchronously at a time, and it must not be started while a split frame
+ * is being sent.
+ *
+ * \param[in] data Buffer to send. Must be kept unmodified until LsdTxPoll()
+ *            returns LSD_OK.
+ * \param[in] len  Length of the buffer to send.
+ * \param[in] ch   Channel number to use.
+ *
+ * \return LSD_OK if the frame was started, or LSD_ERROR if parameters are
+ *         not valid or another frame is being sent asynchronously.
+ ****************************************************************************/
+int LsdTxStart(const uint8_t *data, uint16_t len, uint8_t ch);
+
+/************************************************************************//**
+ * Writes to the UART as much data of the frame started with LsdTxStart() as
+ * fits in the TX FIFO. Does not wait for the UART.
+ *
+ * \return LSD_OK if no frame is being sent asynchronously (i.e. the frame
+ *         has been completely written to the UART), or LSD_IN_PROGRESS if
+ *         there is still data to send.
+ ****************************************************************************/
+int LsdTxPoll(void);
+
+#ifdef LSD_CRC
+/************************************************************************//**
+ * Requests the other end to send again the last frame it sent on a channel.
+ * Call it when LsdPoll() returns LSD_CRC_ERROR.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return LSD_OK on success, or LSD_ERROR if a split frame is being sent.
+ ****************************************************************************/
+int LsdNakSend(uint8_t ch);
 
+/************************************************************************//**
+ * Returns the channel of the last frame received with a wrong CRC. As the
+ * channel field might also be corrupted, use it only as a hint.
+ *
+ * \return Channel number, or LSD_CH_NONE if no CRC errors occurred.
+ ****************************************************************************/
+uint8_t LsdRxErrCh(void);
+#endif
+
+/************************************************************************//**
+ * Receives the data available in the UART into the reception buffer pool.
+ * Returns as soon as there is no more data available or a frame has been
+ * completely received. Received frames are then obtained with LsdRxGet().
+ *
+ * \return The channel number the frame was received on if a frame has
+ *         been completely received, LSD_IN_PROGRESS if frame reception is
+ *         not complete (or there are no free reception buffers),
+ *         LSD_FRAMING_ERROR if data was lost because of an UART overrun or
+ *         ETX was not found, LSD_CRC_ERROR if the frame CRC is wrong, or
+ *         LSD_ERROR if there was another error. On error, the frame being
+ *         received is discarded, and data received after its STX is scanned
+ *         again on next calls looking for the next frame.
+ ****************************************************************************/
+int LsdPoll(void);
+
+/************************************************************************//**
+ * Checks if there is received data not yet processed by LsdPoll().
+ *
+ * \return TRUE if there is data pending to be processed, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxPend(void);
+
+/************************************************************************//**
+ * Checks if reception is stopped because all the reception buffers hold
+ * frames not yet returned with LsdRxFree(). Until a buffer is freed,
+ * LsdPoll() leaves received data in the UART.
+ *
+ * \return TRUE if reception is stopped, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxStalled(void);
+
+/************************************************************************//**
+ * Checks if a frame received on a channel was dropped because the only
+ * free reception buffer was the one kept for LSD_RSV_CH. Later frames on
+ * the channel are also dropped until this function is called, so the
+ * frames queued are the ones received before the first frame lost. The
+ * condition is cleared by this call, and when the channel is enabled.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return TRUE if a frame was dropped since the last call, FALSE otherwise.
+ ****************************************************************************/
+int LsdRxLost(uint8_t ch);
+
+#ifdef LSD_RX_RING
+/************************************************************************//**
+ * Drains the UART RX FIFO into the reception ring. Call it from the
+ * horizontal interrupt handler every LSD_RX_RING_LINES scanlines, and from
+ * the vertical interrupt handler. If the ring is full, data is left in the
+ * UART.
+ ****************************************************************************/
+void LsdRxIsr(void);
+#endif
+
+#ifdef LSD_STATS
+/************************************************************************//**
+ * Obtains a snapshot of the link statistics.
+ *
+ * \param[out] st Statistics recorded since module initialization or since
+ *             the last LsdStatsReset() call.
+ ****************************************************************************/
+void LsdStatsGet(LsdStats *st);
+
+/************************************************************************//**
+ * Clears the link statistics.
+ ****************************************************************************/
+void LsdStatsReset(void);
+#endif
+
+/************************************************************************//**
+ * Obtains the oldest frame received on a channel. The frame stays owned by
+ * the application until it is returned to the pool with LsdRxFree(). This
+ * function does not read data from the UART, call LsdPoll() for that.
+ *
+ * \param[in] ch Channel number.
+ *
+ * \return The received frame (payload, length and channel), or NULL if no
+ *         frame has been received on the channel.
+ ****************************************************************************/
+MwMsgBuf *LsdRxGet(uint8_t ch);
+
+/************************************************************************//**
+ * Returns a frame previously obtained with LsdRxGet() to the reception
+ * buffer pool.
+ *
+ * \param[in] buf Frame to return to the pool.
+ ****************************************************************************/
+void LsdRxFree(MwMsgBuf *buf);
+
+/************************************************************************//**
+ * Receives a frame using LSD protocol. Blocks until the frame is received,
+ * an error occurs or no data is received for maxLoopCnt loops. Received
+ * data is copied to the specified buffer, use LsdPoll() and LsdRxGet() to
+ * avoid the copy.
+ *
+ * \param[out]   buf Buffer that will hold the received data.
+ * \param[inout] maxLen When calling the function, the variable pointed by
+ *               maxLen, must hold the maximum number of bytes buf can
+ *               store. On return, the variable is updated to the number
+ *               of bytes received.
+ * \param[in]    maxLoopCnt Maximum number of loops trying to read data.
+ *
+ * \return On success, the number of the channel in which data has been
+ * 		   received. On failure, a negative number. LSD_ERROR is also
+ * 		   returned if no frame is queued and the application holds all the
+ * 		   reception buffers (see LsdRxStalled()).
+ * \note   Frames already queued are returned first, lower channels first.
+ ****************************************************************************/
 int LsdRecv(uint8_t* buf, uint16_t* maxLen, uint32_t maxLoopCnt);
-//int LsdRecv(MwMsgBuf* buf, uint16_t maxLen, uint32_t maxLoopCnt);
 
 /** \} */
 
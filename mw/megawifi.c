@@ -1,13 +1,144 @@
 #include "megawifi.h"
 #include "lsd.h"
+#include <string.h>
+#include "util.h"
+#include "hvcnt.h"
+#include "prof.h"
+
+/// Tags are in the 0 to 127 range, so they can be returned as int.
+#define MW_CMD_TAG_MASK		0x7F
+
+/// Length of the port fields in TCP connection requests.
+#define MW_PORT_FIELD_LEN	6
+
+/// Returns the socket data for a channel, or NULL if channel is not valid
+#define MwSockGet(ch)	(((ch) && (ch) <= MW_MAX_SOCK)?&d.sock[(ch) - 1]:NULL)
+
+/** \addtogroup megawifi MwSock Socket data.
+ *  \{ */
+typedef struct {
+	MwMsgBuf *rx;					///< Frame being read
+	uint16_t rxPos;					///< Read position in frame
+	uint16_t txLen;					///< Bytes in transmission buffer
+	uint8_t con;					///< Socket is connected
+	uint8_t tx[MW_SOCK_TX_BUFLEN];	///< Transmission buffer
+} MwSock;
+/** \} */
+
+/** \addtogroup megawifi MwCache Module data cache.
+ *  \{ */
+typedef struct {
+	uint8_t ver;					///< Version is valid
+	uint8_t flashId;				///< Flash IDs are valid
+	uint8_t ap;						///< Valid AP configurations (bit per slot)
+	uint8_t ip;						///< Valid IP configurations (bit per slot)
+	uint8_t verNum[2];				///< Firmware major and minor versions
+	char variant[MW_VARIANT_MAXLEN];	///< Firmware variant
+	uint8_t flashIds[MW_FLASH_ID_LEN];	///< Flash manufacturer and device IDs
+	MwMsgApCfg apCfg[MW_NUM_AP_CFGS];	///< AP configurations
+	MwMsgIpCfg ipCfg[MW_NUM_AP_CFGS];	///< IP configurations
+} MwCache;
+/** \} */
+
+/** \addtogroup megawifi MwData Local data required by the module.
+ *  \{ */
+typedef struct {
+	uint8_t tag;	///< Tag for the next submitted command
+	uint8_t pend;	///< Commands pending completion
+	uint8_t drop;	///< Replies to discard (cancelled commands)
+	uint8_t retries;	///< Retransmissions requested for current reply
+	uint8_t hvBack;	///< Values the V counter jumps back each frame
+	MwSock sock[MW_MAX_SOCK];	///< Sockets (channels 1 to MW_MAX_SOCK)
+	MwCache cache;	///< Module data cache
+} MwData;
+/** \} */
+
+/// Module global data
+static MwData d;
+
+// Discards replies to cancelled commands that have already arrived
+static void MwCmdDrop(void) {
+	MwMsgBuf *rep;
+
+	while (d.drop && (rep = LsdRxGet(MW_CTRL_CH))) {
+		LsdRxFree(rep);
+		d.drop--;
+	}
+}
+
+// Accounts a submitted command as pending, and returns its tag
+static int MwCmdTagNext(void) {
+	int tag = d.tag;
+
+	d.tag = (d.tag + 1) & MW_CMD_TAG_MASK;
+	d.pend++;
+
+	return tag;
+}
+
+// Adds to elapsed the scanlines since the V counter was prev, and returns
+// nonzero when MW_CMD_TOUT_LINES have elapsed
+static int MwToutCheck(uint32_t *elapsed, uint8_t *prev) {
+	uint8_t v = HvVCntGet();
+
+	*elapsed += HvLinesElapsed(*prev, v, d.hvBack);
+	*prev = v;
+
+	return *elapsed >= MW_CMD_TOUT_LINES;
+}
+
+// Polls LSD reception. When built with LSD_CRC, a control channel frame
+// received with a wrong CRC is requested again, if it is the only reply
+// outstanding (so it is the last frame the module sent on the channel).
+static int MwPoll(uint8_t outstanding) {
+	int ret = LsdPoll();
+
+#ifdef LSD_CRC
+	if (LSD_CRC_ERROR == ret && MW_CTRL_CH == LsdRxErrCh() &&
+			1 == outstanding && d.retries < MW_CMD_RETRIES) {
+		d.retries++;
+		if (LSD_OK == LsdNakSend(MW_CTRL_CH)) ret = LSD_IN_PROGRESS;
+	}
+#else
+	UNUSED_PARAM(outstanding);
+#endif
+
+	return ret;
+}
+
+// Invalidates the cached data modified by a command
+static void MwCacheCmd(uint16_t cmd) {
+	switch (cmd) {
+		case MW_CMD_AP_CFG:
+			d.cache.ap = 0;
+			break;
+
+		case MW_CMD_IP_CFG:
+			d.cache.ip = 0;
+			break;
+
+		case MW_CMD_DEF_CFG_SET:
+			d.cache.ap = d.cache.ip = 0;
+			break;
+
+		default:
+			break;
+	}
+}
 
 /****************************************************************************
  * \brief MwInit Module initialization. Must be called once before using any
  *        other function. It also initializes de UART.
  ****************************************************************************/
 void MwInit(void) {
+	memset(&d, 0, sizeof(MwData));
+	d.hvBack = (UART_MD_VERSION & UART_MD_VERSION__PAL)?
+		HV_BACK_PAL:HV_BACK_NTSC;
 	// Initialize LSD
 	LsdInit();
+#ifdef MW_PROF
+	ProfInit();
+#endif
 //	UartInit();
 
 	// TODO Set lines to default status (keep WiFi module in reset)
@@ -25,22 +156,841 @@ void MwInit(void) {
  * \return 0 if OK. Nonzero if error.
  ****************************************************************************/
 int MwCmdSend(MwCmd* cmd) {
+	int ret;
+
+	PROF_ENTER(PROF_MW_CMD_SEND);
+	MwCacheCmd(cmd->cmd);
 	// Send data on control channel (0).
-	return LsdSend((uint8_t*)cmd, cmd->datalen + 4, MW_CTRL_CH) < 0?-1:0;
+	ret = LsdSend((uint8_t*)cmd, cmd->datalen + 4, MW_CTRL_CH) < 0?-1:0;
+	PROF_EXIT(PROF_MW_CMD_SEND);
+
+	return ret;
+}
+
+/****************************************************************************
+ * \brief Send a command to the WiFi module, taking the command data from
+ *        several segments. Segments are sent directly from their location
+ *        (e.g. constants in ROM) without copying them to an MwCmd.
+ *
+ * \param[in] cmd Command code.
+ * \param[in] vec Command data segments, in order.
+ * \param[in] n   Number of segments.
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwCmdSendV(uint16_t cmd, const LsdVec vec[], uint8_t n) {
+	uint16_t hdr[2];
+	uint8_t i;
+	int ret = 0;
+
+	hdr[0] = cmd;
+	hdr[1] = 0;
+	for (i = 0; i < n; i++) {
+		hdr[1] += vec[i].len;
+		if (hdr[1] > MW_CMD_MAX_BUFLEN || hdr[1] < vec[i].len) return -1;
+	}
+	MwCacheCmd(cmd);
+
+	// Send command header and data segments in a single frame
+	PROF_ENTER(PROF_MW_CMD_SEND);
+	if (LsdSplitStart((uint8_t*)hdr, sizeof(hdr), hdr[1] + sizeof(hdr),
+				MW_CTRL_CH) < 0) {
+		PROF_EXIT(PROF_MW_CMD_SEND);
+		return -1;
+	}
+	for (i = 0; i < n && !ret; i++) {
+		if (LsdSplitNext(vec[i].data, vec[i].len) < 0) ret = -1;
+	}
+	// End the frame even on error, so the split send state is cleared
+	if (LsdSplitEnd(NULL, 0) < 0) ret = -1;
+	PROF_EXIT(PROF_MW_CMD_SEND);
+
+	return ret;
+}
+
+/****************************************************************************
+ * \brief Try obtaining a reply to a command. The reply is read in place
+ *        from the LSD reception buffer pool, and must be returned to the
+ *        pool by calling MwCmdReplyFree() when done with it.
+ *
+ * \return Pointer to the reply to the command, or NULL if there was a
+ *         reception error, or the reply did not arrive within
+ *         MW_CMD_TOUT_LINES scanlines. On timeout, MwCmdReset() is called,
+ *         so the module is assumed to send no more replies. If it still
+ *         might, reset it with MwModuleReset(), or its late reply would be
+ *         taken for the reply to the next command.
+ ****************************************************************************/
+MwCmd *MwCmdReplyGet(void) {
+	MwMsgBuf *rep;
+	uint32_t elapsed = 0;
+	uint8_t prev;
+	int ret;
+
+	PROF_ENTER(PROF_MW_REPLY_GET);
+	prev = HvVCntGet();
+	// Frames received on data channels are kept queued for their readers.
+	// Replies to cancelled commands arrive first, and are discarded.
+	while (1) {
+		MwCmdDrop();
+		if (!d.drop && (rep = LsdRxGet(MW_CTRL_CH))) break;
+		ret = MwPoll(d.drop + 1);
+		if (ret < 0 && LSD_IN_PROGRESS != ret) {
+			rep = NULL;
+			break;
+		}
+		if (MwToutCheck(&elapsed, &prev)) {
+			// The module is not answering (e.g. it is resetting), so the
+			// reply is not counted as one to discard: it might never come
+			MwCmdReset();
+			rep = NULL;
+			break;
+		}
+	}
+	if (rep) d.retries = 0;
+	PROF_EXIT(PROF_MW_REPLY_GET);
+
+	return rep?&rep->cmd:NULL;
+}
+
+/****************************************************************************
+ * \brief Returns a reply obtained with MwCmdReplyGet() to the LSD reception
+ *        buffer pool. The reply must not be accessed after this call.
+ *
+ * \param[in] rep Reply to free.
+ ****************************************************************************/
+void MwCmdReplyFree(MwCmd *rep) {
+	// Reply is the first member of the MwMsgBuf holding it
+	LsdRxFree((MwMsgBuf*)rep);
+}
+
+/****************************************************************************
+ * \brief Changes the baud rate of the link on both ends. The new rate is
+ *        requested to the WiFi module, and once the module acknowledges it,
+ *        the local UART is reprogrammed.
+ *
+ * \param[in] baud Requested baud rate.
+ * \return 0 if OK. Nonzero if the rate is not supported by the UART, or if
+ *         the module rejected it.
+ *
+ * \note The link must be idle (no frames in flight on any channel) when
+ *       calling this function.
+ ****************************************************************************/
+int MwUartBaudSet(uint32_t baud) {
+	MwCmd req;
+	MwCmd *rep;
+	uint16_t div;
+	int err;
+
+	if (!(div = UartBaudDiv(baud))) return -1;
+
+	// Request the rate the UART will really generate, so the module can
+	// match it
+	req.cmd = MW_CMD_UART_CFG;
+	req.datalen = sizeof(uint32_t);
+	req.baud = UartClkGet() / 16 / div;
+	if (MwCmdSend(&req)) return -1;
+	// Reply is sent at the old rate
+	if (!(rep = MwCmdReplyGet())) return -1;
+	err = MW_CMD_OK != rep->cmd;
+	MwCmdReplyFree(rep);
+	if (err) return -1;
+
+	UartDivSet(div);
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Submits a command to the WiFi module without waiting for its
+ *        reply. Several commands can be submitted back to back, and their
+ *        replies collected later by calling MwCmdComplete(). The module
+ *        processes commands in order, so replies complete in the same order
+ *        commands were submitted.
+ *
+ * \param[in] cmd Pointer to the filled MwCmd command structure. It can be
+ *            reused as soon as this function returns.
+ * \return The tag identifying the command (0 to 127), or -1 if there are
+ *         already MW_CMD_MAX_PEND commands pending or sending failed.
+ *
+ * \warning Do not mix MwCmdReplyGet() with submitted commands pending
+ *          completion, or replies will be mismatched.
+ ****************************************************************************/
+int MwCmdSubmit(MwCmd *cmd) {
+	// Cancelled commands still hold a reply buffer until they complete
+	if ((d.pend + d.drop) >= MW_CMD_MAX_PEND) return -1;
+	if (MwCmdSend(cmd)) return -1;
+
+	return MwCmdTagNext();
+}
+
+/****************************************************************************
+ * \brief Submits a command to the WiFi module without waiting for its
+ *        reply, taking the command data from several segments. See
+ *        MwCmdSubmit() and MwCmdSendV().
+ *
+ * \param[in] cmd Command code.
+ * \param[in] vec Command data segments, in order.
+ * \param[in] n   Number of segments.
+ * \return The tag identifying the command (0 to 127), or -1 if there are
+ *         already MW_CMD_MAX_PEND commands pending or sending failed.
+ ****************************************************************************/
+int MwCmdSubmitV(uint16_t cmd, const LsdVec vec[], uint8_t n) {
+	if ((d.pend + d.drop) >= MW_CMD_MAX_PEND) return -1;
+	if (MwCmdSendV(cmd, vec, n)) return -1;
+
+	return MwCmdTagNext();
+}
+
+/****************************************************************************
+ * \brief Checks for the completion of the oldest submitted command. This
+ *        function does not block: it polls the LSD receiver and returns
+ *        immediately if the reply is not available. If a reply is obtained,
+ *        it must be returned to the pool by calling MwCmdReplyFree().
+ *
+ * \param[out] tag Tag of the completed command, as returned by
+ *             MwCmdSubmit().
+ * \param[out] rep Reply to the completed command.
+ * \return 0 if a command completed, MW_CMD_PENDING if the reply has not
+ *         been received yet or no command is pending, or -1 on reception
+ *         error. After an error, MwCmdCancel() should be called, since the
+ *         reply to a command might have been lost.
+ ****************************************************************************/
+int MwCmdComplete(uint8_t *tag, MwCmd **rep) {
+	MwMsgBuf *buf;
+	int ret;
+
+	if (!d.pend && !d.drop) return MW_CMD_PENDING;
+	ret = MwPoll(d.pend + d.drop);
+	if (ret < 0 && LSD_IN_PROGRESS != ret) return -1;
+
+	MwCmdDrop();
+	if (d.drop || !d.pend || !(buf = LsdRxGet(MW_CTRL_CH))) {
+		return MW_CMD_PENDING;
+	}
+
+	*tag = (d.tag - d.pend) & MW_CMD_TAG_MASK;
+	*rep = &buf->cmd;
+	d.pend--;
+	d.retries = 0;
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Waits for the completion of the oldest submitted command, for up
+ *        to MW_CMD_TOUT_LINES scanlines. If a reply is obtained, it must be
+ *        returned to the pool by calling MwCmdReplyFree().
+ *
+ * \param[out] tag Tag of the completed command, as returned by
+ *             MwCmdSubmit().
+ * \param[out] rep Reply to the completed command.
+ * \return 0 if a command completed, or -1 if no command is pending, on
+ *         reception error or on timeout. On timeout, MwCmdReset() is called
+ *         as MwCmdReplyGet() does. After other errors, MwCmdCancel() should
+ *         be called.
+ ****************************************************************************/
+int MwCmdWait(uint8_t *tag, MwCmd **rep) {
+	uint32_t elapsed = 0;
+	uint8_t prev;
+	int ret;
+
+	if (!d.pend) return -1;
+	prev = HvVCntGet();
+	while (MW_CMD_PENDING == (ret = MwCmdComplete(tag, rep))) {
+		if (MwToutCheck(&elapsed, &prev)) {
+			MwCmdReset();
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
+/****************************************************************************
+ * \brief Returns the number of submitted commands pending completion.
+ *
+ * \return Number of pending commands.
+ ****************************************************************************/
+uint8_t MwCmdPendGet(void) {
+	return d.pend;
+}
+
+/****************************************************************************
+ * \brief Cancels all the submitted commands pending completion. Their
+ *        replies are discarded as they arrive.
+ ****************************************************************************/
+void MwCmdCancel(void) {
+	d.drop += d.pend;
+	d.pend = 0;
+	MwCmdDrop();
+}
+
+/****************************************************************************
+ * \brief Forgets the submitted commands pending completion and the replies
+ *        to cancelled commands, and discards the control channel frames
+ *        already received. Use it when the module will not send the
+ *        replies (e.g. it has been reset). MwModuleReset() calls it.
+ ****************************************************************************/
+void MwCmdReset(void) {
+	MwMsgBuf *rep;
+
+	d.pend = d.drop = d.retries = 0;
+	while ((rep = LsdRxGet(MW_CTRL_CH))) LsdRxFree(rep);
+}
+
+/****************************************************************************
+ * \brief Services the link for up to a scanline budget. Sends pending data
+ *        of the frame started with LsdTxStart(), receives available data
+ *        into the LSD reception buffers (completing submitted commands and
+ *        filling data channel queues) and discards replies to cancelled
+ *        commands. Returns when the budget is exhausted or there is nothing
+ *        more to do, including when all the reception buffers hold frames
+ *        not yet read by the application. Call it once per frame.
+ *
+ * \param[in] lines Budget in scanlines, measured with the VDP V counter.
+ *            The budget can be exceeded by the time needed to service the
+ *            contents of the UART RX FIFO.
+ * \return 0 if OK, or -1 if there was a reception error (a frame was lost).
+ ****************************************************************************/
+int MwService(uint8_t lines) {
+	uint16_t elapsed = 0;
+	uint8_t v, prev;
+	int tx, rx;
+
+	prev = HvVCntGet();
+	do {
+		tx = LsdTxPoll();
+		rx = MwPoll(d.pend + d.drop);
+		if (rx < 0 && LSD_IN_PROGRESS != rx) return -1;
+		MwCmdDrop();
+		// Nothing to send and no data left to receive, or no buffer to
+		// receive it until the application reads the queued frames
+		if (LSD_OK == tx && LSD_IN_PROGRESS == rx &&
+				(!LsdRxPend() || LsdRxStalled())) break;
+		v = HvVCntGet();
+		elapsed += HvLinesElapsed(prev, v, d.hvBack);
+		prev = v;
+	} while (elapsed < lines);
+
+	return 0;
+}
+
+// Sends a command, waits for the reply and checks it is OK
+static int MwChCmd(uint16_t cmd, const LsdVec vec[], uint8_t n) {
+	MwCmd *rep;
+	int err;
+
+	if (MwCmdSendV(cmd, vec, n)) return -1;
+	if (!(rep = MwCmdReplyGet())) return -1;
+	err = MW_CMD_OK != rep->cmd;
+	MwCmdReplyFree(rep);
+
+	return err?-1:0;
+}
+
+/****************************************************************************
+ * \brief Connects a TCP socket to a remote host, and enables its channel.
+ *
+ * \param[in] ch      Socket channel (1 to MW_MAX_SOCK).
+ * \param[in] dstAddr Remote host address (IP or name).
+ * \param[in] dstPort Remote port (up to 5 characters).
+ * \param[in] srcPort Local port (up to 5 characters, empty for any).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwTcpConnect(uint8_t ch, const char *dstAddr, const char *dstPort,
+		const char *srcPort) {
+	MwSock *s = MwSockGet(ch);
+	char dst[MW_PORT_FIELD_LEN] = {0};
+	char src[MW_PORT_FIELD_LEN] = {0};
+	// Both ports, the channel and the address (including '\0')
+	const LsdVec vec[] = {
+		{dst, MW_PORT_FIELD_LEN}, {src, MW_PORT_FIELD_LEN},
+		{&ch, sizeof(ch)}, {dstAddr, strlen(dstAddr) + 1}
+	};
+
+	if (!s || s->con) return -1;
+	if (strlen(dstPort) >= MW_PORT_FIELD_LEN ||
+			strlen(srcPort) >= MW_PORT_FIELD_LEN) return -1;
+	strcpy(dst, dstPort);
+	strcpy(src, srcPort);
+
+	if (MwChCmd(MW_CMD_TCP_CON, vec, 4)) return -1;
+	s->con = TRUE;
+	s->rx = NULL;
+	s->rxPos = s->txLen = 0;
+	LsdChEnable(ch);
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Sends pending data, disconnects a TCP socket and disables its
+ *        channel. Received data not yet read is discarded.
+ *
+ * \param[in] ch Socket channel (1 to MW_MAX_SOCK).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwTcpDisconnect(uint8_t ch) {
+	MwSock *s = MwSockGet(ch);
+	const LsdVec vec[] = {{&ch, sizeof(ch)}};
+	int err;
+
+	if (!s || !s->con) return -1;
+
+	err = MwSockFlush(ch);
+	if (s->rx) LsdRxFree(s->rx);
+	s->rx = NULL;
+	s->con = FALSE;
+	LsdChDisable(ch);
+	if (MwChCmd(MW_CMD_TCP_DISC, vec, 1)) err = -1;
+
+	return err;
 }
 
 /****************************************************************************
- * \brief Try obtaining a reply to a command.
+ * \brief Sends data through a connected socket. Data is buffered and sent
+ *        in frames of MW_SOCK_TX_BUFLEN bytes, so small writes are coalesced.
+ *        Writes not fitting in the buffer are sent directly, split in frames
+ *        of up to LSD_MAX_LEN bytes. Call MwSockFlush() to send data
+ *        remaining in the buffer.
  *
- * \param[out] rep Pointer to MwRep structure, containing the reply to the
- *                 command, if the call completed successfully.
- * \return The channel on which the data has been received (0 if it was on
- *         the control channel). Lower than 0 if there was a reception
- *         error.
+ * \param[in] ch   Socket channel (1 to MW_MAX_SOCK).
+ * \param[in] data Data to send.
+ * \param[in] len  Length of the data to send.
+ * \return The number of bytes sent (or buffered), or -1 on error.
  ****************************************************************************/
-int MwCmdReplyGet(MwCmd *rep) {
-	uint16_t maxLen = sizeof(MwCmd);
+int MwSockSend(uint8_t ch, const uint8_t *data, uint16_t len) {
+	MwSock *s = MwSockGet(ch);
+	uint16_t sent = 0;
+	uint16_t n;
+
+	if (!s || !s->con) return -1;
+
+	while (sent < len) {
+		n = len - sent;
+		if (!s->txLen && n >= MW_SOCK_TX_BUFLEN) {
+			// Buffer empty and data does not fit: send it directly
+			n = MIN(n, LSD_MAX_LEN);
+			if (LsdSend(data + sent, n, ch) < 0) return -1;
+		} else {
+			n = MIN(n, MW_SOCK_TX_BUFLEN - s->txLen);
+			memcpy(s->tx + s->txLen, data + sent, n);
+			s->txLen += n;
+			if (MW_SOCK_TX_BUFLEN == s->txLen && MwSockFlush(ch)) return -1;
+		}
+		sent += n;
+	}
 
-	return LsdRecv((uint8_t*)rep, &maxLen, UINT32_MAX);
+	return sent;
 }
 
+/****************************************************************************
+ * \brief Sends the data buffered on a socket by MwSockSend().
+ *
+ * \param[in] ch Socket channel (1 to MW_MAX_SOCK).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwSockFlush(uint8_t ch) {
+	MwSock *s = MwSockGet(ch);
+
+	if (!s || !s->con) return -1;
+	if (!s->txLen) return 0;
+
+	if (LsdSend(s->tx, s->txLen, ch) < 0) return -1;
+	s->txLen = 0;
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Receives data from a connected socket, without waiting. Frames are
+ *        read in place from the LSD reception buffers: if a frame does not
+ *        fit in buf, the rest of it is returned by the next calls.
+ *
+ * \param[in]  ch  Socket channel (1 to MW_MAX_SOCK).
+ * \param[out] buf Buffer to store the received data.
+ * \param[in]  max Maximum number of bytes to receive.
+ * \return The number of bytes received (0 if no data is available), or -1
+ *         on error. If a received frame was dropped because no reception
+ *         buffer was free, -1 is returned once the data received before it
+ *         has been read, as the stream has a gap.
+ ****************************************************************************/
+int MwSockRecv(uint8_t ch, uint8_t *buf, uint16_t max) {
+	MwSock *s = MwSockGet(ch);
+	uint16_t recv = 0;
+	uint16_t n;
+	int ret;
+
+	if (!s || !s->con) return -1;
+
+	ret = MwPoll(d.pend + d.drop);
+	if (ret < 0 && LSD_IN_PROGRESS != ret) return -1;
+	while (recv < max) {
+		if (!s->rx) {
+			if (!(s->rx = LsdRxGet(ch))) break;
+			s->rxPos = 0;
+		}
+		n = MIN(max - recv, s->rx->len - s->rxPos);
+		memcpy(buf + recv, s->rx->data + s->rxPos, n);
+		recv += n;
+		s->rxPos += n;
+		// Frame completely read, return it to the pool
+		if (s->rxPos >= s->rx->len) {
+			LsdRxFree(s->rx);
+			s->rx = NULL;
+		}
+	}
+	// Data received before a dropped frame has been read, report the gap
+	if (max && !recv && LsdRxLost(ch)) return -1;
+
+	return recv;
+}
+
+// Runs a bulk flash operation: splits the range in requests of step bytes,
+// keeping up to MW_FLASH_PEND of them in flight. Data for writes is taken
+// from wr, and data for reads is stored to rd.
+static int MwFlashBulk(uint16_t cmd, uint32_t addr, uint32_t len,
+		uint16_t step, const uint8_t *wr, uint8_t *rd) {
+	uint32_t req = 0, done = 0;
+	uint32_t reqAddr;
+	MwMsgFlashRange range;
+	uint16_t sect;
+	LsdVec vec[2];
+	uint8_t nVec;
+	uint16_t n;
+	uint8_t tag;
+	MwCmd *rep;
+	int ret;
+
+	// The replies would be mismatched with the ones pending
+	if (d.pend) return -1;
+	while (done < len) {
+		if (req < len && MwCmdPendGet() < MW_FLASH_PEND) {
+			n = MIN(step, len - req);
+			reqAddr = addr + req;
+			switch (cmd) {
+				case MW_CMD_FLASH_READ:
+					range.addr = reqAddr;
+					range.len = n;
+					vec[0].data = &range;
+					vec[0].len = sizeof(MwMsgFlashRange);
+					nVec = 1;
+					break;
+
+				case MW_CMD_FLASH_WRITE:
+					vec[0].data = &reqAddr;
+					vec[0].len = sizeof(uint32_t);
+					vec[1].data = wr + req;
+					vec[1].len = n;
+					nVec = 2;
+					break;
+
+				default:
+					sect = reqAddr / MW_FLASH_SECT_LEN;
+					vec[0].data = &sect;
+					vec[0].len = sizeof(uint16_t);
+					nVec = 1;
+			}
+			if (MwCmdSubmitV(cmd, vec, nVec) < 0) break;
+			req += n;
+			continue;
+		}
+		// Next request is in flight while this reply is processed
+		if (MwCmdWait(&tag, &rep)) break;
+		n = MIN(step, len - done);
+		ret = MW_CMD_OK != rep->cmd;
+		if (rd && !ret) {
+			if (rep->datalen < n) ret = -1;
+			else memcpy(rd + done, rep->data, n);
+		}
+		MwCmdReplyFree(rep);
+		if (ret) break;
+		done += n;
+	}
+	if (done < len) {
+		MwCmdCancel();
+		return -1;
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Reads an arbitrary range of the WiFi module flash. The range is
+ *        split in requests of up to MW_CMD_MAX_BUFLEN bytes, keeping up to
+ *        MW_FLASH_PEND of them in flight.
+ *
+ * \param[in]  addr Flash address to start reading from.
+ * \param[out] buf  Buffer to store the read data.
+ * \param[in]  len  Number of bytes to read.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashRead(uint32_t addr, uint8_t *buf, uint32_t len) {
+	return MwFlashBulk(MW_CMD_FLASH_READ, addr, len, MW_CMD_MAX_BUFLEN,
+			NULL, buf);
+}
+
+/****************************************************************************
+ * \brief Writes an arbitrary range of the WiFi module flash. Data is sent
+ *        directly from buf, in requests of up to MW_FLASH_WR_MAX bytes,
+ *        keeping up to MW_FLASH_PEND of them in flight. The range must have
+ *        been previously erased.
+ *
+ * \param[in] addr Flash address to start writing to.
+ * \param[in] data Data to write.
+ * \param[in] len  Number of bytes to write.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashWrite(uint32_t addr, const uint8_t *data, uint32_t len) {
+	return MwFlashBulk(MW_CMD_FLASH_WRITE, addr, len, MW_FLASH_WR_MAX,
+			data, NULL);
+}
+
+/****************************************************************************
+ * \brief Erases the WiFi module flash sectors covering an arbitrary range.
+ *        Sector erase requests are kept up to MW_FLASH_PEND in flight.
+ *
+ * \param[in] addr Flash address of the start of the range.
+ * \param[in] len  Length of the range.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \warning Whole sectors are erased: data outside the range, but in the
+ *          same sectors as its start and end, is also erased.
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashErase(uint32_t addr, uint32_t len) {
+	uint32_t start;
+
+	if (!len) return 0;
+	// Extend the range to whole sectors
+	start = addr & ~(MW_FLASH_SECT_LEN - 1);
+	len = ((addr + len + MW_FLASH_SECT_LEN - 1) &
+			~(MW_FLASH_SECT_LEN - 1)) - start;
+
+	return MwFlashBulk(MW_CMD_FLASH_ERASE, start, len, MW_FLASH_SECT_LEN,
+			NULL, NULL);
+}
+
+// Sends a query, with the configuration slot as data if num is not NULL,
+// and waits for its reply. Returns the reply if it is OK and has at least
+// len bytes of data, or NULL otherwise.
+static MwCmd *MwCacheQuery(uint16_t cmd, const uint8_t *num, uint16_t len) {
+	const LsdVec vec[] = {{num, sizeof(uint8_t)}};
+	MwCmd *rep;
+
+	// The reply would be mismatched with the ones pending
+	if (d.pend) return NULL;
+	if (MwCmdSendV(cmd, vec, num?1:0)) return NULL;
+	if (!(rep = MwCmdReplyGet())) return NULL;
+	if (MW_CMD_OK != rep->cmd || rep->datalen < len) {
+		MwCmdReplyFree(rep);
+		return NULL;
+	}
+
+	return rep;
+}
+
+// Stores a configuration reply. Even entries are the AP configuration of
+// slot entry / 2, and odd entries its IP configuration.
+static void MwCacheCfgStore(uint8_t entry, const MwCmd *rep) {
+	uint8_t num = entry>>1;
+
+	if (entry & 1) {
+		memcpy(&d.cache.ipCfg[num], rep->data, sizeof(MwMsgIpCfg));
+		d.cache.ip |= 1<<num;
+	} else {
+		memcpy(&d.cache.apCfg[num], rep->data, sizeof(MwMsgApCfg));
+		d.cache.ap |= 1<<num;
+	}
+}
+
+// Returns nonzero if a configuration entry (see MwCacheCfgStore()) is cached
+static uint8_t MwCacheCfgValid(uint8_t entry) {
+	return ((entry & 1)?d.cache.ip:d.cache.ap) & (1<<(entry>>1));
+}
+
+// Command querying a configuration entry (see MwCacheCfgStore())
+static uint16_t MwCacheCfgCmd(uint8_t entry) {
+	return (entry & 1)?MW_CMD_IP_CFG_GET:MW_CMD_AP_CFG_GET;
+}
+
+// Length of the reply to a configuration entry query
+static uint16_t MwCacheCfgLen(uint8_t entry) {
+	return (entry & 1)?sizeof(MwMsgIpCfg):sizeof(MwMsgApCfg);
+}
+
+// Obtains a configuration entry (see MwCacheCfgStore()), querying the
+// module only if it is not cached
+static int MwCacheCfgGet(uint8_t entry) {
+	uint8_t num = entry>>1;
+	MwCmd *rep;
+
+	if (MwCacheCfgValid(entry)) return 0;
+	if (!(rep = MwCacheQuery(MwCacheCfgCmd(entry), &num,
+					MwCacheCfgLen(entry)))) return -1;
+	MwCacheCfgStore(entry, rep);
+	MwCmdReplyFree(rep);
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Invalidates all the cached module data, so it is queried again
+ *        the next time it is requested. The cache is flushed when the
+ *        module is reset. Call it if the module configuration might have
+ *        been changed without using this API.
+ ****************************************************************************/
+void MwCacheFlush(void) {
+	memset(&d.cache, 0, sizeof(MwCache));
+}
+
+/****************************************************************************
+ * \brief Obtains the firmware version of the WiFi module. The module is
+ *        only queried the first time, later calls return the cached data.
+ *
+ * \param[out] major   Major version number. Can be NULL.
+ * \param[out] minor   Minor version number. Can be NULL.
+ * \param[out] variant Firmware variant string. Can be NULL.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the version is not cached, no other commands must be pending
+ *       completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwFwVersionGet(uint8_t *major, uint8_t *minor, const char **variant) {
+	MwCmd *rep;
+	uint16_t len;
+
+	if (!d.cache.ver) {
+		if (!(rep = MwCacheQuery(MW_CMD_VERSION, NULL, 2))) return -1;
+		d.cache.verNum[0] = rep->data[0];
+		d.cache.verNum[1] = rep->data[1];
+		// Variant is not null terminated
+		len = MIN(rep->datalen - 2, MW_VARIANT_MAXLEN - 1);
+		memcpy(d.cache.variant, rep->data + 2, len);
+		d.cache.variant[len] = '\0';
+		MwCmdReplyFree(rep);
+		d.cache.ver = TRUE;
+	}
+	if (major) *major = d.cache.verNum[0];
+	if (minor) *minor = d.cache.verNum[1];
+	if (variant) *variant = d.cache.variant;
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Obtains the WiFi module flash manufacturer and device IDs. The
+ *        module is only queried the first time, later calls return the
+ *        cached data.
+ *
+ * \param[out] ids Flash IDs, MW_FLASH_ID_LEN bytes long.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the IDs are not cached, no other commands must be pending
+ *       completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwFlashIdGet(const uint8_t **ids) {
+	MwCmd *rep;
+
+	if (!d.cache.flashId) {
+		if (!(rep = MwCacheQuery(MW_CMD_FLASH_ID, NULL, MW_FLASH_ID_LEN))) {
+			return -1;
+		}
+		memcpy(d.cache.flashIds, rep->data, MW_FLASH_ID_LEN);
+		MwCmdReplyFree(rep);
+		d.cache.flashId = TRUE;
+	}
+	*ids = d.cache.flashIds;
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Obtains an AP configuration. The module is only queried if the
+ *        configuration is not cached. Sending MW_CMD_AP_CFG or
+ *        MW_CMD_DEF_CFG_SET invalidates the cached AP configurations.
+ *
+ * \param[in]  num Configuration slot (0 to MW_NUM_AP_CFGS - 1).
+ * \param[out] cfg AP configuration.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the configuration is not cached, no other commands must be
+ *       pending completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwApCfgGet(uint8_t num, const MwMsgApCfg **cfg) {
+	if (num >= MW_NUM_AP_CFGS || MwCacheCfgGet(2 * num)) return -1;
+	*cfg = &d.cache.apCfg[num];
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Obtains an IP configuration. The module is only queried if the
+ *        configuration is not cached. Sending MW_CMD_IP_CFG or
+ *        MW_CMD_DEF_CFG_SET invalidates the cached IP configurations.
+ *
+ * \param[in]  num Configuration slot (0 to MW_NUM_AP_CFGS - 1).
+ * \param[out] cfg IP configuration.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the configuration is not cached, no other commands must be
+ *       pending completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwIpCfgGet(uint8_t num, const MwMsgIpCfg **cfg) {
+	if (num >= MW_NUM_AP_CFGS || MwCacheCfgGet(2 * num + 1)) return -1;
+	*cfg = &d.cache.ipCfg[num];
+
+	return 0;
+}
+
+/****************************************************************************
+ * \brief Caches the AP and IP configurations of all the slots. Only the
+ *        configurations not already cached are queried, keeping up to
+ *        MW_CFG_PEND requests in flight. Use it before getting several
+ *        configurations with MwApCfgGet() and MwIpCfgGet().
+ *
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwCfgCacheLoad(void) {
+	uint8_t miss[2 * MW_NUM_AP_CFGS];
+	uint8_t n = 0, req = 0, done = 0;
+	uint8_t num, tag, i;
+	const LsdVec vec[] = {{&num, sizeof(num)}};
+	MwCmd *rep;
+	int ret;
+
+	if (d.pend) return -1;
+	for (i = 0; i < 2 * MW_NUM_AP_CFGS; i++) {
+		if (!MwCacheCfgValid(i)) miss[n++] = i;
+	}
+	while (done < n) {
+		if (req < n && MwCmdPendGet() < MW_CFG_PEND) {
+			num = miss[req]>>1;
+			if (MwCmdSubmitV(MwCacheCfgCmd(miss[req]), vec, 1) < 0) break;
+			req++;
+			continue;
+		}
+		if (MwCmdWait(&tag, &rep)) break;
+		// Replies complete in order
+		ret = MW_CMD_OK != rep->cmd ||
+			rep->datalen < MwCacheCfgLen(miss[done]);
+		if (!ret) MwCacheCfgStore(miss[done], rep);
+		MwCmdReplyFree(rep);
+		if (ret) break;
+		done++;
+	}
+	if (done < n) {
+		MwCmdCancel();
+		return -1;
+	}
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 
 #include "16c550.h"
 #include "mw-msg.h"
+#include "lsd.h"
 
 /** \addtogroup megawifi mw_ctrl_pins Pins used to control WiFi module.
  *  \{ */
@@ -35,8 +36,64 @@
 #define MW_FSM_QUEUE_LEN	8
 /// Maximum number of simultaneous TCP connections
 #define MW_MAX_SOCK			3
-/// Control channel used for LSD protocol
-#define MW_CTRL_CH			0
+/// Control channel used for LSD protocol. A reception buffer is kept for
+/// it, so replies are received even if data channels are not read.
+#define MW_CTRL_CH			LSD_RSV_CH
+
+/// Maximum number of commands submitted with MwCmdSubmit() waiting for
+/// their reply. Must not be greater than LSD_BUF_FRAMES, so all the replies
+/// fit in the LSD reception buffers.
+#ifndef MW_CMD_MAX_PEND
+#define MW_CMD_MAX_PEND		LSD_BUF_FRAMES
+#endif
+
+/// Maximum number of times a reply received with a wrong CRC is requested
+/// again (only when built with LSD_CRC).
+#ifndef MW_CMD_RETRIES
+#define MW_CMD_RETRIES		3
+#endif
+
+/// Scanlines MwCmdReplyGet() and MwCmdWait() wait for a reply before failing
+/// (about 10 seconds, longer than the slowest commands, such as AP scans).
+#ifndef MW_CMD_TOUT_LINES
+#define MW_CMD_TOUT_LINES	157000LU
+#endif
+
+/// MwCmdComplete() return value when the reply has not been received yet.
+#define MW_CMD_PENDING		1
+
+/// Length of the WiFi module flash IDs (manufacturer and device).
+#define MW_FLASH_ID_LEN		3
+
+/// Maximum length of the cached firmware variant string (including '\0').
+/// Longer variants are truncated.
+#ifndef MW_VARIANT_MAXLEN
+#define MW_VARIANT_MAXLEN	32
+#endif
+
+/// Length of the WiFi module flash sectors.
+#define MW_FLASH_SECT_LEN	4096
+
+/// Maximum data length of a flash write request.
+#define MW_FLASH_WR_MAX		(MW_CMD_MAX_BUFLEN - sizeof(uint32_t))
+
+/// Number of flash requests kept in flight by bulk transfers. Must not be
+/// greater than MW_CMD_MAX_PEND.
+#ifndef MW_FLASH_PEND
+#define MW_FLASH_PEND		2
+#endif
+
+/// Number of configuration requests kept in flight by MwCfgCacheLoad().
+/// Must not be greater than MW_CMD_MAX_PEND.
+#ifndef MW_CFG_PEND
+#define MW_CFG_PEND			2
+#endif
+
+/// Length of the per socket transmission buffer. Data written with
+/// MwSockSend() is sent in frames of this length.
+#ifndef MW_SOCK_TX_BUFLEN
+#define MW_SOCK_TX_BUFLEN	MW_MSG_MAX_BUFLEN
+#endif
 
 /****************************************************************************
  * \brief MwInit Module initialization. Must be called once before using any
@@ -53,20 +110,339 @@ void MwInit(void);
 int MwCmdSend(MwCmd* cmd);
 
 /****************************************************************************
- * \brief Try obtaining a reply to a command.
+ * \brief Send a command to the WiFi module, taking the command data from
+ *        several segments. Segments are sent directly from their location
+ *        (e.g. constants in ROM) without copying them to an MwCmd.
+ *
+ * \param[in] cmd Command code.
+ * \param[in] vec Command data segments, in order.
+ * \param[in] n   Number of segments.
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwCmdSendV(uint16_t cmd, const LsdVec vec[], uint8_t n);
+
+/****************************************************************************
+ * \brief Try obtaining a reply to a command. The reply is read in place
+ *        from the LSD reception buffer pool, and must be returned to the
+ *        pool by calling MwCmdReplyFree() when done with it.
+ *
+ * \return Pointer to the reply to the command, or NULL if there was a
+ *         reception error, or the reply did not arrive within
+ *         MW_CMD_TOUT_LINES scanlines. On timeout, MwCmdReset() is called,
+ *         so the module is assumed to send no more replies. If it still
+ *         might, reset it with MwModuleReset(), or its late reply would be
+ *         taken for the reply to the next command.
+ ****************************************************************************/
+MwCmd *MwCmdReplyGet(void);
+
+/****************************************************************************
+ * \brief Returns a reply obtained with MwCmdReplyGet() to the LSD reception
+ *        buffer pool. The reply must not be accessed after this call.
+ *
+ * \param[in] rep Reply to free.
+ ****************************************************************************/
+void MwCmdReplyFree(MwCmd *rep);
+
+/****************************************************************************
+ * \brief Changes the baud rate of the link on both ends. The new rate is
+ *        requested to the WiFi module, and once the module acknowledges it,
+ *        the local UART is reprogrammed.
+ *
+ * \param[in] baud Requested baud rate.
+ * \return 0 if OK. Nonzero if the rate is not supported by the UART, or if
+ *         the module rejected it.
+ *
+ * \note The link must be idle (no frames in flight on any channel) when
+ *       calling this function.
+ ****************************************************************************/
+int MwUartBaudSet(uint32_t baud);
+
+/****************************************************************************
+ * \brief Submits a command to the WiFi module without waiting for its
+ *        reply. Several commands can be submitted back to back, and their
+ *        replies collected later by calling MwCmdComplete(). The module
+ *        processes commands in order, so replies complete in the same order
+ *        commands were submitted.
+ *
+ * \param[in] cmd Pointer to the filled MwCmd command structure. It can be
+ *            reused as soon as this function returns.
+ * \return The tag identifying the command (0 to 127), or -1 if there are
+ *         already MW_CMD_MAX_PEND commands pending or sending failed.
+ *
+ * \warning Do not mix MwCmdReplyGet() with submitted commands pending
+ *          completion, or replies will be mismatched.
+ ****************************************************************************/
+int MwCmdSubmit(MwCmd *cmd);
+
+/****************************************************************************
+ * \brief Submits a command to the WiFi module without waiting for its
+ *        reply, taking the command data from several segments. See
+ *        MwCmdSubmit() and MwCmdSendV().
+ *
+ * \param[in] cmd Command code.
+ * \param[in] vec Command data segments, in order.
+ * \param[in] n   Number of segments.
+ * \return The tag identifying the command (0 to 127), or -1 if there are
+ *         already MW_CMD_MAX_PEND commands pending or sending failed.
+ ****************************************************************************/
+int MwCmdSubmitV(uint16_t cmd, const LsdVec vec[], uint8_t n);
+
+/****************************************************************************
+ * \brief Checks for the completion of the oldest submitted command. This
+ *        function does not block: it polls the LSD receiver and returns
+ *        immediately if the reply is not available. If a reply is obtained,
+ *        it must be returned to the pool by calling MwCmdReplyFree().
+ *
+ * \param[out] tag Tag of the completed command, as returned by
+ *             MwCmdSubmit().
+ * \param[out] rep Reply to the completed command.
+ * \return 0 if a command completed, MW_CMD_PENDING if the reply has not
+ *         been received yet or no command is pending, or -1 on reception
+ *         error. After an error, MwCmdCancel() should be called, since the
+ *         reply to a command might have been lost.
+ ****************************************************************************/
+int MwCmdComplete(uint8_t *tag, MwCmd **rep);
+
+/****************************************************************************
+ * \brief Waits for the completion of the oldest submitted command, for up
+ *        to MW_CMD_TOUT_LINES scanlines. If a reply is obtained, it must be
+ *        returned to the pool by calling MwCmdReplyFree().
+ *
+ * \param[out] tag Tag of the completed command, as returned by
+ *             MwCmdSubmit().
+ * \param[out] rep Reply to the completed command.
+ * \return 0 if a command completed, or -1 if no command is pending, on
+ *         reception error or on timeout. On timeout, MwCmdReset() is called
+ *         as MwCmdReplyGet() does. After other errors, MwCmdCancel() should
+ *         be called.
+ ****************************************************************************/
+int MwCmdWait(uint8_t *tag, MwCmd **rep);
+
+/****************************************************************************
+ * \brief Returns the number of submitted commands pending completion.
+ *
+ * \return Number of pending commands.
+ ****************************************************************************/
+uint8_t MwCmdPendGet(void);
+
+/****************************************************************************
+ * \brief Cancels all the submitted commands pending completion. Their
+ *        replies are discarded as they arrive.
+ ****************************************************************************/
+void MwCmdCancel(void);
+
+/****************************************************************************
+ * \brief Forgets the submitted commands pending completion and the replies
+ *        to cancelled commands, and discards the control channel frames
+ *        already received. Use it when the module will not send the
+ *        replies (e.g. it has been reset). MwModuleReset() calls it.
+ ****************************************************************************/
+void MwCmdReset(void);
+
+/****************************************************************************
+ * \brief Services the link for up to a scanline budget. Sends pending data
+ *        of the frame started with LsdTxStart(), receives available data
+ *        into the LSD reception buffers (completing submitted commands and
+ *        filling data channel queues) and discards replies to cancelled
+ *        commands. Returns when the budget is exhausted or there is nothing
+ *        more to do, including when all the reception buffers hold frames
+ *        not yet read by the application. Call it once per frame.
+ *
+ * \param[in] lines Budget in scanlines, measured with the VDP V counter.
+ *            The budget can be exceeded by the time needed to service the
+ *            contents of the UART RX FIFO.
+ * \return 0 if OK, or -1 if there was a reception error (a frame was lost).
+ ****************************************************************************/
+int MwService(uint8_t lines);
+
+/****************************************************************************
+ * \brief Connects a TCP socket to a remote host, and enables its channel.
+ *
+ * \param[in] ch      Socket channel (1 to MW_MAX_SOCK).
+ * \param[in] dstAddr Remote host address (IP or name).
+ * \param[in] dstPort Remote port (up to 5 characters).
+ * \param[in] srcPort Local port (up to 5 characters, empty for any).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwTcpConnect(uint8_t ch, const char *dstAddr, const char *dstPort,
+		const char *srcPort);
+
+/****************************************************************************
+ * \brief Sends pending data, disconnects a TCP socket and disables its
+ *        channel. Received data not yet read is discarded.
+ *
+ * \param[in] ch Socket channel (1 to MW_MAX_SOCK).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwTcpDisconnect(uint8_t ch);
+
+/****************************************************************************
+ * \brief Sends data through a connected socket. Data is buffered and sent
+ *        in frames of MW_SOCK_TX_BUFLEN bytes, so small writes are coalesced.
+ *        Writes not fitting in the buffer are sent directly, split in frames
+ *        of up to LSD_MAX_LEN bytes. Call MwSockFlush() to send data
+ *        remaining in the buffer.
+ *
+ * \param[in] ch   Socket channel (1 to MW_MAX_SOCK).
+ * \param[in] data Data to send.
+ * \param[in] len  Length of the data to send.
+ * \return The number of bytes sent (or buffered), or -1 on error.
+ ****************************************************************************/
+int MwSockSend(uint8_t ch, const uint8_t *data, uint16_t len);
+
+/****************************************************************************
+ * \brief Sends the data buffered on a socket by MwSockSend().
+ *
+ * \param[in] ch Socket channel (1 to MW_MAX_SOCK).
+ * \return 0 if OK. Nonzero if error.
+ ****************************************************************************/
+int MwSockFlush(uint8_t ch);
+
+/****************************************************************************
+ * \brief Receives data from a connected socket, without waiting. Frames are
+ *        read in place from the LSD reception buffers: if a frame does not
+ *        fit in buf, the rest of it is returned by the next calls.
+ *
+ * \param[in]  ch  Socket channel (1 to MW_MAX_SOCK).
+ * \param[out] buf Buffer to store the received data.
+ * \param[in]  max Maximum number of bytes to receive.
+ * \return The number of bytes received (0 if no data is available), or -1
+ *         on error. If a received frame was dropped because no reception
+ *         buffer was free, -1 is returned once the data received before it
+ *         has been read, as the stream has a gap.
+ ****************************************************************************/
+int MwSockRecv(uint8_t ch, uint8_t *buf, uint16_t max);
+
+/****************************************************************************
+ * \brief Reads an arbitrary range of the WiFi module flash. The range is
+ *        split in requests of up to MW_CMD_MAX_BUFLEN bytes, keeping up to
+ *        MW_FLASH_PEND of them in flight.
+ *
+ * \param[in]  addr Flash address to start reading from.
+ * \param[out] buf  Buffer to store the read data.
+ * \param[in]  len  Number of bytes to read.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashRead(uint32_t addr, uint8_t *buf, uint32_t len);
+
+/****************************************************************************
+ * \brief Writes an arbitrary range of the WiFi module flash. Data is sent
+ *        directly from buf, in requests of up to MW_FLASH_WR_MAX bytes,
+ *        keeping up to MW_FLASH_PEND of them in flight. The range must have
+ *        been previously erased.
+ *
+ * \param[in] addr Flash address to start writing to.
+ * \param[in] data Data to write.
+ * \param[in] len  Number of bytes to write.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashWrite(uint32_t addr, const uint8_t *data, uint32_t len);
+
+/****************************************************************************
+ * \brief Erases the WiFi module flash sectors covering an arbitrary range.
+ *        Sector erase requests are kept up to MW_FLASH_PEND in flight.
+ *
+ * \param[in] addr Flash address of the start of the range.
+ * \param[in] len  Length of the range.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \warning Whole sectors are erased: data outside the range, but in the
+ *          same sectors as its start and end, is also erased.
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
+ ****************************************************************************/
+int MwFlashErase(uint32_t addr, uint32_t len);
+
+/****************************************************************************
+ * \brief Invalidates all the cached module data, so it is queried again
+ *        the next time it is requested. The cache is flushed when the
+ *        module is reset. Call it if the module configuration might have
+ *        been changed without using this API.
+ ****************************************************************************/
+void MwCacheFlush(void);
+
+/****************************************************************************
+ * \brief Obtains the firmware version of the WiFi module. The module is
+ *        only queried the first time, later calls return the cached data.
+ *
+ * \param[out] major   Major version number. Can be NULL.
+ * \param[out] minor   Minor version number. Can be NULL.
+ * \param[out] variant Firmware variant string. Can be NULL.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the version is not cached, no other commands must be pending
+ *       completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwFwVersionGet(uint8_t *major, uint8_t *minor, const char **variant);
+
+/****************************************************************************
+ * \brief Obtains the WiFi module flash manufacturer and device IDs. The
+ *        module is only queried the first time, later calls return the
+ *        cached data.
+ *
+ * \param[out] ids Flash IDs, MW_FLASH_ID_LEN bytes long.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the IDs are not cached, no other commands must be pending
+ *       completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwFlashIdGet(const uint8_t **ids);
+
+/****************************************************************************
+ * \brief Obtains an AP configuration. The module is only queried if the
+ *        configuration is not cached. Sending MW_CMD_AP_CFG or
+ *        MW_CMD_DEF_CFG_SET invalidates the cached AP configurations.
+ *
+ * \param[in]  num Configuration slot (0 to MW_NUM_AP_CFGS - 1).
+ * \param[out] cfg AP configuration.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the configuration is not cached, no other commands must be
+ *       pending completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwApCfgGet(uint8_t num, const MwMsgApCfg **cfg);
+
+/****************************************************************************
+ * \brief Obtains an IP configuration. The module is only queried if the
+ *        configuration is not cached. Sending MW_CMD_IP_CFG or
+ *        MW_CMD_DEF_CFG_SET invalidates the cached IP configurations.
+ *
+ * \param[in]  num Configuration slot (0 to MW_NUM_AP_CFGS - 1).
+ * \param[out] cfg IP configuration.
+ * \return 0 if OK. Nonzero if error.
+ *
+ * \note If the configuration is not cached, no other commands must be
+ *       pending completion when calling this function, or it fails.
+ ****************************************************************************/
+int MwIpCfgGet(uint8_t num, const MwMsgIpCfg **cfg);
+
+/****************************************************************************
+ * \brief Caches the AP and IP configurations of all the slots. Only the
+ *        configurations not already cached are queried, keeping up to
+ *        MW_CFG_PEND requests in flight. Use it before getting several
+ *        configurations with MwApCfgGet() and MwIpCfgGet().
+ *
+ * \return 0 if OK. Nonzero if error.
  *
- * \param[out] rep Pointer to MwRep structure, containing the reply to the
- *                 command, if the call completed successfully.
- * \return The channel on which the data has been received (0 if it was on
- *         the control channel). Lower than 0 if there was a reception
- *         error.
+ * \note No other commands must be pending completion when calling this
+ *       function, or it fails.
  ****************************************************************************/
-int MwCmdReplyGet(MwCmd *rep);
+int MwCfgCacheLoad(void);
 
 /****************************************************************************
- * \brief Puts the WiFi module in reset state.
+ * \brief Puts the WiFi module in reset state. The module data cache is
+ *        flushed, as the module might not keep its firmware and
+ *        configuration when it starts again. Replies to commands sent
+ *        before the reset are no longer expected.
  ****************************************************************************/
-#define MwModuleReset()		do{UartSetBits(MCR, MW__RESET);}while(0)
+#define MwModuleReset()		do{UartSetBits(MCR, MW__RESET);		\
+							MwCacheFlush(); MwCmdReset();}while(0)
 
 /****************************************************************************
  * \brief Releases the module from reset state.
@@ -0,0 +1,442 @@
+/************************************************************************//**
+ * \brief Link benchmark suite. Runs repeatable end to end scenarios through
+ *        the MegaWiFi API, timed with the vertical blanking counter, and
+ *        reports results in a machine readable form. The same suite runs
+ *        on the console and on the host build against the firmware
+ *        stand-in (host/mw-fw).
+ ****************************************************************************/
+#include "mw-bench.h"
+
+#ifdef MW_BENCH
+#include <string.h>
+#include "16c550.h"
+#include "lsd.h"
+#include "megawifi.h"
+#include "util.h"
+
+#ifdef UART_SIM
+/// Reads the frame counter
+#define MwBenchFrameGet()	UartSimFrameCnt()
+#else
+/// Reads the frame counter
+#define MwBenchFrameGet()	(d.frames)
+#endif
+
+/// The scenario uses the socket, connected to the echo server
+#define MwBenchSockOp(op)	(MW_BENCH_SOCK_RTT == (op) ||					\
+		MW_BENCH_SOCK_STREAM == (op) || MW_BENCH_STARVE == (op))
+
+/// Scenario of the standard suite.
+typedef struct {
+	uint8_t op;			///< Scenario (MwBenchOp)
+	uint16_t len;		///< Payload length per repetition
+	uint16_t reps;		///< Repetitions
+} MwBenchStep;
+
+/** \addtogroup mw-bench MwBenchData Local data required by the module.
+ *  \{ */
+typedef struct {
+	uint8_t pat[MW_BENCH_BUFLEN + 256];	///< Test data, pat[i] = i mod 256
+	uint8_t buf[MW_BENCH_BUFLEN];		///< Received data
+	MwCmd cmd;							///< Command to submit
+	volatile uint16_t frames;			///< Vertical interrupts elapsed
+} MwBenchData;
+/** \} */
+
+// Module global data
+static MwBenchData d;
+
+// Standard suite. Repetitions keep each scenario running for tens of frames
+// at the default line rate, so the frame counter resolution is not an issue.
+static const MwBenchStep suite[] = {
+	{MW_BENCH_ECHO, 1, 240},
+	{MW_BENCH_ECHO, 16, 240},
+	{MW_BENCH_ECHO, 64, 120},
+	{MW_BENCH_ECHO, 256, 60},
+	{MW_BENCH_ECHO, MW_CMD_MAX_BUFLEN, 30},
+	{MW_BENCH_CMD, 0, 240},
+	{MW_BENCH_SOCK_RTT, 64, 256},
+	{MW_BENCH_SOCK_RTT, 256, 64},
+	{MW_BENCH_SOCK_RTT, MW_BENCH_BUFLEN, 16},
+	{MW_BENCH_SOCK_STREAM, 64, 256},
+	{MW_BENCH_SOCK_STREAM, 256, 64},
+	{MW_BENCH_SOCK_STREAM, MW_BENCH_BUFLEN, 16},
+	{MW_BENCH_FLASH, 256, 128},
+	{MW_BENCH_FLASH, MW_BENCH_BUFLEN, 32},
+	{MW_BENCH_META, 0, 240},
+	{MW_BENCH_STARVE, 8, 16}
+};
+
+// Scenario names, as reported in the CSV lines
+static const char *const opName[MW_BENCH_MAX] = {
+	"echo", "cmd", "sock_rtt", "sock_stream", "flash", "meta", "starve",
+	"uart"
+};
+
+// Echo command round trips. Commands are sent directly from the test data.
+static int MwBenchEcho(uint16_t len, uint16_t reps, MwBenchResult *res) {
+	const LsdVec vec[] = {{d.pat, len}};
+	MwCmd *rep;
+	int err;
+
+	while (reps--) {
+		if (MwCmdSendV(MW_CMD_ECHO, vec, 1) || !(rep = MwCmdReplyGet())) {
+			return -1;
+		}
+		err = MW_CMD_OK != rep->cmd || rep->datalen != len ||
+			memcmp(rep->data, d.pat, len);
+		MwCmdReplyFree(rep);
+		if (err) return -1;
+		res->bytes += 2 * len;
+	}
+	return 0;
+}
+
+// Version queries, keeping up to MW_CMD_MAX_PEND of them in flight.
+// Replies are collected before each submission, as the UART RX FIFO would
+// overrun if several replies arrived while sending commands back to back.
+static int MwBenchCmd(uint16_t reps, MwBenchResult *res) {
+	uint16_t req = 0, done = 0;
+	MwCmd *rep;
+	uint8_t tag;
+	int ret;
+
+	d.cmd.cmd = MW_CMD_VERSION;
+	d.cmd.datalen = 0;
+	while (done < reps) {
+		ret = MwCmdComplete(&tag, &rep);
+		if (MW_CMD_PENDING == ret &&
+				(req >= reps || MwCmdPendGet() >= MW_CMD_MAX_PEND)) {
+			// Nothing to submit, wait for the oldest reply
+			ret = MwCmdWait(&tag, &rep);
+		}
+		if (MW_CMD_PENDING != ret) {
+			if (ret) break;
+			ret = MW_CMD_OK != rep->cmd;
+			res->bytes += rep->datalen;
+			MwCmdReplyFree(rep);
+			if (ret) break;
+			done++;
+		}
+		if (req < reps && MwCmdPendGet() < MW_CMD_MAX_PEND) {
+			if (MwCmdSubmit(&d.cmd) < 0) break;
+			req++;
+		}
+	}
+	if (done < reps) {
+		MwCmdCancel();
+		return -1;
+	}
+	return 0;
+}
+
+// Sends data through the echo server, checking it comes back unchanged.
+// Up to win bytes are kept in flight, but at least a chunk of len bytes.
+// The offset of each byte in the stream selects its value, so data is
+// checked without copies.
+static int MwBenchSock(uint16_t len, uint16_t reps, uint16_t win,
+		MwBenchResult *res) {
+	uint32_t total = (uint32_t)len * reps;
+	uint32_t sent = 0, recv = 0;
+	uint16_t last = MwBenchFrameGet();
+	int n;
+
+	while (recv < total) {
+		if (sent < total && (sent == recv || sent - recv + len <= win)) {
+			if (MwSockSend(MW_BENCH_SOCK_CH, d.pat + (sent & 0xFF), len) !=
+					len || MwSockFlush(MW_BENCH_SOCK_CH)) {
+				return -1;
+			}
+			sent += len;
+		}
+		if ((n = MwSockRecv(MW_BENCH_SOCK_CH, d.buf, sizeof(d.buf))) < 0) {
+			return -1;
+		}
+		if (n) {
+			if (memcmp(d.buf, d.pat + (recv & 0xFF), n)) return -1;
+			recv += n;
+			last = MwBenchFrameGet();
+		} else if ((uint16_t)(MwBenchFrameGet() - last) >
+				MW_BENCH_TOUT_FRAMES) {
+			return -1;
+		}
+	}
+	res->bytes = 2 * total;
+	return 0;
+}
+
+// Socket stream with several chunks in flight. Auto flow control stops the
+// module while the RX FIFO is not read, so it does not overrun while sending.
+static int MwBenchStream(uint16_t len, uint16_t reps, MwBenchResult *res) {
+	const uint8_t flow = UartGet(MCR) & UART_MCR__AFE;
+	const uint8_t fcr = UartGet(FCR);
+	int err;
+
+	if (!flow) {
+		UartAutoFlowEnable(MW_BENCH_STREAM_TRIG);
+#ifdef UART_SIM
+		UartSimPeerFlowSet(1);
+#endif
+	}
+	err = MwBenchSock(len, reps, MW_BENCH_STREAM_WIN, res);
+	if (!flow) {
+		UartAutoFlowDisable();
+		UartSet(FCR, fcr);
+#ifdef UART_SIM
+		UartSimPeerFlowSet(0);
+#endif
+	}
+	return err;
+}
+
+// Bulk flash reads of consecutive ranges
+static int MwBenchFlash(uint16_t len, uint16_t reps, MwBenchResult *res) {
+	uint32_t addr = 0;
+
+	while (reps--) {
+		if (MwFlashRead(addr, d.buf, len)) return -1;
+		addr += len;
+		res->bytes += len;
+	}
+	return 0;
+}
+
+// Module data requests, as done by a status screen. The cache is flushed,
+// so only the first repetition queries the module.
+static int MwBenchMeta(uint16_t reps, MwBenchResult *res) {
+	const MwMsgApCfg *ap;
+	const MwMsgIpCfg *ip;
+	const uint8_t *ids;
+	const char *variant;
+	uint8_t i;
+
+	MwCacheFlush();
+	while (reps--) {
+		if (MwFwVersionGet(NULL, NULL, &variant) || MwFlashIdGet(&ids) ||
+				MwCfgCacheLoad()) return -1;
+		res->bytes += 2 + strlen(variant) + MW_FLASH_ID_LEN;
+		for (i = 0; i < MW_NUM_AP_CFGS; i++) {
+			if (MwApCfgGet(i, &ap) || MwIpCfgGet(i, &ip)) return -1;
+			res->bytes += sizeof(MwMsgApCfg) + sizeof(MwMsgIpCfg);
+		}
+	}
+	return 0;
+}
+
+// Receives frames into the LSD buffers, without reading them, until one is
+// received on ch or MW_BENCH_ECHO_FRAMES elapse
+static void MwBenchRxWait(uint8_t ch) {
+	uint16_t start = MwBenchFrameGet();
+
+	while (LsdPoll() != ch && (uint16_t)(MwBenchFrameGet() - start) <
+			MW_BENCH_ECHO_FRAMES);
+}
+
+// Command replies with the socket queue full. LSD_BUF_FRAMES chunks are
+// echoed and left unread, so the last one is dropped to keep a buffer for
+// the control channel, and then an ECHO command is sent. Chunks are sent
+// once the previous one has been received, so the RX FIFO does not overrun.
+static int MwBenchStarve(uint16_t len, uint16_t reps, MwBenchResult *res) {
+	const LsdVec vec[] = {{d.pat, len}};
+	const uint16_t keep = (LSD_BUF_FRAMES - 1) * len;
+	uint16_t recv, last;
+	MwCmd *rep;
+	uint8_t i, lost;
+	int n, err;
+
+	while (reps--) {
+		for (i = 0; i < LSD_BUF_FRAMES; i++) {
+			if (MwSockSend(MW_BENCH_SOCK_CH, d.pat + i * len, len) != len ||
+					MwSockFlush(MW_BENCH_SOCK_CH)) return -1;
+			MwBenchRxWait(MW_BENCH_SOCK_CH);
+		}
+		if (MwCmdSendV(MW_CMD_ECHO, vec, 1) || !(rep = MwCmdReplyGet())) {
+			return -1;
+		}
+		err = MW_CMD_OK != rep->cmd || rep->datalen != len ||
+			memcmp(rep->data, d.pat, len);
+		MwCmdReplyFree(rep);
+		if (err) return -1;
+		// The socket keeps the start of the stream, and then reports the
+		// dropped frame once
+		recv = lost = 0;
+		last = MwBenchFrameGet();
+		while ((uint16_t)(MwBenchFrameGet() - last) < MW_BENCH_ECHO_FRAMES) {
+			if ((n = MwSockRecv(MW_BENCH_SOCK_CH, d.buf + recv,
+							sizeof(d.buf) - recv)) < 0) lost++;
+			else recv += n;
+		}
+		if (recv != keep || 1 != lost || memcmp(d.buf, d.pat, keep)) {
+			return -1;
+		}
+		res->bytes += 2 * len + 2 * LSD_BUF_FRAMES * len;
+	}
+	return 0;
+}
+
+// UART internal loopback
+static int MwBenchUart(uint16_t len, uint16_t reps, MwBenchResult *res) {
+	UartLoopStats st;
+	int err;
+
+	err = UartLoopbackBench((uint32_t)len * reps, &st);
+	res->bytes = st.bytes;
+	res->polls = st.polls;
+	res->lsr = st.lsr;
+	return err;
+}
+
+// Writes the decimal representation of a number followed by a separator,
+// returning the characters written
+static uint8_t MwBenchDec(uint32_t val, char *str, char sep) {
+	char tmp[10];
+	uint8_t n = 0, i;
+
+	do {
+		tmp[n++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	for (i = 0; i < n; i++) str[i] = tmp[n - 1 - i];
+	str[n] = sep;
+
+	return n + 1;
+}
+
+/************************************************************************//**
+ * \brief Increments the frame counter. Must be called from the vertical
+ *        interrupt handler.
+ ****************************************************************************/
+void MwBenchVInt(void) {
+	d.frames++;
+}
+
+/************************************************************************//**
+ * \brief Runs a scenario.
+ *
+ * \param[in]  op   Scenario.
+ * \param[in]  len  Payload length per repetition. Unused by MW_BENCH_CMD
+ *             and MW_BENCH_META.
+ * \param[in]  reps Repetitions.
+ * \param[out] res  Result.
+ *
+ * \return 0 if OK, nonzero if the scenario failed.
+ ****************************************************************************/
+int MwBenchRun(MwBenchOp op, uint16_t len, uint16_t reps,
+		MwBenchResult *res) {
+	uint16_t start;
+	uint16_t i;
+	int err = -1;
+
+	memset(res, 0, sizeof(MwBenchResult));
+	res->op = op;
+	res->len = len;
+	res->reps = reps;
+	res->fps = (UART_MD_VERSION & UART_MD_VERSION__PAL)?50:60;
+	res->err = 1;
+	if (op >= MW_BENCH_MAX || len > MW_BENCH_BUFLEN ||
+			(MW_BENCH_ECHO == op && len > MW_CMD_MAX_BUFLEN) ||
+			(MW_BENCH_STARVE == op &&
+			 LSD_BUF_FRAMES * len > MW_BENCH_BUFLEN)) {
+		return -1;
+	}
+	for (i = 0; i < sizeof(d.pat); i++) d.pat[i] = i;
+	if (MwBenchSockOp(op) && MwTcpConnect(MW_BENCH_SOCK_CH, MW_BENCH_HOST,
+				MW_BENCH_PORT, "")) {
+		return -1;
+	}
+
+	start = MwBenchFrameGet();
+	switch (op) {
+		case MW_BENCH_ECHO:
+			err = MwBenchEcho(len, reps, res);
+			break;
+
+		case MW_BENCH_CMD:
+			err = MwBenchCmd(reps, res);
+			break;
+
+		case MW_BENCH_SOCK_RTT:
+			// A single chunk in flight: each waits for the previous echo
+			err = MwBenchSock(len, reps, len, res);
+			break;
+
+		case MW_BENCH_SOCK_STREAM:
+			err = MwBenchStream(len, reps, res);
+			break;
+
+		case MW_BENCH_FLASH:
+			err = MwBenchFlash(len, reps, res);
+			break;
+
+		case MW_BENCH_META:
+			err = MwBenchMeta(reps, res);
+			break;
+
+		case MW_BENCH_STARVE:
+			err = MwBenchStarve(len, reps, res);
+			break;
+
+		case MW_BENCH_UART:
+			err = MwBenchUart(len, reps, res);
+			break;
+
+		default:
+			break;
+	}
+	res->frames = MwBenchFrameGet() - start;
+
+	if (MwBenchSockOp(op) && MwTcpDisconnect(MW_BENCH_SOCK_CH)) err = -1;
+	res->err = err != 0;
+	return res->err;
+}
+
+/************************************************************************//**
+ * \brief Runs all the scenarios, with the standard lengths and repetitions.
+ *
+ * \param[in] cb Callback receiving each result.
+ *
+ * \return 0 if all the scenarios succeeded, nonzero otherwise.
+ ****************************************************************************/
+int MwBenchSuite(MwBenchCb cb) {
+	MwBenchResult res;
+	uint8_t i;
+	int err = 0;
+
+	for (i = 0; i < sizeof(suite) / sizeof(MwBenchStep); i++) {
+		if (MwBenchRun(suite[i].op, suite[i].len, suite[i].reps, &res)) {
+			err = 1;
+		}
+		cb(&res);
+	}
+	return err;
+}
+
+/************************************************************************//**
+ * \brief Formats a result as a CSV line, with the MW_BENCH_CSV_HDR fields.
+ *
+ * \param[in]  res Result.
+ * \param[out] str Line, without end of line. Must have room for
+ *             MW_BENCH_CSV_MAX characters.
+ *
+ * \return Length of the line.
+ ****************************************************************************/
+uint8_t MwBenchCsv(const MwBenchResult *res, char *str) {
+	uint8_t pos;
+
+	pos = strlen(opName[MIN(res->op, MW_BENCH_MAX - 1)]);
+	memcpy(str, opName[MIN(res->op, MW_BENCH_MAX - 1)], pos);
+	str[pos++] = ',';
+	pos += MwBenchDec(res->len, str + pos, ',');
+	pos += MwBenchDec(res->reps, str + pos, ',');
+	pos += MwBenchDec(res->frames, str + pos, ',');
+	pos += MwBenchDec(res->fps, str + pos, ',');
+	pos += MwBenchDec(res->bytes, str + pos, ',');
+	pos += MwBenchDec(res->polls, str + pos, ',');
+	pos += MwBenchDec(res->lsr, str + pos, ',');
+	pos += MwBenchDec(res->err, str + pos, '\0');
+
+	return pos - 1;
+}
+
+#endif /*MW_BENCH*/
+
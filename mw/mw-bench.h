@@ -0,0 +1,173 @@
+/************************************************************************//**
+ * \brief Link benchmark suite. Runs repeatable end to end scenarios through
+ *        the MegaWiFi API, timed with the vertical blanking counter, and
+ *        reports results in a machine readable form. The same suite runs
+ *        on the console and on the host build against the firmware
+ *        stand-in (host/mw-fw).
+ *
+ * \defgroup mw-bench Link benchmark suite
+ * \{
+ ****************************************************************************/
+
+/**
+ * USAGE:
+ * Build with MW_BENCH defined to enable the suite. Call MwBenchVInt() from
+ * the vertical interrupt handler, then call MwBenchSuite() once the module
+ * is ready. Each scenario result is passed to a callback, that can format
+ * it as a CSV line with MwBenchCsv(). The first line of the report is
+ * MW_BENCH_CSV_HDR.
+ *
+ * MW_BENCH_UART measures the UART driver alone, through the UART internal
+ * loopback. As loopback mode drives the module control lines inactive, it
+ * is not part of MwBenchSuite(): run it with MwBenchRun() before starting
+ * the module. It sends len * reps bytes, keeping the TX FIFO topped up, and
+ * also reports the LSR reads (the polling overhead) and the line error bits
+ * (UART_LSR__ERR_MASK) seen.
+ *
+ * MW_BENCH_META flushes the module data cache, and then gets the firmware
+ * version, flash IDs and all the AP and IP configurations on each
+ * repetition, as a status screen would. Only the first repetition queries
+ * the module.
+ *
+ * MW_BENCH_STARVE leaves LSD_BUF_FRAMES frames of len bytes echoed on
+ * the socket channel unread, and then sends an ECHO command. The reply
+ * must be received, as a reception buffer is kept for the control channel,
+ * and the socket must keep the first LSD_BUF_FRAMES - 1 frames, and then
+ * report the last one was dropped. len must fit in the UART RX FIFO with the frame
+ * overhead, as the frames are not read while the command is sent.
+ *
+ * MW_BENCH_SOCK_RTT sends each chunk once the previous one has been echoed,
+ * so it measures the socket round trip time. MW_BENCH_SOCK_STREAM keeps
+ * up to MW_BENCH_STREAM_WIN bytes in flight, measuring the sustained
+ * throughput with data flowing in both directions. As the RX FIFO is not
+ * read while sending, it enables auto RTS/CTS flow control for the duration
+ * of the scenario (unless already enabled), so the module must honour RTS.
+ *
+ * The socket scenarios need a TCP echo server (RFC 862) at MW_BENCH_HOST,
+ * so on the console build MW_BENCH_HOST must be defined to a machine in
+ * the network. The firmware stand-in serves the echo port itself.
+ */
+#ifndef _MW_BENCH_H_
+#define _MW_BENCH_H_
+
+#include <stdint.h>
+
+#ifdef MW_BENCH
+
+/// Echo server address for the socket scenarios
+#ifndef MW_BENCH_HOST
+#define MW_BENCH_HOST		"127.0.0.1"
+#endif
+
+/// Echo server port for the socket scenarios
+#ifndef MW_BENCH_PORT
+#define MW_BENCH_PORT		"7"
+#endif
+
+/// Socket channel used by the socket scenarios
+#define MW_BENCH_SOCK_CH	1
+
+/// Bytes MW_BENCH_SOCK_STREAM keeps in flight. Must not exceed the data
+/// the module and the echo server can buffer.
+#ifndef MW_BENCH_STREAM_WIN
+#define MW_BENCH_STREAM_WIN	2048
+#endif
+
+/// RX FIFO trigger level (UART_FCR__TRIG_x) for MW_BENCH_SOCK_STREAM
+#define MW_BENCH_STREAM_TRIG	UART_FCR__TRIG_8
+
+/// Data buffer length. Limits the payload of the flash scenario.
+#ifndef MW_BENCH_BUFLEN
+#define MW_BENCH_BUFLEN		1024
+#endif
+
+/// Frames MW_BENCH_STARVE waits for each echoed frame
+#define MW_BENCH_ECHO_FRAMES	30
+
+/// Frames without progress before a scenario is aborted
+#define MW_BENCH_TOUT_FRAMES	300
+
+/// Header of the CSV report
+#define MW_BENCH_CSV_HDR	"op,len,reps,frames,fps,bytes,polls,lsr,err"
+
+/// Maximum length of a CSV report line, including the terminator
+#define MW_BENCH_CSV_MAX	64
+
+/** \addtogroup mw-bench MwBenchOp Benchmark scenarios.
+ *  \{ */
+typedef enum {
+	MW_BENCH_ECHO = 0,		///< ECHO command round trips
+	MW_BENCH_CMD,			///< Pipelined VERSION commands
+	MW_BENCH_SOCK_RTT,		///< Socket echo round trips, one chunk at a time
+	MW_BENCH_SOCK_STREAM,	///< Stream echoed back through a socket
+	MW_BENCH_FLASH,			///< Bulk flash reads
+	MW_BENCH_META,			///< Cached version, flash IDs and configurations
+	MW_BENCH_STARVE,		///< Command reply with a socket queue full
+	MW_BENCH_UART,			///< UART internal loopback (not in the suite)
+	MW_BENCH_MAX			///< Number of scenarios
+} MwBenchOp;
+/** \} */
+
+/// Result of a scenario. Payload bytes moved in both directions are
+/// accounted, so throughput is bytes * fps / frames.
+typedef struct {
+	uint8_t op;			///< Scenario (MwBenchOp)
+	uint8_t fps;		///< Vertical interrupts per second
+	uint16_t len;		///< Payload length per repetition
+	uint16_t reps;		///< Repetitions
+	uint16_t frames;	///< Frames elapsed
+	uint32_t bytes;		///< Payload bytes moved
+	uint32_t polls;		///< LSR reads (MW_BENCH_UART only)
+	uint8_t lsr;		///< Line error bits detected (MW_BENCH_UART only)
+	int8_t err;			///< Nonzero if the scenario failed
+} MwBenchResult;
+
+/// Callback receiving each scenario result
+typedef void (*MwBenchCb)(const MwBenchResult *res);
+
+/************************************************************************//**
+ * \brief Increments the frame counter. Must be called from the vertical
+ *        interrupt handler.
+ ****************************************************************************/
+void MwBenchVInt(void);
+
+/************************************************************************//**
+ * \brief Runs a scenario.
+ *
+ * \param[in]  op   Scenario.
+ * \param[in]  len  Payload length per repetition. Unused by MW_BENCH_CMD
+ *             and MW_BENCH_META.
+ * \param[in]  reps Repetitions.
+ * \param[out] res  Result.
+ *
+ * \return 0 if OK, nonzero if the scenario failed.
+ ****************************************************************************/
+int MwBenchRun(MwBenchOp op, uint16_t len, uint16_t reps,
+		MwBenchResult *res);
+
+/************************************************************************//**
+ * \brief Runs all the scenarios, with the standard lengths and repetitions.
+ *
+ * \param[in] cb Callback receiving each result.
+ *
+ * \return 0 if all the scenarios succeeded, nonzero otherwise.
+ ****************************************************************************/
+int MwBenchSuite(MwBenchCb cb);
+
+/************************************************************************//**
+ * \brief Formats a result as a CSV line, with the MW_BENCH_CSV_HDR fields.
+ *
+ * \param[in]  res Result.
+ * \param[out] str Line, without end of line. Must have room for
+ *             MW_BENCH_CSV_MAX characters.
+ *
+ * \return Length of the line.
+ ****************************************************************************/
+uint8_t MwBenchCsv(const MwBenchResult *res, char *str);
+
+#endif /*MW_BENCH*/
+
+#endif /*_MW_BENCH_H_*/
+
+/** \} */
+
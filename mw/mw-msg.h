@@ -44,6 +44,7 @@
 #define MW_CMD_SYS_STAT		 26		///< Get system status
 #define MW_CMD_DEF_CFG_SET	 27		///< Set default configuration
 #define MW_CMD_HRNG_GET		 28		///< Gets random numbers
+#define MW_CMD_UART_CFG		 29		///< Set UART baud rate
 #define MW_CMD_ERROR		255		///< Error command reply
 /** \} */
 
@@ -118,12 +119,16 @@ typedef struct {
 		uint16_t flSect;	// Flash sector
 		uint32_t flId;		// Flash IDs
 		uint16_t rndLen;	// Length of the random buffer to fill
+		uint32_t baud;		// UART baud rate
 	};
 } MwCmd;
 /** \} */
 
 typedef struct {
-	uint8_t data[MW_MSG_MAX_BUFLEN];	///< Buffer data
+	union {
+		uint8_t data[MW_MSG_MAX_BUFLEN];	///< Buffer data
+		MwCmd cmd;							///< Buffer data, as a command
+	};
 	uint16_t len;						///< Length of buffer contents
 	uint8_t ch;							///< Channel associated with buffer
 } MwMsgBuf;
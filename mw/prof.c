@@ -0,0 +1,199 @@
+/************************************************************************//**
+ * \brief Hot path profiler. Measures the 68000 cycles spent in the driver
+ *        hot paths, using the VDP H/V counter and a frame counter
+ *        incremented on each vertical interrupt.
+ ****************************************************************************/
+#include "prof.h"
+
+#ifdef MW_PROF
+#include <string.h>
+#include "16c550.h"
+#include "hvcnt.h"
+#include "lsd.h"
+
+#ifdef UART_SIM
+/// Reads the frame counter
+#define ProfFrameGet()		UartSimFrameCnt()
+#else
+/// Reads the frame counter
+#define ProfFrameGet()		(d.frames)
+#endif
+
+/// 68000 cycles per H counter step, in 1/256 cycle units
+#define PROF_STEP_CYCLES	((HV_LINE_MCLK * 256 + HV_H_STEPS * HV_M68K_MCLK / 2)\
+		/ (HV_H_STEPS * HV_M68K_MCLK))
+
+/// Point in time. As the V counter jumps back during the vertical blanking,
+/// some values are reached twice each frame, so each time has up to two
+/// possible values.
+typedef struct {
+	uint16_t frame;		///< Frame counter value
+	uint16_t line[2];	///< Possible scanlines since the vertical interrupt
+	uint8_t step;		///< H counter steps since the scanline started
+} ProfStamp;
+
+/** \addtogroup prof ProfData Local data required by the module.
+ *  \{ */
+typedef struct {
+	ProfProbe probe[PROF_MAX];	///< Results of each probe
+	ProfStamp start[PROF_MAX];	///< Entry time of each probe
+	volatile uint16_t frames;	///< Vertical interrupts elapsed
+	uint16_t lines;				///< Scanlines per frame
+	uint16_t jump;				///< Last scanline before V counter jumps back
+} ProfData;
+/** \} */
+
+// Module global data
+static ProfData d;
+
+// Converts a scanline number to scanlines since the vertical interrupt
+static inline uint16_t ProfSinceVInt(uint16_t line) {
+	return line >= HV_VINT_V?line - HV_VINT_V:line + d.lines - HV_VINT_V;
+}
+
+// Takes the current time. The frame counter is read again in case the
+// interrupt happened between both reads.
+static inline void ProfStampGet(ProfStamp *t) {
+	uint16_t hv, v, alt;
+
+	do {
+		t->frame = ProfFrameGet();
+		hv = HvCntGet();
+	} while (t->frame != ProfFrameGet());
+	t->step = HvHStepsGet(hv & 0xFF);
+	v = hv>>8;
+	// Scanlines after the jump have the counter value of previous ones
+	alt = v + d.lines - 256;
+	if (alt <= d.jump || alt >= d.lines) {
+		// Before the jump the counter wraps on machines with more lines
+		alt = v + 256;
+		if (alt > d.jump) alt = v;
+	}
+	if (v > d.jump) v = alt;
+	t->line[0] = ProfSinceVInt(v);
+	t->line[1] = ProfSinceVInt(alt);
+}
+
+// Converts H counter steps to 68000 cycles
+static inline uint32_t ProfCycles(uint32_t steps) {
+	return (steps>>8) * PROF_STEP_CYCLES +
+		(((steps & 0xFF) * PROF_STEP_CYCLES)>>8);
+}
+
+// Histogram slot for a call duration
+static inline uint8_t ProfHistSlot(uint32_t cycles) {
+	uint8_t slot = 0;
+
+	cycles >>= PROF_HIST_SHIFT;
+	while (cycles && slot < (PROF_HIST_LEN - 1)) {
+		cycles >>= 1;
+		slot++;
+	}
+	return slot;
+}
+
+/************************************************************************//**
+ * \brief Clears the results of all the probes.
+ ****************************************************************************/
+void ProfReset(void) {
+	uint8_t i;
+
+	memset(d.probe, 0, sizeof(d.probe));
+	for (i = 0; i < PROF_MAX; i++) d.probe[i].min = UINT32_MAX;
+}
+
+/************************************************************************//**
+ * \brief Module initialization. Clears the results and detects the number
+ *        of scanlines per frame.
+ ****************************************************************************/
+void ProfInit(void) {
+	if (UART_MD_VERSION & UART_MD_VERSION__PAL) {
+		d.lines = HV_LINES_PAL;
+		d.jump = HV_JUMP_PAL;
+	} else {
+		d.lines = HV_LINES_NTSC;
+		d.jump = HV_JUMP_NTSC;
+	}
+	ProfReset();
+}
+
+/************************************************************************//**
+ * \brief Increments the frame counter. Must be called from the vertical
+ *        interrupt handler.
+ ****************************************************************************/
+void ProfVInt(void) {
+	d.frames++;
+}
+
+/************************************************************************//**
+ * \brief Marks the entry of a hot path. Use PROF_ENTER() instead.
+ *
+ * \param[in] id Probe.
+ ****************************************************************************/
+void ProfEnter(ProfId id) {
+	ProfStampGet(&d.start[id]);
+}
+
+/************************************************************************//**
+ * \brief Marks the exit of a hot path, accounting the time elapsed since
+ *        its entry. Use PROF_EXIT() instead.
+ *
+ * \param[in] id Probe.
+ ****************************************************************************/
+void ProfExit(ProfId id) {
+	ProfStamp now;
+	ProfProbe *p = &d.probe[id];
+	int32_t frames, elapsed;
+	uint32_t steps = UINT32_MAX;
+	uint32_t cycles;
+	uint8_t i, j;
+
+	ProfStampGet(&now);
+	frames = (int32_t)((uint16_t)(now.frame - d.start[id].frame)) * d.lines;
+	// Take the shortest time possible, calls are expected to be short
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			elapsed = (frames + now.line[i] - d.start[id].line[j]) *
+				HV_H_STEPS + now.step - d.start[id].step;
+			if (elapsed >= 0 && (uint32_t)elapsed < steps) steps = elapsed;
+		}
+	}
+	if (UINT32_MAX == steps) steps = 0;
+	cycles = ProfCycles(steps);
+
+	p->count++;
+	p->sum += cycles;
+	if (cycles < p->min) p->min = cycles;
+	if (cycles > p->max) p->max = cycles;
+	p->hist[ProfHistSlot(cycles)]++;
+}
+
+/************************************************************************//**
+ * \brief Obtains the results of a probe.
+ *
+ * \param[in]  id    Probe.
+ * \param[out] probe Results, accumulated since ProfInit() or ProfReset().
+ ****************************************************************************/
+void ProfGet(ProfId id, ProfProbe *probe) {
+	memcpy(probe, &d.probe[id], sizeof(ProfProbe));
+}
+
+/************************************************************************//**
+ * \brief Sends the results of all the probes (PROF_MAX ProfProbe entries,
+ *        in ProfId order, big endian) in a frame through a LSD channel.
+ *
+ * \param[in] ch Channel number. Must be enabled.
+ *
+ * \return -1 if there was an error, or the number of characters sent
+ *         otherwise.
+ ****************************************************************************/
+int ProfSend(uint8_t ch) {
+	ProfProbe probe[PROF_MAX];
+
+	// Sending is also profiled, so send a snapshot
+	memcpy(probe, d.probe, sizeof(probe));
+	return LsdSend((const uint8_t*)probe, sizeof(probe), ch);
+}
+
+#endif /*MW_PROF*/
+
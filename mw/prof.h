@@ -0,0 +1,133 @@
+/************************************************************************//**
+ * \brief Hot path profiler. Measures the 68000 cycles spent in the driver
+ *        hot paths, using the VDP H/V counter and a frame counter
+ *        incremented on each vertical interrupt.
+ *
+ * \defgroup prof Hot path profiler
+ * \{
+ ****************************************************************************/
+
+/**
+ * USAGE:
+ * Build with MW_PROF defined to enable the profiler. Otherwise PROF_ENTER()
+ * and PROF_EXIT() compile to nothing and no other function is available.
+ *
+ * ProfInit() is called by MwInit(). Call ProfVInt() from the vertical
+ * interrupt handler, so calls lasting more than a frame are measured. Then
+ * read the results of each probe with ProfGet(), or send the whole table
+ * through a LSD channel with ProfSend().
+ *
+ * Times are measured in 68000 cycles. The V counter gives the scanline,
+ * and the H counter the position within it, in steps of about 2.3 cycles
+ * (H40 mode, build with HV_H32 defined for H32 mode, with steps of about
+ * 2.9 cycles). As the V counter jumps back during the vertical blanking,
+ * some counter values are reached twice per frame. When this happens the
+ * shortest possible time is taken, so calls measured from or to the
+ * blanking might be accounted shorter than they were. Total times wrap
+ * after 2^32 cycles (about 9 minutes), use ProfReset() to start again.
+ *
+ * Each frame sent is accounted once by PROF_LSD_SEND, and each command
+ * sent once by PROF_MW_CMD_SEND, that includes the PROF_LSD_SEND time of
+ * its frame.
+ */
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+
+/** \addtogroup prof ProfId Profiled hot paths.
+ *  \{ */
+typedef enum {
+	PROF_LSD_SEND = 0,		///< Sending a frame (LsdSend, LsdSendV, and
+							///< LsdSplitStart to LsdSplitEnd)
+	PROF_LSD_POLL,			///< Reception state machine (LsdPoll)
+	PROF_MW_CMD_SEND,		///< Sending a command (MwCmdSend, MwCmdSendV)
+	PROF_MW_REPLY_GET,		///< Waiting for a command reply (MwCmdReplyGet)
+	PROF_MAX				///< Number of probes
+} ProfId;
+/** \} */
+
+/// Number of histogram slots. Slot 0 counts calls shorter than
+/// 2^PROF_HIST_SHIFT cycles, and slot n calls lasting from
+/// 2^(n - 1 + PROF_HIST_SHIFT) to 2^(n + PROF_HIST_SHIFT) - 1 cycles. The
+/// last slot also counts longer calls.
+#define PROF_HIST_LEN	12
+/// Duration of the calls counted in histogram slot 0 (log2 of cycles).
+#define PROF_HIST_SHIFT	6
+
+/// Results of a probe.
+typedef struct {
+	uint32_t count;					///< Number of calls
+	uint32_t sum;					///< Total cycles (avg = sum / count)
+	uint32_t min;					///< Minimum cycles per call
+	uint32_t max;					///< Maximum cycles per call
+	uint16_t hist[PROF_HIST_LEN];	///< Cycles per call histogram
+} ProfProbe;
+
+#ifdef MW_PROF
+/// Marks the entry of a profiled hot path
+#define PROF_ENTER(id)	ProfEnter(id)
+/// Marks the exit of a profiled hot path
+#define PROF_EXIT(id)	ProfExit(id)
+
+/************************************************************************//**
+ * \brief Module initialization. Clears the results and detects the number
+ *        of scanlines per frame.
+ ****************************************************************************/
+void ProfInit(void);
+
+/************************************************************************//**
+ * \brief Increments the frame counter. Must be called from the vertical
+ *        interrupt handler.
+ ****************************************************************************/
+void ProfVInt(void);
+
+/************************************************************************//**
+ * \brief Marks the entry of a hot path. Use PROF_ENTER() instead.
+ *
+ * \param[in] id Probe.
+ ****************************************************************************/
+void ProfEnter(ProfId id);
+
+/************************************************************************//**
+ * \brief Marks the exit of a hot path, accounting the time elapsed since
+ *        its entry. Use PROF_EXIT() instead.
+ *
+ * \param[in] id Probe.
+ ****************************************************************************/
+void ProfExit(ProfId id);
+
+/************************************************************************//**
+ * \brief Obtains the results of a probe.
+ *
+ * \param[in]  id    Probe.
+ * \param[out] probe Results, accumulated since ProfInit() or ProfReset().
+ ****************************************************************************/
+void ProfGet(ProfId id, ProfProbe *probe);
+
+/************************************************************************//**
+ * \brief Clears the results of all the probes.
+ ****************************************************************************/
+void ProfReset(void);
+
+/************************************************************************//**
+ * \brief Sends the results of all the probes (PROF_MAX ProfProbe entries,
+ *        in ProfId order, big endian) in a frame through a LSD channel.
+ *
+ * \param[in] ch Channel number. Must be enabled.
+ *
+ * \return -1 if there was an error, or the number of characters sent
+ *         otherwise.
+ ****************************************************************************/
+int ProfSend(uint8_t ch);
+#else
+/// Marks the entry of a profiled hot path
+#define PROF_ENTER(id)
+/// Marks the exit of a profiled hot path
+#define PROF_EXIT(id)
+#endif
+
+#endif /*_PROF_H_*/
+
+/** \} */
+
@@ -0,0 +1,62 @@
+/************************************************************************//**
+ * \brief Z80 bus and reset control, and Z80 RAM access from the 68000.
+ *
+ * Z80 RAM can only be accessed while holding the Z80 bus, and only with
+ * byte accesses.
+ *
+ * \defgroup z80 Z80 control
+ * \{
+ ****************************************************************************/
+
+#ifndef _Z80_H_
+#define _Z80_H_
+
+#include <stdint.h>
+
+/// Z80 RAM length.
+#define Z80_RAM_LEN		0x2000
+
+#ifdef UART_SIM
+#include "z80-sim.h"
+/// Z80 RAM, as seen by the 68000.
+#define Z80_RAM				Z80SimRam()
+/// Takes the Z80 bus, stopping the Z80.
+#define Z80BusReq()			Z80SimBusReq(1)
+/// Releases the Z80 bus.
+#define Z80BusRel()			Z80SimBusReq(0)
+/// Asserts (nonzero) or releases (zero) the Z80 reset line.
+#define Z80ResetSet(reset)	Z80SimResetSet(reset)
+#else
+/// Z80 RAM, as seen by the 68000.
+#define Z80_RAM			((volatile uint8_t*)0xA00000)
+/// Z80 bus request register.
+#define Z80_BUSREQ		(*((volatile uint16_t*)0xA11100))
+/// Z80 reset register.
+#define Z80_RESET		(*((volatile uint16_t*)0xA11200))
+
+/************************************************************************//**
+ * \brief Takes the Z80 bus, stopping the Z80. Waits until it is granted.
+ ****************************************************************************/
+static inline void Z80BusReq(void) {
+	Z80_BUSREQ = 0x100;
+	while (Z80_BUSREQ & 0x100);
+}
+
+/************************************************************************//**
+ * \brief Releases the Z80 bus.
+ ****************************************************************************/
+#define Z80BusRel()		do{Z80_BUSREQ = 0;}while(0)
+
+/************************************************************************//**
+ * \brief Asserts or releases the Z80 reset line. Take the bus before
+ *        asserting reset, as the bus cannot be granted while in reset.
+ *
+ * \param[in] reset Nonzero to assert reset, zero to release it.
+ ****************************************************************************/
+#define Z80ResetSet(reset)	do{Z80_RESET = (reset)?0:0x100;}while(0)
+#endif
+
+#endif /*_Z80_H_*/
+
+/** \} */
+